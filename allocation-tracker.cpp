@@ -0,0 +1,45 @@
+#include "allocation-tracker.h"
+
+#include <cstdlib>
+#include <new>
+
+thread_local uint64_t AllocationTracker::s_threadAllocationCount = 0;
+
+void* AllocationTracker::allocate(size_t size) {
+	if (ENABLED) ++s_threadAllocationCount;
+	// malloc(0) may return nullptr, which operator new must not
+	return std::malloc(size > 0 ? size : 1);
+}
+
+void AllocationTracker::deallocate(void* pointer) {
+	std::free(pointer);
+}
+
+#ifdef MEGA_TRACK_ALLOCATIONS
+// The nothrow forms forward to these by default
+void* operator new(std::size_t size) {
+	void* pointer = AllocationTracker::allocate(size);
+	if (!pointer) throw std::bad_alloc();
+	return pointer;
+}
+
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+	AllocationTracker::deallocate(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+	AllocationTracker::deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+	AllocationTracker::deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+	AllocationTracker::deallocate(pointer);
+}
+#endif // MEGA_TRACK_ALLOCATIONS
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Tracking is on in debug builds, unless MEGA_DISABLE_ALLOCATION_TRACKING is
+// defined. Release builds may opt in by defining MEGA_TRACK_ALLOCATIONS.
+#if !defined(MEGA_TRACK_ALLOCATIONS) && !defined(NDEBUG) && !defined(MEGA_DISABLE_ALLOCATION_TRACKING)
+#define MEGA_TRACK_ALLOCATIONS
+#endif
+
+/**
+ * Counts heap allocations per thread, to keep the frame loop free of them.
+ *
+ * With tracking compiled in, the global operator new is replaced so that
+ * every allocation of C++ code counts towards the calling thread. Libraries
+ * that call malloc() themselves are only counted when they let us plug in
+ * allocate() and deallocate(), as ImGui does. Over-aligned allocations are
+ * not counted.
+ *
+ * The frame loop compares the count of the main thread before and after each
+ * frame, and CPU profiler scopes record the allocations they made.
+ */
+class AllocationTracker {
+public:
+#ifdef MEGA_TRACK_ALLOCATIONS
+	static constexpr bool ENABLED = true;
+#else
+	static constexpr bool ENABLED = false;
+#endif
+
+	// Allocations made by the calling thread since it started, always 0 when
+	// tracking is compiled out. Inline, as profiler scopes read it twice.
+	static uint64_t threadAllocationCount() { return ENABLED ? s_threadAllocationCount : 0; }
+
+	// Counting malloc() and free(), for libraries taking an allocator
+	static void* allocate(size_t size);
+	static void deallocate(void* pointer);
+
+private:
+	// Trivially initialized, so that it is usable from operator new at any
+	// time
+	static thread_local uint64_t s_threadAllocationCount;
+};
@@ -1,10 +1,14 @@
 
 #include "application.h"
+#include "allocation-tracker.h"
 #include "controls.h"
+#include "cpu-profiler.h"
 #include "resource-manager.h"
+#include "stress-scene.h"
 #include "ui-manager.h"
 
 #include "webgpu-utils/webgpu-std-utils.hpp"
+#include "resource-loaders/stb_image_write.h"
 
 #include <glfw3webgpu.h>
 #include <GLFW/glfw3.h>
@@ -17,153 +21,339 @@
 #include <backends/imgui_impl_glfw.h>
 
 #include <iostream>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <filesystem>
 #include <sstream>
 #include <string>
 #include <array>
+#include <chrono>
+#include <thread>
 
 using namespace wgpu;
 using VertexAttributes = ResourceManager::VertexAttributes;
 
 constexpr float PI = 3.14159265358979323846f;
+// Bytes of scene uniforms that defragmentation may copy in a frame
+constexpr uint64_t UNIFORM_DEFRAGMENT_BYTES_PER_FRAME = 64 * 1024;
+// Simulated frame rate of headless mode, so that its frames do not depend
+// on how fast they are rendered
+constexpr float HEADLESS_FRAME_RATE = 60.0f;
 
 /**
  * Public methods
  */
 
-bool Application::onInit() {
+bool Application::onInit(const LaunchOptions& options) {
+	m_launchOptions = options;
+	CpuProfiler::setThreadName("Main");
+	if (!m_launchOptions.cpuTracePath.empty()) {
+		m_renderSettings.recordCpuTrace = true;
+		updateCpuTrace();
+	}
+	if (!m_launchOptions.metricsPath.empty() && !m_metricsLog.open(m_launchOptions.metricsPath)) return false;
+	GpuMemory::setBudget(
+		static_cast<uint64_t>(m_launchOptions.gpuMemoryBudgetMiB) * 1024 * 1024,
+		m_launchOptions.refuseOverBudget ? GpuMemory::BudgetPolicy::Refuse : GpuMemory::BudgetPolicy::Warn
+	);
+	CPU_PROFILE_SCOPE("Init");
 	if (!initWindowAndDevice()) return false;
-	if (!initSurfaceConfiguration()) return false;
+	if (m_launchOptions.headless) {
+		if (!initOffscreenTarget()) return false;
+		// Same resolution whatever the GPU, so that images can be compared
+		m_renderSettings.dynamicResolution = false;
+	}
+	else {
+		if (!initSurfaceConfiguration()) return false;
+	}
 	if (!initDepthBuffer()) return false;
+	if (!m_upscaler.init(*m_device, m_surfaceFormat)) return false;
+	if (!m_transparencyPass.init(*m_device, m_surfaceFormat)) return false;
+	if (!initSceneColorBuffer()) return false;
+	m_gpuProfiler.init(*m_device, FRAMES_IN_FLIGHT);
+	m_renderStats.gpuTimingAvailable = m_gpuProfiler.isAvailable();
 	if (!initBindGroupLayouts()) return false;
+	if (!m_clusteredLighting.init(*m_device)) return false;
+	if (!m_shadowMaps.init(*m_device, *m_emptyBindGroupLayout, *m_nodeBindGroupLayout, m_minUniformBufferOffsetAlignment)) return false;
 	// m_filePath = (ResourceManager::path)RESOURCE_DIR "/scenes/triangle.gltf";
 	m_filePath = (ResourceManager::path)RESOURCE_DIR "/scenes/box.gltf";
 	// m_filePath = (ResourceManager::path)RESOURCE_DIR "/scenes/BusterDrone.gltf";
 	// m_filePath = (ResourceManager::path)RESOURCE_DIR "/scenes/DamagedHelmet.glb";
+	if (!m_launchOptions.scenePath.empty()) m_filePath = m_launchOptions.scenePath;
 	if (!initGeometry(m_filePath)) return false;
+	m_shaderLibrary.init(*m_device);
+	m_pipelineCompiler.init(*m_device);
 	if (!initRenderPipelines()) return false;
 	if (!initUniforms()) return false;
-	if (!initLightingUniforms()) return false;
+	initLightingUniforms();
 	if (!initBindGroup()) return false;
-	if (!UiManager::init(m_window, *m_device, m_surfaceFormat, m_depthTextureFormat)) return false;
+	// The UI is drawn at native resolution after upscaling, without depth
+	if (hasUi()) {
+		if (!UiManager::init(m_window, *m_device, m_surfaceFormat, TextureFormat::Undefined)) return false;
+		if (!m_window) UiManager::setDisplaySize(m_launchOptions.width, m_launchOptions.height);
+	}
 	return true;
 }
 
 void Application::onFinish() {
-	UiManager::shutdown();
-	terminateLightingUniforms();
+	m_renderSettings.recordCpuTrace = false;
+	updateCpuTrace();
+	m_metricsLog.close();
+	GpuMemory::printSummary();
+
+	if (hasUi()) UiManager::shutdown();
 	terminateUniforms();
 	terminateRenderPipelines();
+	m_pipelineCache.clear();
+	m_pipelineCompiler.terminate();
+	m_shaderLibrary.terminate();
 	terminateGeometry();
+	m_shadowMaps.terminate();
+	m_clusteredLighting.terminate();
+	m_gpuProfiler.terminate();
+	terminateSceneColorBuffer();
+	m_transparencyPass.terminate();
+	m_upscaler.terminate();
 	terminateDepthBuffer();
+	terminateOffscreenTarget();
 	terminateWindowAndDevice();
 }
 
 void Application::onFrame() {
+	const auto frameStart = std::chrono::steady_clock::now();
+	const uint64_t frameStartAllocationCount = AllocationTracker::threadAllocationCount();
+	float waitTimeMs = 0.0f;
+	updateCpuTrace();
+	CPU_PROFILE_SCOPE("Frame");
+
+	if (m_renderSettings.staticBatching != m_staticBatchingEnabled) {
+		m_staticBatchingEnabled = m_renderSettings.staticBatching;
+		m_gpuScene.setStaticBatching(m_staticBatchingEnabled);
+		m_filePathHasChanged = true;
+	}
 
 	if (m_filePathHasChanged) {
-		if (updateGeometry()) {
-			m_filePathHasChanged = false;
+		// Not retried on failure, e.g. when the scene is over budget
+		updateGeometry();
+		m_filePathHasChanged = false;
+	}
+
+	// Compact scene uniforms a little every frame, rather than all at once
+	// after a scene switch
+	m_gpuScene.defragment(UNIFORM_DEFRAGMENT_BYTES_PER_FRAME);
+	m_renderStats.uniformPool = m_gpuScene.uniformPoolStats();
+	m_renderStats.geometryBytes = m_gpuScene.geometryByteSize();
+	m_renderStats.gpuMemory = GpuMemory::stats();
+
+	// Main pipelines depend on whether depth is laid down by a pre-pass, and
+	// on the quality tier their shaders are specialized for
+	if (m_renderSettings.depthPrePass != m_depthPrePassEnabled || m_renderSettings.qualityTier != m_qualityTier) {
+		terminateRenderPipelines();
+		initRenderPipelines();
+	}
+
+	// Pick up pipelines compiled in the background, draws use a fallback
+	// until then
+	{
+		CPU_PROFILE_SCOPE("Poll pipelines");
+		m_pipelineCompiler.poll();
+	}
+	// Offscreen frames are meant to be compared, so they never show fallbacks
+	if (m_launchOptions.headless && m_pipelineCompiler.pendingCount() > 0) {
+		CPU_PROFILE_SCOPE("Wait for pipelines");
+		auto waitStart = std::chrono::steady_clock::now();
+		while (m_pipelineCompiler.pendingCount() > 0) {
+			pollDevice(false);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			m_pipelineCompiler.poll();
 		}
+		m_renderStats.load.pipelineCreationMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
 	}
+	m_renderStats.pendingPipelineCount = m_pipelineCompiler.pendingCount();
+
+	if (!m_launchOptions.headless) {
+		// Present mode and frame latency are part of the surface configuration
+		if (m_framePacer.resolvePresentMode(m_renderSettings.presentMode) != m_presentMode
+			|| m_renderSettings.maxQueuedFrames != m_maxQueuedFrames) {
+			initSurfaceConfiguration();
+		}
 
-	glfwPollEvents();
-	// Controls::updateDragInertia(*&m_drag, *&m_cameraState);
-	updateLightingUniforms();
+		// Wait for the frame rate cap before sampling input, so that the time
+		// spent waiting does not add to input latency
+		{
+			CPU_PROFILE_SCOPE("Wait for frame pacer");
+			auto waitStart = std::chrono::steady_clock::now();
+			m_framePacer.waitForNextFrame(m_renderSettings.maxFrameRate);
+			waitTimeMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+		}
 
-	// Update uniform buffer
-	m_uniforms.time = static_cast<float>(glfwGetTime());
-	m_queue->writeBuffer(*m_uniformBuffer, offsetof(GlobalUniforms, time), &m_uniforms.time, sizeof(GlobalUniforms::time));
+		CPU_PROFILE_SCOPE("Poll events");
+		glfwPollEvents();
+		// Controls::updateDragInertia(*&m_drag, *&m_cameraState);
+	}
 
-	TextureView nextTexture = getNextSurfaceTextureView();
+	// Stage all uniforms of this frame and upload them at once, in a slot
+	// that the GPU is done reading
+	{
+		CPU_PROFILE_SCOPE("Wait for frame slot");
+		auto waitStart = std::chrono::steady_clock::now();
+		waitForFrameSlot();
+		waitTimeMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+	}
+	m_uniforms.time = m_launchOptions.headless
+		? static_cast<float>(m_submittedFrameCount) / HEADLESS_FRAME_RATE
+		: static_cast<float>(glfwGetTime());
+
+	// Resolution of the 3D passes for this frame
+	updateRenderResolution();
+	m_clusteredLighting.fillUniforms(m_lightingUniforms.clusters, m_renderWidth, m_renderHeight, Z_NEAR, Z_FAR);
+	m_shadowMaps.update(
+		m_uniforms.viewMatrix,
+		m_uniforms.projectionMatrix,
+		Z_NEAR,
+		std::min(m_renderSettings.shadowDistance, Z_FAR),
+		m_lightingUniforms.directions,
+		m_gpuScene,
+		m_renderSettings.shadows
+	);
+
+	{
+		CPU_PROFILE_SCOPE("Upload uniforms");
+		uploadFrameUniforms();
+	}
+
+	// Pick levels of detail for the current camera
+	{
+		CPU_PROFILE_SCOPE("Select LODs");
+		m_gpuScene.selectLods(m_uniforms.viewMatrix, m_uniforms.projectionMatrix, static_cast<float>(m_renderHeight));
+	}
+
+	TextureView nextTexture;
+	{
+		CPU_PROFILE_SCOPE("Acquire surface texture");
+		nextTexture = getNextSurfaceTextureView();
+	}
 	if (!nextTexture) {
 		std::cerr << "Could not acquire next texture from surface configuration" << std::endl;
 		return;
 	}
 
+	auto encodeStart = std::chrono::steady_clock::now();
+	m_gpuScene.resetDrawStats();
+
 	CommandEncoderDescriptor commandEncoderDesc;
 	commandEncoderDesc.label = "Command Encoder";
 	CommandEncoder encoder = m_device->createCommandEncoder(commandEncoderDesc);
 
-	RenderPassDescriptor renderPassDesc{};
+	m_gpuProfiler.beginFrame(static_cast<uint32_t>(m_submittedFrameCount % FRAMES_IN_FLIGHT));
 
-	RenderPassColorAttachment renderPassColorAttachment{};
-	renderPassColorAttachment.view = nextTexture;
-	renderPassColorAttachment.resolveTarget = nullptr;
-	renderPassColorAttachment.loadOp = LoadOp::Clear;
-	renderPassColorAttachment.storeOp = StoreOp::Store;
-	renderPassColorAttachment.clearValue = Color{ m_uniforms.worldColor.r,m_uniforms.worldColor.g, m_uniforms.worldColor.b,m_uniforms.worldColor.w };
-	renderPassDesc.colorAttachmentCount = 1;
-	renderPassDesc.colorAttachments = &renderPassColorAttachment;
-
-	RenderPassDepthStencilAttachment depthStencilAttachment;
-	depthStencilAttachment.view = *m_depthTextureView;
-	depthStencilAttachment.depthClearValue = 1.0f;
-	depthStencilAttachment.depthLoadOp = LoadOp::Clear;
-	depthStencilAttachment.depthStoreOp = StoreOp::Store;
-	depthStencilAttachment.depthReadOnly = false;
-	depthStencilAttachment.stencilClearValue = 0;
-#ifdef WEBGPU_BACKEND_WGPU
-	depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
-	depthStencilAttachment.stencilStoreOp = StoreOp::Store;
-#else
-	depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
-	depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
-#endif
-	depthStencilAttachment.stencilReadOnly = true;
-
-	renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
-
-	renderPassDesc.timestampWrites = nullptr;
-	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-
-	for (uint32_t pipelineIdx = 0; pipelineIdx < m_pipelines.size(); ++pipelineIdx) {
-		renderPass.setPipeline(m_pipelines[pipelineIdx]);
-		renderPass.setBindGroup(0, *m_bindGroup, 0, nullptr);
-
-		m_gpuScene.draw(renderPass, pipelineIdx);
+	m_clusteredLighting.assignLights(
+		encoder,
+		m_frameUniformOffsets.data(),
+		static_cast<uint32_t>(m_frameUniformOffsets.size()),
+		m_gpuProfiler.computePassTimestampWrites("Light assignment")
+	);
+	m_renderStats.shadowCascadesRendered = m_shadowMaps.render(encoder, m_gpuScene, m_gpuProfiler);
+	if (m_depthPrePassEnabled) {
+		renderDepthPrePass(encoder);
 	}
-
-	// We add the GUI drawing commands to the render pass
-	UiManager::update(renderPass, m_uniforms, m_lightingUniforms, m_lightingUniformsChanged, m_filePath, m_filePathHasChanged);
-
-	renderPass.end();
-	renderPass.release();
+	renderScene(encoder);
+	renderTransparency(encoder);
+	m_upscaler.upscale(encoder, m_renderWidth, m_renderHeight, m_renderSettings.sharpness, m_gpuProfiler.computePassTimestampWrites("Upscale"));
+	renderComposite(encoder, nextTexture);
+	if (hasUi()) {
+		renderUi(encoder, nextTexture);
+	}
+	m_gpuProfiler.resolve(encoder);
 
 	nextTexture.release();
 
+	// Only the last headless frame is saved
+	const bool isLastHeadlessFrame =
+		m_launchOptions.headless &&
+		!m_launchOptions.outputPath.empty() &&
+		m_submittedFrameCount + 1 == m_launchOptions.frameCount;
+	if (isLastHeadlessFrame) {
+		copyOffscreenTarget(encoder);
+	}
+
 	CommandBufferDescriptor cmdBufferDescriptor{};
 	cmdBufferDescriptor.label = "Command buffer";
-	CommandBuffer command = encoder.finish(cmdBufferDescriptor);
-	encoder.release();
+	CommandBuffer command = nullptr;
+	{
+		CPU_PROFILE_SCOPE("Finish command buffer");
+		command = encoder.finish(cmdBufferDescriptor);
+		encoder.release();
+	}
+	m_renderStats.cpuEncodeTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+	m_renderStats.draws = m_gpuScene.drawStats();
 
-	m_queue->submit(command);
-	command.release();
+	{
+		CPU_PROFILE_SCOPE("Submit");
+		m_queue->submit(command);
+		command.release();
+		onFrameSubmitted();
+		m_gpuProfiler.onFrameSubmitted();
+	}
 
-	m_surface->present();
+	if (m_launchOptions.headless) {
+		if (isLastHeadlessFrame) {
+			CPU_PROFILE_SCOPE("Write offscreen target");
+			if (!writeOffscreenTarget(m_launchOptions.outputPath)) {
+				m_hasFailed = true;
+			}
+		}
+	}
+	else {
+		CPU_PROFILE_SCOPE("Present");
+		m_surface->present();
+		m_framePacer.onPresent();
+	}
 
 #ifdef WEBGPU_BACKEND_DAWN
 	// Check for pending error callbacks
 	m_device->tick();
 #endif
+
+	recordFrameStats(frameStart, waitTimeMs, frameStartAllocationCount);
 }
 
 bool Application::isRunning() {
+	if (m_launchOptions.headless) {
+		return m_submittedFrameCount < m_launchOptions.frameCount;
+	}
 	return !glfwWindowShouldClose(m_window);
 }
 
 void Application::onResize() {
 	// Terminate in reverse order
+	terminateSceneColorBuffer();
 	terminateDepthBuffer();
 
 	// Re-init
 	initSurfaceConfiguration();
 	initDepthBuffer();
+	initSceneColorBuffer();
 
 	updateProjectionMatrix();
 }
 
+bool Application::loadScene(const std::string& path) {
+	m_filePath = path;
+	m_filePathHasChanged = false;
+	return updateGeometry();
+}
+
+void Application::setCameraState(const CameraState& state) {
+	m_cameraState = state;
+	updateViewMatrix();
+}
+
+float Application::sceneBoundsRadius() const {
+	return m_gpuScene.boundsRadius();
+}
+
 void Application::onMouseMove(double xPos, double yPos) {
 	if (m_drag.active) {
 		Controls::updateMouseMove(xPos, yPos, *&m_drag, *&m_cameraState);
@@ -192,28 +382,39 @@ bool Application::initWindowAndDevice() {
 		return false;
 	}
 
-	if (!glfwInit()) {
-		std::cerr << "Could not initialize GLFW!" << std::endl;
-		return false;
-	}
+	// Headless mode needs neither a window nor a display
+	const bool headless = m_launchOptions.headless;
+	if (!headless) {
+		if (!glfwInit()) {
+			std::cerr << "Could not initialize GLFW!" << std::endl;
+			return false;
+		}
 
-	auto monitor = glfwGetPrimaryMonitor();
-	int monWidth, monHeight;
-	glfwGetMonitorWorkarea(monitor, nullptr, nullptr, &monWidth, &monHeight);
+		auto monitor = glfwGetPrimaryMonitor();
+		int monWidth, monHeight;
+		glfwGetMonitorWorkarea(monitor, nullptr, nullptr, &monWidth, &monHeight);
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
-	m_window = glfwCreateWindow(monWidth, monHeight, "Mega Render Engine", NULL, NULL);
-	if (!m_window) {
-		std::cerr << "Could not open window!" << std::endl;
-		return false;
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+		m_window = glfwCreateWindow(monWidth, monHeight, "Mega Render Engine", NULL, NULL);
+		if (!m_window) {
+			std::cerr << "Could not open window!" << std::endl;
+			return false;
+		}
 	}
 
 	std::cout << "Requesting adapter..." << std::endl;
-	*m_surface = glfwGetWGPUSurface(*m_instance, m_window);
 	RequestAdapterOptions adapterOpts{};
-	adapterOpts.compatibleSurface = *m_surface;
+	if (!headless) {
+		*m_surface = glfwGetWGPUSurface(*m_instance, m_window);
+		adapterOpts.compatibleSurface = *m_surface;
+	}
+	adapterOpts.forceFallbackAdapter = m_launchOptions.forceFallbackAdapter;
 	Adapter adapter = m_instance->requestAdapter(adapterOpts);
+	if (!adapter) {
+		std::cerr << "Could not get an adapter!" << std::endl;
+		return false;
+	}
 	std::cout << "Got adapter: " << adapter << std::endl;
 
 	SupportedLimits supportedLimits;
@@ -227,31 +428,45 @@ bool Application::initWindowAndDevice() {
 	requiredLimits.limits.maxVertexBufferArrayStride = sizeof(VertexAttributes);
 	requiredLimits.limits.minStorageBufferOffsetAlignment = supportedLimits.limits.minStorageBufferOffsetAlignment;
 	requiredLimits.limits.minUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
+	m_minUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
 	requiredLimits.limits.maxInterStageShaderComponents = 11;
 	requiredLimits.limits.maxBindGroups = 3;
 	requiredLimits.limits.maxUniformBuffersPerShaderStage = 2;
 	requiredLimits.limits.maxUniformBufferBindingSize = 16 * 4 * sizeof(float);
 
 	int maxTextureDimensions = 2048;
-	int monCount;
-	auto monitors = glfwGetMonitors(&monCount);
-	for (int monIdx = 0; monIdx < monCount; ++monIdx) {
-		int monWidth;
-		glfwGetMonitorWorkarea(monitors[monIdx], nullptr, nullptr, &monWidth, nullptr);
-		if (maxTextureDimensions < monWidth) {
-			maxTextureDimensions = monWidth;
+	if (headless) {
+		maxTextureDimensions = std::max({ maxTextureDimensions, static_cast<int>(m_launchOptions.width), static_cast<int>(m_launchOptions.height) });
+	}
+	else {
+		int monCount;
+		auto monitors = glfwGetMonitors(&monCount);
+		for (int monIdx = 0; monIdx < monCount; ++monIdx) {
+			int monWidth;
+			glfwGetMonitorWorkarea(monitors[monIdx], nullptr, nullptr, &monWidth, nullptr);
+			if (maxTextureDimensions < monWidth) {
+				maxTextureDimensions = monWidth;
+			}
 		}
 	}
 
 	requiredLimits.limits.maxTextureDimension1D = maxTextureDimensions;
 	requiredLimits.limits.maxTextureDimension2D = maxTextureDimensions;
-	requiredLimits.limits.maxTextureArrayLayers = 1;
-	requiredLimits.limits.maxSampledTexturesPerShaderStage = 3;
-	requiredLimits.limits.maxSamplersPerShaderStage = 3;
+	requiredLimits.limits.maxTextureArrayLayers = ShadowMaps::LAYER_COUNT;
+	// Material textures and the shadow maps
+	requiredLimits.limits.maxSampledTexturesPerShaderStage = 4;
+	requiredLimits.limits.maxSamplersPerShaderStage = 4;
+
+	// Timestamp queries measure GPU frame time, they are optional
+	std::vector<WGPUFeatureName> requiredFeatures;
+	if (adapter.hasFeature(FeatureName::TimestampQuery)) {
+		requiredFeatures.push_back(FeatureName::TimestampQuery);
+	}
 
 	DeviceDescriptor deviceDesc;
 	deviceDesc.label = "My Device";
-	deviceDesc.requiredFeatureCount = 0;
+	deviceDesc.requiredFeatureCount = requiredFeatures.size();
+	deviceDesc.requiredFeatures = requiredFeatures.data();
 	deviceDesc.requiredLimits = &requiredLimits;
 	deviceDesc.defaultQueue.label = "Default Device";
 	m_device = adapter.requestDevice(deviceDesc);
@@ -267,12 +482,35 @@ bool Application::initWindowAndDevice() {
 
 	m_queue = m_device->getQueue();
 
+	if (headless) {
+		// Byte order of the PNG images written by stb_image_write
+		m_surfaceFormat = TextureFormat::RGBA8Unorm;
+		adapter.release();
+		return m_device;
+	}
+
 #ifdef WEBGPU_BACKEND_WGPU
 	m_surfaceFormat = m_surface->getPreferredFormat(adapter);
 #else
 	m_surfaceFormat = TextureFormat::BGRA8Unorm;
 #endif
 
+#ifndef __EMSCRIPTEN__
+	// Present modes available for this surface on this adapter (browsers
+	// only ever present with Fifo)
+	SurfaceCapabilities surfaceCapabilities;
+	m_surface->getCapabilities(adapter, &surfaceCapabilities);
+	std::vector<PresentMode> presentModes;
+	std::cout << "Supported present modes:";
+	for (size_t i = 0; i < surfaceCapabilities.presentModeCount; ++i) {
+		presentModes.push_back(surfaceCapabilities.presentModes[i]);
+		std::cout << " " << FramePacer::presentModeName(surfaceCapabilities.presentModes[i]);
+	}
+	std::cout << std::endl;
+	m_framePacer.setSupportedPresentModes(std::move(presentModes));
+	surfaceCapabilities.freeMembers();
+#endif // __EMSCRIPTEN__
+
 	// Add window callbacks
 	// Set the user pointer to be "this"
 	glfwSetWindowUserPointer(m_window, this);
@@ -298,6 +536,7 @@ bool Application::initWindowAndDevice() {
 }
 
 void Application::terminateWindowAndDevice() {
+	if (m_launchOptions.headless) return;
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
 }
@@ -306,7 +545,7 @@ bool Application::initSurfaceConfiguration()
 {
 	// Get the current size of the window's framebuffer
 	int width, height;
-	glfwGetFramebufferSize(m_window, &width, &height);
+	getFramebufferSize(width, height);
 
 	SurfaceConfiguration surfaceConfig = {};
 
@@ -317,18 +556,124 @@ bool Application::initSurfaceConfiguration()
 	surfaceConfig.viewFormatCount = 0;
 	surfaceConfig.viewFormats = nullptr;
 	surfaceConfig.device = *m_device;
-	surfaceConfig.presentMode = PresentMode::Fifo;
+	m_presentMode = m_framePacer.resolvePresentMode(m_renderSettings.presentMode);
+	m_maxQueuedFrames = m_renderSettings.maxQueuedFrames;
+	surfaceConfig.presentMode = m_presentMode;
 	surfaceConfig.alphaMode = CompositeAlphaMode::Auto;
 
+#ifdef WEBGPU_BACKEND_WGPU
+	// Also bound the swapchain queue, otherwise the backend may keep more
+	// images in flight than we allow frames
+	SurfaceConfigurationExtras surfaceConfigExtras = Default;
+	surfaceConfigExtras.desiredMaximumFrameLatency = m_maxQueuedFrames;
+	surfaceConfig.nextInChain = &surfaceConfigExtras.chain;
+#endif
+
+	// Intervals measured with the previous configuration are meaningless now
+	m_framePacer.resetStats();
+
 	m_surface->configure(surfaceConfig);
 
 	return m_surface;
 }
 
+void Application::getFramebufferSize(int& width, int& height) const {
+	if (m_launchOptions.headless) {
+		width = static_cast<int>(m_launchOptions.width);
+		height = static_cast<int>(m_launchOptions.height);
+		return;
+	}
+	glfwGetFramebufferSize(m_window, &width, &height);
+}
+
+bool Application::initOffscreenTarget() {
+	TextureDescriptor textureDesc;
+	textureDesc.label = "Offscreen target";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = m_surfaceFormat;
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.size = { m_launchOptions.width, m_launchOptions.height, 1 };
+	textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	m_offscreenTexture = m_device->createTexture(textureDesc);
+	m_offscreenTextureMemory.set(GpuMemory::Category::RenderTarget, GpuMemory::textureByteSize(textureDesc));
+
+	m_readbackBytesPerRow = alignToNextMultipleOf(4 * m_launchOptions.width, 256u);
+	BufferDescriptor bufferDesc;
+	bufferDesc.label = "Offscreen readback";
+	bufferDesc.size = static_cast<uint64_t>(m_readbackBytesPerRow) * m_launchOptions.height;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+	bufferDesc.mappedAtCreation = false;
+	m_readbackBuffer = m_device->createBuffer(bufferDesc);
+	m_readbackBufferMemory.set(GpuMemory::Category::Staging, bufferDesc.size);
+
+	return m_offscreenTexture && m_readbackBuffer;
+}
+
+void Application::terminateOffscreenTarget() {
+	m_readbackBuffer = {};
+	m_offscreenTexture = {};
+	m_readbackBufferMemory.reset();
+	m_offscreenTextureMemory.reset();
+}
+
+void Application::copyOffscreenTarget(CommandEncoder encoder) {
+	ImageCopyTexture source = Default;
+	source.texture = *m_offscreenTexture;
+	ImageCopyBuffer destination = Default;
+	destination.buffer = *m_readbackBuffer;
+	destination.layout.offset = 0;
+	destination.layout.bytesPerRow = m_readbackBytesPerRow;
+	destination.layout.rowsPerImage = m_launchOptions.height;
+	const WGPUExtent3D copySize = { m_launchOptions.width, m_launchOptions.height, 1 };
+	encoder.copyTextureToBuffer(source, destination, copySize);
+}
+
+bool Application::writeOffscreenTarget(const std::string& path) {
+	const uint32_t width = m_launchOptions.width;
+	const uint32_t height = m_launchOptions.height;
+	const uint64_t size = static_cast<uint64_t>(m_readbackBytesPerRow) * height;
+
+	bool isMapped = false;
+	bool success = false;
+	auto mapCallback = m_readbackBuffer->mapAsync(MapMode::Read, 0, size, [&](BufferMapAsyncStatus status) {
+		isMapped = true;
+		success = status == BufferMapAsyncStatus::Success;
+	});
+	while (!isMapped) {
+		pollDevice(true);
+	}
+	if (!success) {
+		std::cerr << "Could not read back the offscreen target!" << std::endl;
+		return false;
+	}
+
+	// Drop row padding, and write opaque pixels whatever the passes left in
+	// the alpha channel
+	std::vector<uint8_t> pixels(4 * width * height);
+	const uint8_t* mapped = static_cast<const uint8_t*>(m_readbackBuffer->getConstMappedRange(0, size));
+	for (uint32_t y = 0; y < height; ++y) {
+		std::memcpy(pixels.data() + 4 * width * y, mapped + m_readbackBytesPerRow * y, 4 * width);
+	}
+	m_readbackBuffer->unmap();
+	for (uint32_t i = 0; i < width * height; ++i) {
+		pixels[4 * i + 3] = 255;
+	}
+
+	if (!stbi_write_png(path.c_str(), width, height, 4, pixels.data(), 4 * width)) {
+		std::cerr << "Could not write " << path << std::endl;
+		return false;
+	}
+	std::cout << "Wrote " << path << std::endl;
+	return true;
+}
+
 bool Application::initDepthBuffer() {
 	// Get the current size of the window's framebuffer:
 	int width, height;
-	glfwGetFramebufferSize(m_window, &width, &height);
+	getFramebufferSize(width, height);
 
 	// Create the depth texture
 	TextureDescriptor depthTextureDesc;
@@ -341,6 +686,7 @@ bool Application::initDepthBuffer() {
 	depthTextureDesc.viewFormatCount = 1;
 	depthTextureDesc.viewFormats = (WGPUTextureFormat*)&m_depthTextureFormat;
 	m_depthTexture = m_device->createTexture(depthTextureDesc);
+	m_depthTextureMemory.set(GpuMemory::Category::Depth, GpuMemory::textureByteSize(depthTextureDesc));
 
 	// Create the view of the depth texture manipulated by the rasterizer
 	TextureViewDescriptor depthTextureViewDesc;
@@ -358,20 +704,87 @@ bool Application::initDepthBuffer() {
 
 void Application::terminateDepthBuffer() {
 	m_depthTexture->destroy();
+	m_depthTextureMemory.reset();
 }
 
-bool Application::initRenderPipelines() {
-	std::cout << "Creating shader module..." << std::endl;
-	m_shaderModule = ResourceManager::loadShaderModule(RESOURCE_DIR "/shaders/shader.wgsl", *m_device);
-	if (!m_shaderModule) {
-		std::cerr << "Could not load shader from path!" << std::endl;
+bool Application::initSceneColorBuffer() {
+	int width, height;
+	getFramebufferSize(width, height);
+
+	// Same format as the surface, so that pipelines do not depend on whether
+	// the scene is upscaled. Sampled by the upscaler.
+	TextureDescriptor colorTextureDesc;
+	colorTextureDesc.label = "Scene color";
+	colorTextureDesc.dimension = TextureDimension::_2D;
+	colorTextureDesc.format = m_surfaceFormat;
+	colorTextureDesc.mipLevelCount = 1;
+	colorTextureDesc.sampleCount = 1;
+	colorTextureDesc.size = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
+	colorTextureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+	colorTextureDesc.viewFormatCount = 0;
+	colorTextureDesc.viewFormats = nullptr;
+	m_sceneColorTexture = m_device->createTexture(colorTextureDesc);
+	m_sceneColorTextureMemory.set(GpuMemory::Category::RenderTarget, GpuMemory::textureByteSize(colorTextureDesc));
+
+	TextureViewDescriptor colorTextureViewDesc;
+	colorTextureViewDesc.aspect = TextureAspect::All;
+	colorTextureViewDesc.baseArrayLayer = 0;
+	colorTextureViewDesc.arrayLayerCount = 1;
+	colorTextureViewDesc.baseMipLevel = 0;
+	colorTextureViewDesc.mipLevelCount = 1;
+	colorTextureViewDesc.dimension = TextureViewDimension::_2D;
+	colorTextureViewDesc.format = m_surfaceFormat;
+	m_sceneColorTextureView = m_sceneColorTexture->createView(colorTextureViewDesc);
+
+	m_renderStats.outputWidth = static_cast<uint32_t>(width);
+	m_renderStats.outputHeight = static_cast<uint32_t>(height);
+
+	return m_sceneColorTextureView
+		&& m_upscaler.resize(*m_sceneColorTextureView, m_renderStats.outputWidth, m_renderStats.outputHeight)
+		&& m_transparencyPass.resize(m_renderStats.outputWidth, m_renderStats.outputHeight);
+}
+
+void Application::terminateSceneColorBuffer() {
+	m_sceneColorTextureView = {};
+	m_sceneColorTexture = {};
+	m_sceneColorTextureMemory.reset();
+}
+
+void Application::updateRenderResolution() {
+	float scale = m_renderSettings.renderScale;
+	float gpuFrameTimeMs;
+	if (m_gpuProfiler.consumeFrameTime(gpuFrameTimeMs)) {
+		m_renderStats.gpuFrameTimeMs = gpuFrameTimeMs;
+		m_renderStats.gpuScopes = m_gpuProfiler.scopeStats();
+		++m_renderStats.gpuFrameTimeSampleCount;
+		if (m_renderSettings.dynamicResolution) {
+			scale = m_dynamicResolution.update(gpuFrameTimeMs, m_renderSettings.targetFrameTimeMs, m_renderSettings.minRenderScale, 1.0f);
+		}
+	}
+	if (!m_renderSettings.dynamicResolution || !m_gpuProfiler.isAvailable()) {
+		// Manual scale, picked up again by the controller when re-enabled
+		m_dynamicResolution.reset(scale);
 	}
-	std::cout << "Shader module: " << m_shaderModule << std::endl;
+	scale = std::clamp(scale, MIN_RENDER_SCALE, 1.0f);
+	m_renderSettings.renderScale = scale;
+
+	m_renderWidth = std::max(1u, static_cast<uint32_t>(m_renderStats.outputWidth * scale + 0.5f));
+	m_renderHeight = std::max(1u, static_cast<uint32_t>(m_renderStats.outputHeight * scale + 0.5f));
+	m_renderStats.renderWidth = m_renderWidth;
+	m_renderStats.renderHeight = m_renderHeight;
+}
+
+bool Application::initRenderPipelines() {
+	CPU_PROFILE_SCOPE("Init render pipelines");
+	// Shader variants are compiled on first use and kept across pipeline
+	// rebuilds, see ShaderLibrary
+	const ResourceManager::path shaderPath = RESOURCE_DIR "/shaders/shader.wgsl";
+	m_qualityTier = m_renderSettings.qualityTier;
+	auto startTime = std::chrono::steady_clock::now();
 
 	std::cout << "Creating render pipeline..." << std::endl;
 	RenderPipelineDescriptor pipelineDesc;
 
-	pipelineDesc.vertex.module = *m_shaderModule;
 	pipelineDesc.vertex.entryPoint = "vs_main";
 	pipelineDesc.vertex.constantCount = 0;
 	pipelineDesc.vertex.constants = nullptr;
@@ -382,30 +795,25 @@ bool Application::initRenderPipelines() {
 
 	FragmentState fragmentState;
 	pipelineDesc.fragment = &fragmentState;
-	fragmentState.module = *m_shaderModule;
 	fragmentState.entryPoint = "fs_main";
 	fragmentState.constantCount = 0;
 	fragmentState.constants = nullptr;
 
-	BlendState blendState;
-	blendState.color.srcFactor = BlendFactor::SrcAlpha;
-	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
-	blendState.color.operation = BlendOperation::Add;
-	blendState.alpha.srcFactor = BlendFactor::Zero;
-	blendState.alpha.dstFactor = BlendFactor::One;
-	blendState.alpha.operation = BlendOperation::Add;
-
+	// Opaque and masked primitives write the scene color without blending,
+	// blended ones are accumulated in the targets of the transparency pass
 	ColorTargetState colorTarget;
 	colorTarget.format = m_surfaceFormat;
-	colorTarget.blend = &blendState;
+	colorTarget.blend = nullptr;
 	colorTarget.writeMask = ColorWriteMask::All;
+	const std::array<ColorTargetState, 2> transparentTargets = TransparencyPass::colorTargets();
 
 	fragmentState.targetCount = 1;
 	fragmentState.targets = &colorTarget;
 
+	// With a depth pre-pass, depth is already final: only the closest
+	// fragment passes the test and there is nothing left to write.
+	m_depthPrePassEnabled = m_renderSettings.depthPrePass;
 	DepthStencilState depthStencilState = Default;
-	depthStencilState.depthCompare = CompareFunction::Less;
-	depthStencilState.depthWriteEnabled = true;
 	depthStencilState.format = m_depthTextureFormat;
 	depthStencilState.stencilReadMask = 0;
 	depthStencilState.stencilWriteMask = 0;
@@ -431,33 +839,214 @@ bool Application::initRenderPipelines() {
 
 
 	for (uint32_t pipelineIdx = 0; pipelineIdx < m_gpuScene.renderPipelineCount(); ++pipelineIdx) {
-		std::vector<VertexBufferLayout> vertexBufferLayouts = m_gpuScene.vertexBufferLayouts(pipelineIdx);
+		// Pipelines built for a previous scene or with previous settings are
+		// reused as is
+		RenderPipelineKey key = m_gpuScene.renderPipelineKey(pipelineIdx);
+		key.add(static_cast<uint64_t>(m_qualityTier));
+		key.add(m_depthPrePassEnabled);
+		key.add(static_cast<uint64_t>(m_surfaceFormat));
+		key.add(static_cast<uint64_t>(m_depthTextureFormat));
+		if (const uint32_t* pipelineId = m_pipelineCache.find(key)) {
+			m_pipelineIds.push_back(*pipelineId);
+			continue;
+		}
+
+		const uint32_t features = m_gpuScene.materialFeatures(pipelineIdx);
+		std::vector<std::string> defines = GpuScene::shaderDefines(features);
+		if (m_qualityTier == QualityTier::High) {
+			defines.push_back("HIGH_QUALITY");
+		}
+		ShaderModule shaderModule = m_shaderLibrary.getOrCreateModule(shaderPath, defines);
+		if (!shaderModule) {
+			std::cerr << "Could not load shader from path!" << std::endl;
+			layout.release();
+			return false;
+		}
+		pipelineDesc.vertex.module = shaderModule;
+		fragmentState.module = shaderModule;
+
+		// Only opaque primitives are part of the depth pre-pass, others
+		// test depth as if there were none
+		const bool isBlended = (features & GpuScene::AlphaBlend) != 0;
+		const bool isOpaque = (features & (GpuScene::AlphaMask | GpuScene::AlphaBlend)) == 0;
+		const bool hasPrePassDepth = m_depthPrePassEnabled && isOpaque;
+		fragmentState.targetCount = isBlended ? static_cast<uint32_t>(transparentTargets.size()) : 1;
+		fragmentState.targets = isBlended ? transparentTargets.data() : &colorTarget;
+		depthStencilState.depthCompare = hasPrePassDepth ? CompareFunction::LessEqual : CompareFunction::Less;
+		depthStencilState.depthWriteEnabled = !hasPrePassDepth && !isBlended;
+
+		const GeometryArena::VertexBufferLayouts vertexBufferLayouts = m_gpuScene.vertexBufferLayouts(pipelineIdx);
 		pipelineDesc.vertex.bufferCount = static_cast<uint32_t>(vertexBufferLayouts.size());
 		pipelineDesc.vertex.buffers = vertexBufferLayouts.data();
 		pipelineDesc.primitive.topology = m_gpuScene.primitiveTopology(pipelineIdx);
+		pipelineDesc.primitive.frontFace = m_gpuScene.frontFace(pipelineIdx);
+		pipelineDesc.primitive.cullMode = m_gpuScene.cullMode(pipelineIdx);
 
-		RenderPipeline pipeline = m_device->createRenderPipeline(pipelineDesc);
-		std::cout << "Render pipeline: " << pipeline << std::endl;
-		if (pipeline == nullptr) return false;
-		m_pipelines.push_back(pipeline);
+		// Never wait for the driver to compile it, see renderScene()
+		uint32_t pipelineId = m_pipelineCompiler.compileAsync(pipelineDesc);
+		m_pipelineCache.insert(key, pipelineId);
+		m_pipelineIds.push_back(pipelineId);
 	}
+	layout.release();
+	m_renderStats.shaderVariantCount = static_cast<uint32_t>(m_shaderLibrary.moduleCount());
+	m_renderStats.cachedPipelineCount = static_cast<uint32_t>(m_pipelineCache.size());
+	m_renderStats.pendingPipelineCount = m_pipelineCompiler.pendingCount();
+
+	// vs_depth is the same in all variants
+	ShaderModule depthShaderModule = m_shaderLibrary.getOrCreateModule(shaderPath, {});
+	if (!depthShaderModule) return false;
 
+	// Materials are not needed to write depth or a flat color
+	std::vector<BindGroupLayout> depthBindGroupLayouts = {
+		*m_bindGroupLayout,
+		*m_emptyBindGroupLayout,
+		*m_nodeBindGroupLayout
+	};
+	PipelineLayoutDescriptor depthLayoutDesc{};
+	depthLayoutDesc.bindGroupLayoutCount = static_cast<uint32_t>(depthBindGroupLayouts.size());
+	depthLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)depthBindGroupLayouts.data();
+	PipelineLayout depthLayout = m_device->createPipelineLayout(depthLayoutDesc);
+
+	// Drawn instead of opaque primitives whose pipeline is not compiled yet.
+	// Their shaders are trivial, so creating them does not hold the frame.
+	// Other primitives are skipped meanwhile, as a flat color would not let
+	// what is behind them through.
+	{
+		RenderPipelineDescriptor fallbackPipelineDesc = pipelineDesc;
+		fallbackPipelineDesc.label = "Fallback";
+		fallbackPipelineDesc.vertex.module = depthShaderModule;
+		fallbackPipelineDesc.vertex.entryPoint = "vs_depth";
+		fallbackPipelineDesc.layout = depthLayout;
+		fragmentState.module = depthShaderModule;
+		fragmentState.entryPoint = "fs_fallback";
+		fragmentState.targetCount = 1;
+		fragmentState.targets = &colorTarget;
+		depthStencilState.depthCompare = m_depthPrePassEnabled ? CompareFunction::LessEqual : CompareFunction::Less;
+		depthStencilState.depthWriteEnabled = !m_depthPrePassEnabled;
+
+		for (uint32_t pipelineIdx = 0; pipelineIdx < m_gpuScene.renderPipelineCount(); ++pipelineIdx) {
+			const uint32_t features = m_gpuScene.materialFeatures(pipelineIdx);
+			if (features & (GpuScene::AlphaMask | GpuScene::AlphaBlend)) {
+				m_fallbackPipelines.push_back(nullptr);
+				continue;
+			}
+			VertexBufferLayout positionLayout = m_gpuScene.positionVertexBufferLayout(pipelineIdx);
+			fallbackPipelineDesc.vertex.bufferCount = 1;
+			fallbackPipelineDesc.vertex.buffers = &positionLayout;
+			fallbackPipelineDesc.primitive.topology = m_gpuScene.primitiveTopology(pipelineIdx);
+			fallbackPipelineDesc.primitive.frontFace = m_gpuScene.frontFace(pipelineIdx);
+			fallbackPipelineDesc.primitive.cullMode = m_gpuScene.cullMode(pipelineIdx);
+
+			RenderPipeline pipeline = m_device->createRenderPipeline(fallbackPipelineDesc);
+			if (pipeline == nullptr) {
+				depthLayout.release();
+				return false;
+			}
+			m_fallbackPipelines.push_back(pipeline);
+		}
+	}
+
+	if (m_depthPrePassEnabled) {
+		std::cout << "Creating depth pre-pass pipelines..." << std::endl;
+
+		DepthStencilState depthOnlyState = depthStencilState;
+		depthOnlyState.depthCompare = CompareFunction::Less;
+		depthOnlyState.depthWriteEnabled = true;
+
+		RenderPipelineDescriptor depthPipelineDesc = pipelineDesc;
+		depthPipelineDesc.label = "Depth pre-pass";
+		depthPipelineDesc.vertex.module = depthShaderModule;
+		depthPipelineDesc.vertex.entryPoint = "vs_depth";
+		depthPipelineDesc.fragment = nullptr;
+		depthPipelineDesc.depthStencil = &depthOnlyState;
+		depthPipelineDesc.layout = depthLayout;
+
+		for (uint32_t pipelineIdx = 0; pipelineIdx < m_gpuScene.renderPipelineCount(); ++pipelineIdx) {
+			VertexBufferLayout positionLayout = m_gpuScene.positionVertexBufferLayout(pipelineIdx);
+			depthPipelineDesc.vertex.bufferCount = 1;
+			depthPipelineDesc.vertex.buffers = &positionLayout;
+			depthPipelineDesc.primitive.topology = m_gpuScene.primitiveTopology(pipelineIdx);
+			depthPipelineDesc.primitive.frontFace = m_gpuScene.frontFace(pipelineIdx);
+			depthPipelineDesc.primitive.cullMode = m_gpuScene.cullMode(pipelineIdx);
+
+			RenderPipeline pipeline = m_device->createRenderPipeline(depthPipelineDesc);
+			if (pipeline == nullptr) {
+				depthLayout.release();
+				return false;
+			}
+			m_depthPipelines.push_back(pipeline);
+		}
+	}
+	depthLayout.release();
+
+	if (!m_shadowMaps.initPipelines(m_gpuScene)) return false;
+
+	// Main pipelines are still compiling, see onFrame()
+	m_renderStats.load.pipelineCreationMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
 	return true;
 }
 
 void Application::terminateRenderPipelines() {
-	m_pipelines.clear();
+	// Main pipelines stay in m_pipelineCache
+	m_pipelineIds.clear();
+	for (RenderPipeline pipeline : m_fallbackPipelines) {
+		if (pipeline) {
+			pipeline.release();
+		}
+	}
+	m_fallbackPipelines.clear();
+	for (RenderPipeline pipeline : m_depthPipelines) {
+		pipeline.release();
+	}
+	m_depthPipelines.clear();
+	m_shadowMaps.terminatePipelines();
 }
 
 bool Application::initGeometry(const ResourceManager::path& filePath) {
+	CPU_PROFILE_SCOPE("Load scene");
 	auto extension = filePath.extension();
 	bool success = false;
 
-	if (extension == ".glb" || extension == ".gltf") {
-		std::cout << "loading glTF file" << filePath << std::endl;
-		success = ResourceManager::loadGeometryFromGltf(filePath, m_cpuScene);
-		std::cout << "Creating scene from glTF..." << std::endl;
-		m_gpuScene.createFromModel(m_device, m_cpuScene, *m_materialBindGroupLayout, *m_nodeBindGroupLayout);
+	const std::string pathString = filePath.string();
+	const bool isStressScene = pathString.rfind(StressScene::PATH_PREFIX, 0) == 0;
+
+	if (isStressScene || extension == ".glb" || extension == ".gltf") {
+		m_renderStats.load = {};
+		auto parseStart = std::chrono::steady_clock::now();
+		if (isStressScene) {
+			std::cout << "generating " << pathString << std::endl;
+			StressScene::Parameters parameters;
+			success = StressScene::parse(pathString.substr(std::strlen(StressScene::PATH_PREFIX)), parameters);
+			if (success) m_cpuScene = StressScene::generate(parameters);
+		}
+		else {
+			std::cout << "loading glTF file" << filePath << std::endl;
+			success = ResourceManager::loadGeometryFromGltf(filePath, m_cpuScene, &m_renderStats.load.imageDecodeMs);
+		}
+		float loadTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - parseStart).count();
+		m_renderStats.load.parseMs = loadTimeMs - m_renderStats.load.imageDecodeMs;
+		// The memory of the current scene is released or reused
+		uint64_t projectedBytes = 0;
+		if (success) {
+			projectedBytes = GpuMemory::stats().totalBytes - m_gpuScene.byteSize() + m_gpuScene.estimateByteSize(m_cpuScene);
+			success = GpuMemory::checkBudget(projectedBytes, ("loading " + pathString).c_str());
+		}
+		if (success) {
+			std::cout << "Creating scene from glTF..." << std::endl;
+			m_gpuScene.createFromModel(m_device, m_cpuScene, *m_materialBindGroupLayout, *m_nodeBindGroupLayout);
+			const uint64_t totalBytes = GpuMemory::stats().totalBytes;
+			if (totalBytes > projectedBytes) {
+				std::cerr << "GPU memory estimate of " << projectedBytes / (1024 * 1024) << " MiB exceeded by loading " << pathString
+					<< " (" << totalBytes / (1024 * 1024) << " MiB), the budget check may let scenes through" << std::endl;
+			}
+			m_renderStats.load.scene = m_gpuScene.loadTimings();
+			m_clusteredLighting.uploadLights(m_gpuScene.punctualLights());
+			m_shadowMaps.invalidate();
+			m_renderStats.punctualLightCount = m_clusteredLighting.lightCount();
+			m_renderStats.staticBatchCount = m_gpuScene.staticBatchCount();
+			m_renderStats.batchedPrimitiveCount = m_gpuScene.batchedPrimitiveCount();
+			GpuMemory::printSummary();
+		}
 		m_cpuScene = {};
 	}
 	else if (extension == ".obj") {
@@ -474,10 +1063,9 @@ bool Application::initGeometry(const ResourceManager::path& filePath) {
 
 bool Application::updateGeometry() {
 	terminateRenderPipelines();
-	if (initGeometry(m_filePath) && initRenderPipelines()) {
-		return true;
-	}
-	return false;
+	// The previous scene, if any, stays when the new one cannot be loaded
+	const bool success = initGeometry(m_filePath);
+	return initRenderPipelines() && success;
 }
 
 void Application::terminateGeometry() {
@@ -486,14 +1074,22 @@ void Application::terminateGeometry() {
 }
 
 bool Application::initUniforms() {
+	// Each frame in flight owns a slot holding global then lighting uniforms,
+	// both bound with the same dynamic offset
+	m_lightingUniformsOffset = alignToNextMultipleOf(static_cast<uint32_t>(sizeof(GlobalUniforms)), m_minUniformBufferOffsetAlignment);
+	m_frameUniformsStride = alignToNextMultipleOf(m_lightingUniformsOffset + static_cast<uint32_t>(sizeof(LightingUniforms)), m_minUniformBufferOffsetAlignment);
+	m_frameUniformsStaging.assign(m_frameUniformsStride, 0);
+
 	// Create uniform buffer
 	BufferDescriptor bufferDesc;
-	bufferDesc.size = sizeof(GlobalUniforms);
+	bufferDesc.label = "Frame uniforms";
+	bufferDesc.size = FRAMES_IN_FLIGHT * m_frameUniformsStride;
 	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
 	bufferDesc.mappedAtCreation = false;
 	m_uniformBuffer = m_device->createBuffer(bufferDesc);
+	m_uniformBufferMemory.set(GpuMemory::Category::Uniform, bufferDesc.size);
 
-	// Upload the initial value of the uniforms
+	// Initial value of the uniforms, uploaded with the first frame
 	m_uniforms.modelMatrix = mat4x4(1.0);
 	m_uniforms.viewMatrix = glm::lookAt(vec3(-2.0f, -3.0f, 2.0f), vec3(0.0f), vec3(0, 0, 1));
 	m_uniforms.projectionMatrix = glm::perspective(45 * PI / 180, 640.0f / 480.0f, 0.01f, 100.0f);
@@ -501,7 +1097,6 @@ bool Application::initUniforms() {
 	m_uniforms.gamma = textureFormatGamma(m_surfaceFormat);
 	float grey = std::pow(0.25, textureFormatGamma(m_surfaceFormat));
 	m_uniforms.worldColor = { grey, grey,grey, 1.0 };
-	m_queue->writeBuffer(*m_uniformBuffer, 0, &m_uniforms, sizeof(GlobalUniforms));
 
 	updateProjectionMatrix();
 	updateViewMatrix();
@@ -511,47 +1106,117 @@ bool Application::initUniforms() {
 
 void Application::terminateUniforms() {
 	m_uniformBuffer->destroy();
+	m_uniformBufferMemory.reset();
 }
 
-bool Application::initLightingUniforms() {
-	// Create uniform buffer
-	BufferDescriptor bufferDesc;
-	bufferDesc.size = sizeof(LightingUniforms);
-	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
-	bufferDesc.mappedAtCreation = false;
-	m_lightingUniformBuffer = m_device->createBuffer(bufferDesc);
-
-	// Initial values
+void Application::initLightingUniforms() {
+	// Initial values, they live in the frame uniforms slots
 	m_lightingUniforms.directions[0] = { 0.5f, -0.9f, 0.1f, 0.0f };
 	m_lightingUniforms.directions[1] = { 0.2f, 0.4f, 0.3f, 0.0f };
 	m_lightingUniforms.colors[0] = { 1.0f, 0.9f, 0.6f, 1.0f };
 	m_lightingUniforms.colors[1] = { 0.6f, 0.9f, 1.0f, 1.0f };
+}
 
-	updateLightingUniforms();
+void Application::waitForFrameSlot() {
+#ifndef __EMSCRIPTEN__
+	// The slot we are about to write was last used FRAMES_IN_FLIGHT frames
+	// ago, but we may wait for less to keep latency down
+	uint32_t maxQueuedFrames = std::clamp(m_renderSettings.maxQueuedFrames, 1u, FRAMES_IN_FLIGHT);
+	while (m_submittedFrameCount - m_completedFrameCount >= maxQueuedFrames) {
+		pollDevice(true);
+	}
+#endif // __EMSCRIPTEN__
+}
+
+void Application::uploadFrameUniforms() {
+	uint32_t slot = static_cast<uint32_t>(m_submittedFrameCount % FRAMES_IN_FLIGHT);
+	uint32_t slotOffset = slot * m_frameUniformsStride;
+
+	std::memcpy(m_frameUniformsStaging.data(), &m_uniforms, sizeof(GlobalUniforms));
+	std::memcpy(m_frameUniformsStaging.data() + m_lightingUniformsOffset, &m_lightingUniforms, sizeof(LightingUniforms));
+	m_queue->writeBuffer(*m_uniformBuffer, slotOffset, m_frameUniformsStaging.data(), m_frameUniformsStaging.size());
+	m_frameUniformUploadedBytes += m_frameUniformsStaging.size();
 
-	return m_lightingUniformBuffer;
+	// One dynamic offset per binding of the global bind group
+	m_frameUniformOffsets = { slotOffset, slotOffset };
 }
 
-void Application::terminateLightingUniforms() {
-	m_lightingUniformBuffer->destroy();
+void Application::onFrameSubmitted() {
+	++m_submittedFrameCount;
+	// Through the C API, as the wrapper would allocate a std::function for
+	// each frame
+	wgpuQueueOnSubmittedWorkDone(*m_queue, [](WGPUQueueWorkDoneStatus, void* userdata) {
+		++static_cast<Application*>(userdata)->m_completedFrameCount;
+	}, this);
 }
 
-void Application::updateLightingUniforms() {
-	if (m_lightingUniformsChanged) {
-		m_queue->writeBuffer(*m_lightingUniformBuffer, 0, &m_lightingUniforms, sizeof(LightingUniforms));
-		m_lightingUniformsChanged = false;
+void Application::recordFrameStats(std::chrono::steady_clock::time_point frameStart, float waitTimeMs, uint64_t frameStartAllocationCount) {
+	m_renderStats.heapAllocations = AllocationTracker::threadAllocationCount() - frameStartAllocationCount;
+
+	// Counters only ever grow, except the uniform pool's that restarts with
+	// a new device
+	const uint64_t uploadedBytes = m_frameUniformUploadedBytes
+		+ m_gpuScene.uploadedBytes()
+		+ m_shadowMaps.uploadedBytes()
+		+ m_clusteredLighting.uploadedBytes()
+		+ m_upscaler.uploadedBytes();
+	m_renderStats.uploadBytes = uploadedBytes >= m_uploadedBytes ? uploadedBytes - m_uploadedBytes : 0;
+	m_uploadedBytes = uploadedBytes;
+
+	const auto frameEnd = std::chrono::steady_clock::now();
+	RenderStats::FrameHistory& history = m_renderStats.history;
+	// The first frame has no predecessor to measure from
+	const bool hasLastFrame = m_lastFrameEnd != std::chrono::steady_clock::time_point{};
+	const float frameMs = std::chrono::duration<float, std::milli>(frameEnd - (hasLastFrame ? m_lastFrameEnd : frameStart)).count();
+	const float cpuMs = std::chrono::duration<float, std::milli>(frameEnd - frameStart).count() - waitTimeMs;
+	history.frameMs[history.nextFrame] = frameMs;
+	history.cpuMs[history.nextFrame] = cpuMs;
+	history.gpuMs[history.nextFrame] = m_renderStats.gpuFrameTimeMs;
+	history.nextFrame = (history.nextFrame + 1) % RenderStats::FrameHistory::LENGTH;
+	history.count = std::min(history.count + 1, RenderStats::FrameHistory::LENGTH);
+	m_lastFrameEnd = frameEnd;
+
+	if (m_metricsLog.isOpen()) {
+		MetricsLog::Record record;
+		// Already counted as submitted
+		record.frame = m_submittedFrameCount - 1;
+		record.timestampUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count());
+		record.frameMs = frameMs;
+		record.cpuMs = cpuMs;
+		record.hasGpuTime = m_renderStats.gpuFrameTimeSampleCount != m_loggedGpuSampleCount;
+		record.gpuMs = m_renderStats.gpuFrameTimeMs;
+		record.drawCalls = m_renderStats.draws.drawCalls;
+		record.triangles = m_renderStats.draws.triangles;
+		record.pipelineSwitches = m_renderStats.draws.pipelineSwitches;
+		record.bindGroupSwitches = m_renderStats.draws.bindGroupSwitches;
+		record.shadowCascadesRendered = m_renderStats.shadowCascadesRendered;
+		record.uploadBytes = m_renderStats.uploadBytes;
+		record.gpuMemoryBytes = GpuMemory::stats().totalBytes;
+		record.heapAllocations = m_renderStats.heapAllocations;
+		m_metricsLog.push(record);
+		m_loggedGpuSampleCount = m_renderStats.gpuFrameTimeSampleCount;
 	}
 }
 
+void Application::pollDevice([[maybe_unused]] bool wait) {
+#if defined(WEBGPU_BACKEND_WGPU)
+	m_device->poll(wait);
+#elif defined(WEBGPU_BACKEND_DAWN)
+	m_device->tick();
+#endif
+}
+
 bool Application::initBindGroupLayouts() {
 	{
-		std::vector<BindGroupLayoutEntry> bindGroupLayoutEntries(2, Default);
+		std::vector<BindGroupLayoutEntry> bindGroupLayoutEntries(7, Default);
 
 		// The uniform buffer binding
 		BindGroupLayoutEntry& bindingLayout = bindGroupLayoutEntries[0];
 		bindingLayout.binding = 0;
 		bindingLayout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
 		bindingLayout.buffer.type = BufferBindingType::Uniform;
+		bindingLayout.buffer.hasDynamicOffset = true;
 		bindingLayout.buffer.minBindingSize = sizeof(GlobalUniforms);
 
 		// The lighting uniform buffer binding
@@ -559,8 +1224,40 @@ bool Application::initBindGroupLayouts() {
 		lightingUniformLayout.binding = 1;
 		lightingUniformLayout.visibility = ShaderStage::Fragment; // only Fragment is needed
 		lightingUniformLayout.buffer.type = BufferBindingType::Uniform;
+		lightingUniformLayout.buffer.hasDynamicOffset = true;
 		lightingUniformLayout.buffer.minBindingSize = sizeof(LightingUniforms);
 
+		// Punctual lights and their assignment to clusters
+		BindGroupLayoutEntry& lightsLayout = bindGroupLayoutEntries[2];
+		lightsLayout.binding = 2;
+		lightsLayout.visibility = ShaderStage::Fragment;
+		lightsLayout.buffer.type = BufferBindingType::ReadOnlyStorage;
+		lightsLayout.buffer.minBindingSize = sizeof(ClusteredLighting::GpuLight);
+
+		BindGroupLayoutEntry& clusterLightsLayout = bindGroupLayoutEntries[3];
+		clusterLightsLayout.binding = 3;
+		clusterLightsLayout.visibility = ShaderStage::Fragment;
+		clusterLightsLayout.buffer.type = BufferBindingType::ReadOnlyStorage;
+		clusterLightsLayout.buffer.minBindingSize = sizeof(uint32_t);
+
+		// Cascaded shadow maps
+		BindGroupLayoutEntry& shadowUniformsLayout = bindGroupLayoutEntries[4];
+		shadowUniformsLayout.binding = 4;
+		shadowUniformsLayout.visibility = ShaderStage::Fragment;
+		shadowUniformsLayout.buffer.type = BufferBindingType::ReadOnlyStorage;
+		shadowUniformsLayout.buffer.minBindingSize = sizeof(ShadowMaps::Uniforms);
+
+		BindGroupLayoutEntry& shadowMapLayout = bindGroupLayoutEntries[5];
+		shadowMapLayout.binding = 5;
+		shadowMapLayout.visibility = ShaderStage::Fragment;
+		shadowMapLayout.texture.sampleType = TextureSampleType::Depth;
+		shadowMapLayout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+		BindGroupLayoutEntry& shadowSamplerLayout = bindGroupLayoutEntries[6];
+		shadowSamplerLayout.binding = 6;
+		shadowSamplerLayout.visibility = ShaderStage::Fragment;
+		shadowSamplerLayout.sampler.type = SamplerBindingType::Comparison;
+
 		// Create a bind group layout
 		BindGroupLayoutDescriptor bindGroupLayoutDesc{};
 		bindGroupLayoutDesc.entryCount = (uint32_t)bindGroupLayoutEntries.size();
@@ -633,16 +1330,26 @@ bool Application::initBindGroupLayouts() {
 		m_nodeBindGroupLayout = m_device->createBindGroupLayout(bindGroupLayoutDesc);
 	}
 
+	// Empty bind group
+	{
+		BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+		bindGroupLayoutDesc.label = "Empty";
+		bindGroupLayoutDesc.entryCount = 0;
+		bindGroupLayoutDesc.entries = nullptr;
+		m_emptyBindGroupLayout = m_device->createBindGroupLayout(bindGroupLayoutDesc);
+	}
+
 	return (
 		m_bindGroupLayout &&
 		m_materialBindGroupLayout &&
-		m_nodeBindGroupLayout
+		m_nodeBindGroupLayout &&
+		m_emptyBindGroupLayout
 		);
 }
 
 bool Application::initBindGroup() {
 	// Create a binding
-	std::vector<BindGroupEntry> bindings(2);
+	std::vector<BindGroupEntry> bindings(7);
 
 	bindings[0].binding = 0;
 	bindings[0].buffer = *m_uniformBuffer;
@@ -650,31 +1357,55 @@ bool Application::initBindGroup() {
 	bindings[0].size = sizeof(GlobalUniforms);
 
 	bindings[1].binding = 1;
-	bindings[1].buffer = *m_lightingUniformBuffer;
-	bindings[1].offset = 0;
+	bindings[1].buffer = *m_uniformBuffer;
+	bindings[1].offset = m_lightingUniformsOffset;
 	bindings[1].size = sizeof(LightingUniforms);
 
+	bindings[2].binding = 2;
+	bindings[2].buffer = m_clusteredLighting.lightBuffer();
+	bindings[2].offset = 0;
+	bindings[2].size = m_clusteredLighting.lightBufferSize();
+
+	bindings[3].binding = 3;
+	bindings[3].buffer = m_clusteredLighting.clusterLightsBuffer();
+	bindings[3].offset = 0;
+	bindings[3].size = m_clusteredLighting.clusterLightsBufferSize();
+
+	bindings[4].binding = 4;
+	bindings[4].buffer = m_shadowMaps.uniformBuffer();
+	bindings[4].offset = 0;
+	bindings[4].size = m_shadowMaps.uniformBufferSize();
+
+	bindings[5].binding = 5;
+	bindings[5].textureView = m_shadowMaps.textureView();
+
+	bindings[6].binding = 6;
+	bindings[6].sampler = m_shadowMaps.sampler();
+
 	BindGroupDescriptor bindGroupDesc;
 	bindGroupDesc.layout = *m_bindGroupLayout;
 	bindGroupDesc.entryCount = (uint32_t)bindings.size();
 	bindGroupDesc.entries = bindings.data();
 	m_bindGroup = m_device->createBindGroup(bindGroupDesc);
 
-	return m_bindGroup;
+	BindGroupDescriptor emptyBindGroupDesc;
+	emptyBindGroupDesc.label = "Empty";
+	emptyBindGroupDesc.layout = *m_emptyBindGroupLayout;
+	emptyBindGroupDesc.entryCount = 0;
+	emptyBindGroupDesc.entries = nullptr;
+	m_emptyBindGroup = m_device->createBindGroup(emptyBindGroupDesc);
+
+	if (!m_clusteredLighting.initBindGroup(*m_uniformBuffer, sizeof(GlobalUniforms), m_lightingUniformsOffset, sizeof(LightingUniforms))) return false;
+
+	return m_bindGroup && m_emptyBindGroup;
 }
 
 void Application::updateProjectionMatrix() {
 	// Update projection matrix
 	int width, height;
-	glfwGetFramebufferSize(m_window, &width, &height);
+	getFramebufferSize(width, height);
 	float ratio = width / (float)height;
-	m_uniforms.projectionMatrix = glm::perspective(45 * PI / 180, ratio, 0.01f, 100.0f);
-	m_queue->writeBuffer(
-		*m_uniformBuffer,
-		offsetof(GlobalUniforms, projectionMatrix),
-		&m_uniforms.projectionMatrix,
-		sizeof(GlobalUniforms::projectionMatrix)
-	);
+	m_uniforms.projectionMatrix = glm::perspective(45 * PI / 180, ratio, Z_NEAR, Z_FAR);
 }
 
 void Application::updateViewMatrix() {
@@ -686,24 +1417,239 @@ void Application::updateViewMatrix() {
 	mat4x4 translationMatrix = glm::translate(mat4x4(1.0f), -vec3(m_cameraState.pan.x, m_cameraState.pan.y, 0.0f));
 	m_uniforms.viewMatrix = glm::lookAt(position, vec3(0.0), vec3(0, 0, 1));
 	m_uniforms.viewMatrix = translationMatrix * m_uniforms.viewMatrix;
-	m_queue->writeBuffer(
-		*m_uniformBuffer,
-		offsetof(GlobalUniforms, viewMatrix),
-		&m_uniforms.viewMatrix,
-		sizeof(GlobalUniforms::viewMatrix)
-	);
-
 	m_uniforms.cameraWorldPosition = position;
-	m_queue->writeBuffer(
-		*m_uniformBuffer,
-		offsetof(GlobalUniforms, cameraWorldPosition),
-		&m_uniforms.cameraWorldPosition,
-		sizeof(GlobalUniforms::cameraWorldPosition)
-	);
+}
+
+void Application::renderDepthPrePass(CommandEncoder encoder) {
+	CPU_PROFILE_SCOPE("Encode depth pre-pass");
+	RenderPassDepthStencilAttachment depthStencilAttachment;
+	depthStencilAttachment.view = *m_depthTextureView;
+	depthStencilAttachment.depthClearValue = 1.0f;
+	depthStencilAttachment.depthLoadOp = LoadOp::Clear;
+	depthStencilAttachment.depthStoreOp = StoreOp::Store;
+	depthStencilAttachment.depthReadOnly = false;
+	depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+	depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Store;
+#else
+	depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif
+	depthStencilAttachment.stencilReadOnly = true;
+
+	// No color attachment, so no fragment shader runs at all
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Depth pre-pass";
+	renderPassDesc.colorAttachmentCount = 0;
+	renderPassDesc.colorAttachments = nullptr;
+	renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+	renderPassDesc.timestampWrites = m_gpuProfiler.renderPassTimestampWrites(renderPassDesc.label);
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	renderPass.setViewport(0.0f, 0.0f, static_cast<float>(m_renderWidth), static_cast<float>(m_renderHeight), 0.0f, 1.0f);
+
+	renderPass.setBindGroup(0, *m_bindGroup, m_frameUniformOffsets.size(), m_frameUniformOffsets.data());
+	renderPass.setBindGroup(1, *m_emptyBindGroup, 0, nullptr);
+	m_gpuScene.bindPositions(renderPass);
+	for (uint32_t pipelineIdx = 0; pipelineIdx < m_depthPipelines.size(); ++pipelineIdx) {
+		// Alpha tested and blended fragments must not occlude anything here
+		if (m_gpuScene.materialFeatures(pipelineIdx) & (GpuScene::AlphaMask | GpuScene::AlphaBlend)) continue;
+		renderPass.setPipeline(m_depthPipelines[pipelineIdx]);
+		m_gpuScene.drawDepth(renderPass, pipelineIdx);
+	}
+
+	renderPass.end();
+	renderPass.release();
+}
+
+void Application::renderScene(CommandEncoder encoder) {
+	CPU_PROFILE_SCOPE("Encode scene");
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Scene";
+
+	RenderPassColorAttachment renderPassColorAttachment{};
+	renderPassColorAttachment.view = *m_sceneColorTextureView;
+	renderPassColorAttachment.resolveTarget = nullptr;
+	renderPassColorAttachment.loadOp = LoadOp::Clear;
+	renderPassColorAttachment.storeOp = StoreOp::Store;
+	renderPassColorAttachment.clearValue = Color{ m_uniforms.worldColor.r,m_uniforms.worldColor.g, m_uniforms.worldColor.b,m_uniforms.worldColor.w };
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &renderPassColorAttachment;
+
+	RenderPassDepthStencilAttachment depthStencilAttachment;
+	depthStencilAttachment.view = *m_depthTextureView;
+	depthStencilAttachment.depthClearValue = 1.0f;
+	// Keep the depth laid down by the pre-pass
+	depthStencilAttachment.depthLoadOp = m_depthPrePassEnabled ? LoadOp::Load : LoadOp::Clear;
+	depthStencilAttachment.depthStoreOp = StoreOp::Store;
+	depthStencilAttachment.depthReadOnly = false;
+	depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+	depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Store;
+#else
+	depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif
+	depthStencilAttachment.stencilReadOnly = true;
+
+	renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+
+	renderPassDesc.timestampWrites = m_gpuProfiler.renderPassTimestampWrites(renderPassDesc.label);
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	renderPass.setViewport(0.0f, 0.0f, static_cast<float>(m_renderWidth), static_cast<float>(m_renderHeight), 0.0f, 1.0f);
+
+	// All primitives share the same vertex and index buffers, and fallback
+	// pipelines only read positions, in slot 0 like the others
+	m_gpuScene.bindGeometry(renderPass);
+
+	// Blended primitives are drawn by renderTransparency()
+	for (uint32_t pipelineIdx = 0; pipelineIdx < m_pipelineIds.size(); ++pipelineIdx) {
+		if (m_gpuScene.materialFeatures(pipelineIdx) & GpuScene::AlphaBlend) continue;
+
+		RenderPipeline pipeline = m_pipelineCompiler.pipeline(m_pipelineIds[pipelineIdx]);
+		if (pipeline) {
+			renderPass.setPipeline(pipeline);
+			renderPass.setBindGroup(0, *m_bindGroup, m_frameUniformOffsets.size(), m_frameUniformOffsets.data());
+			m_gpuScene.draw(renderPass, pipelineIdx);
+		}
+		else if (m_fallbackPipelines[pipelineIdx] && m_pipelineCompiler.status(m_pipelineIds[pipelineIdx]) == PipelineCompiler::Status::Pending) {
+			renderPass.setPipeline(m_fallbackPipelines[pipelineIdx]);
+			renderPass.setBindGroup(0, *m_bindGroup, m_frameUniformOffsets.size(), m_frameUniformOffsets.data());
+			renderPass.setBindGroup(1, *m_emptyBindGroup, 0, nullptr);
+			m_gpuScene.drawDepth(renderPass, pipelineIdx);
+		}
+		// Otherwise deferred until its pipeline is compiled. Those that failed
+		// are skipped, rather than drawn with the fallback forever.
+	}
+
+	renderPass.end();
+	renderPass.release();
+}
+
+void Application::renderTransparency(CommandEncoder encoder) {
+	CPU_PROFILE_SCOPE("Encode transparency");
+	auto isReadyBlendedPipeline = [this](uint32_t pipelineIdx) {
+		return (m_gpuScene.materialFeatures(pipelineIdx) & GpuScene::AlphaBlend) != 0
+			&& m_pipelineCompiler.pipeline(m_pipelineIds[pipelineIdx]);
+	};
+	// Nothing to accumulate nor resolve without a ready blended pipeline
+	uint32_t firstPipelineIdx = 0;
+	while (firstPipelineIdx < m_pipelineIds.size() && !isReadyBlendedPipeline(firstPipelineIdx)) {
+		++firstPipelineIdx;
+	}
+	if (firstPipelineIdx == m_pipelineIds.size()) return;
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Transparency";
+
+	std::array<RenderPassColorAttachment, 2> colorAttachments = m_transparencyPass.colorAttachments();
+	renderPassDesc.colorAttachmentCount = static_cast<uint32_t>(colorAttachments.size());
+	renderPassDesc.colorAttachments = colorAttachments.data();
+
+	// Tested against the opaque depth, which blended pipelines do not write
+	RenderPassDepthStencilAttachment depthStencilAttachment;
+	depthStencilAttachment.view = *m_depthTextureView;
+	depthStencilAttachment.depthClearValue = 1.0f;
+	depthStencilAttachment.depthLoadOp = LoadOp::Load;
+	depthStencilAttachment.depthStoreOp = StoreOp::Store;
+	depthStencilAttachment.depthReadOnly = false;
+	depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+	depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Store;
+#else
+	depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif
+	depthStencilAttachment.stencilReadOnly = true;
+	renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+	renderPassDesc.timestampWrites = m_gpuProfiler.renderPassTimestampWrites(renderPassDesc.label);
+
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	renderPass.setViewport(0.0f, 0.0f, static_cast<float>(m_renderWidth), static_cast<float>(m_renderHeight), 0.0f, 1.0f);
+	m_gpuScene.bindGeometry(renderPass);
+	for (uint32_t pipelineIdx = firstPipelineIdx; pipelineIdx < m_pipelineIds.size(); ++pipelineIdx) {
+		if (!isReadyBlendedPipeline(pipelineIdx)) continue;
+		renderPass.setPipeline(m_pipelineCompiler.pipeline(m_pipelineIds[pipelineIdx]));
+		renderPass.setBindGroup(0, *m_bindGroup, m_frameUniformOffsets.size(), m_frameUniformOffsets.data());
+		m_gpuScene.draw(renderPass, pipelineIdx);
+	}
+	renderPass.end();
+	renderPass.release();
+
+	m_transparencyPass.resolve(encoder, *m_sceneColorTextureView, m_renderWidth, m_renderHeight, m_gpuProfiler.renderPassTimestampWrites("Transparency resolve"));
+}
+
+void Application::renderComposite(CommandEncoder encoder, TextureView surfaceView) {
+	CPU_PROFILE_SCOPE("Encode composite");
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Composite";
+
+	// Every pixel is overwritten by the upscaled image
+	RenderPassColorAttachment renderPassColorAttachment{};
+	renderPassColorAttachment.view = surfaceView;
+	renderPassColorAttachment.resolveTarget = nullptr;
+	renderPassColorAttachment.loadOp = LoadOp::Clear;
+	renderPassColorAttachment.storeOp = StoreOp::Store;
+	renderPassColorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &renderPassColorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+
+	renderPassDesc.timestampWrites = m_gpuProfiler.renderPassTimestampWrites(renderPassDesc.label);
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+
+	m_upscaler.draw(renderPass);
+
+	renderPass.end();
+	renderPass.release();
+}
+
+void Application::renderUi(CommandEncoder encoder, TextureView surfaceView) {
+	// In a pass of its own, so that the GUI is profiled apart from the scene
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "UI";
+
+	RenderPassColorAttachment renderPassColorAttachment{};
+	renderPassColorAttachment.view = surfaceView;
+	renderPassColorAttachment.resolveTarget = nullptr;
+	renderPassColorAttachment.loadOp = LoadOp::Load;
+	renderPassColorAttachment.storeOp = StoreOp::Store;
+	renderPassColorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &renderPassColorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+
+	renderPassDesc.timestampWrites = m_gpuProfiler.renderPassTimestampWrites(renderPassDesc.label);
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+
+	// We add the GUI drawing commands to the render pass
+	CPU_PROFILE_SCOPE("UI update");
+	UiManager::update(renderPass, m_uniforms, m_lightingUniforms, m_renderSettings, m_renderStats, m_framePacer, m_filePath, m_filePathHasChanged);
+
+	renderPass.end();
+	renderPass.release();
+}
+
+void Application::updateCpuTrace() {
+	if (m_renderSettings.recordCpuTrace == CpuProfiler::isRecording()) return;
+	if (m_renderSettings.recordCpuTrace) {
+		CpuProfiler::clear();
+		CpuProfiler::setRecording(true);
+	}
+	else {
+		CpuProfiler::setRecording(false);
+		CpuProfiler::writeChromeTrace(m_launchOptions.cpuTracePath.empty() ? "cpu-trace.json" : m_launchOptions.cpuTracePath);
+	}
 }
 
 TextureView Application::getNextSurfaceTextureView()
 {
+	if (m_launchOptions.headless) {
+		return m_offscreenTexture->createView();
+	}
+
 	SurfaceTexture surfaceTexture;
 	m_surface->getCurrentTexture(&surfaceTexture);
 
@@ -1,7 +1,18 @@
 #pragma once
 
+#include "clustered-lighting.h"
+#include "dynamic-resolution.h"
+#include "frame-pacer.h"
+#include "gpu-memory.h"
+#include "gpu-profiler.h"
 #include "gpu-scene.h"
+#include "metrics-log.h"
+#include "pipeline-compiler.h"
 #include "resource-manager.h"
+#include "shader-library.h"
+#include "shadow-maps.h"
+#include "transparency-pass.h"
+#include "upscaler.h"
 
 #include "resource-loaders/tiny_gltf.h"
 
@@ -10,6 +21,8 @@
 #include <glm/glm/glm.hpp>
 
 #include <array>
+#include <chrono>
+#include <string>
 
 // Forward declare
 struct GLFWwindow;
@@ -20,8 +33,40 @@ using namespace wgpu;
 
 class Application {
 public:
+	// Options given on the command line, see main.cpp
+	struct LaunchOptions {
+		// Render to an offscreen texture instead of a window, e.g. on
+		// machines without display
+		bool headless = false;
+		// Draw the UI in headless mode too, as it looks without input, so
+		// that its cost and allocations are measured
+		bool headlessUi = false;
+		// Request a software adapter (such as lavapipe) rather than a GPU
+		bool forceFallbackAdapter = false;
+		// Size of the offscreen target in headless mode
+		uint32_t width = 1280;
+		uint32_t height = 720;
+		// Frames rendered in headless mode, the last one is written to
+		// outputPath as a PNG image
+		uint32_t frameCount = 1;
+		std::string outputPath = "frame.png";
+		// Scene loaded at startup, the default one if empty
+		std::string scenePath;
+		// Record CPU scopes from startup, and write them to this Chrome
+		// trace when the application finishes. Captures started from the UI
+		// are written there too, or to cpu-trace.json.
+		std::string cpuTracePath;
+		// Append per-frame metrics to this JSON-lines file, and print their
+		// percentiles when the application finishes
+		std::string metricsPath;
+		// GPU memory budget in MiB, 0 for none. Scenes that would exceed it
+		// are loaded with a warning, or refused.
+		uint32_t gpuMemoryBudgetMiB = 0;
+		bool refuseOverBudget = false;
+	};
+
 	// A function called only once at the beginning. Returns false if init failed.
-	bool onInit();
+	bool onInit(const LaunchOptions& options);
 
 	// A function called at each frame, guaranteed never to be called before `onInit`.
 	void onFrame();
@@ -32,6 +77,10 @@ public:
 	// A function that tells if the application is still running.
 	bool isRunning();
 
+	// Whether something failed that should make the process exit with an
+	// error, e.g. writing the image of a headless run
+	bool hasFailed() const { return m_hasFailed; }
+
 	// A function called when the window is resized.
 	void onResize();
 
@@ -46,9 +95,26 @@ private:
 
 	bool initSurfaceConfiguration();
 
+	// Size of the window's framebuffer, or of the offscreen target
+	void getFramebufferSize(int& width, int& height) const;
+
+	// Always with a window, on request in headless mode
+	bool hasUi() const { return !m_launchOptions.headless || m_launchOptions.headlessUi; }
+
+	// Target of the frames in headless mode, read back through a buffer
+	bool initOffscreenTarget();
+	void terminateOffscreenTarget();
+	void copyOffscreenTarget(CommandEncoder encoder);
+	bool writeOffscreenTarget(const std::string& path);
+
 	bool initDepthBuffer();
 	void terminateDepthBuffer();
 
+	// Offscreen color target of the 3D passes, upscaled to the surface
+	bool initSceneColorBuffer();
+	void terminateSceneColorBuffer();
+	void updateRenderResolution();
+
 	bool initRenderPipelines();
 	void terminateRenderPipelines();
 
@@ -59,9 +125,16 @@ private:
 	bool initUniforms();
 	void terminateUniforms();
 
-	bool initLightingUniforms();
-	void terminateLightingUniforms();
-	void updateLightingUniforms();
+	void initLightingUniforms();
+
+	// Frames in flight
+	void waitForFrameSlot();
+	void uploadFrameUniforms();
+	void onFrameSubmitted();
+	void pollDevice(bool wait);
+	// Count the uploads of the frame, and append it to the history of the
+	// render stats
+	void recordFrameStats(std::chrono::steady_clock::time_point frameStart, float waitTimeMs, uint64_t frameStartAllocationCount);
 
 	bool initBindGroupLayouts();
 
@@ -70,6 +143,15 @@ private:
 	void updateProjectionMatrix();
 	void updateViewMatrix();
 
+	void renderDepthPrePass(CommandEncoder encoder);
+	void renderScene(CommandEncoder encoder);
+	void renderTransparency(CommandEncoder encoder);
+	void renderComposite(CommandEncoder encoder, TextureView surfaceView);
+	void renderUi(CommandEncoder encoder, TextureView surfaceView);
+	// Start or stop, and write, the CPU trace capture as requested by the
+	// render settings
+	void updateCpuTrace();
+
 	TextureView getNextSurfaceTextureView();
 
 public:
@@ -99,9 +181,126 @@ public:
 	struct LightingUniforms {
 		std::array<vec4, 2> directions;
 		std::array<vec4, 2> colors;
+		ClusteredLighting::Uniforms clusters;
 	};
 	static_assert(sizeof(LightingUniforms) % 16 == 0);
 
+	// Shading cost tiers, each one has its own shader variants
+	enum class QualityTier {
+		// Lambert diffuse, single tap shadows
+		Low,
+		// Burley diffuse, 3x3 filtered shadows
+		High,
+	};
+
+	// Number of frames the CPU may record ahead of the GPU. Each one owns a
+	// slot of m_uniformBuffer, so uniforms of a frame that is still being
+	// rendered are never overwritten.
+	static constexpr uint32_t FRAMES_IN_FLIGHT = 3;
+
+	// Lowest fraction of the native resolution the 3D passes may render at
+	static constexpr float MIN_RENDER_SCALE = 0.25f;
+
+	// Rendering options that can be toggled at runtime from the UI
+	struct RenderSettings {
+		// Lay down depth with a position-only pass first, so that the main
+		// pass shades each pixel about once
+		bool depthPrePass = false;
+		QualityTier qualityTier = QualityTier::High;
+		// Merge small static meshes when loading, the scene is reloaded when
+		// this changes
+		bool staticBatching = true;
+		// Falls back to Fifo when the surface does not support it
+		PresentMode presentMode = PresentMode::Fifo;
+		// Frames per second, 0 means uncapped
+		float maxFrameRate = 0.0f;
+		// How many submitted frames may be pending on the GPU, between 1 and
+		// FRAMES_IN_FLIGHT. Lower values trade throughput for input latency.
+		uint32_t maxQueuedFrames = 2;
+		// Scale the 3D passes resolution to keep GPU frame time around the
+		// target. Requires timestamp queries, otherwise renderScale is used.
+		bool dynamicResolution = true;
+		float targetFrameTimeMs = 16.0f;
+		float minRenderScale = 0.5f;
+		// Fraction of the native resolution the 3D passes render at
+		float renderScale = 1.0f;
+		// Strength of the sharpening applied after upscaling, 0 to disable
+		float sharpness = 0.2f;
+		// Cascaded shadow maps of the directional lights, up to this view
+		// distance
+		bool shadows = true;
+		float shadowDistance = 20.0f;
+		// Record CPU scopes, the capture is written when this is unset
+		bool recordCpuTrace = false;
+	};
+
+	// Read-only figures about the last frames, for display
+	struct RenderStats {
+		bool gpuTimingAvailable = false;
+		float gpuFrameTimeMs = 0.0f;
+		uint32_t renderWidth = 0;
+		uint32_t renderHeight = 0;
+		uint32_t outputWidth = 0;
+		uint32_t outputHeight = 0;
+		uint32_t punctualLightCount = 0;
+		// Cascades whose static shadow casters were drawn again last frame
+		uint32_t shadowCascadesRendered = 0;
+		// Shader permutations compiled so far
+		uint32_t shaderVariantCount = 0;
+		// Main pipelines compiled or compiling, for any scene loaded so far
+		uint32_t cachedPipelineCount = 0;
+		// Main pipelines still compiling in the background
+		uint32_t pendingPipelineCount = 0;
+		uint32_t staticBatchCount = 0;
+		uint32_t batchedPrimitiveCount = 0;
+		// Pool that material and node uniforms are sub-allocated from
+		BufferPool::Stats uniformPool;
+		// Vertex and index buffers of the scene
+		uint64_t geometryBytes = 0;
+		// Time spent recording the commands of the last frame
+		float cpuEncodeTimeMs = 0.0f;
+		// Incremented with each new gpuFrameTimeMs sample
+		uint64_t gpuFrameTimeSampleCount = 0;
+		// Scene draws of all passes of the last frame
+		GpuScene::DrawStats draws;
+		// Written to buffers and textures during the last frame
+		uint64_t uploadBytes = 0;
+		// Made by the main thread during the last frame, always 0 without
+		// the AllocationTracker
+		uint64_t heapAllocations = 0;
+		GpuMemory::Stats gpuMemory;
+		// GPU time of each pass, over the last frames
+		std::vector<GpuProfiler::ScopeStats> gpuScopes;
+
+		// Timings of the last frames, in milliseconds, as ring buffers
+		// starting at nextFrame once full
+		struct FrameHistory {
+			static constexpr uint32_t LENGTH = 240;
+			// Between the ends of consecutive frames
+			std::array<float, LENGTH> frameMs = {};
+			// Spent in onFrame(), except waiting for the frame pacer and
+			// frame slots
+			std::array<float, LENGTH> cpuMs = {};
+			// Latest GPU frame time, which arrives a few frames late
+			std::array<float, LENGTH> gpuMs = {};
+			uint32_t count = 0;
+			uint32_t nextFrame = 0;
+		};
+		FrameHistory history;
+
+		// Stages of the last scene load, in milliseconds
+		struct LoadStats {
+			// glTF parsing, excluding image decoding
+			float parseMs = 0.0f;
+			float imageDecodeMs = 0.0f;
+			GpuScene::LoadTimings scene;
+			// Until all main pipelines are compiled, only known in headless
+			// mode that waits for them
+			float pipelineCreationMs = 0.0f;
+		};
+		LoadStats load;
+	};
+
 	struct CameraState {
 		// angles.x is the rotation of the camera around the global vertical axis, affected by mouse.x
 		// angles.y is the rotation of the camera around its local horizontal axis, affected by mouse.y
@@ -132,27 +331,84 @@ public:
 		MouseAction mouseAction = MouseAction::Orbit;
 	};
 
+	// Scripted control, e.g. by mega-bench
+	// Replace the current scene, returns false if it could not be loaded
+	bool loadScene(const std::string& path);
+	void setCameraState(const CameraState& state);
+	// Radius of the bounding sphere of the current scene
+	float sceneBoundsRadius() const;
+
 	GlobalUniforms m_uniforms;
 	LightingUniforms m_lightingUniforms;
 
 	CameraState m_cameraState;
 	DragState m_drag;
+	RenderSettings m_renderSettings;
+	RenderStats m_renderStats;
 
 private:
+	LaunchOptions m_launchOptions;
 	GLFWwindow* m_window = nullptr;
 	raii::Instance m_instance;
 	raii::Surface m_surface;
 	raii::Device m_device;
 	raii::Queue m_queue;
 	TextureFormat m_surfaceFormat = TextureFormat::Undefined;
+	// Present mode and frame latency the surface is currently configured with
+	PresentMode m_presentMode = PresentMode::Fifo;
+	uint32_t m_maxQueuedFrames = 0;
+	FramePacer m_framePacer;
 	std::unique_ptr<ErrorCallback> m_errorCallbackHandle;
 
+	// Replace the surface in headless mode. Rows of the readback buffer are
+	// padded to the alignment copyTextureToBuffer requires.
+	raii::Texture m_offscreenTexture;
+	raii::Buffer m_readbackBuffer;
+	GpuMemory::Allocation m_offscreenTextureMemory;
+	GpuMemory::Allocation m_readbackBufferMemory;
+	uint32_t m_readbackBytesPerRow = 0;
+
 	TextureFormat m_depthTextureFormat = TextureFormat::Depth24Plus;
 	raii::Texture m_depthTexture;
 	raii::TextureView m_depthTextureView;
-
-	raii::ShaderModule m_shaderModule;
-	std::vector<RenderPipeline> m_pipelines;
+	GpuMemory::Allocation m_depthTextureMemory;
+
+	// Scene color and depth are allocated at native resolution, the 3D passes
+	// only render to their top-left m_renderWidth x m_renderHeight corner so
+	// that scale changes never reallocate
+	raii::Texture m_sceneColorTexture;
+	raii::TextureView m_sceneColorTextureView;
+	GpuMemory::Allocation m_sceneColorTextureMemory;
+	uint32_t m_renderWidth = 0;
+	uint32_t m_renderHeight = 0;
+	Upscaler m_upscaler;
+	TransparencyPass m_transparencyPass;
+	DynamicResolution m_dynamicResolution;
+	GpuProfiler m_gpuProfiler;
+	MetricsLog m_metricsLog;
+
+	// Clip planes, also bounds of the light clusters
+	static constexpr float Z_NEAR = 0.01f;
+	static constexpr float Z_FAR = 100.0f;
+	ClusteredLighting m_clusteredLighting;
+	ShadowMaps m_shadowMaps;
+
+	ShaderLibrary m_shaderLibrary;
+	PipelineCompiler m_pipelineCompiler;
+	// Compiled main pipelines, kept across scene loads and settings changes
+	PipelineKeyMap<uint32_t> m_pipelineCache;
+	// Main pipelines in m_pipelineCompiler, one per render pipeline of the scene
+	std::vector<uint32_t> m_pipelineIds;
+	// Flat color pipelines drawn until the main ones are compiled, nullptr
+	// for primitives that are not opaque
+	std::vector<RenderPipeline> m_fallbackPipelines;
+	// Position-only pipelines of the depth pre-pass, one per entry of m_pipelineIds
+	std::vector<RenderPipeline> m_depthPipelines;
+	// Whether the current pipelines were built for a depth pre-pass
+	bool m_depthPrePassEnabled = false;
+	// Whether the current scene was loaded with static batching
+	bool m_staticBatchingEnabled = true;
+	QualityTier m_qualityTier = QualityTier::High;
 
 	raii::Sampler m_sampler;
 	raii::Texture m_texture;
@@ -162,15 +418,31 @@ private:
 	GpuScene m_gpuScene;
 
 	raii::Buffer m_uniformBuffer;
-	raii::Buffer m_lightingUniformBuffer;
-	bool m_lightingUniformsChanged = true;
+	GpuMemory::Allocation m_uniformBufferMemory;
+	uint32_t m_minUniformBufferOffsetAlignment = 256;
+	uint32_t m_lightingUniformsOffset = 0; // within a slot
+	uint32_t m_frameUniformsStride = 0; // byte size of a slot
+	std::vector<uint8_t> m_frameUniformsStaging;
+	std::array<uint32_t, 2> m_frameUniformOffsets = { 0, 0 };
+	uint64_t m_submittedFrameCount = 0;
+	uint64_t m_completedFrameCount = 0;
+	std::chrono::steady_clock::time_point m_lastFrameEnd;
+	// Upload totals of all subsystems at the end of the last frame
+	uint64_t m_uploadedBytes = 0;
+	// Value of gpuFrameTimeSampleCount at the last metrics record
+	uint64_t m_loggedGpuSampleCount = 0;
+	uint64_t m_frameUniformUploadedBytes = 0;
 
 	raii::BindGroupLayout m_bindGroupLayout;
 	raii::BindGroupLayout m_materialBindGroupLayout;
 	raii::BindGroupLayout m_nodeBindGroupLayout;
+	// Stands in for the material bind group in depth-only pipelines
+	raii::BindGroupLayout m_emptyBindGroupLayout;
 
 	raii::BindGroup m_bindGroup;
+	raii::BindGroup m_emptyBindGroup;
 
 	ResourceManager::path m_filePath;
 	bool m_filePathHasChanged;
+	bool m_hasFailed = false;
 };
\ No newline at end of file
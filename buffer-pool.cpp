@@ -0,0 +1,224 @@
+#include "buffer-pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+using namespace wgpu;
+
+bool BufferPool::init(Device device, const char* label, BufferUsageFlags usage, GpuMemory::Category category, uint32_t pageSize, uint32_t alignment) {
+	assert(alignment > 0 && pageSize % alignment == 0);
+	m_device = device;
+	m_queue = device.getQueue();
+	m_label = label;
+	m_usage = usage | BufferUsage::CopySrc | BufferUsage::CopyDst;
+	m_category = category;
+	m_pageSize = pageSize;
+	m_alignment = alignment;
+	m_movedBytes = 0;
+	m_writtenBytes = 0;
+	return true;
+}
+
+void BufferPool::terminate() {
+	m_allocations.clear();
+	m_unusedHandles.clear();
+	m_pages.clear();
+	if (m_queue) m_queue.release();
+	m_queue = nullptr;
+	m_device = nullptr;
+}
+
+BufferPool::Handle BufferPool::allocate(uint32_t size, RelocationCallback onRelocated) {
+	if (size == 0) return INVALID_HANDLE;
+
+	uint32_t pageIndex, offset;
+	if (!place(size, ~0u, true, pageIndex, offset)) {
+		std::cerr << "Could not allocate " << size << " bytes in buffer pool '" << m_label << "'" << std::endl;
+		return INVALID_HANDLE;
+	}
+
+	Handle handle;
+	if (!m_unusedHandles.empty()) {
+		handle = m_unusedHandles.back();
+		m_unusedHandles.pop_back();
+	}
+	else {
+		handle = static_cast<Handle>(m_allocations.size());
+		m_allocations.emplace_back();
+	}
+
+	Allocation& allocation = m_allocations[handle];
+	allocation.pageIndex = pageIndex;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.onRelocated = std::move(onRelocated);
+	allocation.isUsed = true;
+	if (!allocation.onRelocated) ++m_pages[pageIndex]->pinnedCount;
+	return handle;
+}
+
+void BufferPool::free(Handle handle) {
+	if (handle == INVALID_HANDLE) return;
+	Allocation& allocation = m_allocations[handle];
+	assert(allocation.isUsed);
+	Page& page = *m_pages[allocation.pageIndex];
+	page.allocator.free(allocation.offset);
+	if (!allocation.onRelocated) --page.pinnedCount;
+	allocation = Allocation{};
+	m_unusedHandles.push_back(handle);
+	// Empty pages are only released by defragment(), so that pages are
+	// reused when a scene is replaced by another one
+}
+
+BufferPool::Range BufferPool::range(Handle handle) const {
+	Range range;
+	if (handle == INVALID_HANDLE) return range;
+	const Allocation& allocation = m_allocations[handle];
+	range.buffer = *m_pages[allocation.pageIndex]->buffer;
+	range.offset = allocation.offset;
+	range.size = allocation.size;
+	return range;
+}
+
+void BufferPool::write(Handle handle, const void* data, size_t size) {
+	if (handle == INVALID_HANDLE) return;
+	const Allocation& allocation = m_allocations[handle];
+	assert(size <= allocation.size);
+	m_queue.writeBuffer(*m_pages[allocation.pageIndex]->buffer, allocation.offset, data, size);
+	m_writtenBytes += size;
+}
+
+uint64_t BufferPool::defragment(uint64_t maxBytes) {
+	releaseEmptyPages();
+
+	// Evacuate the least used page that has no pinned allocation, provided
+	// that the others have enough room in total to take it all
+	uint32_t sourceIndex = ~0u;
+	uint64_t totalFree = 0;
+	for (uint32_t pageIndex = 0; pageIndex < m_pages.size(); ++pageIndex) {
+		const Page* page = m_pages[pageIndex].get();
+		if (!page) continue;
+		totalFree += page->allocator.size() - page->allocator.usedSize();
+		if (page->pinnedCount > 0 || page->allocator.isEmpty()) continue;
+		if (sourceIndex == ~0u || page->allocator.usedSize() < m_pages[sourceIndex]->allocator.usedSize()) {
+			sourceIndex = pageIndex;
+		}
+	}
+	if (sourceIndex == ~0u) return 0;
+	const Page& source = *m_pages[sourceIndex];
+	const uint64_t sourceFree = source.allocator.size() - source.allocator.usedSize();
+	if (totalFree - sourceFree < source.allocator.usedSize()) return 0;
+
+	CommandEncoder encoder = nullptr;
+	std::vector<Handle> movedHandles;
+	uint64_t movedBytes = 0;
+	for (Handle handle = 0; handle < m_allocations.size() && movedBytes < maxBytes; ++handle) {
+		Allocation& allocation = m_allocations[handle];
+		if (!allocation.isUsed || allocation.pageIndex != sourceIndex) continue;
+
+		uint32_t pageIndex, offset;
+		// Free space may be too fragmented for this one, try the next ones
+		if (!place(allocation.size, sourceIndex, false, pageIndex, offset)) continue;
+
+		if (!encoder) encoder = m_device.createCommandEncoder();
+		const uint64_t copySize = m_pages[pageIndex]->allocator.allocationSize(offset);
+		encoder.copyBufferToBuffer(*m_pages[sourceIndex]->buffer, allocation.offset, *m_pages[pageIndex]->buffer, offset, copySize);
+
+		m_pages[sourceIndex]->allocator.free(allocation.offset);
+		allocation.pageIndex = pageIndex;
+		allocation.offset = offset;
+		movedBytes += copySize;
+		movedHandles.push_back(handle);
+	}
+	if (!encoder) return 0;
+
+	// Queue operations run in order, so the copies see all previous writes
+	// and draws submitted after this use the new ranges
+	CommandBuffer command = encoder.finish();
+	encoder.release();
+	m_queue.submit(command);
+	command.release();
+
+	for (Handle handle : movedHandles) {
+		m_allocations[handle].onRelocated();
+	}
+	m_movedBytes += movedBytes;
+	return movedBytes;
+}
+
+BufferPool::Stats BufferPool::stats() const {
+	Stats stats;
+	for (const std::unique_ptr<Page>& page : m_pages) {
+		if (!page) continue;
+		++stats.pageCount;
+		stats.reservedBytes += page->allocator.size();
+		stats.usedBytes += page->allocator.usedSize();
+		stats.allocationCount += page->allocator.allocationCount();
+		stats.freeBlockCount += page->allocator.freeBlockCount();
+		stats.largestFreeBlock = std::max<uint64_t>(stats.largestFreeBlock, page->allocator.largestFreeBlock());
+	}
+	stats.movedBytes = m_movedBytes;
+	stats.writtenBytes = m_writtenBytes;
+	return stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+bool BufferPool::place(uint32_t size, uint32_t excludedPage, bool allowNewPage, uint32_t& pageIndex, uint32_t& offset) {
+	for (pageIndex = 0; pageIndex < m_pages.size(); ++pageIndex) {
+		if (!m_pages[pageIndex] || pageIndex == excludedPage) continue;
+		offset = m_pages[pageIndex]->allocator.allocate(size);
+		if (offset != TlsfAllocator::INVALID_OFFSET) return true;
+	}
+	if (!allowNewPage) return false;
+
+	// Allocations larger than a page get a page of their own
+	const uint32_t alignedSize = (size + m_alignment - 1) / m_alignment * m_alignment;
+	pageIndex = createPage(std::max(m_pageSize, alignedSize));
+	if (pageIndex == ~0u) return false;
+	offset = m_pages[pageIndex]->allocator.allocate(size);
+	return offset != TlsfAllocator::INVALID_OFFSET;
+}
+
+uint32_t BufferPool::createPage(uint32_t size) {
+	SupportedLimits limits;
+	m_device.getLimits(&limits);
+	if (size > limits.limits.maxBufferSize) return ~0u;
+
+	auto page = std::make_unique<Page>();
+	BufferDescriptor bufferDesc = Default;
+	bufferDesc.label = m_label.c_str();
+	bufferDesc.size = size;
+	bufferDesc.usage = m_usage;
+	page->buffer = m_device.createBuffer(bufferDesc);
+	if (!page->buffer) return ~0u;
+	page->allocator.init(size, m_alignment);
+	page->memory.set(m_category, size);
+
+	auto it = std::find(m_pages.begin(), m_pages.end(), nullptr);
+	if (it != m_pages.end()) {
+		*it = std::move(page);
+		return static_cast<uint32_t>(it - m_pages.begin());
+	}
+	m_pages.push_back(std::move(page));
+	return static_cast<uint32_t>(m_pages.size() - 1);
+}
+
+void BufferPool::releaseEmptyPages() {
+	// Keep one empty page, to absorb allocations without creating one
+	bool keptOne = false;
+	for (std::unique_ptr<Page>& page : m_pages) {
+		if (!page || !page->allocator.isEmpty()) continue;
+		if (!keptOne && page->allocator.size() == m_pageSize) {
+			keptOne = true;
+			continue;
+		}
+		// Draws submitted before still complete, destroy() waits for them
+		page.reset();
+	}
+	while (!m_pages.empty() && !m_pages.back()) {
+		m_pages.pop_back();
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "gpu-memory.h"
+#include "tlsf-allocator.h"
+
+#include <webgpu/webgpu.hpp>
+#include <webgpu/webgpu-raii.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Small buffers (uniforms, storage) sub-allocated from a few large pages.
+ *
+ * Each page is a GPU buffer managed by a TlsfAllocator, and new pages are
+ * only created when no existing one has room. Ranges are aligned to the
+ * offset alignment required for binding them, so each allocation can be
+ * bound on its own.
+ *
+ * Allocations given a relocation callback may be moved by defragment(),
+ * which evacuates the least used page into the others with GPU copies, so
+ * that it can be released. The callback must then recreate whatever refers
+ * to the old range (typically bind groups). Others are pinned.
+ */
+class BufferPool {
+public:
+	using Handle = uint32_t;
+	static constexpr Handle INVALID_HANDLE = ~0u;
+
+	// Called once an allocation has moved, range() is then the new one
+	using RelocationCallback = std::function<void()>;
+
+	struct Range {
+		wgpu::Buffer buffer = nullptr;
+		uint64_t offset = 0;
+		uint64_t size = 0;
+	};
+
+	struct Stats {
+		uint32_t pageCount = 0;
+		// Sum of the size of all pages
+		uint64_t reservedBytes = 0;
+		uint64_t usedBytes = 0;
+		uint32_t allocationCount = 0;
+		uint32_t freeBlockCount = 0;
+		uint64_t largestFreeBlock = 0;
+		// Total moved by defragment() so far
+		uint64_t movedBytes = 0;
+		// Total uploaded by write() so far
+		uint64_t writtenBytes = 0;
+	};
+
+public:
+	// Usage of the pages, CopySrc and CopyDst are added for defragmentation
+	// and writes. Pages are accounted in 'category' of the GPU memory.
+	// Allocation sizes and offsets are multiples of alignment.
+	bool init(wgpu::Device device, const char* label, wgpu::BufferUsageFlags usage, GpuMemory::Category category, uint32_t pageSize, uint32_t alignment);
+	void terminate();
+
+	// INVALID_HANDLE on failure. Without a callback, the allocation never moves.
+	Handle allocate(uint32_t size, RelocationCallback onRelocated = nullptr);
+	void free(Handle handle);
+
+	Range range(Handle handle) const;
+	void write(Handle handle, const void* data, size_t size);
+
+	// Move up to maxBytes of allocations out of the least used page, and
+	// release pages left empty. Returns the number of bytes moved.
+	uint64_t defragment(uint64_t maxBytes);
+
+	Stats stats() const;
+	bool isInitialized() const { return m_device != nullptr; }
+
+private:
+	struct Page {
+		wgpu::raii::Buffer buffer;
+		TlsfAllocator allocator;
+		// Allocations without relocation callback
+		uint32_t pinnedCount = 0;
+		GpuMemory::Allocation memory;
+	};
+
+	struct Allocation {
+		uint32_t pageIndex = 0;
+		uint32_t offset = 0;
+		uint32_t size = 0;
+		RelocationCallback onRelocated;
+		bool isUsed = false;
+	};
+
+	// Try existing pages, except one, then a new page if allowed
+	bool place(uint32_t size, uint32_t excludedPage, bool allowNewPage, uint32_t& pageIndex, uint32_t& offset);
+	uint32_t createPage(uint32_t size);
+	void releaseEmptyPages();
+
+private:
+	wgpu::Device m_device = nullptr;
+	wgpu::Queue m_queue = nullptr;
+	std::string m_label;
+	wgpu::BufferUsageFlags m_usage = wgpu::BufferUsage::None;
+	GpuMemory::Category m_category = GpuMemory::Category::Uniform;
+	uint32_t m_pageSize = 0;
+	uint32_t m_alignment = 1;
+
+	// Released pages leave a null entry, so that page indices remain valid
+	std::vector<std::unique_ptr<Page>> m_pages;
+
+	// Indexed by handle
+	std::vector<Allocation> m_allocations;
+	std::vector<Handle> m_unusedHandles;
+
+	uint64_t m_movedBytes = 0;
+	uint64_t m_writtenBytes = 0;
+};
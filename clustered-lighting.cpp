@@ -0,0 +1,206 @@
+#include "clustered-lighting.h"
+#include "resource-manager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace wgpu;
+
+// Radiance below which an unbounded light is considered to have no effect,
+// used to give it a finite range for binning
+constexpr float LIGHT_CUTOFF = 1.0f / 256.0f;
+
+bool ClusteredLighting::init(Device device) {
+	m_device = device;
+	m_queue = device.getQueue();
+
+	BufferDescriptor bufferDesc;
+	bufferDesc.mappedAtCreation = false;
+
+	bufferDesc.label = "Lights";
+	bufferDesc.size = lightBufferSize();
+	bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+	m_lightBuffer = m_device.createBuffer(bufferDesc);
+
+	bufferDesc.label = "Cluster lights";
+	bufferDesc.size = clusterLightsBufferSize();
+	bufferDesc.usage = BufferUsage::Storage;
+	m_clusterLightsBuffer = m_device.createBuffer(bufferDesc);
+	m_bufferMemory.set(GpuMemory::Category::Storage, lightBufferSize() + clusterLightsBufferSize());
+
+	m_shaderModule = ResourceManager::loadShaderModule(RESOURCE_DIR "/shaders/clustered-lighting.wgsl", m_device);
+	if (!m_shaderModule) {
+		std::cerr << "Could not load clustered lighting shader!" << std::endl;
+		return false;
+	}
+
+	std::vector<BindGroupLayoutEntry> entries(4, Default);
+	// Global uniforms
+	entries[0].binding = 0;
+	entries[0].visibility = ShaderStage::Compute;
+	entries[0].buffer.type = BufferBindingType::Uniform;
+	entries[0].buffer.hasDynamicOffset = true;
+
+	// Lighting uniforms
+	entries[1].binding = 1;
+	entries[1].visibility = ShaderStage::Compute;
+	entries[1].buffer.type = BufferBindingType::Uniform;
+	entries[1].buffer.hasDynamicOffset = true;
+
+	// Lights
+	entries[2].binding = 2;
+	entries[2].visibility = ShaderStage::Compute;
+	entries[2].buffer.type = BufferBindingType::ReadOnlyStorage;
+	entries[2].buffer.minBindingSize = sizeof(GpuLight);
+
+	// Cluster lights
+	entries[3].binding = 3;
+	entries[3].visibility = ShaderStage::Compute;
+	entries[3].buffer.type = BufferBindingType::Storage;
+	entries[3].buffer.minBindingSize = clusterLightsBufferSize();
+
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.label = "Light assignment";
+	bindGroupLayoutDesc.entryCount = (uint32_t)entries.size();
+	bindGroupLayoutDesc.entries = entries.data();
+	m_bindGroupLayout = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&*m_bindGroupLayout;
+	PipelineLayout layout = m_device.createPipelineLayout(layoutDesc);
+
+	ComputePipelineDescriptor pipelineDesc;
+	pipelineDesc.label = "Light assignment";
+	pipelineDesc.layout = layout;
+	pipelineDesc.compute.module = *m_shaderModule;
+	pipelineDesc.compute.entryPoint = "cs_assign_lights";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	m_pipeline = m_device.createComputePipeline(pipelineDesc);
+	layout.release();
+
+	return m_lightBuffer && m_clusterLightsBuffer && m_pipeline;
+}
+
+void ClusteredLighting::terminate() {
+	m_bindGroup = {};
+	m_pipeline = {};
+	m_bindGroupLayout = {};
+	m_shaderModule = {};
+	m_clusterLightsBuffer = {};
+	m_lightBuffer = {};
+	m_bufferMemory.reset();
+	m_lightCount = 0;
+	if (m_queue) m_queue.release();
+	m_queue = nullptr;
+	m_device = nullptr;
+}
+
+bool ClusteredLighting::initBindGroup(
+	Buffer uniformBuffer,
+	uint64_t globalUniformsSize,
+	uint64_t lightingUniformsOffset,
+	uint64_t lightingUniformsSize
+) {
+	std::vector<BindGroupEntry> entries(4, Default);
+	entries[0].binding = 0;
+	entries[0].buffer = uniformBuffer;
+	entries[0].offset = 0;
+	entries[0].size = globalUniformsSize;
+
+	entries[1].binding = 1;
+	entries[1].buffer = uniformBuffer;
+	entries[1].offset = lightingUniformsOffset;
+	entries[1].size = lightingUniformsSize;
+
+	entries[2].binding = 2;
+	entries[2].buffer = *m_lightBuffer;
+	entries[2].offset = 0;
+	entries[2].size = lightBufferSize();
+
+	entries[3].binding = 3;
+	entries[3].buffer = *m_clusterLightsBuffer;
+	entries[3].offset = 0;
+	entries[3].size = clusterLightsBufferSize();
+
+	BindGroupDescriptor bindGroupDesc;
+	bindGroupDesc.label = "Light assignment";
+	bindGroupDesc.layout = *m_bindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)entries.size();
+	bindGroupDesc.entries = entries.data();
+	m_bindGroup = m_device.createBindGroup(bindGroupDesc);
+
+	return m_bindGroup;
+}
+
+void ClusteredLighting::uploadLights(const std::vector<GpuScene::PunctualLight>& lights) {
+	if (lights.size() > MAX_LIGHTS) {
+		std::cerr << "Scene has " << lights.size() << " lights, only the first " << MAX_LIGHTS << " are used" << std::endl;
+	}
+	m_lightCount = static_cast<uint32_t>(std::min<size_t>(lights.size(), MAX_LIGHTS));
+
+	std::vector<GpuLight> gpuLights(m_lightCount);
+	for (uint32_t i = 0; i < m_lightCount; ++i) {
+		gpuLights[i] = toGpuLight(lights[i]);
+	}
+	if (m_lightCount > 0) {
+		m_queue.writeBuffer(*m_lightBuffer, 0, gpuLights.data(), gpuLights.size() * sizeof(GpuLight));
+		m_uploadedBytes += gpuLights.size() * sizeof(GpuLight);
+	}
+}
+
+void ClusteredLighting::fillUniforms(Uniforms& uniforms, uint32_t renderWidth, uint32_t renderHeight, float zNear, float zFar) const {
+	uniforms.gridSize = { GRID_SIZE_X, GRID_SIZE_Y, GRID_SIZE_Z };
+	uniforms.lightCount = m_lightCount;
+	uniforms.renderSize = { static_cast<float>(renderWidth), static_cast<float>(renderHeight) };
+	uniforms.zNear = zNear;
+	uniforms.zFar = zFar;
+}
+
+void ClusteredLighting::assignLights(
+	CommandEncoder encoder,
+	const uint32_t* dynamicOffsets,
+	uint32_t dynamicOffsetCount,
+	const ComputePassTimestampWrites* timestampWrites
+) {
+	ComputePassDescriptor computePassDesc;
+	computePassDesc.label = "Light assignment";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(*m_pipeline);
+	computePass.setBindGroup(0, *m_bindGroup, dynamicOffsetCount, dynamicOffsets);
+	computePass.dispatchWorkgroups((CLUSTER_COUNT + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+	computePass.end();
+	computePass.release();
+}
+
+uint64_t ClusteredLighting::lightBufferSize() const {
+	return MAX_LIGHTS * sizeof(GpuLight);
+}
+
+uint64_t ClusteredLighting::clusterLightsBufferSize() const {
+	return CLUSTER_COUNT * (MAX_LIGHTS_PER_CLUSTER + 1) * sizeof(uint32_t);
+}
+
+ClusteredLighting::GpuLight ClusteredLighting::toGpuLight(const GpuScene::PunctualLight& light) {
+	GpuLight gpuLight = {};
+	gpuLight.position = light.position;
+	gpuLight.color = light.color;
+	gpuLight.type = static_cast<uint32_t>(light.type);
+	gpuLight.direction = light.direction;
+
+	gpuLight.range = light.range;
+	if (gpuLight.range <= 0.0f) {
+		float intensity = std::max({ light.color.r, light.color.g, light.color.b });
+		gpuLight.range = std::sqrt(intensity / LIGHT_CUTOFF);
+	}
+
+	// As recommended by the KHR_lights_punctual specification
+	float cosOuter = std::cos(light.outerConeAngle);
+	float cosInner = std::cos(light.innerConeAngle);
+	gpuLight.spotScale = 1.0f / std::max(0.001f, cosInner - cosOuter);
+	gpuLight.spotOffset = -cosOuter * gpuLight.spotScale;
+	return gpuLight;
+}
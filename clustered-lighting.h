@@ -0,0 +1,116 @@
+#pragma once
+
+#include "gpu-memory.h"
+#include "gpu-scene.h"
+
+#include <webgpu/webgpu.hpp>
+#include <webgpu/webgpu-raii.hpp>
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+/**
+ * Clustered forward lighting for punctual lights.
+ *
+ * The view frustum is split into a grid of froxels, uniform in screen space
+ * and exponential in depth. Every frame a compute pass bins the scene lights
+ * into the froxels they touch, and the fragment shader only iterates over the
+ * lights of the froxel it falls in, so shading cost follows the local light
+ * density rather than the total light count.
+ *
+ * Each cluster owns a fixed-size block of clusterLights: a light count
+ * followed by up to MAX_LIGHTS_PER_CLUSTER light indices. Lights beyond that
+ * are dropped from the cluster.
+ */
+class ClusteredLighting {
+public:
+	static constexpr uint32_t GRID_SIZE_X = 16;
+	static constexpr uint32_t GRID_SIZE_Y = 9;
+	static constexpr uint32_t GRID_SIZE_Z = 24;
+	static constexpr uint32_t CLUSTER_COUNT = GRID_SIZE_X * GRID_SIZE_Y * GRID_SIZE_Z;
+	// Must match resources/shaders/*.wgsl
+	static constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 127;
+	static constexpr uint32_t MAX_LIGHTS = 8192;
+
+	// Part of the lighting uniforms, refreshed every frame
+	struct Uniforms {
+		glm::uvec3 gridSize;
+		uint32_t lightCount;
+		// Size of the viewport the 3D passes render to, in pixels
+		glm::vec2 renderSize;
+		float zNear;
+		float zFar;
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+	// Layout of a light in the storage buffer
+	struct GpuLight {
+		glm::vec3 position;
+		// Distance at which the light is cut off, infinite lights get one
+		// from their intensity
+		float range;
+		glm::vec3 color;
+		uint32_t type;
+		glm::vec3 direction;
+		// Spot cone attenuation is saturate(cos * scale + offset)
+		float spotScale;
+		float spotOffset;
+		float _pad[3];
+	};
+	static_assert(sizeof(GpuLight) % 16 == 0);
+
+public:
+	bool init(wgpu::Device device);
+	void terminate();
+
+	// The compute pass reads view and projection from the global uniforms,
+	// both buffers are bound with dynamic offsets
+	bool initBindGroup(
+		wgpu::Buffer uniformBuffer,
+		uint64_t globalUniformsSize,
+		uint64_t lightingUniformsOffset,
+		uint64_t lightingUniformsSize
+	);
+
+	// Replace the lights, typically after loading a scene
+	void uploadLights(const std::vector<GpuScene::PunctualLight>& lights);
+	uint32_t lightCount() const { return m_lightCount; }
+	// Total uploaded by uploadLights() so far
+	uint64_t uploadedBytes() const { return m_uploadedBytes; }
+
+	void fillUniforms(Uniforms& uniforms, uint32_t renderWidth, uint32_t renderHeight, float zNear, float zFar) const;
+
+	// Bin lights into clusters, must run before any pass that shades with them
+	void assignLights(
+		wgpu::CommandEncoder encoder,
+		const uint32_t* dynamicOffsets,
+		uint32_t dynamicOffsetCount,
+		const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr
+	);
+
+	// Bound as read-only storage in the global bind group of the main pipelines
+	wgpu::Buffer lightBuffer() const { return *m_lightBuffer; }
+	uint64_t lightBufferSize() const;
+	wgpu::Buffer clusterLightsBuffer() const { return *m_clusterLightsBuffer; }
+	uint64_t clusterLightsBufferSize() const;
+
+private:
+	static GpuLight toGpuLight(const GpuScene::PunctualLight& light);
+
+private:
+	static constexpr uint32_t WORKGROUP_SIZE = 64;
+
+	wgpu::Device m_device = nullptr;
+	wgpu::Queue m_queue = nullptr;
+
+	wgpu::raii::ShaderModule m_shaderModule;
+	wgpu::raii::BindGroupLayout m_bindGroupLayout;
+	wgpu::raii::ComputePipeline m_pipeline;
+	wgpu::raii::BindGroup m_bindGroup;
+
+	wgpu::raii::Buffer m_lightBuffer;
+	wgpu::raii::Buffer m_clusterLightsBuffer;
+	GpuMemory::Allocation m_bufferMemory;
+	uint32_t m_lightCount = 0;
+	uint64_t m_uploadedBytes = 0;
+};
@@ -0,0 +1,162 @@
+#include "cpu-profiler.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> CpuProfiler::s_recording{ false };
+const std::chrono::steady_clock::time_point CpuProfiler::s_epoch = std::chrono::steady_clock::now();
+const uint64_t CpuProfiler::s_epochTicks = CpuProfiler::now();
+
+namespace {
+// Fields are atomics so that a trace can be written while the thread keeps
+// recording. Relaxed accesses compile to plain loads and stores.
+struct Event {
+	std::atomic<const char*> name{ nullptr };
+	std::atomic<uint64_t> begin{ 0 };
+	std::atomic<uint64_t> end{ 0 };
+	std::atomic<uint64_t> allocations{ 0 };
+};
+
+struct ThreadBuffer {
+	std::unique_ptr<Event[]> events{ new Event[CpuProfiler::EVENTS_PER_THREAD] };
+	// Events ever written, the last EVENTS_PER_THREAD of which are kept
+	std::atomic<uint64_t> writeCount{ 0 };
+	// Value of writeCount at the last clear()
+	std::atomic<uint64_t> clearCount{ 0 };
+	std::atomic<const char*> name{ nullptr };
+	uint32_t threadId = 0;
+};
+
+// Buffers live until the process exits, so that the scopes of a finished
+// thread still make it to the trace
+std::mutex s_registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+thread_local ThreadBuffer* t_buffer = nullptr;
+
+ThreadBuffer& threadBuffer() {
+	if (!t_buffer) {
+		std::lock_guard lock(s_registryMutex);
+		s_buffers.push_back(std::make_unique<ThreadBuffer>());
+		t_buffer = s_buffers.back().get();
+		t_buffer->threadId = static_cast<uint32_t>(s_buffers.size());
+	}
+	return *t_buffer;
+}
+
+// Scope names are literals of ours, but keep the output valid regardless
+void writeJsonString(FILE* file, const char* string) {
+	std::fputc('"', file);
+	for (const char* c = string; *c; ++c) {
+		if (*c == '"' || *c == '\\') std::fputc('\\', file);
+		if (static_cast<unsigned char>(*c) >= 0x20) std::fputc(*c, file);
+	}
+	std::fputc('"', file);
+}
+} // namespace
+
+void CpuProfiler::setRecording(bool recording) {
+	s_recording.store(recording, std::memory_order_relaxed);
+}
+
+void CpuProfiler::setThreadName(const char* name) {
+	threadBuffer().name.store(name, std::memory_order_relaxed);
+}
+
+void CpuProfiler::clear() {
+	std::lock_guard lock(s_registryMutex);
+	for (const std::unique_ptr<ThreadBuffer>& buffer : s_buffers) {
+		buffer->clearCount.store(buffer->writeCount.load(std::memory_order_acquire), std::memory_order_relaxed);
+	}
+}
+
+bool CpuProfiler::writeChromeTrace(const std::string& path) {
+	FILE* file = std::fopen(path.c_str(), "w");
+	if (!file) {
+		std::cerr << "Could not write " << path << std::endl;
+		return false;
+	}
+
+	struct CopiedEvent {
+		const char* name;
+		uint64_t begin;
+		uint64_t end;
+		uint64_t allocations;
+	};
+	std::vector<CopiedEvent> events;
+	size_t eventCount = 0;
+
+	// The longer the profiler ran, the more precise the rate
+	const uint64_t elapsedTicks = now() - s_epochTicks;
+	const double elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - s_epoch).count();
+	const double nsPerTick = elapsedTicks > 0 ? elapsedNs / static_cast<double>(elapsedTicks) : 1.0;
+
+	std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	std::lock_guard lock(s_registryMutex);
+	for (const std::unique_ptr<ThreadBuffer>& buffer : s_buffers) {
+		const char* threadName = buffer->name.load(std::memory_order_relaxed);
+		if (threadName) {
+			std::fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", eventCount++ ? ",\n" : "", buffer->threadId);
+			writeJsonString(file, threadName);
+			std::fprintf(file, "}}");
+		}
+
+		// Copy, then drop what the thread may have overwritten meanwhile
+		const uint64_t writeCount = buffer->writeCount.load(std::memory_order_acquire);
+		uint64_t first = std::max(buffer->clearCount.load(std::memory_order_relaxed), writeCount > EVENTS_PER_THREAD ? writeCount - EVENTS_PER_THREAD : 0);
+		events.clear();
+		for (uint64_t idx = first; idx < writeCount; ++idx) {
+			const Event& event = buffer->events[idx % EVENTS_PER_THREAD];
+			events.push_back({
+				event.name.load(std::memory_order_relaxed),
+				event.begin.load(std::memory_order_relaxed),
+				event.end.load(std::memory_order_relaxed),
+				event.allocations.load(std::memory_order_relaxed),
+			});
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t laterWriteCount = buffer->writeCount.load(std::memory_order_relaxed);
+		// The event after the last published one may be being written
+		const uint64_t overwritten = laterWriteCount + 1 > EVENTS_PER_THREAD ? laterWriteCount + 1 - EVENTS_PER_THREAD : 0;
+		const size_t skipped = static_cast<size_t>(std::min<uint64_t>(events.size(), overwritten > first ? overwritten - first : 0));
+
+		for (size_t i = skipped; i < events.size(); ++i) {
+			const CopiedEvent& event = events[i];
+			// Complete events, timestamps in microseconds since the epoch. Scopes
+			// of static initializers may begin before it.
+			std::fprintf(file, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+				eventCount++ ? ",\n" : "",
+				buffer->threadId,
+				static_cast<double>(static_cast<int64_t>(event.begin - s_epochTicks)) * nsPerTick * 1e-3,
+				static_cast<double>(event.end - event.begin) * nsPerTick * 1e-3
+			);
+			writeJsonString(file, event.name);
+			if (AllocationTracker::ENABLED) {
+				std::fprintf(file, ",\"args\":{\"allocations\":%" PRIu64 "}", event.allocations);
+			}
+			std::fputc('}', file);
+		}
+	}
+	std::fprintf(file, "\n]}\n");
+
+	bool success = std::fclose(file) == 0;
+	if (success) {
+		std::cout << "Wrote " << eventCount << " trace events to " << path << std::endl;
+	}
+	return success;
+}
+
+void CpuProfiler::record(const char* name, uint64_t begin, uint64_t end, uint64_t allocations) {
+	ThreadBuffer& buffer = threadBuffer();
+	const uint64_t idx = buffer.writeCount.load(std::memory_order_relaxed);
+	Event& event = buffer.events[idx % EVENTS_PER_THREAD];
+	event.name.store(name, std::memory_order_relaxed);
+	event.begin.store(begin, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	event.allocations.store(allocations, std::memory_order_relaxed);
+	buffer.writeCount.store(idx + 1, std::memory_order_release);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "allocation-tracker.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Records how long CPU scopes take, on every thread, for display in
+ * chrome://tracing or Perfetto.
+ *
+ * Each thread writes the scopes it closes to a ring buffer of its own, so
+ * recording takes no lock: a scope costs two clock reads and a store. On
+ * x86-64 the clock is the time stamp counter, which is read in a few
+ * nanoseconds where steady_clock takes a few tens, and converted to time
+ * only when a trace is written. When the recording is off, a scope is a
+ * single relaxed load. Buffers keep the
+ * last EVENTS_PER_THREAD scopes of their thread, older ones are overwritten.
+ * When the AllocationTracker is compiled in, scopes also record how many
+ * heap allocations their thread made in them.
+ *
+ * Define MEGA_DISABLE_CPU_PROFILING to compile the scopes out entirely.
+ */
+class CpuProfiler {
+public:
+	static void setRecording(bool recording);
+	static bool isRecording() { return s_recording.load(std::memory_order_relaxed); }
+
+	// Name of the calling thread in traces, which must outlive the profiler
+	// (typically a literal)
+	static void setThreadName(const char* name);
+
+	// Forget all recorded scopes
+	static void clear();
+
+	// Write the recorded scopes in the Chrome trace event format, which
+	// Perfetto reads too. Threads may keep recording meanwhile.
+	static bool writeChromeTrace(const std::string& path);
+
+	// In clock ticks, which only compare with each other. The time stamp
+	// counter of modern x86-64 CPUs runs at a constant rate, synchronized
+	// across cores.
+	static uint64_t now() {
+#if defined(__x86_64__) || defined(_M_X64)
+		return __rdtsc();
+#else
+		return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+	}
+
+	// Times the enclosing block, use through CPU_PROFILE_SCOPE
+	class Scope {
+	public:
+		explicit Scope(const char* name)
+			: m_name(isRecording() ? name : nullptr)
+			, m_begin(m_name ? now() : 0)
+			, m_beginAllocations(m_name ? AllocationTracker::threadAllocationCount() : 0)
+		{}
+		~Scope() {
+			if (m_name) record(m_name, m_begin, now(), AllocationTracker::threadAllocationCount() - m_beginAllocations);
+		}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		const char* m_name;
+		uint64_t m_begin;
+		uint64_t m_beginAllocations;
+	};
+
+	static constexpr uint32_t EVENTS_PER_THREAD = 1 << 16;
+
+private:
+	static void record(const char* name, uint64_t begin, uint64_t end, uint64_t allocations);
+
+	static std::atomic<bool> s_recording;
+	// Taken together, to convert ticks to time
+	static const std::chrono::steady_clock::time_point s_epoch;
+	static const uint64_t s_epochTicks;
+};
+
+#ifndef MEGA_DISABLE_CPU_PROFILING
+#define CPU_PROFILE_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILE_CONCAT(a, b) CPU_PROFILE_CONCAT_INNER(a, b)
+// 'name' must outlive the profiler, typically a literal
+#define CPU_PROFILE_SCOPE(name) CpuProfiler::Scope CPU_PROFILE_CONCAT(cpuProfileScope, __LINE__)(name)
+#else
+#define CPU_PROFILE_SCOPE(name)
+#endif
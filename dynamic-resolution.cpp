@@ -0,0 +1,42 @@
+#include "dynamic-resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+float DynamicResolution::update(float gpuFrameTimeMs, float targetFrameTimeMs, float minScale, float maxScale) {
+	if (m_framesToSettle > 0) {
+		--m_framesToSettle;
+		// Measurements of the previous scale, start over from the new one
+		m_smoothedFrameTimeMs = 0.0f;
+		return m_scale;
+	}
+
+	m_smoothedFrameTimeMs = m_smoothedFrameTimeMs > 0.0f
+		? m_smoothedFrameTimeMs + SMOOTHING * (gpuFrameTimeMs - m_smoothedFrameTimeMs)
+		: gpuFrameTimeMs;
+	if (m_smoothedFrameTimeMs <= 0.0f || targetFrameTimeMs <= 0.0f) return m_scale;
+
+	float desiredScale = m_scale * std::sqrt(HEADROOM * targetFrameTimeMs / m_smoothedFrameTimeMs);
+	desiredScale = std::clamp(desiredScale, minScale, maxScale);
+
+	if (std::abs(desiredScale - m_scale) < MIN_SCALE_STEP) return m_scale;
+
+	// Step down quickly when over budget, climb back up slowly
+	float rate = desiredScale < m_scale ? 0.75f : 0.25f;
+	float newScale = m_scale + rate * (desiredScale - m_scale);
+	if (std::abs(desiredScale - newScale) < MIN_SCALE_STEP) {
+		newScale = desiredScale;
+	}
+
+	if (newScale != m_scale) {
+		m_scale = newScale;
+		m_framesToSettle = SETTLE_FRAME_COUNT;
+	}
+	return m_scale;
+}
+
+void DynamicResolution::reset(float scale) {
+	m_scale = scale;
+	m_smoothedFrameTimeMs = 0.0f;
+	m_framesToSettle = 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Chooses the render scale of the 3D passes from measured GPU frame times so
+ * that they stay within a target.
+ *
+ * Shading cost is assumed to be proportional to the pixel count, i.e. to the
+ * square of the scale. Measurements are smoothed, small corrections are
+ * ignored to avoid oscillating between two sizes, and after each change the
+ * controller waits for measurements of frames rendered at the new scale.
+ */
+class DynamicResolution {
+public:
+	// Feed a new GPU frame time, returns the scale to render the next frames at
+	float update(float gpuFrameTimeMs, float targetFrameTimeMs, float minScale, float maxScale);
+
+	float scale() const { return m_scale; }
+	void reset(float scale);
+
+private:
+	// Aim slightly below the target to absorb frame to frame variance
+	static constexpr float HEADROOM = 0.9f;
+	static constexpr float SMOOTHING = 0.2f;
+	static constexpr float MIN_SCALE_STEP = 0.02f;
+	// Measurements arrive a few frames late, this is how many to skip after a change
+	static constexpr uint32_t SETTLE_FRAME_COUNT = 4;
+
+	float m_scale = 1.0f;
+	float m_smoothedFrameTimeMs = 0.0f;
+	uint32_t m_framesToSettle = 0;
+};
@@ -0,0 +1,101 @@
+#include "frame-pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using namespace wgpu;
+
+void FramePacer::setSupportedPresentModes(std::vector<PresentMode> presentModes) {
+	m_supportedPresentModes = std::move(presentModes);
+}
+
+bool FramePacer::isSupported(PresentMode presentMode) const {
+	return std::find(m_supportedPresentModes.begin(), m_supportedPresentModes.end(), presentMode) != m_supportedPresentModes.end();
+}
+
+PresentMode FramePacer::resolvePresentMode(PresentMode requested) const {
+	return isSupported(requested) ? requested : PresentMode::Fifo;
+}
+
+void FramePacer::waitForNextFrame(float maxFrameRate) {
+	if (maxFrameRate <= 0.0f) {
+		m_hasDeadline = false;
+		return;
+	}
+
+	const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / maxFrameRate));
+	clock::time_point now = clock::now();
+
+	// Deadlines advance by exactly one period so that the cap does not drift,
+	// unless we fell behind by more than a frame (hitch, window drag...), in
+	// which case catching up would produce a burst of frames. This frame then
+	// starts right away, and the next one a full period later.
+	if (!m_hasDeadline || now - m_nextFrameDeadline > period) {
+		m_nextFrameDeadline = now + period;
+		m_hasDeadline = true;
+		return;
+	}
+
+	if (m_nextFrameDeadline - now > SPIN_THRESHOLD) {
+		std::this_thread::sleep_until(m_nextFrameDeadline - SPIN_THRESHOLD);
+	}
+	while (clock::now() < m_nextFrameDeadline) {
+		std::this_thread::yield();
+	}
+
+	m_nextFrameDeadline += period;
+}
+
+void FramePacer::onPresent() {
+	clock::time_point now = clock::now();
+	if (m_hasPresented) {
+		m_intervalsMs[m_intervalCursor] = std::chrono::duration<float, std::milli>(now - m_lastPresent).count();
+		m_intervalCursor = (m_intervalCursor + 1) % INTERVAL_HISTORY_SIZE;
+		m_intervalCount = std::min(m_intervalCount + 1, INTERVAL_HISTORY_SIZE);
+		updateStats();
+	}
+	m_lastPresent = now;
+	m_hasPresented = true;
+}
+
+void FramePacer::resetStats() {
+	m_hasPresented = false;
+	m_intervalCount = 0;
+	m_intervalCursor = 0;
+	m_stats = Stats{};
+}
+
+const char* FramePacer::presentModeName(PresentMode presentMode) {
+	switch (presentMode) {
+	case PresentMode::Fifo: return "Fifo";
+	case PresentMode::FifoRelaxed: return "Fifo relaxed";
+	case PresentMode::Immediate: return "Immediate";
+	case PresentMode::Mailbox: return "Mailbox";
+	default: return "Unknown";
+	}
+}
+
+void FramePacer::updateStats() {
+	float sum = 0.0f;
+	float minMs = m_intervalsMs[0];
+	float maxMs = m_intervalsMs[0];
+	for (size_t i = 0; i < m_intervalCount; ++i) {
+		sum += m_intervalsMs[i];
+		minMs = std::min(minMs, m_intervalsMs[i]);
+		maxMs = std::max(maxMs, m_intervalsMs[i]);
+	}
+	float average = sum / m_intervalCount;
+
+	float variance = 0.0f;
+	for (size_t i = 0; i < m_intervalCount; ++i) {
+		float delta = m_intervalsMs[i] - average;
+		variance += delta * delta;
+	}
+	variance /= m_intervalCount;
+
+	m_stats.averageMs = average;
+	m_stats.jitterMs = std::sqrt(variance);
+	m_stats.minMs = minMs;
+	m_stats.maxMs = maxMs;
+}
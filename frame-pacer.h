@@ -0,0 +1,70 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <chrono>
+#include <vector>
+
+/**
+ * Frame pacing: present mode selection according to what the surface
+ * supports, frame rate capping and present-to-present timing statistics.
+ *
+ * The cap is enforced with a hybrid wait: the thread sleeps until shortly
+ * before the deadline, since OS sleeps routinely overshoot by a millisecond
+ * or more, then spins for the remainder.
+ */
+class FramePacer {
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct Stats {
+		// Over the last INTERVAL_HISTORY_SIZE presents
+		float averageMs = 0.0f;
+		// Standard deviation of the present-to-present interval
+		float jitterMs = 0.0f;
+		float minMs = 0.0f;
+		float maxMs = 0.0f;
+	};
+
+	// Present modes of the surface for the current adapter
+	void setSupportedPresentModes(std::vector<wgpu::PresentMode> presentModes);
+	const std::vector<wgpu::PresentMode>& supportedPresentModes() const { return m_supportedPresentModes; }
+	bool isSupported(wgpu::PresentMode presentMode) const;
+	// Returns 'requested' if the surface supports it, Fifo otherwise (Fifo
+	// support is guaranteed by the specification)
+	wgpu::PresentMode resolvePresentMode(wgpu::PresentMode requested) const;
+
+	// Block until the next frame is due, no-op when maxFrameRate <= 0. Call
+	// it before sampling input so that the wait does not add to latency.
+	void waitForNextFrame(float maxFrameRate);
+
+	// Record that a frame has just been handed over to the surface
+	void onPresent();
+
+	const Stats& stats() const { return m_stats; }
+	// Forget past intervals, e.g. after the present mode changed
+	void resetStats();
+
+	static const char* presentModeName(wgpu::PresentMode presentMode);
+
+private:
+	void updateStats();
+
+private:
+	static constexpr size_t INTERVAL_HISTORY_SIZE = 120;
+	// Below this, waiting spins instead of sleeping
+	static constexpr std::chrono::microseconds SPIN_THRESHOLD{ 2000 };
+
+	std::vector<wgpu::PresentMode> m_supportedPresentModes;
+
+	clock::time_point m_nextFrameDeadline;
+	bool m_hasDeadline = false;
+
+	clock::time_point m_lastPresent;
+	bool m_hasPresented = false;
+	std::array<float, INTERVAL_HISTORY_SIZE> m_intervalsMs = {};
+	size_t m_intervalCount = 0;
+	size_t m_intervalCursor = 0;
+	Stats m_stats;
+};
@@ -0,0 +1,233 @@
+#include "geometry-arena.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+static const std::array<VertexFormat, GeometryArena::STREAM_COUNT> STREAM_FORMATS = {
+	VertexFormat::Float32x3, // Position
+	VertexFormat::Float32x3, // Normal
+	VertexFormat::Float32x3, // Color
+	VertexFormat::Float32x2, // TexCoord
+};
+static constexpr std::array<uint32_t, GeometryArena::STREAM_COUNT> STREAM_STRIDES = {
+	3 * sizeof(float),
+	3 * sizeof(float),
+	3 * sizeof(float),
+	2 * sizeof(float),
+};
+static constexpr std::array<const char*, GeometryArena::STREAM_COUNT> STREAM_LABELS = {
+	"Positions",
+	"Normals",
+	"Colors",
+	"Texture coordinates",
+};
+
+// Referenced by the layouts returned to pipeline builders
+static const std::array<VertexAttribute, GeometryArena::STREAM_COUNT> STREAM_ATTRIBUTES = []() {
+	std::array<VertexAttribute, GeometryArena::STREAM_COUNT> attributes;
+	for (uint32_t stream = 0; stream < GeometryArena::STREAM_COUNT; ++stream) {
+		attributes[stream].shaderLocation = stream;
+		attributes[stream].format = STREAM_FORMATS[stream];
+		attributes[stream].offset = 0;
+	}
+	return attributes;
+}();
+
+bool GeometryArena::init(Device device, uint32_t vertexCapacity, uint32_t indexCapacity) {
+	m_device = device;
+	m_queue = device.getQueue();
+	m_vertexAllocator.init(0);
+	m_indexAllocator.init(0);
+	return growVertexBuffers(vertexCapacity) && growIndexBuffer(indexCapacity);
+}
+
+void GeometryArena::terminate() {
+	for (raii::Buffer& buffer : m_vertexBuffers) {
+		if (buffer) buffer->destroy();
+		buffer = {};
+	}
+	if (m_indexBuffer) m_indexBuffer->destroy();
+	m_indexBuffer = {};
+	m_vertexMemory.reset();
+	m_indexMemory.reset();
+	m_vertexAllocator.init(0);
+	m_indexAllocator.init(0);
+	if (m_queue) m_queue.release();
+	m_queue = nullptr;
+	m_device = nullptr;
+}
+
+GeometryArena::Allocation GeometryArena::allocate(uint32_t vertexCount, uint32_t indexCount) {
+	Allocation allocation;
+	if (vertexCount == 0 || indexCount == 0) return allocation;
+
+	uint32_t baseVertex = m_vertexAllocator.allocate(vertexCount);
+	if (baseVertex == OffsetAllocator::INVALID_OFFSET) {
+		// Grow at least geometrically, so that loading many meshes does not
+		// copy the buffers over and over
+		uint32_t capacity = m_vertexAllocator.capacity();
+		if (!growVertexBuffers(std::max(2 * capacity, capacity + vertexCount))) return allocation;
+		baseVertex = m_vertexAllocator.allocate(vertexCount);
+	}
+
+	uint32_t firstIndex = m_indexAllocator.allocate(indexCount);
+	if (firstIndex == OffsetAllocator::INVALID_OFFSET) {
+		uint32_t capacity = m_indexAllocator.capacity();
+		if (!growIndexBuffer(std::max(2 * capacity, capacity + indexCount))) {
+			m_vertexAllocator.free(baseVertex, vertexCount);
+			return allocation;
+		}
+		firstIndex = m_indexAllocator.allocate(indexCount);
+	}
+
+	allocation.baseVertex = baseVertex;
+	allocation.vertexCount = vertexCount;
+	allocation.firstIndex = firstIndex;
+	allocation.indexCount = indexCount;
+	return allocation;
+}
+
+void GeometryArena::free(const Allocation& allocation) {
+	if (!allocation.isValid()) return;
+	m_vertexAllocator.free(allocation.baseVertex, allocation.vertexCount);
+	m_indexAllocator.free(allocation.firstIndex, allocation.indexCount);
+}
+
+void GeometryArena::writeVertices(const Allocation& allocation, Stream stream, const void* data) {
+	const uint64_t stride = STREAM_STRIDES[stream];
+	m_queue.writeBuffer(*m_vertexBuffers[stream], allocation.baseVertex * stride, data, allocation.vertexCount * stride);
+	m_uploadedBytes += allocation.vertexCount * stride;
+}
+
+void GeometryArena::writeIndices(const Allocation& allocation, const uint32_t* indices) {
+	m_queue.writeBuffer(*m_indexBuffer, allocation.firstIndex * sizeof(uint32_t), indices, allocation.indexCount * sizeof(uint32_t));
+	m_uploadedBytes += allocation.indexCount * sizeof(uint32_t);
+}
+
+void GeometryArena::bind(RenderPassEncoder renderPass) const {
+	for (uint32_t stream = 0; stream < STREAM_COUNT; ++stream) {
+		renderPass.setVertexBuffer(stream, *m_vertexBuffers[stream], 0, vertexBufferSize(static_cast<Stream>(stream)));
+	}
+	renderPass.setIndexBuffer(*m_indexBuffer, IndexFormat::Uint32, 0, indexBufferSize());
+}
+
+void GeometryArena::bindPositions(RenderPassEncoder renderPass) const {
+	renderPass.setVertexBuffer(0, *m_vertexBuffers[Position], 0, vertexBufferSize(Position));
+	renderPass.setIndexBuffer(*m_indexBuffer, IndexFormat::Uint32, 0, indexBufferSize());
+}
+
+GeometryArena::VertexBufferLayouts GeometryArena::vertexBufferLayouts() {
+	VertexBufferLayouts layouts;
+	for (uint32_t stream = 0; stream < STREAM_COUNT; ++stream) {
+		layouts[stream] = vertexBufferLayout(static_cast<Stream>(stream));
+	}
+	return layouts;
+}
+
+VertexBufferLayout GeometryArena::vertexBufferLayout(Stream stream) {
+	VertexBufferLayout layout;
+	layout.arrayStride = STREAM_STRIDES[stream];
+	layout.stepMode = VertexStepMode::Vertex;
+	layout.attributeCount = 1;
+	layout.attributes = &STREAM_ATTRIBUTES[stream];
+	return layout;
+}
+
+uint64_t GeometryArena::vertexByteSize() {
+	uint64_t size = 0;
+	for (uint32_t stride : STREAM_STRIDES) {
+		size += stride;
+	}
+	return size;
+}
+
+uint64_t GeometryArena::byteSize() const {
+	uint64_t size = indexBufferSize();
+	for (uint32_t stream = 0; stream < STREAM_COUNT; ++stream) {
+		size += vertexBufferSize(static_cast<Stream>(stream));
+	}
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+uint64_t GeometryArena::vertexBufferSize(Stream stream) const {
+	return alignedSize(static_cast<uint64_t>(m_vertexAllocator.capacity()) * STREAM_STRIDES[stream]);
+}
+
+uint64_t GeometryArena::indexBufferSize() const {
+	return alignedSize(static_cast<uint64_t>(m_indexAllocator.capacity()) * sizeof(uint32_t));
+}
+
+uint64_t GeometryArena::alignedSize(uint64_t size) {
+	// Sizes of vertex and index buffers must be multiples of 4
+	return (size + 3) & ~uint64_t(3);
+}
+
+bool GeometryArena::growVertexBuffers(uint32_t minCapacity) {
+	const uint32_t oldCapacity = m_vertexAllocator.capacity();
+	if (minCapacity <= oldCapacity) return true;
+
+	SupportedLimits limits;
+	m_device.getLimits(&limits);
+	for (uint32_t stream = 0; stream < STREAM_COUNT; ++stream) {
+		if (static_cast<uint64_t>(minCapacity) * STREAM_STRIDES[stream] > limits.limits.maxBufferSize) {
+			std::cerr << "Geometry does not fit in a buffer: " << minCapacity << " vertices" << std::endl;
+			return false;
+		}
+	}
+
+	for (uint32_t stream = 0; stream < STREAM_COUNT; ++stream) {
+		const uint64_t stride = STREAM_STRIDES[stream];
+		reallocate(m_vertexBuffers[stream], oldCapacity * stride, minCapacity * stride, STREAM_LABELS[stream]);
+	}
+	m_vertexAllocator.grow(minCapacity);
+
+	uint64_t vertexBytes = 0;
+	for (uint32_t stream = 0; stream < STREAM_COUNT; ++stream) {
+		vertexBytes += vertexBufferSize(static_cast<Stream>(stream));
+	}
+	m_vertexMemory.set(GpuMemory::Category::Vertex, vertexBytes);
+	return true;
+}
+
+bool GeometryArena::growIndexBuffer(uint32_t minCapacity) {
+	const uint32_t oldCapacity = m_indexAllocator.capacity();
+	if (minCapacity <= oldCapacity) return true;
+
+	SupportedLimits limits;
+	m_device.getLimits(&limits);
+	if (static_cast<uint64_t>(minCapacity) * sizeof(uint32_t) > limits.limits.maxBufferSize) {
+		std::cerr << "Geometry does not fit in a buffer: " << minCapacity << " indices" << std::endl;
+		return false;
+	}
+
+	reallocate(m_indexBuffer, oldCapacity * sizeof(uint32_t), minCapacity * sizeof(uint32_t), "Indices");
+	m_indexAllocator.grow(minCapacity);
+	m_indexMemory.set(GpuMemory::Category::Index, indexBufferSize());
+	return true;
+}
+
+void GeometryArena::reallocate(raii::Buffer& buffer, uint64_t oldSize, uint64_t newSize, const char* label) {
+	BufferDescriptor bufferDesc = Default;
+	bufferDesc.label = label;
+	bufferDesc.size = alignedSize(newSize);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::CopySrc | BufferUsage::Vertex | BufferUsage::Index;
+	Buffer newBuffer = m_device.createBuffer(bufferDesc);
+
+	// Queue operations run in order, so the copy sees all previous writes,
+	// and writes issued after it go to the new buffer
+	if (buffer && oldSize > 0) {
+		CommandEncoder encoder = m_device.createCommandEncoder();
+		encoder.copyBufferToBuffer(*buffer, 0, newBuffer, 0, alignedSize(oldSize));
+		CommandBuffer command = encoder.finish();
+		encoder.release();
+		m_queue.submit(command);
+		command.release();
+	}
+	// Released rather than destroyed, as the copy may not have run yet
+	buffer = newBuffer;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "gpu-memory.h"
+#include "offset-allocator.h"
+
+#include <webgpu/webgpu.hpp>
+#include <webgpu/webgpu-raii.hpp>
+
+#include <array>
+#include <vector>
+
+/**
+ * Vertex and index data of all meshes, packed in a few large buffers.
+ *
+ * Each vertex attribute has its own buffer (stream) in a fixed format, and
+ * all streams are indexed by the same vertex offset. Indices are Uint32 and
+ * relative to the first vertex of their allocation, which is passed as the
+ * base vertex of draws. Passes bind the buffers once, then only draw.
+ *
+ * Buffers grow (by reallocation and a GPU copy) when an allocation does not
+ * fit. Freed ranges are reused, so that meshes can be streamed in and out.
+ */
+class GeometryArena {
+public:
+	// Also the vertex buffer slot and shader location of each attribute
+	enum Stream : uint32_t {
+		Position,
+		Normal,
+		Color,
+		TexCoord,
+		STREAM_COUNT,
+	};
+	using VertexBufferLayouts = std::array<wgpu::VertexBufferLayout, STREAM_COUNT>;
+
+	struct Allocation {
+		uint32_t baseVertex = OffsetAllocator::INVALID_OFFSET;
+		uint32_t vertexCount = 0;
+		uint32_t firstIndex = OffsetAllocator::INVALID_OFFSET;
+		uint32_t indexCount = 0;
+
+		bool isValid() const { return baseVertex != OffsetAllocator::INVALID_OFFSET; }
+	};
+
+public:
+	bool init(wgpu::Device device, uint32_t vertexCapacity, uint32_t indexCapacity);
+	void terminate();
+
+	// Both ranges or none, invalid if the buffers could not grow enough
+	Allocation allocate(uint32_t vertexCount, uint32_t indexCount);
+	void free(const Allocation& allocation);
+
+	// vertexCount elements in the format of the stream
+	void writeVertices(const Allocation& allocation, Stream stream, const void* data);
+	// indexCount indices, relative to the base vertex
+	void writeIndices(const Allocation& allocation, const uint32_t* indices);
+
+	// All streams and the index buffer
+	void bind(wgpu::RenderPassEncoder renderPass) const;
+	// Only positions (at slot 0) and the index buffer, for depth-only passes
+	void bindPositions(wgpu::RenderPassEncoder renderPass) const;
+
+	// One layout per stream, in slot order
+	static VertexBufferLayouts vertexBufferLayouts();
+	static wgpu::VertexBufferLayout vertexBufferLayout(Stream stream);
+	// Of one vertex, in all streams
+	static uint64_t vertexByteSize();
+
+	uint32_t vertexCapacity() const { return m_vertexAllocator.capacity(); }
+	uint32_t indexCapacity() const { return m_indexAllocator.capacity(); }
+	uint64_t byteSize() const;
+	// Total uploaded by writeVertices() and writeIndices() so far
+	uint64_t uploadedBytes() const { return m_uploadedBytes; }
+
+private:
+	uint64_t vertexBufferSize(Stream stream) const;
+	uint64_t indexBufferSize() const;
+	static uint64_t alignedSize(uint64_t size);
+
+	bool growVertexBuffers(uint32_t minCapacity);
+	bool growIndexBuffer(uint32_t minCapacity);
+	// Copy the content of a buffer into a larger one, then replace it
+	void reallocate(wgpu::raii::Buffer& buffer, uint64_t oldSize, uint64_t newSize, const char* label);
+
+private:
+	wgpu::Device m_device = nullptr;
+	wgpu::Queue m_queue = nullptr;
+
+	std::array<wgpu::raii::Buffer, STREAM_COUNT> m_vertexBuffers;
+	wgpu::raii::Buffer m_indexBuffer;
+	// Of all streams
+	GpuMemory::Allocation m_vertexMemory;
+	GpuMemory::Allocation m_indexMemory;
+
+	// In vertices and indices
+	OffsetAllocator m_vertexAllocator;
+	OffsetAllocator m_indexAllocator;
+
+	uint64_t m_uploadedBytes = 0;
+};
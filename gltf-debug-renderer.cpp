@@ -51,6 +51,7 @@ void GltfDebugRenderer::initVertexBuffer() {
 	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
 	m_vertexBuffer = m_device.createBuffer(bufferDesc);
 	m_vertexBufferByteSize = bufferDesc.size;
+	m_vertexBufferMemory.set(GpuMemory::Category::Vertex, m_vertexBufferByteSize);
 	m_vertexCount = 5;
 }
 
@@ -58,6 +59,7 @@ void GltfDebugRenderer::terminateVertexBuffer() {
 	m_vertexBuffer.destroy();
 	m_vertexBuffer.release();
 	m_vertexBufferByteSize = 0;
+	m_vertexBufferMemory.reset();
 	m_vertexCount = 0;
 }
 
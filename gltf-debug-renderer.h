@@ -1,5 +1,6 @@
 #pragma once
 
+#include "gpu-memory.h"
 #include "resource-loaders/tiny_gltf.h"
 
 #include <webgpu/webgpu.hpp>
@@ -37,6 +38,7 @@ private:
 	wgpu::RenderPipeline m_pipeline = nullptr;
 	wgpu::Buffer m_vertexBuffer = nullptr;
 	uint64_t m_vertexBufferByteSize = 0;
+	GpuMemory::Allocation m_vertexBufferMemory;
 	uint32_t m_nodeCount = 0;
 	uint32_t m_vertexCount = 0;
 };
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "gpu-memory.h"
+#include "webgpu-utils/webgpu-std-utils.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+using namespace wgpu;
+
+GpuMemory::Stats GpuMemory::s_stats;
+GpuMemory::BudgetPolicy GpuMemory::s_budgetPolicy = GpuMemory::BudgetPolicy::Warn;
+
+void GpuMemory::Allocation::set(Category category, uint64_t byteSize) {
+	reset();
+	m_category = category;
+	m_byteSize = byteSize;
+	add(m_category, m_byteSize);
+}
+
+void GpuMemory::Allocation::reset() {
+	if (m_byteSize == 0) return;
+	remove(m_category, m_byteSize);
+	m_byteSize = 0;
+}
+
+const char* GpuMemory::categoryName(Category category) {
+	switch (category) {
+	case Category::Vertex: return "Vertex";
+	case Category::Index: return "Index";
+	case Category::Texture: return "Texture";
+	case Category::Uniform: return "Uniform";
+	case Category::Storage: return "Storage";
+	case Category::RenderTarget: return "Render target";
+	case Category::Depth: return "Depth";
+	case Category::Staging: return "Staging";
+	default: return "Unknown";
+	}
+}
+
+void GpuMemory::setBudget(uint64_t byteSize, BudgetPolicy policy) {
+	s_stats.budgetBytes = byteSize;
+	s_budgetPolicy = policy;
+}
+
+bool GpuMemory::checkBudget(uint64_t projectedTotalBytes, const char* what) {
+	if (s_stats.budgetBytes == 0 || projectedTotalBytes <= s_stats.budgetBytes) return true;
+	const bool refused = s_budgetPolicy == BudgetPolicy::Refuse;
+	std::cerr << "GPU memory budget of " << s_stats.budgetBytes / (1024 * 1024) << " MiB exceeded by " << what
+		<< " (" << projectedTotalBytes / (1024 * 1024) << " MiB), " << (refused ? "refused" : "proceeding anyway") << std::endl;
+	return !refused;
+}
+
+uint64_t GpuMemory::textureByteSize(const TextureDescriptor& desc) {
+	uint32_t bitsPerTexel;
+	switch (desc.format) {
+	// Not covered by textureFormatBitsPerTexel(), sizes are typical rather
+	// than guaranteed
+	case TextureFormat::Depth16Unorm: bitsPerTexel = 16; break;
+	case TextureFormat::Depth24Plus: bitsPerTexel = 32; break;
+	case TextureFormat::Depth24PlusStencil8: bitsPerTexel = 32; break;
+	case TextureFormat::Depth32Float: bitsPerTexel = 32; break;
+	default: bitsPerTexel = textureFormatBitsPerTexel(desc.format); break;
+	}
+
+	uint64_t texelCount = 0;
+	for (uint32_t level = 0; level < desc.mipLevelCount; ++level) {
+		const uint64_t width = std::max(desc.size.width >> level, 1u);
+		const uint64_t height = std::max(desc.size.height >> level, 1u);
+		texelCount += width * height;
+	}
+	return texelCount * desc.size.depthOrArrayLayers * desc.sampleCount * bitsPerTexel / 8;
+}
+
+void GpuMemory::printSummary() {
+	std::printf("GPU memory: %.1f MiB, peak %.1f MiB", s_stats.totalBytes / (1024.0 * 1024.0), s_stats.peakTotalBytes / (1024.0 * 1024.0));
+	if (s_stats.budgetBytes > 0) {
+		std::printf(", budget %.1f MiB", s_stats.budgetBytes / (1024.0 * 1024.0));
+	}
+	std::printf("\n");
+	for (uint32_t categoryIdx = 0; categoryIdx < CATEGORY_COUNT; ++categoryIdx) {
+		std::printf("  %-14s %9.2f MiB, peak %9.2f MiB\n",
+			categoryName(static_cast<Category>(categoryIdx)),
+			s_stats.usedBytes[categoryIdx] / (1024.0 * 1024.0),
+			s_stats.peakBytes[categoryIdx] / (1024.0 * 1024.0));
+	}
+	std::fflush(stdout);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+void GpuMemory::add(Category category, uint64_t byteSize) {
+	const uint32_t categoryIdx = static_cast<uint32_t>(category);
+	s_stats.usedBytes[categoryIdx] += byteSize;
+	s_stats.peakBytes[categoryIdx] = std::max(s_stats.peakBytes[categoryIdx], s_stats.usedBytes[categoryIdx]);
+	s_stats.totalBytes += byteSize;
+	s_stats.peakTotalBytes = std::max(s_stats.peakTotalBytes, s_stats.totalBytes);
+}
+
+void GpuMemory::remove(Category category, uint64_t byteSize) {
+	s_stats.usedBytes[static_cast<uint32_t>(category)] -= byteSize;
+	s_stats.totalBytes -= byteSize;
+}
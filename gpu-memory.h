@@ -0,0 +1,94 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Accounts for the GPU memory of buffers and textures, by category.
+ *
+ * Owners keep a GpuMemory::Allocation next to each resource (or group of
+ * resources), which adds its size to the totals while set and removes it
+ * when reset or destroyed. Sizes are those requested from WebGPU, drivers
+ * may round them up.
+ *
+ * An optional budget caps the total: scene loads check what they are about
+ * to allocate against it, and are either warned or refused when it would be
+ * exceeded. Only used from the main thread.
+ */
+class GpuMemory {
+public:
+	enum class Category : uint32_t {
+		Vertex,
+		Index,
+		// Sampled textures of scenes
+		Texture,
+		Uniform,
+		Storage,
+		// Color targets of the passes
+		RenderTarget,
+		Depth,
+		// Readback and query resolution
+		Staging,
+		Count,
+	};
+	static constexpr uint32_t CATEGORY_COUNT = static_cast<uint32_t>(Category::Count);
+
+	enum class BudgetPolicy {
+		// Log and load anyway
+		Warn,
+		// Log and refuse the load
+		Refuse,
+	};
+
+	struct Stats {
+		std::array<uint64_t, CATEGORY_COUNT> usedBytes = {};
+		// High-water marks, since the start of the process
+		std::array<uint64_t, CATEGORY_COUNT> peakBytes = {};
+		uint64_t totalBytes = 0;
+		uint64_t peakTotalBytes = 0;
+		// 0 when there is no budget
+		uint64_t budgetBytes = 0;
+	};
+
+	class Allocation {
+	public:
+		Allocation() = default;
+		~Allocation() { reset(); }
+		Allocation(const Allocation&) = delete;
+		Allocation& operator=(const Allocation&) = delete;
+
+		// Replaces whatever was accounted before
+		void set(Category category, uint64_t byteSize);
+		void reset();
+		uint64_t byteSize() const { return m_byteSize; }
+
+	private:
+		Category m_category = Category::Vertex;
+		uint64_t m_byteSize = 0;
+	};
+
+	static const Stats& stats() { return s_stats; }
+	static uint64_t usedBytes(Category category) { return s_stats.usedBytes[static_cast<uint32_t>(category)]; }
+	static const char* categoryName(Category category);
+
+	// 0 removes the budget
+	static void setBudget(uint64_t byteSize, BudgetPolicy policy);
+	// Whether a load bringing the total to 'projectedTotalBytes' may proceed.
+	// Logs a warning when it exceeds the budget.
+	static bool checkBudget(uint64_t projectedTotalBytes, const char* what);
+
+	// All mip levels and layers of a texture created with 'desc'
+	static uint64_t textureByteSize(const wgpu::TextureDescriptor& desc);
+
+	// Usage and peak of each category, to the standard output
+	static void printSummary();
+
+private:
+	static void add(Category category, uint64_t byteSize);
+	static void remove(Category category, uint64_t byteSize);
+
+	static Stats s_stats;
+	static BudgetPolicy s_budgetPolicy;
+};
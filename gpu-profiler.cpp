@@ -0,0 +1,227 @@
+#include "gpu-profiler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+using namespace wgpu;
+
+bool GpuProfiler::init(Device device, uint32_t frameSlotCount) {
+	static_assert(SLOT_BYTE_SIZE % RESOLVE_ALIGNMENT == 0, "Slots must be aligned for resolving");
+
+	m_device = device;
+	m_available = device.hasFeature(FeatureName::TimestampQuery);
+	if (!m_available) {
+		std::cout << "Timestamp queries are not supported, GPU timings are unavailable" << std::endl;
+		return false;
+	}
+
+	QuerySetDescriptor querySetDesc;
+	querySetDesc.label = "GPU profiler";
+	querySetDesc.type = QueryType::Timestamp;
+	querySetDesc.count = QUERIES_PER_SLOT * frameSlotCount;
+	m_querySet = device.createQuerySet(querySetDesc);
+
+	BufferDescriptor bufferDesc;
+	bufferDesc.label = "GPU profiler resolve";
+	bufferDesc.size = SLOT_BYTE_SIZE * frameSlotCount;
+	bufferDesc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+	bufferDesc.mappedAtCreation = false;
+	m_resolveBuffer = device.createBuffer(bufferDesc);
+	// Readback buffers are as large as the resolve buffer in total
+	m_bufferMemory.set(GpuMemory::Category::Staging, 2 * bufferDesc.size);
+
+	m_slots.resize(frameSlotCount);
+	bufferDesc.label = "GPU profiler readback";
+	bufferDesc.size = SLOT_BYTE_SIZE;
+	bufferDesc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+	for (FrameSlot& slot : m_slots) {
+		slot.profiler = this;
+		slot.passScopes.reserve(MAX_PASSES_PER_FRAME);
+		slot.readbackBuffer = device.createBuffer(bufferDesc);
+	}
+
+	RenderPassTimestampWrites renderPassWrites;
+	renderPassWrites.querySet = *m_querySet;
+	m_renderPassWrites.assign(MAX_PASSES_PER_FRAME, renderPassWrites);
+	ComputePassTimestampWrites computePassWrites;
+	computePassWrites.querySet = *m_querySet;
+	m_computePassWrites.assign(MAX_PASSES_PER_FRAME, computePassWrites);
+
+	return m_querySet && m_resolveBuffer;
+}
+
+void GpuProfiler::terminate() {
+	// Map callbacks refer to the slots, let them fire before the slots go away
+#if defined(WEBGPU_BACKEND_WGPU) || defined(WEBGPU_BACKEND_DAWN)
+	for (const FrameSlot& slot : m_slots) {
+		while (slot.pending) {
+#if defined(WEBGPU_BACKEND_WGPU)
+			m_device.poll(true);
+#else
+			m_device.tick();
+#endif
+		}
+	}
+#else
+	// In a browser callbacks only fire once we return to the event loop, so
+	// slots with a pending map are left alive, and ignored by their callback
+	if (std::any_of(m_slots.begin(), m_slots.end(), [](const FrameSlot& slot) { return slot.pending; })) {
+		for (FrameSlot& slot : m_slots) {
+			slot.profiler = nullptr;
+		}
+		// Moving keeps the slots where they are
+		new std::vector<FrameSlot>(std::move(m_slots));
+	}
+#endif
+	m_slots.clear();
+	m_renderPassWrites.clear();
+	m_computePassWrites.clear();
+	m_scopeStats.clear();
+	m_scopeHistories.clear();
+	m_resolveBuffer = {};
+	m_bufferMemory.reset();
+	m_querySet = {};
+	m_available = false;
+	m_currentSlot = -1;
+	m_device = nullptr;
+}
+
+bool GpuProfiler::beginFrame(uint32_t slot) {
+	m_currentSlot = -1;
+	if (!m_available || m_slots[slot].pending) return false;
+	m_currentSlot = static_cast<int>(slot);
+	m_slots[slot].passScopes.clear();
+	return true;
+}
+
+const RenderPassTimestampWrites* GpuProfiler::renderPassTimestampWrites(const char* name) {
+	uint32_t firstQuery;
+	if (!allocatePass(name, firstQuery)) return nullptr;
+	RenderPassTimestampWrites& writes = m_renderPassWrites[firstQuery / 2 % MAX_PASSES_PER_FRAME];
+	writes.beginningOfPassWriteIndex = firstQuery;
+	writes.endOfPassWriteIndex = firstQuery + 1;
+	return &writes;
+}
+
+const ComputePassTimestampWrites* GpuProfiler::computePassTimestampWrites(const char* name) {
+	uint32_t firstQuery;
+	if (!allocatePass(name, firstQuery)) return nullptr;
+	ComputePassTimestampWrites& writes = m_computePassWrites[firstQuery / 2 % MAX_PASSES_PER_FRAME];
+	writes.beginningOfPassWriteIndex = firstQuery;
+	writes.endOfPassWriteIndex = firstQuery + 1;
+	return &writes;
+}
+
+void GpuProfiler::resolve(CommandEncoder encoder) {
+	if (m_currentSlot < 0) return;
+	uint32_t slot = static_cast<uint32_t>(m_currentSlot);
+	uint32_t queryCount = 2 * static_cast<uint32_t>(m_slots[slot].passScopes.size());
+	if (queryCount == 0) return;
+	encoder.resolveQuerySet(*m_querySet, QUERIES_PER_SLOT * slot, queryCount, *m_resolveBuffer, SLOT_BYTE_SIZE * slot);
+	encoder.copyBufferToBuffer(*m_resolveBuffer, SLOT_BYTE_SIZE * slot, *m_slots[slot].readbackBuffer, 0, queryCount * sizeof(uint64_t));
+}
+
+void GpuProfiler::onFrameSubmitted() {
+	if (m_currentSlot < 0) return;
+	FrameSlot& slot = m_slots[m_currentSlot];
+	m_currentSlot = -1;
+	if (slot.passScopes.empty()) return;
+
+	slot.mappedByteSize = 2 * slot.passScopes.size() * sizeof(uint64_t);
+	slot.pending = true;
+	wgpuBufferMapAsync(*slot.readbackBuffer, WGPUMapMode_Read, 0, slot.mappedByteSize, &GpuProfiler::onReadbackMapped, &slot);
+}
+
+bool GpuProfiler::consumeFrameTime(float& milliseconds) {
+	if (!m_hasNewFrameTime) return false;
+	milliseconds = m_lastFrameTime;
+	m_hasNewFrameTime = false;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+bool GpuProfiler::allocatePass(const char* name, uint32_t& firstQuery) {
+	if (m_currentSlot < 0) return false;
+	FrameSlot& slot = m_slots[m_currentSlot];
+	if (slot.passScopes.size() == MAX_PASSES_PER_FRAME) return false;
+
+	uint32_t scopeIdx = 0;
+	while (scopeIdx < m_scopeStats.size() && std::strcmp(m_scopeStats[scopeIdx].name, name) != 0) {
+		++scopeIdx;
+	}
+	if (scopeIdx == m_scopeStats.size()) {
+		ScopeStats stats;
+		stats.name = name;
+		m_scopeStats.push_back(stats);
+		m_scopeHistories.emplace_back();
+	}
+
+	firstQuery = QUERIES_PER_SLOT * static_cast<uint32_t>(m_currentSlot) + 2 * static_cast<uint32_t>(slot.passScopes.size());
+	slot.passScopes.push_back(scopeIdx);
+	return true;
+}
+
+void GpuProfiler::onReadbackMapped(WGPUBufferMapAsyncStatus status, void* userdata) {
+	FrameSlot& slot = *static_cast<FrameSlot*>(userdata);
+	slot.pending = false;
+	// The profiler was terminated meanwhile
+	if (!slot.profiler) return;
+	if (status != WGPUBufferMapAsyncStatus_Success) return;
+
+	uint64_t timestamps[QUERIES_PER_SLOT];
+	std::memcpy(timestamps, slot.readbackBuffer->getConstMappedRange(0, slot.mappedByteSize), slot.mappedByteSize);
+	slot.readbackBuffer->unmap();
+	slot.profiler->onTimestampsMapped(slot, timestamps);
+}
+
+void GpuProfiler::onTimestampsMapped(FrameSlot& slot, const uint64_t* timestamps) {
+	// Timestamps are taken as nanoseconds, as the WebGPU specification
+	// defines resolved timestamps. The C API used here exposes no timestamp
+	// period, so a backend resolving raw GPU ticks would report times scaled
+	// by its period. They may also go backwards when the GPU changes power
+	// state, such passes are dropped.
+	uint64_t frameBegin = UINT64_MAX;
+	uint64_t frameEnd = 0;
+	for (size_t passIdx = 0; passIdx < slot.passScopes.size(); ++passIdx) {
+		uint64_t begin = timestamps[2 * passIdx];
+		uint64_t end = timestamps[2 * passIdx + 1];
+		if (end <= begin) continue;
+		frameBegin = std::min(frameBegin, begin);
+		frameEnd = std::max(frameEnd, end);
+
+		ScopeHistory& history = m_scopeHistories[slot.passScopes[passIdx]];
+		history.frameTotal += static_cast<float>(end - begin) * 1e-6f;
+		history.isInFrame = true;
+	}
+
+	if (frameEnd > frameBegin) {
+		m_lastFrameTime = static_cast<float>(frameEnd - frameBegin) * 1e-6f;
+		m_hasNewFrameTime = true;
+	}
+
+	for (size_t scopeIdx = 0; scopeIdx < m_scopeHistories.size(); ++scopeIdx) {
+		ScopeHistory& history = m_scopeHistories[scopeIdx];
+		if (!history.isInFrame) continue;
+		history.samples[history.nextSample] = history.frameTotal;
+		history.nextSample = (history.nextSample + 1) % HISTORY_LENGTH;
+		history.sampleCount = std::min(history.sampleCount + 1, HISTORY_LENGTH);
+
+		ScopeStats& stats = m_scopeStats[scopeIdx];
+		stats.lastMs = history.frameTotal;
+		stats.minMs = history.samples[0];
+		stats.maxMs = history.samples[0];
+		float sum = 0.0f;
+		for (uint32_t i = 0; i < history.sampleCount; ++i) {
+			stats.minMs = std::min(stats.minMs, history.samples[i]);
+			stats.maxMs = std::max(stats.maxMs, history.samples[i]);
+			sum += history.samples[i];
+		}
+		stats.avgMs = sum / history.sampleCount;
+
+		history.frameTotal = 0.0f;
+		history.isInFrame = false;
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "gpu-memory.h"
+
+#include <webgpu/webgpu.hpp>
+#include <webgpu/webgpu-raii.hpp>
+
+#include <array>
+#include <vector>
+
+/**
+ * Measures how long the GPU spends on each pass of a frame, and on the whole
+ * frame, with timestamp queries.
+ *
+ * Passes are timed as a whole through their timestampWrites, and attributed
+ * to a named scope. Several passes may share a scope, e.g. all shadow map
+ * layers, in which case their times add up. Timestamps cannot be written
+ * inside a pass in core WebGPU, so draws that should be told apart go to
+ * passes of their own.
+ *
+ * Each frame slot resolves its timestamps into its own readback buffer,
+ * which is mapped once the frame is submitted. Results therefore arrive a few
+ * frames late, and the slot is skipped if its previous readback has not
+ * completed yet. Without the timestamp-query feature the profiler is simply
+ * unavailable. Resolved timestamps are assumed to be in nanoseconds, as
+ * WebGPU specifies.
+ */
+class GpuProfiler {
+public:
+	// Over the last HISTORY_LENGTH frames that ran the scope
+	struct ScopeStats {
+		// The string given to *TimestampWrites(), which must outlive the
+		// profiler (typically a literal)
+		const char* name = nullptr;
+		float lastMs = 0.0f;
+		float minMs = 0.0f;
+		float avgMs = 0.0f;
+		float maxMs = 0.0f;
+	};
+
+	bool init(wgpu::Device device, uint32_t frameSlotCount);
+	void terminate();
+
+	bool isAvailable() const { return m_available; }
+
+	// Returns false if the frame in 'slot' cannot be timed
+	bool beginFrame(uint32_t slot);
+
+	// Timestamp writes timing a pass as part of scope 'name', nullptr when
+	// the current frame is not timed. Valid until the next beginFrame().
+	const wgpu::RenderPassTimestampWrites* renderPassTimestampWrites(const char* name);
+	const wgpu::ComputePassTimestampWrites* computePassTimestampWrites(const char* name);
+
+	// Copy timestamps to the readback buffer, after the last pass
+	void resolve(wgpu::CommandEncoder encoder);
+
+	// Start reading back, after the frame is submitted
+	void onFrameSubmitted();
+
+	// Whether a new whole frame measurement arrived since the last call
+	bool consumeFrameTime(float& milliseconds);
+
+	// In order of first use
+	const std::vector<ScopeStats>& scopeStats() const { return m_scopeStats; }
+
+private:
+	static constexpr uint64_t RESOLVE_ALIGNMENT = 256;
+	static constexpr uint32_t MAX_PASSES_PER_FRAME = 64;
+	static constexpr uint32_t QUERIES_PER_SLOT = 2 * MAX_PASSES_PER_FRAME;
+	// Each frame slot resolves to its own range of the resolve buffer
+	static constexpr uint64_t SLOT_BYTE_SIZE = QUERIES_PER_SLOT * sizeof(uint64_t);
+	static constexpr uint32_t HISTORY_LENGTH = 120;
+
+	struct FrameSlot {
+		// Passed to the map callback, slots are never moved after init().
+		// Null once the profiler is terminated with the map still pending.
+		GpuProfiler* profiler = nullptr;
+		bool pending = false;
+		// Scope of each timed pass, in the order of their queries
+		std::vector<uint32_t> passScopes;
+		size_t mappedByteSize = 0;
+		// Last, so that a pending map is cancelled before the slot dies
+		wgpu::raii::Buffer readbackBuffer;
+	};
+
+	struct ScopeHistory {
+		std::array<float, HISTORY_LENGTH> samples = {};
+		uint32_t sampleCount = 0;
+		uint32_t nextSample = 0;
+		// Accumulated over the passes of the frame being read back
+		float frameTotal = 0.0f;
+		bool isInFrame = false;
+	};
+
+	// Index of the scope, and of the first query of the pass
+	bool allocatePass(const char* name, uint32_t& firstQuery);
+	// Called with the FrameSlot. A plain callback rather than the wrapper's
+	// std::function, which would be allocated every frame.
+	static void onReadbackMapped(WGPUBufferMapAsyncStatus status, void* userdata);
+	void onTimestampsMapped(FrameSlot& slot, const uint64_t* timestamps);
+
+	// To wait for pending readbacks on terminate()
+	wgpu::Device m_device = nullptr;
+	bool m_available = false;
+	wgpu::raii::QuerySet m_querySet;
+	wgpu::raii::Buffer m_resolveBuffer;
+	std::vector<FrameSlot> m_slots;
+	// Of the resolve and readback buffers
+	GpuMemory::Allocation m_bufferMemory;
+
+	// Slot of the frame being recorded, -1 if it is not timed
+	int m_currentSlot = -1;
+	// One entry per pass of the current frame, never reallocated so that
+	// returned pointers stay valid
+	std::vector<wgpu::RenderPassTimestampWrites> m_renderPassWrites;
+	std::vector<wgpu::ComputePassTimestampWrites> m_computePassWrites;
+
+	std::vector<ScopeStats> m_scopeStats;
+	std::vector<ScopeHistory> m_scopeHistories;
+
+	float m_lastFrameTime = 0.0f;
+	bool m_hasNewFrameTime = false;
+};
@@ -1,4 +1,6 @@
 #include "gpu-scene.h"
+#include "cpu-profiler.h"
+#include "mesh-simplifier.h"
 #include "webgpu-utils/webgpu-std-utils.hpp"
 #include "webgpu-utils/webgpu-gltf-utils.h"
 
@@ -6,116 +8,244 @@
 
 #include <glm/glm/gtc/type_ptr.hpp>
 
+#include <array>
+#include <atomic>
 #include <cassert>
-#include <unordered_map>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <limits>
 #include <map>
+#include <thread>
+#include <tuple>
 
 using namespace wgpu;
 using namespace tinygltf;
 using namespace wgpu::gltf;
 
+// Number of simplified index buffers generated per triangle primitive
+constexpr uint32_t MAX_LOD_LEVEL_COUNT = 6;
+// Initial size of the geometry arena, it grows as needed
+constexpr uint32_t INITIAL_VERTEX_CAPACITY = 1 << 16;
+constexpr uint32_t INITIAL_INDEX_CAPACITY = 1 << 18;
+// Size of the buffers that material and node uniforms are sub-allocated from
+constexpr uint32_t UNIFORM_POOL_PAGE_SIZE = 1 << 20;
+// Triangle primitives up to this size may be merged in static batches
+constexpr uint32_t MAX_BATCHED_PRIMITIVE_TRIANGLE_COUNT = 200;
+// A new batch is started beyond this size
+constexpr uint32_t MAX_BATCH_TRIANGLE_COUNT = 1 << 14;
+// Static batches only merge instances within a cell of a grid over the
+// scene bounds, with this many cells along each axis
+constexpr uint32_t BATCH_GRID_RESOLUTION = 4;
+
+static bool readAttribute(const tinygltf::Model& model, const Accessor& accessor, uint32_t componentCount, float* output);
+static bool readIndices(const tinygltf::Model& model, const Accessor& accessor, std::vector<uint32_t>& indices);
+static void transformVectors(const glm::mat4& matrix, float w, const float* input, float* output, uint32_t count);
+static void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
 ///////////////////////////////////////////////////////////////////////////////
 // Public methods
 
+void GpuScene::setStaticBatching(bool enabled) {
+	m_staticBatching = enabled;
+}
+
 void GpuScene::createFromModel(
 	raii::Device device,
 	const tinygltf::Model& model,
 	BindGroupLayout materialBindGroupLayout,
 	BindGroupLayout nodeBindGroupLayout
 ) {
-	destroy();
+	CPU_PROFILE_SCOPE("Create scene");
+	clear();
 
 	initDevice(device);
-	initBuffers(model);
+	m_materialBindGroupLayout = materialBindGroupLayout;
+	m_nodeBindGroupLayout = nodeBindGroupLayout;
+
+	// Milliseconds since the previous call
+	auto stageStart = std::chrono::steady_clock::now();
+	auto stageTime = [&stageStart]() {
+		auto now = std::chrono::steady_clock::now();
+		float milliseconds = std::chrono::duration<float, std::milli>(now - stageStart).count();
+		stageStart = now;
+		return milliseconds;
+	};
+
 	initTextures(model);
 	initSamplers(model);
-	initMaterials(model, materialBindGroupLayout);
-	initNodes(model, nodeBindGroupLayout);
-	initDrawCalls(model);
+	m_loadTimings.texturesMs = stageTime();
+	initMaterials(model);
+	m_loadTimings.materialsMs = stageTime();
+	initNodes(model);
+	m_loadTimings.nodesMs = stageTime();
+	std::vector<BatchSource> batchSources;
+	initDrawCalls(model, batchSources);
+	m_loadTimings.drawCallsMs = stageTime();
+	initBounds();
+	initStaticBatches(batchSources);
+	m_loadTimings.staticBatchesMs = stageTime();
 }
 
-void GpuScene::draw(wgpu::RenderPassEncoder renderPass, uint32_t renderPipelineIndex) {
-	for (const Node& node : m_nodes) {
+void GpuScene::selectLods(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float viewportHeight) {
+	const glm::vec3 cameraPosition = glm::vec3(glm::inverse(viewMatrix)[3]);
+	// Number of pixels covered by a world-space unit seen at distance 1
+	const float pixelsPerUnit = 0.5f * viewportHeight * projectionMatrix[1][1];
+
+	for (Node& node : m_nodes) {
 		const Mesh& mesh = m_meshes[node.meshIndex];
-		renderPass.setBindGroup(2, *node.bindGroup, 0, nullptr);
-		for (const MeshPrimitive& prim : mesh.primitives) {
-			if (prim.renderPipelineIndex != renderPipelineIndex) continue;
-			for (size_t layoutIdx = 0; layoutIdx < prim.attributeBufferViews.size(); ++layoutIdx) {
-				const auto& view = prim.attributeBufferViews[layoutIdx];
-				uint32_t slot = static_cast<uint32_t>(layoutIdx);
-				if (view.bufferIndex != WGPU_LIMIT_U32_UNDEFINED) {
-					renderPass.setVertexBuffer(slot, *m_buffers[view.bufferIndex], view.byteOffset, view.byteLength);
-				}
-				else {
-					renderPass.setVertexBuffer(slot, *m_nullBuffer, 0, 4 * sizeof(float));
+		for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
+			const MeshPrimitive& prim = mesh.primitives[primIdx];
+			uint32_t lod = 0;
+			if (!prim.lods.empty()) {
+				glm::vec3 center = glm::vec3(node.uniforms.modelMatrix * glm::vec4(prim.boundsCenter, 1.0f));
+				float distance = glm::length(center - cameraPosition) - prim.boundsRadius * node.maxScale;
+				// When the camera is within the bounds we keep full detail
+				if (distance > 0.0f) {
+					float errorToPixels = node.maxScale * pixelsPerUnit / distance;
+					while (lod < prim.lods.size() && prim.lods[lod].error * errorToPixels <= m_lodErrorThreshold) {
+						++lod;
+					}
 				}
 			}
+			node.primitiveLods[primIdx] = lod;
+		}
+	}
+}
+
+void GpuScene::bindGeometry(wgpu::RenderPassEncoder renderPass) const {
+	m_geometry.bind(renderPass);
+}
+
+void GpuScene::bindPositions(wgpu::RenderPassEncoder renderPass) const {
+	m_geometry.bindPositions(renderPass);
+}
 
+void GpuScene::draw(wgpu::RenderPassEncoder renderPass, uint32_t renderPipelineIndex) {
+	++m_drawStats.pipelineSwitches;
+	for (const Node& node : m_nodes) {
+		const Mesh& mesh = m_meshes[node.meshIndex];
+		// Only bound if some primitive is not drawn by a static batch
+		bool isNodeBound = false;
+		for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
+			const MeshPrimitive& prim = mesh.primitives[primIdx];
+			if (GpuScene::renderPipelineIndex(node, prim) != renderPipelineIndex || node.isPrimitiveBatched[primIdx]) continue;
+			if (!isNodeBound) {
+				renderPass.setBindGroup(2, *node.bindGroup, 0, nullptr);
+				++m_drawStats.bindGroupSwitches;
+				isNodeBound = true;
+			}
 			renderPass.setBindGroup(1, *m_materials[prim.materialIndex].bindGroup, 0, nullptr);
-			assert(prim.indexBufferView.byteStride == 0 || prim.indexBufferView.byteStride == indexFormatByteSize(prim.indexFormat));
-			renderPass.setIndexBuffer(
-				*m_buffers[prim.indexBufferView.bufferIndex],
-				prim.indexFormat,
-				prim.indexBufferView.byteOffset + prim.indexBufferByteOffset,
-				prim.indexBufferView.byteLength
-			);
-			renderPass.drawIndexed(prim.indexCount, 1, 0, 0, 0);
+			++m_drawStats.bindGroupSwitches;
+			drawPrimitive(renderPass, prim, node.primitiveLods[primIdx]);
 		}
 	}
+	drawStaticBatches(renderPass, renderPipelineIndex, true);
+}
+
+void GpuScene::drawDepth(wgpu::RenderPassEncoder renderPass, uint32_t renderPipelineIndex, NodeFilter filter) {
+	++m_drawStats.pipelineSwitches;
+	for (const Node& node : m_nodes) {
+		if (filter == NodeFilter::Static && node.isDynamic) continue;
+		if (filter == NodeFilter::Dynamic && !node.isDynamic) continue;
+		const Mesh& mesh = m_meshes[node.meshIndex];
+		bool isNodeBound = false;
+		for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
+			const MeshPrimitive& prim = mesh.primitives[primIdx];
+			if (GpuScene::renderPipelineIndex(node, prim) != renderPipelineIndex || node.isPrimitiveBatched[primIdx]) continue;
+			if (!isNodeBound) {
+				renderPass.setBindGroup(2, *node.bindGroup, 0, nullptr);
+				++m_drawStats.bindGroupSwitches;
+				isNodeBound = true;
+			}
+			drawPrimitive(renderPass, prim, node.primitiveLods[primIdx]);
+		}
+	}
+	// Batches only hold static nodes
+	if (filter != NodeFilter::Dynamic) {
+		drawStaticBatches(renderPass, renderPipelineIndex, false);
+	}
+}
+
+uint64_t GpuScene::defragment(uint64_t maxBytes) {
+	return m_uniformPool.defragment(maxBytes);
 }
 
 void GpuScene::destroy() {
-	terminateDrawCalls();
-	terminateNodes();
-	terminateMaterials();
-	terminateSamplers();
-	terminateTextures();
-	terminateBuffers();
+	clear();
+	m_geometry.terminate();
+	m_uniformPool.terminate();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Private methods
 
-void GpuScene::initDevice(wgpu::raii::Device device) {
-	if (m_device != device) {
-		m_device = device;
+void GpuScene::drawPrimitive(wgpu::RenderPassEncoder renderPass, const MeshPrimitive& prim, uint32_t lod) const {
+	uint32_t firstIndex = prim.geometry.firstIndex;
+	uint32_t indexCount = prim.indexCount;
+	if (lod > 0) {
+		firstIndex = prim.lods[lod - 1].firstIndex;
+		indexCount = prim.lods[lod - 1].indexCount;
 	}
-	m_queue = m_device->getQueue();
+	renderPass.drawIndexed(indexCount, 1, firstIndex, static_cast<int32_t>(prim.geometry.baseVertex), 0);
+	++m_drawStats.drawCalls;
+	m_drawStats.triangles += indexCount / 3;
 }
 
-void GpuScene::initBuffers(const tinygltf::Model& model) {
-	for (const tinygltf::Buffer& buffer : model.buffers) {
-		BufferDescriptor bufferDesc = Default;
-		bufferDesc.label = buffer.name.c_str();
-		bufferDesc.size = alignToNextMultipleOf(static_cast<uint32_t>(buffer.data.size()), 4);
-		bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex | BufferUsage::Index;
-		wgpu::Buffer gpuBuffer = m_device->createBuffer(bufferDesc);
-		m_buffers.push_back(std::move(gpuBuffer));
-		m_queue->writeBuffer(gpuBuffer, 0, buffer.data.data(), bufferDesc.size);
-	}
+uint32_t GpuScene::renderPipelineIndex(const Node& node, const MeshPrimitive& prim) {
+	return node.isMirrored ? prim.mirroredRenderPipelineIndex : prim.renderPipelineIndex;
+}
 
-	{
-		BufferDescriptor bufferDesc = Default;
-		bufferDesc.label = "Null Buffer";
-		bufferDesc.size = static_cast<uint32_t>(4 * sizeof(float));
-		bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex | BufferUsage::Index;
-		m_nullBuffer = m_device->createBuffer(bufferDesc);
+void GpuScene::drawStaticBatches(wgpu::RenderPassEncoder renderPass, uint32_t renderPipelineIndex, bool bindMaterials) const {
+	bool isNodeBound = false;
+	for (const StaticBatch& batch : m_staticBatches) {
+		if (batch.renderPipelineIndex != renderPipelineIndex) continue;
+		if (!isNodeBound) {
+			renderPass.setBindGroup(2, *m_batchNode.bindGroup, 0, nullptr);
+			++m_drawStats.bindGroupSwitches;
+			isNodeBound = true;
+		}
+		if (bindMaterials) {
+			renderPass.setBindGroup(1, *m_materials[batch.materialIndex].bindGroup, 0, nullptr);
+			++m_drawStats.bindGroupSwitches;
+		}
+		renderPass.drawIndexed(batch.geometry.indexCount, 1, batch.geometry.firstIndex, static_cast<int32_t>(batch.geometry.baseVertex), 0);
+		++m_drawStats.drawCalls;
+		m_drawStats.triangles += batch.geometry.indexCount / 3;
 	}
 }
 
-void GpuScene::terminateBuffers() {
-	for (wgpu::raii::Buffer b : m_buffers) {
-		b->destroy();
-	}
-	m_buffers.clear();
+void GpuScene::initDevice(wgpu::raii::Device device) {
+	// Geometry and uniform buffers outlive scenes, so that the next one
+	// reuses their space
+	if (m_device != device || m_geometry.vertexCapacity() == 0) {
+		m_device = device;
+		m_geometry.terminate();
+		m_geometry.init(*m_device, INITIAL_VERTEX_CAPACITY, INITIAL_INDEX_CAPACITY);
 
-	if (m_nullBuffer) {
-		m_nullBuffer->destroy();
+		SupportedLimits limits;
+		m_device->getLimits(&limits);
+		m_uniformPool.terminate();
+		m_uniformPool.init(*m_device, "Scene Uniforms", BufferUsage::Uniform, GpuMemory::Category::Uniform, UNIFORM_POOL_PAGE_SIZE, limits.limits.minUniformBufferOffsetAlignment);
 	}
+	m_queue = m_device->getQueue();
+}
+
+void GpuScene::clear() {
+	terminateStaticBatches();
+	terminateDrawCalls();
+	terminateNodes();
+	terminateMaterials();
+	terminateSamplers();
+	terminateTextures();
 }
 
 void GpuScene::initTextures(const tinygltf::Model& model) {
+	CPU_PROFILE_SCOPE("Init textures");
 	TextureDescriptor desc;
+	uint64_t textureBytes = 0;
 	for (const tinygltf::Image& image : model.images) {
 		// Texture
 		desc.label = image.name.c_str();
@@ -129,6 +259,7 @@ void GpuScene::initTextures(const tinygltf::Model& model) {
 		desc.viewFormats = nullptr;
 		wgpu::Texture gpuTexture = m_device->createTexture(desc);
 		m_textures.push_back(gpuTexture);
+		textureBytes += GpuMemory::textureByteSize(desc);
 
 		// View
 		TextureViewDescriptor viewDesc;
@@ -155,6 +286,7 @@ void GpuScene::initTextures(const tinygltf::Model& model) {
 		sourceLayout.bytesPerRow = bitsPerPixel * desc.size.width / 8;
 		sourceLayout.rowsPerImage = desc.size.height;
 		m_queue->writeTexture(destination, image.image.data(), image.image.size(), sourceLayout, desc.size);
+		m_uploadedTextureBytes += image.image.size();
 	}
 
 	// Default texture
@@ -173,6 +305,7 @@ void GpuScene::initTextures(const tinygltf::Model& model) {
 		desc.viewFormats = nullptr;
 		wgpu::Texture gpuTexture = m_device->createTexture(desc);
 		m_textures.push_back(gpuTexture);
+		textureBytes += GpuMemory::textureByteSize(desc);
 
 		// View
 		TextureViewDescriptor viewDesc;
@@ -200,6 +333,7 @@ void GpuScene::initTextures(const tinygltf::Model& model) {
 		sourceLayout.rowsPerImage = desc.size.height;
 		uint32_t data = 0;
 		m_queue->writeTexture(destination, &data, 4, sourceLayout, desc.size);
+		m_uploadedTextureBytes += 4;
 	}
 
 	for (const tinygltf::Texture& texture : model.textures) {
@@ -208,6 +342,7 @@ void GpuScene::initTextures(const tinygltf::Model& model) {
 			static_cast<uint32_t>(texture.sampler),
 									});
 	}
+	m_textureMemory.set(GpuMemory::Category::Texture, textureBytes);
 }
 
 void GpuScene::terminateTextures() {
@@ -218,9 +353,11 @@ void GpuScene::terminateTextures() {
 		t.release();
 	}
 	m_textures.clear();
+	m_textureMemory.reset();
 }
 
 void GpuScene::initSamplers(const tinygltf::Model& model) {
+	CPU_PROFILE_SCOPE("Init samplers");
 	SamplerDescriptor desc;
 	for (const tinygltf::Sampler& sampler : model.samplers) {
 		desc.label = sampler.name.c_str();
@@ -246,9 +383,11 @@ void GpuScene::terminateSamplers() {
 	m_samplers.clear();
 }
 
-void GpuScene::initMaterials(const tinygltf::Model& model, BindGroupLayout bindGroupLayout) {
+void GpuScene::initMaterials(const tinygltf::Model& model) {
+	CPU_PROFILE_SCOPE("Init materials");
 	for (const tinygltf::Material& material : model.materials) {
 		GpuScene::Material gpuMaterial;
+		gpuMaterial.name = material.name;
 
 		int baseColorSampledTextureIdx = material.pbrMetallicRoughness.baseColorTexture.index;
 		int baseColorTextureIdx = -1;
@@ -274,13 +413,11 @@ void GpuScene::initMaterials(const tinygltf::Model& model, BindGroupLayout bindG
 			normalSamplerIdx = m_sampledTextures[normalSampledTextureIdx].samplerIndex;
 		}
 
-		// Uniforms
-		BufferDescriptor bufferDesc;
-		bufferDesc.label = material.name.c_str();
-		bufferDesc.mappedAtCreation = false;
-		bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
-		bufferDesc.size = sizeof(MaterialUniforms);
-		gpuMaterial.uniformBuffer = m_device->createBuffer(bufferDesc);
+		// Uniforms, whose bind group is recreated if the pool moves them
+		const uint32_t materialIdx = static_cast<uint32_t>(m_materials.size());
+		gpuMaterial.uniformHandle = m_uniformPool.allocate(sizeof(MaterialUniforms), [this, materialIdx]() {
+			initMaterialBindGroup(materialIdx);
+		});
 
 		// Uniform Values
 		gpuMaterial.uniforms.baseColorFactor = glm::make_vec4(material.pbrMetallicRoughness.baseColorFactor.data());
@@ -298,154 +435,167 @@ void GpuScene::initMaterials(const tinygltf::Model& model, BindGroupLayout bindG
 			normalTextureIdx >= 0
 			? static_cast<uint32_t>(material.normalTexture.texCoord)
 			: WGPU_LIMIT_U32_UNDEFINED;
-		m_queue->writeBuffer(gpuMaterial.uniformBuffer, 0, &gpuMaterial.uniforms, sizeof(MaterialUniforms));
-
-		// Bind Group
-		std::vector<BindGroupEntry> bindGroupEntries(7, Default);
-		bindGroupEntries[0].binding = 0;
-		bindGroupEntries[0].buffer = gpuMaterial.uniformBuffer;
-		bindGroupEntries[0].size = sizeof(MaterialUniforms);
-
-		bindGroupEntries[1].binding = 1;
-		int idx = baseColorTextureIdx >= 0 ? baseColorTextureIdx : m_defaultTextureIdx;
-		bindGroupEntries[1].textureView = *m_textureViews[idx];
-
-		bindGroupEntries[2].binding = 2;
-		idx = baseColorSamplerIdx >= 0 ? baseColorSamplerIdx : m_defaultSamplerIdx;
-		bindGroupEntries[2].sampler = *m_samplers[idx];
-
-		bindGroupEntries[3].binding = 3;
-		idx = metallicRoughnessTextureIdx >= 0 ? metallicRoughnessTextureIdx : m_defaultTextureIdx;
-		bindGroupEntries[3].textureView = *m_textureViews[idx];
-
-		bindGroupEntries[4].binding = 4;
-		idx = metallicRoughnessSamplerIdx >= 0 ? metallicRoughnessSamplerIdx : m_defaultSamplerIdx;
-		bindGroupEntries[4].sampler = *m_samplers[idx];
-
-		bindGroupEntries[5].binding = 5;
-		idx = normalTextureIdx >= 0 ? normalTextureIdx : m_defaultTextureIdx;
-		bindGroupEntries[5].textureView = *m_textureViews[idx];
-
-		bindGroupEntries[6].binding = 6;
-		idx = normalSamplerIdx >= 0 ? normalSamplerIdx : m_defaultSamplerIdx;
-		bindGroupEntries[6].sampler = *m_samplers[idx];
-
-		BindGroupDescriptor bindGroupDesc;
-		bindGroupDesc.label = material.name.c_str();
-		bindGroupDesc.entryCount = static_cast<uint32_t>(bindGroupEntries.size());
-		bindGroupDesc.entries = bindGroupEntries.data();
-		bindGroupDesc.layout = bindGroupLayout;
-		gpuMaterial.bindGroup = m_device->createBindGroup(bindGroupDesc);
+		gpuMaterial.uniforms.alphaCutoff = static_cast<float>(material.alphaCutoff);
+		m_uniformPool.write(gpuMaterial.uniformHandle, &gpuMaterial.uniforms, sizeof(MaterialUniforms));
+
+		// Shader features, textures that are not provided are not sampled
+		if (baseColorTextureIdx >= 0) gpuMaterial.features |= BaseColorTexture;
+		if (metallicRoughnessTextureIdx >= 0) gpuMaterial.features |= MetallicRoughnessTexture;
+		if (normalTextureIdx >= 0) gpuMaterial.features |= NormalTexture;
+		if (material.alphaMode == "MASK") gpuMaterial.features |= AlphaMask;
+		else if (material.alphaMode == "BLEND") gpuMaterial.features |= AlphaBlend;
+		if (material.doubleSided) gpuMaterial.features |= DoubleSided;
+
+		// Textures
+		gpuMaterial.textureViewIndices = {
+			static_cast<uint32_t>(baseColorTextureIdx >= 0 ? baseColorTextureIdx : m_defaultTextureIdx),
+			static_cast<uint32_t>(metallicRoughnessTextureIdx >= 0 ? metallicRoughnessTextureIdx : m_defaultTextureIdx),
+			static_cast<uint32_t>(normalTextureIdx >= 0 ? normalTextureIdx : m_defaultTextureIdx),
+		};
+		gpuMaterial.samplerIndices = {
+			static_cast<uint32_t>(baseColorSamplerIdx >= 0 ? baseColorSamplerIdx : m_defaultSamplerIdx),
+			static_cast<uint32_t>(metallicRoughnessSamplerIdx >= 0 ? metallicRoughnessSamplerIdx : m_defaultSamplerIdx),
+			static_cast<uint32_t>(normalSamplerIdx >= 0 ? normalSamplerIdx : m_defaultSamplerIdx),
+		};
 
 		m_materials.push_back(gpuMaterial);
+		initMaterialBindGroup(materialIdx);
 	}
 
 	// Add default material
 	{
 		GpuScene::Material gpuMaterial;
+		gpuMaterial.name = "Default Material";
 		m_defaultMaterialIdx = static_cast<uint32_t>(m_materials.size());
 
 		// Uniforms
-		BufferDescriptor bufferDesc;
-		bufferDesc.label = "Default Material";
-		bufferDesc.mappedAtCreation = false;
-		bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
-		bufferDesc.size = sizeof(MaterialUniforms);
-		gpuMaterial.uniformBuffer = m_device->createBuffer(bufferDesc);
+		const uint32_t materialIdx = m_defaultMaterialIdx;
+		gpuMaterial.uniformHandle = m_uniformPool.allocate(sizeof(MaterialUniforms), [this, materialIdx]() {
+			initMaterialBindGroup(materialIdx);
+		});
 
 		// Uniform Values
 		gpuMaterial.uniforms.baseColorFactor = { 1.0, 0.5, 0.5, 1.0 };
 		gpuMaterial.uniforms.metallicFactor = 0.0;
 		gpuMaterial.uniforms.roughnessFactor = 0.2;
 		gpuMaterial.uniforms.baseColorTexCoords = WGPU_LIMIT_U32_UNDEFINED;
-		m_queue->writeBuffer(gpuMaterial.uniformBuffer, 0, &gpuMaterial.uniforms, sizeof(MaterialUniforms));
-
-		// Bind Group
-		std::vector<BindGroupEntry> bindGroupEntries(7, Default);
-		bindGroupEntries[0].binding = 0;
-		bindGroupEntries[0].buffer = gpuMaterial.uniformBuffer;
-		bindGroupEntries[0].size = sizeof(MaterialUniforms);
+		gpuMaterial.uniforms.metallicRoughnessTexCoords = WGPU_LIMIT_U32_UNDEFINED;
+		gpuMaterial.uniforms.normalTexCoords = WGPU_LIMIT_U32_UNDEFINED;
+		gpuMaterial.uniforms.alphaCutoff = 0.5f;
+		m_uniformPool.write(gpuMaterial.uniformHandle, &gpuMaterial.uniforms, sizeof(MaterialUniforms));
 
-		bindGroupEntries[1].binding = 1;
-		bindGroupEntries[1].textureView = *m_textureViews[m_defaultTextureIdx];
-
-		bindGroupEntries[2].binding = 2;
-		bindGroupEntries[2].sampler = *m_samplers[m_defaultSamplerIdx];
-
-		bindGroupEntries[3].binding = 3;
-		bindGroupEntries[3].textureView = *m_textureViews[m_defaultTextureIdx];
-
-		bindGroupEntries[4].binding = 4;
-		bindGroupEntries[4].sampler = *m_samplers[m_defaultSamplerIdx];
-
-		bindGroupEntries[5].binding = 5;
-		bindGroupEntries[5].textureView = *m_textureViews[m_defaultTextureIdx];
-
-		bindGroupEntries[6].binding = 6;
-		bindGroupEntries[6].sampler = *m_samplers[m_defaultSamplerIdx];
-
-		BindGroupDescriptor bindGroupDesc;
-		bindGroupDesc.label = "Default Material";
-		bindGroupDesc.entryCount = static_cast<uint32_t>(bindGroupEntries.size());
-		bindGroupDesc.entries = bindGroupEntries.data();
-		bindGroupDesc.layout = bindGroupLayout;
-		gpuMaterial.bindGroup = m_device->createBindGroup(bindGroupDesc);
+		// Textures
+		gpuMaterial.textureViewIndices.fill(m_defaultTextureIdx);
+		gpuMaterial.samplerIndices.fill(m_defaultSamplerIdx);
 
 		m_materials.push_back(gpuMaterial);
+		initMaterialBindGroup(materialIdx);
 	}
 }
 
 void GpuScene::terminateMaterials() {
 	for (Material& mat : m_materials) {
-		mat.uniformBuffer.destroy();
-		mat.uniformBuffer.release();
+		m_uniformPool.free(mat.uniformHandle);
 	}
 	m_materials.clear();
 }
 
-void GpuScene::initNodes(const tinygltf::Model& model, BindGroupLayout bindGroupLayout) {
-	std::function<void(const std::vector<int>&, const glm::mat4&)> addNodes;
-	addNodes = [&](const std::vector<int>& nodeIndices, const glm::mat4& parentGlobalTransform) {
+void GpuScene::initMaterialBindGroup(uint32_t materialIndex) {
+	Material& material = m_materials[materialIndex];
+	BufferPool::Range uniforms = m_uniformPool.range(material.uniformHandle);
+
+	std::vector<BindGroupEntry> bindGroupEntries(7, Default);
+	bindGroupEntries[0].binding = 0;
+	bindGroupEntries[0].buffer = uniforms.buffer;
+	bindGroupEntries[0].offset = uniforms.offset;
+	bindGroupEntries[0].size = sizeof(MaterialUniforms);
+
+	// Then a texture and its sampler per map
+	for (uint32_t i = 0; i < 3; ++i) {
+		bindGroupEntries[1 + 2 * i].binding = 1 + 2 * i;
+		bindGroupEntries[1 + 2 * i].textureView = *m_textureViews[material.textureViewIndices[i]];
+
+		bindGroupEntries[2 + 2 * i].binding = 2 + 2 * i;
+		bindGroupEntries[2 + 2 * i].sampler = *m_samplers[material.samplerIndices[i]];
+	}
+
+	BindGroupDescriptor bindGroupDesc;
+	bindGroupDesc.label = material.name.c_str();
+	bindGroupDesc.entryCount = static_cast<uint32_t>(bindGroupEntries.size());
+	bindGroupDesc.entries = bindGroupEntries.data();
+	bindGroupDesc.layout = m_materialBindGroupLayout;
+	material.bindGroup = m_device->createBindGroup(bindGroupDesc);
+}
+
+void GpuScene::initNodes(const tinygltf::Model& model) {
+	CPU_PROFILE_SCOPE("Init nodes");
+	// Nodes that an animation moves, the whole subtree below them moves too
+	std::vector<bool> isAnimated(model.nodes.size(), false);
+	for (const tinygltf::Animation& animation : model.animations) {
+		for (const tinygltf::AnimationChannel& channel : animation.channels) {
+			if (channel.target_node >= 0 && channel.target_node < static_cast<int>(isAnimated.size())) {
+				isAnimated[channel.target_node] = true;
+			}
+		}
+	}
+
+	std::function<void(const std::vector<int>&, const glm::mat4&, bool)> addNodes;
+	addNodes = [&](const std::vector<int>& nodeIndices, const glm::mat4& parentGlobalTransform, bool parentIsDynamic) {
 		for (int idx : nodeIndices) {
 			const tinygltf::Node& node = model.nodes[idx];
 			std::cout << " - Adding node '" << node.name << "'" << std::endl;
 			const glm::mat4 localTransform = nodeMatrix(node);
 			const glm::mat4 globalTransform = parentGlobalTransform * localTransform;
+			const bool isDynamic = parentIsDynamic || isAnimated[idx];
+
+			if (node.light > -1) {
+				const tinygltf::Light& light = model.lights[node.light];
+				PunctualLight gpuLight;
+				if (light.type == "directional") gpuLight.type = PunctualLight::Type::Directional;
+				else if (light.type == "spot") gpuLight.type = PunctualLight::Type::Spot;
+				else gpuLight.type = PunctualLight::Type::Point;
+				// Lights sit at the origin of their node and point towards -Z
+				gpuLight.position = glm::vec3(globalTransform[3]);
+				gpuLight.direction = glm::normalize(-glm::vec3(globalTransform[2]));
+				glm::vec3 color = light.color.size() == 3
+					? glm::vec3(light.color[0], light.color[1], light.color[2])
+					: glm::vec3(1.0f);
+				gpuLight.color = color * static_cast<float>(light.intensity);
+				gpuLight.range = static_cast<float>(light.range);
+				gpuLight.innerConeAngle = static_cast<float>(light.spot.innerConeAngle);
+				gpuLight.outerConeAngle = static_cast<float>(light.spot.outerConeAngle);
+				m_punctualLights.push_back(gpuLight);
+			}
 
 			if (node.mesh > -1) {
 				Node gpuNode;
+				gpuNode.name = node.name;
 				gpuNode.meshIndex = static_cast<uint32_t>(node.mesh);
+				gpuNode.maxScale = std::max({
+					glm::length(glm::vec3(globalTransform[0])),
+					glm::length(glm::vec3(globalTransform[1])),
+					glm::length(glm::vec3(globalTransform[2]))
+				});
+				gpuNode.primitiveLods.assign(model.meshes[node.mesh].primitives.size(), 0);
+				gpuNode.isDynamic = isDynamic;
+				gpuNode.isMirrored = glm::determinant(glm::mat3(globalTransform)) < 0.0f;
 
 				// Uniforms
-				BufferDescriptor bufferDesc;
-				bufferDesc.label = node.name.c_str();
-				bufferDesc.mappedAtCreation = false;
-				bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
-				bufferDesc.size = sizeof(NodeUniforms);
-				gpuNode.uniformBuffer = m_device->createBuffer(bufferDesc);
+				const uint32_t nodeIdx = static_cast<uint32_t>(m_nodes.size());
+				gpuNode.uniformHandle = m_uniformPool.allocate(sizeof(NodeUniforms), [this, nodeIdx]() {
+					initNodeBindGroup(m_nodes[nodeIdx]);
+				});
 
 				// Uniform Values
 				gpuNode.uniforms.modelMatrix = globalTransform;
-				m_queue->writeBuffer(gpuNode.uniformBuffer, 0, &gpuNode.uniforms, sizeof(NodeUniforms));
-
-				// Bind Group
-				std::vector<BindGroupEntry> bindGroupEntries(1, Default);
-				bindGroupEntries[0].binding = 0;
-				bindGroupEntries[0].buffer = gpuNode.uniformBuffer;
-				bindGroupEntries[0].size = sizeof(NodeUniforms);
-
-				BindGroupDescriptor bindGroupDesc;
-				bindGroupDesc.label = node.name.c_str();
-				bindGroupDesc.entryCount = static_cast<uint32_t>(bindGroupEntries.size());
-				bindGroupDesc.entries = bindGroupEntries.data();
-				bindGroupDesc.layout = bindGroupLayout;
-				gpuNode.bindGroup = m_device->createBindGroup(bindGroupDesc);
+				m_uniformPool.write(gpuNode.uniformHandle, &gpuNode.uniforms, sizeof(NodeUniforms));
 
 				m_nodes.push_back(gpuNode);
+				initNodeBindGroup(m_nodes[nodeIdx]);
 			}
 
 			// Recursive call
-			addNodes(node.children, globalTransform);
+			addNodes(node.children, globalTransform, isDynamic);
 		}
 		};
 
@@ -457,223 +607,738 @@ void GpuScene::initNodes(const tinygltf::Model& model, BindGroupLayout bindGroup
 		0.0, -1.0, 0.0, 0.0,
 		0.0, 0.0, 0.0, 1.0
 	};
-	addNodes(scene.nodes, swapYandZ);
+	addNodes(scene.nodes, swapYandZ, false);
 }
 
 void GpuScene::terminateNodes() {
 	for (Node& node : m_nodes) {
-		node.uniformBuffer.destroy();
-		node.uniformBuffer.release();
+		m_uniformPool.free(node.uniformHandle);
 	}
 	m_nodes.clear();
+	m_punctualLights.clear();
+	m_boundsCenter = glm::vec3(0.0f);
+	m_boundsRadius = 0.0f;
 }
 
-void GpuScene::initDrawCalls(const tinygltf::Model& model) {
-	struct Comp {
-		bool operator()(const GpuBufferView& a, const GpuBufferView& b) const {
-			return std::tie(a.bufferIndex, a.byteOffset, a.byteLength, a.byteStride) < std::tie(b.bufferIndex, b.byteOffset, b.byteLength, b.byteStride);
-		}
+void GpuScene::initNodeBindGroup(Node& node) {
+	BufferPool::Range uniforms = m_uniformPool.range(node.uniformHandle);
+
+	std::vector<BindGroupEntry> bindGroupEntries(1, Default);
+	bindGroupEntries[0].binding = 0;
+	bindGroupEntries[0].buffer = uniforms.buffer;
+	bindGroupEntries[0].offset = uniforms.offset;
+	bindGroupEntries[0].size = sizeof(NodeUniforms);
+
+	BindGroupDescriptor bindGroupDesc;
+	bindGroupDesc.label = node.name.c_str();
+	bindGroupDesc.entryCount = static_cast<uint32_t>(bindGroupEntries.size());
+	bindGroupDesc.entries = bindGroupEntries.data();
+	bindGroupDesc.layout = m_nodeBindGroupLayout;
+	node.bindGroup = m_device->createBindGroup(bindGroupDesc);
+}
+
+void GpuScene::initDrawCalls(const tinygltf::Model& model, std::vector<BatchSource>& batchSources) {
+	CPU_PROFILE_SCOPE("Init draw calls");
+	// glTF semantic of the attribute held by each stream of the geometry arena
+	const std::array<const char*, GeometryArena::STREAM_COUNT> streamSemantics = {
+		"POSITION",
+		"NORMAL",
+		"COLOR_0",
+		"TEXCOORD_0",
 	};
+	const std::array<uint32_t, GeometryArena::STREAM_COUNT> streamComponentCounts = { 3, 3, 3, 2 };
 
-	// We create our own set of buffer views, where attribute offsets cannot be
-	// larger than the vertex buffer stride.
-	std::vector<GpuBufferView> gpuBufferViews;
-	std::map<GpuBufferView, uint32_t, Comp> gpuBufferViewLut;
-	auto getOrCreateGpuBufferViewIndex = [&](const GpuBufferView& view) {
-		auto it = gpuBufferViewLut.find(view);
-		if (it != gpuBufferViewLut.end()) {
-			return it->second;
-		}
-		else {
-			uint32_t idx = static_cast<uint32_t>(gpuBufferViews.size());
-			gpuBufferViews.push_back(view);
-			gpuBufferViewLut[view] = idx;
-			return idx;
-		}
-		};
+	// Meshes that need pipelines with clockwise front faces
+	std::vector<bool> hasMirroredInstance(model.meshes.size(), false);
+	for (const Node& node : m_nodes) {
+		if (node.isMirrored) hasMirroredInstance[node.meshIndex] = true;
+	}
 
+	// One summary for the scene, stress scenes have far too many primitives
+	// to report each
+	uint32_t simplifiedPrimitiveCount = 0;
+	uint32_t lodCount = 0;
 	for (const tinygltf::Mesh& mesh : model.meshes) {
+		const uint32_t meshIdx = static_cast<uint32_t>(m_meshes.size());
 		Mesh gpuMesh;
 		for (const tinygltf::Primitive& prim : mesh.primitives) {
-
-			std::vector<std::tuple<std::string, uint32_t, VertexFormat>> semanticToLocation = {
-				// GLTF Semantic, Shader input location, Default format
-				{"POSITION", 0, VertexFormat::Float32x3},
-				{"NORMAL", 1, VertexFormat::Float32x3},
-				{"COLOR", 2, VertexFormat::Float32x3},
-				{"TEXCOORD_0", 3, VertexFormat::Float32x2},
-			};
-
-			// We create one vertex buffer layout per bufferView
-			std::vector<VertexBufferLayout> vertexBufferLayouts;
-			// For each layout, there are multiple attributes
-			std::vector<std::vector<VertexAttribute>> vertexBufferLayoutToAttributes;
-			// For each layout, there is a single buffer view
-			std::vector<GpuBufferView> vertexBufferLayoutToGpuBufferView;
-			// And we keep the map from bufferView to layout index
-			// NB: The index '-1' is used for attributes expected by the shader but not
-			// provided by the glTF file.
-			std::unordered_map<int, size_t> gpuBufferViewToVertexBufferLayout;
-
-			for (const auto& [attrSemantic, location, defaultFormat] : semanticToLocation) {
-				int gpuBufferViewIdx = -1;
-				VertexFormat format = defaultFormat;
-				uint64_t attrByteOffset = 0;
-
-				auto accessorIt = prim.attributes.find(attrSemantic);
-
-				if (accessorIt != prim.attributes.end()) {
-					Accessor accessor = model.accessors[accessorIt->second];
-					const BufferView& bufferView = model.bufferViews[accessor.bufferView];
-					format = vertexFormatFromAccessor(accessor);
-					attrByteOffset = static_cast<uint64_t>(accessor.byteOffset);
-					uint64_t byteStride =
-						bufferView.byteStride != 0
-						? bufferView.byteStride
-						: vertexFormatByteSize(format);
-					uint64_t bufferByteOffset = bufferView.byteOffset;
-
-					// Prevent attribute offset from being larger than the stride
-					uint64_t x = (attrByteOffset / byteStride) * byteStride;
-					attrByteOffset -= x;
-					bufferByteOffset += x;
-
-					gpuBufferViewIdx = getOrCreateGpuBufferViewIndex(GpuBufferView{
-						static_cast<uint32_t>(bufferView.buffer),
-						bufferByteOffset,
-						bufferView.byteLength,
-						byteStride
-																	 });
+			auto positionIt = prim.attributes.find("POSITION");
+			if (positionIt == prim.attributes.end() || model.accessors[positionIt->second].count == 0) {
+				std::cerr << "Skipping a primitive without positions in mesh '" << mesh.name << "'" << std::endl;
+				continue;
+			}
+			const Accessor& positionAccessor = model.accessors[positionIt->second];
+			const uint32_t vertexCount = static_cast<uint32_t>(positionAccessor.count);
+
+			// Attributes are converted to the format of their stream, those
+			// that are not provided are left to zero
+			std::array<std::vector<float>, GeometryArena::STREAM_COUNT> streams;
+			bool hasPositions = false;
+			for (uint32_t stream = 0; stream < GeometryArena::STREAM_COUNT; ++stream) {
+				streams[stream].assign(vertexCount * streamComponentCounts[stream], 0.0f);
+				auto accessorIt = prim.attributes.find(streamSemantics[stream]);
+				if (accessorIt == prim.attributes.end()) continue;
+				const Accessor& accessor = model.accessors[accessorIt->second];
+				bool success =
+					accessor.count == vertexCount &&
+					readAttribute(model, accessor, streamComponentCounts[stream], streams[stream].data());
+				if (!success) {
+					std::cerr << "Could not read " << streamSemantics[stream] << " in mesh '" << mesh.name << "'" << std::endl;
 				}
+				if (stream == GeometryArena::Position) {
+					hasPositions = success;
+				}
+			}
+			if (!hasPositions) continue;
+
+			// Non-indexed primitives are drawn with trivial indices
+			std::vector<uint32_t> indices;
+			if (prim.indices >= 0) {
+				if (!readIndices(model, model.accessors[prim.indices], indices)) {
+					std::cerr << "Could not read indices in mesh '" << mesh.name << "'" << std::endl;
+					continue;
+				}
+			}
+			else {
+				indices.resize(vertexCount);
+				for (uint32_t i = 0; i < vertexCount; ++i) {
+					indices[i] = i;
+				}
+			}
+
+			const uint32_t materialIdx = prim.material >= 0 ? static_cast<uint32_t>(prim.material) : m_defaultMaterialIdx;
+			RenderPipelineSettings renderPipelineSettings;
+			renderPipelineSettings.primitiveTopology = primitiveTopologyFromGltf(prim);
+			renderPipelineSettings.materialFeatures = m_materials[materialIdx].features;
+			// Faces only exist for triangles
+			const bool isTriangles =
+				renderPipelineSettings.primitiveTopology == PrimitiveTopology::TriangleList ||
+				renderPipelineSettings.primitiveTopology == PrimitiveTopology::TriangleStrip;
+			if (isTriangles && (renderPipelineSettings.materialFeatures & DoubleSided) == 0) {
+				renderPipelineSettings.cullMode = CullMode::Back;
+			}
+
+			MeshPrimitive gpuPrim;
+			gpuPrim.indexCount = static_cast<uint32_t>(indices.size());
+			gpuPrim.materialIndex = materialIdx;
+			gpuPrim.renderPipelineIndex = getOrCreateRenderPipelineIndex(RenderPipelineSettings(renderPipelineSettings));
+			gpuPrim.mirroredRenderPipelineIndex = gpuPrim.renderPipelineIndex;
+			if (isTriangles && hasMirroredInstance[meshIdx]) {
+				renderPipelineSettings.frontFace = FrontFace::CW;
+				gpuPrim.mirroredRenderPipelineIndex = getOrCreateRenderPipelineIndex(std::move(renderPipelineSettings));
+			}
 
-				// Group attributes by bufferView
-				size_t layoutIdx = 0;
-				auto vertexBufferLayoutIt = gpuBufferViewToVertexBufferLayout.find(gpuBufferViewIdx);
-				if (vertexBufferLayoutIt == gpuBufferViewToVertexBufferLayout.end()) {
-					GpuBufferView view = gpuBufferViewIdx >= 0 ? gpuBufferViews[gpuBufferViewIdx] : GpuBufferView{};
-					layoutIdx = vertexBufferLayouts.size();
-					VertexBufferLayout layout;
-					layout.arrayStride = view.byteStride;
-					layout.stepMode = VertexStepMode::Vertex;
-					vertexBufferLayouts.push_back(layout);
-					vertexBufferLayoutToAttributes.push_back({});
-					vertexBufferLayoutToGpuBufferView.push_back(view);
-					gpuBufferViewToVertexBufferLayout[gpuBufferViewIdx] = layoutIdx;
+			// Bounds
+			std::vector<glm::vec3> positions(vertexCount);
+			std::memcpy(positions.data(), streams[GeometryArena::Position].data(), vertexCount * sizeof(glm::vec3));
+			if (positionAccessor.minValues.size() == 3 && positionAccessor.maxValues.size() == 3) {
+				glm::vec3 minPos = glm::make_vec3(positionAccessor.minValues.data());
+				glm::vec3 maxPos = glm::make_vec3(positionAccessor.maxValues.data());
+				gpuPrim.boundsCenter = 0.5f * (minPos + maxPos);
+				gpuPrim.boundsRadius = 0.5f * glm::length(maxPos - minPos);
+			}
+			else {
+				glm::vec3 minPos = positions[0];
+				glm::vec3 maxPos = positions[0];
+				for (const glm::vec3& p : positions) {
+					minPos = glm::min(minPos, p);
+					maxPos = glm::max(maxPos, p);
 				}
-				else {
-					layoutIdx = vertexBufferLayoutIt->second;
+				gpuPrim.boundsCenter = 0.5f * (minPos + maxPos);
+				gpuPrim.boundsRadius = 0.5f * glm::length(maxPos - minPos);
+			}
+
+			// Small triangle meshes are candidates for static batching, which
+			// needs their data on the CPU
+			BatchSource batchSource;
+			const bool isBatchable =
+				m_staticBatching &&
+				primitiveTopologyFromGltf(prim) == PrimitiveTopology::TriangleList &&
+				indices.size() % 3 == 0 &&
+				indices.size() <= 3 * MAX_BATCHED_PRIMITIVE_TRIANGLE_COUNT;
+			if (isBatchable) {
+				batchSource.meshIndex = meshIdx;
+				batchSource.primitiveIndex = static_cast<uint32_t>(gpuMesh.primitives.size());
+				batchSource.indices = indices;
+			}
+
+			// Levels of detail, their indices follow the full detail ones
+			if (
+				gpuPrim.boundsRadius > 0.0f &&
+				primitiveTopologyFromGltf(prim) == PrimitiveTopology::TriangleList &&
+				indices.size() % 3 == 0
+			) {
+				std::vector<MeshSimplifier::Lod> chain = MeshSimplifier::generateLodChain(positions, indices, MAX_LOD_LEVEL_COUNT);
+				for (const MeshSimplifier::Lod& lod : chain) {
+					gpuPrim.lods.push_back(MeshLod{
+						static_cast<uint32_t>(indices.size()),
+						static_cast<uint32_t>(lod.indices.size()),
+						lod.error
+					});
+					indices.insert(indices.end(), lod.indices.begin(), lod.indices.end());
 				}
+			}
+			if (!gpuPrim.lods.empty()) {
+				++simplifiedPrimitiveCount;
+				lodCount += static_cast<uint32_t>(gpuPrim.lods.size());
+			}
 
-				VertexAttribute attrib;
-				attrib.shaderLocation = location;
-				attrib.format = format;
-				attrib.offset = attrByteOffset;
+			gpuPrim.geometry = m_geometry.allocate(vertexCount, static_cast<uint32_t>(indices.size()));
+			if (!gpuPrim.geometry.isValid()) {
+				std::cerr << "Out of geometry memory, skipping a primitive of mesh '" << mesh.name << "'" << std::endl;
+				continue;
+			}
+			for (uint32_t stream = 0; stream < GeometryArena::STREAM_COUNT; ++stream) {
+				m_geometry.writeVertices(gpuPrim.geometry, static_cast<GeometryArena::Stream>(stream), streams[stream].data());
+			}
+			m_geometry.writeIndices(gpuPrim.geometry, indices.data());
+			// Level offsets were relative to the allocation
+			for (MeshLod& lod : gpuPrim.lods) {
+				lod.firstIndex += gpuPrim.geometry.firstIndex;
+			}
 
-				vertexBufferLayoutToAttributes[layoutIdx].push_back(attrib);
+			if (isBatchable) {
+				batchSource.streams = std::move(streams);
+				batchSources.push_back(std::move(batchSource));
 			}
 
-			// Index data
-			const Accessor& indexAccessor = model.accessors[prim.indices];
-			const BufferView& indexBufferView = model.bufferViews[indexAccessor.bufferView];
-			IndexFormat indexFormat = indexFormatFromAccessor(indexAccessor);
-			assert(indexFormat != IndexFormat::Undefined);
-			assert(indexAccessor.type == TINYGLTF_TYPE_SCALAR);
-
-			RenderPipelineSettings renderPipelineSettings = {
-				vertexBufferLayoutToAttributes,
-				vertexBufferLayouts,
-				primitiveTopologyFromGltf(prim)
-			};
-
-			gpuMesh.primitives.push_back(MeshPrimitive{
-				vertexBufferLayoutToGpuBufferView,
-				GpuBufferView{
-					static_cast<uint32_t>(indexBufferView.buffer),
-					indexBufferView.byteOffset,
-					indexBufferView.byteLength,
-					indexBufferView.byteStride
-				},
-				static_cast<uint32_t>(indexAccessor.byteOffset),
-				indexFormat,
-				static_cast<uint32_t>(indexAccessor.count),
-				prim.material >= 0 ? static_cast<uint32_t>(prim.material) : m_defaultMaterialIdx,
-				getOrCreateRenderPipelineIndex(renderPipelineSettings)
-										 });
+			gpuMesh.primitives.push_back(std::move(gpuPrim));
 		}
 		m_meshes.push_back(std::move(gpuMesh));
 	}
+	std::cout << "Generated " << lodCount << " levels of detail for " << simplifiedPrimitiveCount << " primitives" << std::endl;
 }
 
-bool GpuScene::isCompatible(const RenderPipelineSettings& a, const RenderPipelineSettings& b) const {
-	if (a.vertexBufferLayouts.size() != b.vertexBufferLayouts.size()) return false;
-	assert(a.vertexAttributes.size() == a.vertexBufferLayouts.size());
-	assert(b.vertexAttributes.size() == b.vertexBufferLayouts.size());
-
-	if (a.primitiveTopology != b.primitiveTopology) return false;
-
-	for (int bufferIdx = 0; bufferIdx < a.vertexBufferLayouts.size(); ++bufferIdx) {
-		if (a.vertexAttributes[bufferIdx].size() != b.vertexAttributes[bufferIdx].size()) return false;
-		const auto& bufferLayoutA = a.vertexBufferLayouts[bufferIdx];
-		const auto& bufferLayoutB = b.vertexBufferLayouts[bufferIdx];
-		if (bufferLayoutA.arrayStride != bufferLayoutB.arrayStride) return false;
-		if (bufferLayoutA.stepMode != bufferLayoutB.stepMode) return false;
-
-		std::unordered_map<uint32_t, uint32_t> locationToFormatA;
-		std::unordered_map<uint32_t, uint64_t> locationToOffsetA;
-		std::unordered_map<uint32_t, uint32_t> locationToFormatB;
-		std::unordered_map<uint32_t, uint64_t> locationToOffsetB;
-		for (int attrIdx = 0; attrIdx < a.vertexAttributes[bufferIdx].size(); ++attrIdx) {
-			const auto& attrA = a.vertexAttributes[bufferIdx][attrIdx];
-			const auto& attrB = b.vertexAttributes[bufferIdx][attrIdx];
-			locationToFormatA[attrA.shaderLocation] = (uint32_t)attrA.format;
-			locationToOffsetA[attrA.shaderLocation] = attrA.offset;
-			locationToFormatB[attrB.shaderLocation] = (uint32_t)attrB.format;
-			locationToOffsetB[attrB.shaderLocation] = attrB.offset;
+void GpuScene::initBounds() {
+	// Sphere around the box that encloses the bounding spheres of all primitives
+	glm::vec3 minPos(std::numeric_limits<float>::max());
+	glm::vec3 maxPos(std::numeric_limits<float>::lowest());
+	for (const Node& node : m_nodes) {
+		for (const MeshPrimitive& prim : m_meshes[node.meshIndex].primitives) {
+			glm::vec3 center = glm::vec3(node.uniforms.modelMatrix * glm::vec4(prim.boundsCenter, 1.0f));
+			float radius = prim.boundsRadius * node.maxScale;
+			minPos = glm::min(minPos, center - radius);
+			maxPos = glm::max(maxPos, center + radius);
 		}
-		if (locationToFormatA != locationToFormatB) return false;
-		if (locationToOffsetA != locationToOffsetB) return false;
 	}
-
-	return true;
+	if (minPos.x > maxPos.x) return;
+	m_boundsCenter = 0.5f * (minPos + maxPos);
+	m_boundsRadius = 0.5f * glm::length(maxPos - minPos);
 }
 
-uint32_t GpuScene::getOrCreateRenderPipelineIndex(const RenderPipelineSettings& newSettings) {
-	for (uint32_t idx = 0; idx < m_renderPipelines.size(); ++idx) {
-		const RenderPipelineSettings& settings = m_renderPipelines[idx];
-		if (isCompatible(settings, newSettings)) {
-			return idx;
+void GpuScene::initStaticBatches(const std::vector<BatchSource>& batchSources) {
+	CPU_PROFILE_SCOPE("Init static batches");
+	for (Node& node : m_nodes) {
+		node.isPrimitiveBatched.assign(m_meshes[node.meshIndex].primitives.size(), false);
+	}
+	if (batchSources.empty()) return;
+
+	// Source of each primitive that may be batched
+	std::vector<std::vector<const BatchSource*>> primitiveSources(m_meshes.size());
+	for (size_t meshIdx = 0; meshIdx < m_meshes.size(); ++meshIdx) {
+		primitiveSources[meshIdx].assign(m_meshes[meshIdx].primitives.size(), nullptr);
+	}
+	for (const BatchSource& source : batchSources) {
+		primitiveSources[source.meshIndex][source.primitiveIndex] = &source;
+	}
+
+	// Group the instances of these primitives by static node, by render
+	// pipeline and material, and by grid cell
+	struct Instance {
+		uint32_t nodeIndex;
+		const BatchSource* source;
+	};
+	using GroupKey = std::tuple<uint32_t, uint32_t, int32_t, int32_t, int32_t>;
+	std::map<GroupKey, std::vector<Instance>> groups;
+	const float cellSize = std::max(2.0f * m_boundsRadius / BATCH_GRID_RESOLUTION, 1e-6f);
+	for (uint32_t nodeIdx = 0; nodeIdx < m_nodes.size(); ++nodeIdx) {
+		const Node& node = m_nodes[nodeIdx];
+		if (node.isDynamic) continue;
+		const Mesh& mesh = m_meshes[node.meshIndex];
+		for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
+			const BatchSource* source = primitiveSources[node.meshIndex][primIdx];
+			if (!source) continue;
+			const MeshPrimitive& prim = mesh.primitives[primIdx];
+			glm::vec3 center = glm::vec3(node.uniforms.modelMatrix * glm::vec4(prim.boundsCenter, 1.0f));
+			glm::ivec3 cell = glm::ivec3(glm::floor((center - m_boundsCenter) / cellSize));
+			groups[{ prim.renderPipelineIndex, prim.materialIndex, cell.x, cell.y, cell.z }].push_back({ nodeIdx, source });
+		}
+	}
+
+	// Split groups in batches of limited size. A single instance gains
+	// nothing from being batched, so it is left as is.
+	struct BatchContent {
+		uint32_t materialIndex = 0;
+		uint32_t renderPipelineIndex = 0;
+		std::vector<Instance> instances;
+		uint32_t vertexCount = 0;
+		uint32_t indexCount = 0;
+	};
+	std::vector<BatchContent> contents;
+	for (const auto& [key, instances] : groups) {
+		BatchContent content;
+		content.renderPipelineIndex = std::get<0>(key);
+		content.materialIndex = std::get<1>(key);
+		for (size_t i = 0; i <= instances.size(); ++i) {
+			const bool isFull = i == instances.size()
+				|| content.indexCount + instances[i].source->indices.size() > 3 * MAX_BATCH_TRIANGLE_COUNT;
+			if (isFull) {
+				if (content.instances.size() >= 2) contents.push_back(content);
+				content.instances.clear();
+				content.vertexCount = 0;
+				content.indexCount = 0;
+			}
+			if (i == instances.size()) break;
+			const BatchSource& source = *instances[i].source;
+			content.instances.push_back(instances[i]);
+			content.vertexCount += static_cast<uint32_t>(source.streams[GeometryArena::Position].size() / 3);
+			content.indexCount += static_cast<uint32_t>(source.indices.size());
+		}
+	}
+	if (contents.empty()) return;
+
+	// Pre-transform vertices to world space, batches in parallel
+	struct BatchData {
+		std::array<std::vector<float>, GeometryArena::STREAM_COUNT> streams;
+		std::vector<uint32_t> indices;
+	};
+	std::vector<BatchData> batchData(contents.size());
+	parallelFor(contents.size(), [&](size_t batchIdx) {
+		const BatchContent& content = contents[batchIdx];
+		BatchData& data = batchData[batchIdx];
+		data.streams[GeometryArena::Position].resize(3 * content.vertexCount);
+		data.streams[GeometryArena::Normal].resize(3 * content.vertexCount);
+		data.streams[GeometryArena::Color].resize(3 * content.vertexCount);
+		data.streams[GeometryArena::TexCoord].resize(2 * content.vertexCount);
+		data.indices.resize(content.indexCount);
+
+		uint32_t vertexOffset = 0;
+		uint32_t indexOffset = 0;
+		for (const Instance& instance : content.instances) {
+			const BatchSource& source = *instance.source;
+			const glm::mat4& modelMatrix = m_nodes[instance.nodeIndex].uniforms.modelMatrix;
+			const uint32_t vertexCount = static_cast<uint32_t>(source.streams[GeometryArena::Position].size() / 3);
+
+			// Same transforms as the vertex shader
+			transformVectors(modelMatrix, 1.0f, source.streams[GeometryArena::Position].data(), data.streams[GeometryArena::Position].data() + 3 * vertexOffset, vertexCount);
+			transformVectors(modelMatrix, 0.0f, source.streams[GeometryArena::Normal].data(), data.streams[GeometryArena::Normal].data() + 3 * vertexOffset, vertexCount);
+			std::copy(source.streams[GeometryArena::Color].begin(), source.streams[GeometryArena::Color].end(), data.streams[GeometryArena::Color].begin() + 3 * vertexOffset);
+			std::copy(source.streams[GeometryArena::TexCoord].begin(), source.streams[GeometryArena::TexCoord].end(), data.streams[GeometryArena::TexCoord].begin() + 2 * vertexOffset);
+
+			for (size_t i = 0; i < source.indices.size(); ++i) {
+				data.indices[indexOffset + i] = source.indices[i] + vertexOffset;
+			}
+			// Batches are drawn with counter-clockwise front faces, so the
+			// winding of mirrored instances is reversed back
+			if (m_nodes[instance.nodeIndex].isMirrored) {
+				for (size_t i = 0; i < source.indices.size(); i += 3) {
+					std::swap(data.indices[indexOffset + i + 1], data.indices[indexOffset + i + 2]);
+				}
+			}
+			vertexOffset += vertexCount;
+			indexOffset += static_cast<uint32_t>(source.indices.size());
+		}
+	});
+
+	// Upload
+	for (size_t batchIdx = 0; batchIdx < contents.size(); ++batchIdx) {
+		const BatchContent& content = contents[batchIdx];
+		const BatchData& data = batchData[batchIdx];
+
+		StaticBatch batch;
+		batch.geometry = m_geometry.allocate(content.vertexCount, content.indexCount);
+		if (!batch.geometry.isValid()) {
+			std::cerr << "Out of geometry memory, leaving instances unbatched" << std::endl;
+			continue;
+		}
+		for (uint32_t stream = 0; stream < GeometryArena::STREAM_COUNT; ++stream) {
+			m_geometry.writeVertices(batch.geometry, static_cast<GeometryArena::Stream>(stream), data.streams[stream].data());
 		}
+		m_geometry.writeIndices(batch.geometry, data.indices.data());
+		batch.materialIndex = content.materialIndex;
+		batch.renderPipelineIndex = content.renderPipelineIndex;
+		m_staticBatches.push_back(batch);
+
+		for (const Instance& instance : content.instances) {
+			m_nodes[instance.nodeIndex].isPrimitiveBatched[instance.source->primitiveIndex] = true;
+		}
+		m_batchedPrimitiveCount += static_cast<uint32_t>(content.instances.size());
+	}
+	if (m_staticBatches.empty()) return;
+
+	// Vertices are already in world space
+	m_batchNode.name = "Static Batches";
+	m_batchNode.uniforms.modelMatrix = glm::mat4(1.0f);
+	m_batchNode.uniformHandle = m_uniformPool.allocate(sizeof(NodeUniforms), [this]() {
+		initNodeBindGroup(m_batchNode);
+	});
+	m_uniformPool.write(m_batchNode.uniformHandle, &m_batchNode.uniforms, sizeof(NodeUniforms));
+	initNodeBindGroup(m_batchNode);
+
+	std::cout << "Merged " << m_batchedPrimitiveCount << " primitives in " << m_staticBatches.size() << " static batches" << std::endl;
+}
+
+void GpuScene::terminateStaticBatches() {
+	for (const StaticBatch& batch : m_staticBatches) {
+		m_geometry.free(batch.geometry);
+	}
+	m_staticBatches.clear();
+	m_batchedPrimitiveCount = 0;
+	m_uniformPool.free(m_batchNode.uniformHandle);
+	m_batchNode = Node{};
+}
+
+uint32_t GpuScene::getOrCreateRenderPipelineIndex(RenderPipelineSettings&& newSettings) {
+	RenderPipelineKey& key = newSettings.key;
+	key = {};
+	for (const VertexBufferLayout& layout : GeometryArena::vertexBufferLayouts()) {
+		key.addVertexBufferLayout(layout);
+	}
+	key.add(static_cast<uint64_t>(newSettings.primitiveTopology));
+	key.add(newSettings.materialFeatures);
+	key.add(static_cast<uint64_t>(newSettings.frontFace));
+	key.add(static_cast<uint64_t>(newSettings.cullMode));
+
+	if (const uint32_t* idx = m_renderPipelineIndices.find(key)) {
+		return *idx;
 	}
 
 	// No appropriate render pipeline was found, register a new one
-	m_renderPipelines.push_back(newSettings);
-	return static_cast<uint32_t>(m_renderPipelines.size() - 1);
+	uint32_t idx = static_cast<uint32_t>(m_renderPipelines.size());
+	m_renderPipelineIndices.insert(key, idx);
+	m_renderPipelines.push_back(std::move(newSettings));
+	return idx;
 }
 
 void GpuScene::terminateDrawCalls() {
+	// Give the space back for the next scene
+	for (const Mesh& mesh : m_meshes) {
+		for (const MeshPrimitive& prim : mesh.primitives) {
+			m_geometry.free(prim.geometry);
+		}
+	}
 	m_meshes.clear();
 	m_renderPipelines.clear();
+	m_renderPipelineIndices.clear();
 }
 
 uint32_t GpuScene::renderPipelineCount() const {
 	return static_cast<uint32_t>(m_renderPipelines.size());
 }
 
-std::vector<wgpu::VertexBufferLayout> GpuScene::vertexBufferLayouts(uint32_t renderPipelineIndex) const {
-	const auto& rp = m_renderPipelines[renderPipelineIndex];
-	std::vector<wgpu::VertexBufferLayout> vertexBufferLayouts = rp.vertexBufferLayouts;
-
-	// Assign pointer addresses (should be done upon foreign access)
-	for (size_t layoutIdx = 0; layoutIdx < rp.vertexBufferLayouts.size(); ++layoutIdx) {
-		VertexBufferLayout& layout = vertexBufferLayouts[layoutIdx];
-		const auto& attributes = rp.vertexAttributes[layoutIdx];
-		layout.attributeCount = static_cast<uint32_t>(attributes.size());
-		layout.attributes = attributes.data();
-	}
+GeometryArena::VertexBufferLayouts GpuScene::vertexBufferLayouts([[maybe_unused]] uint32_t renderPipelineIndex) const {
+	return GeometryArena::vertexBufferLayouts();
+}
 
-	return vertexBufferLayouts;
+wgpu::VertexBufferLayout GpuScene::positionVertexBufferLayout([[maybe_unused]] uint32_t renderPipelineIndex) const {
+	return GeometryArena::vertexBufferLayout(GeometryArena::Position);
 }
 
 PrimitiveTopology GpuScene::primitiveTopology(uint32_t renderPipelineIndex) const {
 	return m_renderPipelines[renderPipelineIndex].primitiveTopology;
-}
\ No newline at end of file
+}
+
+FrontFace GpuScene::frontFace(uint32_t renderPipelineIndex) const {
+	return m_renderPipelines[renderPipelineIndex].frontFace;
+}
+
+CullMode GpuScene::cullMode(uint32_t renderPipelineIndex) const {
+	return m_renderPipelines[renderPipelineIndex].cullMode;
+}
+
+const std::vector<GpuScene::PunctualLight>& GpuScene::punctualLights() const {
+	return m_punctualLights;
+}
+
+const RenderPipelineKey& GpuScene::renderPipelineKey(uint32_t renderPipelineIndex) const {
+	return m_renderPipelines[renderPipelineIndex].key;
+}
+
+uint32_t GpuScene::materialFeatures(uint32_t renderPipelineIndex) const {
+	return m_renderPipelines[renderPipelineIndex].materialFeatures;
+}
+
+std::vector<std::string> GpuScene::shaderDefines(uint32_t materialFeatures) {
+	std::vector<std::string> defines;
+	if (materialFeatures & BaseColorTexture) defines.push_back("HAS_BASE_COLOR_TEXTURE");
+	if (materialFeatures & MetallicRoughnessTexture) defines.push_back("HAS_METALLIC_ROUGHNESS_TEXTURE");
+	if (materialFeatures & NormalTexture) defines.push_back("HAS_NORMAL_TEXTURE");
+	if (materialFeatures & AlphaMask) defines.push_back("ALPHA_MODE_MASK");
+	if (materialFeatures & AlphaBlend) defines.push_back("ALPHA_MODE_BLEND");
+	if (materialFeatures & DoubleSided) defines.push_back("DOUBLE_SIDED");
+	return defines;
+}
+
+bool GpuScene::hasDynamicNodes() const {
+	return std::any_of(m_nodes.begin(), m_nodes.end(), [](const Node& node) { return node.isDynamic; });
+}
+
+BufferPool::Stats GpuScene::uniformPoolStats() const {
+	return m_uniformPool.stats();
+}
+
+const GpuScene::LoadTimings& GpuScene::loadTimings() const {
+	return m_loadTimings;
+}
+
+uint64_t GpuScene::geometryByteSize() const {
+	return m_geometry.byteSize();
+}
+
+uint64_t GpuScene::byteSize() const {
+	return m_textureMemory.byteSize() + m_geometry.byteSize() + m_uniformPool.stats().reservedBytes;
+}
+
+uint64_t GpuScene::estimateByteSize(const tinygltf::Model& model) const {
+	// Textures as initTextures() creates them
+	uint64_t byteSize = 0;
+	for (const tinygltf::Image& image : model.images) {
+		TextureDescriptor desc;
+		desc.format = textureFormatToFloatFormat(textureFormatFromGltfImage(image));
+		desc.sampleCount = 1;
+		desc.size = { static_cast<uint32_t>(image.width), static_cast<uint32_t>(image.height), 1 };
+		desc.mipLevelCount = 1;
+		byteSize += GpuMemory::textureByteSize(desc);
+	}
+
+	// Instances of each mesh, all assumed static
+	std::vector<uint64_t> meshInstanceCounts(model.meshes.size(), 0);
+	uint64_t nodeCount = 0;
+	for (const tinygltf::Node& node : model.nodes) {
+		if (node.mesh < 0) continue;
+		++meshInstanceCounts[node.mesh];
+		++nodeCount;
+	}
+
+	// Full detail geometry once per mesh whatever the number of nodes, then
+	// levels of detail and static batches
+	uint64_t vertexCount = 0;
+	uint64_t indexCount = 0;
+	for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+		for (const tinygltf::Primitive& prim : model.meshes[meshIdx].primitives) {
+			auto position = prim.attributes.find("POSITION");
+			if (position == prim.attributes.end()) continue;
+			const uint64_t primVertexCount = model.accessors[position->second].count;
+			const uint64_t primIndexCount = prim.indices >= 0 ? model.accessors[prim.indices].count : primVertexCount;
+			vertexCount += primVertexCount;
+			indexCount += primIndexCount;
+			if (primitiveTopologyFromGltf(prim) != PrimitiveTopology::TriangleList || primIndexCount % 3 != 0) continue;
+
+			// Each level keeps at most 3/4 of the indices of the previous one,
+			// see MeshSimplifier::generateLodChain()
+			uint64_t lodIndexCount = primIndexCount;
+			for (uint32_t level = 0; level < MAX_LOD_LEVEL_COUNT; ++level) {
+				lodIndexCount = lodIndexCount * 3 / 4;
+				indexCount += lodIndexCount;
+			}
+
+			// Batches copy the primitive for each of its instances
+			if (m_staticBatching && primIndexCount <= 3 * MAX_BATCHED_PRIMITIVE_TRIANGLE_COUNT) {
+				vertexCount += meshInstanceCounts[meshIdx] * primVertexCount;
+				indexCount += meshInstanceCounts[meshIdx] * primIndexCount;
+			}
+		}
+	}
+
+	// The arena doubles its capacity when full, and keeps the capacity that
+	// previous scenes needed
+	auto projectedCapacity = [](uint64_t capacity, uint64_t count) {
+		while (capacity < count) capacity *= 2;
+		return capacity;
+	};
+	const uint64_t vertexCapacity = projectedCapacity(std::max<uint64_t>(m_geometry.vertexCapacity(), INITIAL_VERTEX_CAPACITY), vertexCount);
+	const uint64_t indexCapacity = projectedCapacity(std::max<uint64_t>(m_geometry.indexCapacity(), INITIAL_INDEX_CAPACITY), indexCount);
+	byteSize += vertexCapacity * GeometryArena::vertexByteSize() + indexCapacity * sizeof(uint32_t);
+
+	// Uniforms of the materials, the default one, the nodes and the batches,
+	// each aligned for binding, in whole pages that are also kept
+	uint64_t alignment = 256;
+	if (m_device) {
+		SupportedLimits limits;
+		m_device->getLimits(&limits);
+		alignment = limits.limits.minUniformBufferOffsetAlignment;
+	}
+	auto alignedSize = [alignment](uint64_t size) {
+		return (size + alignment - 1) / alignment * alignment;
+	};
+	const uint64_t uniformBytes =
+		(model.materials.size() + 1) * alignedSize(sizeof(MaterialUniforms)) +
+		(nodeCount + 1) * alignedSize(sizeof(NodeUniforms));
+	const uint64_t pageCount = std::max<uint64_t>((uniformBytes + UNIFORM_POOL_PAGE_SIZE - 1) / UNIFORM_POOL_PAGE_SIZE, m_uniformPool.stats().pageCount);
+	byteSize += pageCount * UNIFORM_POOL_PAGE_SIZE;
+	return byteSize;
+}
+
+uint64_t GpuScene::uploadedBytes() const {
+	return m_uploadedTextureBytes + m_geometry.uploadedBytes() + m_uniformPool.stats().writtenBytes;
+}
+
+const GpuScene::DrawStats& GpuScene::drawStats() const {
+	return m_drawStats;
+}
+
+void GpuScene::resetDrawStats() {
+	m_drawStats = {};
+}
+
+uint32_t GpuScene::staticBatchCount() const {
+	return static_cast<uint32_t>(m_staticBatches.size());
+}
+
+uint32_t GpuScene::batchedPrimitiveCount() const {
+	return m_batchedPrimitiveCount;
+}
+
+glm::vec3 GpuScene::boundsCenter() const {
+	return m_boundsCenter;
+}
+
+float GpuScene::boundsRadius() const {
+	return m_boundsRadius;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Accessor reading
+
+static bool readAttribute(const tinygltf::Model& model, const Accessor& accessor, uint32_t componentCount, float* output) {
+	// Missing components are 0, extra ones are dropped (e.g. the alpha of
+	// vertex colors)
+	const int accessorComponentCount = tinygltf::GetNumComponentsInType(accessor.type);
+	if (accessorComponentCount <= 0 || accessor.sparse.isSparse) return false;
+	std::fill(output, output + accessor.count * componentCount, 0.0f);
+	// Accessors without buffer view are all zeros
+	if (accessor.bufferView < 0) return true;
+
+	const BufferView& bufferView = model.bufferViews[accessor.bufferView];
+	const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+	int byteStride = accessor.ByteStride(bufferView);
+	if (byteStride <= 0) return false;
+
+	size_t byteOffset = bufferView.byteOffset + accessor.byteOffset;
+	size_t componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+	size_t elementSize = componentSize * accessorComponentCount;
+	if (accessor.count == 0 || byteOffset + (accessor.count - 1) * byteStride + elementSize > buffer.data.size()) return false;
+
+	const uint32_t readCount = std::min(componentCount, static_cast<uint32_t>(accessorComponentCount));
+	const unsigned char* data = buffer.data.data() + byteOffset;
+	for (size_t i = 0; i < accessor.count; ++i) {
+		for (uint32_t c = 0; c < readCount; ++c) {
+			const unsigned char* component = data + i * byteStride + c * componentSize;
+			float& value = output[i * componentCount + c];
+			// Normalized integers map to [0, 1] or [-1, 1]
+			switch (accessor.componentType) {
+			case TINYGLTF_COMPONENT_TYPE_FLOAT:
+				std::memcpy(&value, component, sizeof(float));
+				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+				value = accessor.normalized ? *component / 255.0f : *component;
+				break;
+			case TINYGLTF_COMPONENT_TYPE_BYTE: {
+				int8_t x;
+				std::memcpy(&x, component, sizeof(x));
+				value = accessor.normalized ? std::max(x / 127.0f, -1.0f) : x;
+				break;
+			}
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+				uint16_t x;
+				std::memcpy(&x, component, sizeof(x));
+				value = accessor.normalized ? x / 65535.0f : x;
+				break;
+			}
+			case TINYGLTF_COMPONENT_TYPE_SHORT: {
+				int16_t x;
+				std::memcpy(&x, component, sizeof(x));
+				value = accessor.normalized ? std::max(x / 32767.0f, -1.0f) : x;
+				break;
+			}
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+				uint32_t x;
+				std::memcpy(&x, component, sizeof(x));
+				value = static_cast<float>(x);
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool readIndices(const tinygltf::Model& model, const Accessor& accessor, std::vector<uint32_t>& indices) {
+	if (accessor.type != TINYGLTF_TYPE_SCALAR) return false;
+	if (accessor.bufferView < 0 || accessor.sparse.isSparse) return false;
+
+	const BufferView& bufferView = model.bufferViews[accessor.bufferView];
+	const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+	int byteStride = accessor.ByteStride(bufferView);
+	if (byteStride <= 0) return false;
+
+	size_t byteOffset = bufferView.byteOffset + accessor.byteOffset;
+	size_t componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+	if (accessor.count == 0 || byteOffset + (accessor.count - 1) * byteStride + componentSize > buffer.data.size()) return false;
+
+	indices.resize(accessor.count);
+	const unsigned char* data = buffer.data.data() + byteOffset;
+	for (size_t i = 0; i < accessor.count; ++i) {
+		const unsigned char* element = data + i * byteStride;
+		switch (accessor.componentType) {
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			indices[i] = *element;
+			break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+			uint16_t value;
+			std::memcpy(&value, element, sizeof(value));
+			indices[i] = value;
+			break;
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+			std::memcpy(&indices[i], element, sizeof(uint32_t));
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+// Transform count packed 3D vectors by matrix, with w = 1 for points and 0
+// for directions. Kept to plain arithmetic on locals so that the compiler
+// vectorizes it.
+static void transformVectors(const glm::mat4& matrix, float w, const float* input, float* output, uint32_t count) {
+	const glm::vec3 x = glm::vec3(matrix[0]);
+	const glm::vec3 y = glm::vec3(matrix[1]);
+	const glm::vec3 z = glm::vec3(matrix[2]);
+	const glm::vec3 t = w * glm::vec3(matrix[3]);
+	for (uint32_t i = 0; i < count; ++i) {
+		const float* v = input + 3 * i;
+		const glm::vec3 result = x * v[0] + y * v[1] + z * v[2] + t;
+		output[3 * i + 0] = result.x;
+		output[3 * i + 1] = result.y;
+		output[3 * i + 2] = result.z;
+	}
+}
+
+// Run task(i) for each i in [0, count), spread over the available cores
+static void parallelFor(size_t count, const std::function<void(size_t)>& task) {
+#ifdef __EMSCRIPTEN__
+	// No threads without SharedArrayBuffer support
+	const size_t threadCount = 1;
+#else
+	const size_t threadCount = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+#endif
+	std::atomic<size_t> next = 0;
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++) {
+			task(i);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadCount; ++i) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
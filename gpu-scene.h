@@ -1,11 +1,17 @@
 #pragma once
 
+#include "buffer-pool.h"
+#include "geometry-arena.h"
+#include "gpu-memory.h"
+#include "pipeline-key.h"
 #include "resource-loaders/tiny_gltf.h"
 
 #include <webgpu/webgpu.hpp>
 #include <webgpu/webgpu-raii.hpp>
 #include <glm/glm/glm.hpp>
 
+#include <array>
+#include <string>
 #include <vector>
 
 /**
@@ -25,11 +31,81 @@ public:
 		uint32_t baseColorTexCoords;
 		uint32_t metallicRoughnessTexCoords;
 		uint32_t normalTexCoords;
-		float _pad[3];
+		// Alpha below which fragments are discarded, with AlphaMask only
+		float alphaCutoff;
+		float _pad[2];
 	};
 	static_assert(sizeof(MaterialUniforms) % 16 == 0);
 
+	// Optional parts of a material. Primitives whose materials have different
+	// features use different render pipelines, built from specialized
+	// variants of the shader (see shaderDefines).
+	enum MaterialFeature : uint32_t {
+		BaseColorTexture = 1 << 0,
+		MetallicRoughnessTexture = 1 << 1,
+		NormalTexture = 1 << 2,
+		// Alpha modes, neither of them means opaque
+		AlphaMask = 1 << 3,
+		AlphaBlend = 1 << 4,
+		// Back faces are drawn, with flipped normals, instead of culled
+		DoubleSided = 1 << 5,
+	};
+
+	// A KHR_lights_punctual light instantiated by a node, in world space
+	struct PunctualLight {
+		enum class Type : uint32_t {
+			Directional = 0,
+			Point = 1,
+			Spot = 2,
+		};
+		Type type = Type::Point;
+		glm::vec3 position = glm::vec3(0.0f);
+		// Direction the light points to (spot and directional)
+		glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+		// Linear color multiplied by intensity
+		glm::vec3 color = glm::vec3(1.0f);
+		// 0 means infinite
+		float range = 0.0f;
+		float innerConeAngle = 0.0f;
+		float outerConeAngle = 0.0f;
+	};
+
+	// Time spent in each stage of createFromModel(), in milliseconds
+	struct LoadTimings {
+		// Texture upload and mipmap generation, and samplers
+		float texturesMs = 0.0f;
+		float materialsMs = 0.0f;
+		float nodesMs = 0.0f;
+		// Geometry upload and level of detail generation
+		float drawCallsMs = 0.0f;
+		float staticBatchesMs = 0.0f;
+	};
+
+	// Commands recorded by draw() and drawDepth() since the last reset
+	struct DrawStats {
+		uint32_t drawCalls = 0;
+		uint64_t triangles = 0;
+		// Material and node bind groups set
+		uint32_t bindGroupSwitches = 0;
+		// Callers set the pipeline of each draw() and drawDepth() call, so
+		// every call counts as one switch
+		uint32_t pipelineSwitches = 0;
+	};
+
+	// Subset of the nodes drawn by drawDepth()
+	enum class NodeFilter {
+		All,
+		// Nodes that never move, whose shadows can be cached
+		Static,
+		// Nodes targeted by an animation, and their descendants
+		Dynamic,
+	};
+
 public:
+	// Merge the small primitives of static nodes into world-space batches
+	// when loading. Applies to scenes created afterwards.
+	void setStaticBatching(bool enabled);
+
 	// Create from a CPU-side tinygltf model (destroy previous data)
 	void createFromModel(
 		wgpu::raii::Device device,
@@ -38,16 +114,67 @@ public:
 		wgpu::BindGroupLayout nodeBindGroupLayout
 	);
 
+	// Pick the level of detail of every drawn primitive from the screen-space
+	// error it would produce with the given camera. Call once per frame
+	// before draw().
+	void selectLods(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float viewportHeight);
+
+	// Bind the vertex and index buffers of all primitives, once per pass
+	// before draw()
+	void bindGeometry(wgpu::RenderPassEncoder renderPass) const;
+	// Bind only positions, in slot 0 (see positionVertexBufferLayout), and
+	// indices, once per pass before drawDepth()
+	void bindPositions(wgpu::RenderPassEncoder renderPass) const;
+
 	// Draw all nodes that use a given renderPipeline
 	void draw(wgpu::RenderPassEncoder renderPass, uint32_t renderPipelineIndex);
 
+	// Draw the same nodes as draw(), with only positions
+	void drawDepth(wgpu::RenderPassEncoder renderPass, uint32_t renderPipelineIndex, NodeFilter filter = NodeFilter::All);
+
+	// Move per-object uniforms out of a sparsely used page of the uniform
+	// pool, up to maxBytes. Call once per frame, before recording draws.
+	uint64_t defragment(uint64_t maxBytes);
+
 	// Destroy and release all resources
 	void destroy();
 
 	// Accessors
 	uint32_t renderPipelineCount() const;
-	std::vector<wgpu::VertexBufferLayout> vertexBufferLayouts(uint32_t renderPipelineIndex) const;
+	GeometryArena::VertexBufferLayouts vertexBufferLayouts(uint32_t renderPipelineIndex) const;
+	wgpu::VertexBufferLayout positionVertexBufferLayout(uint32_t renderPipelineIndex) const;
 	wgpu::PrimitiveTopology primitiveTopology(uint32_t renderPipelineIndex) const;
+	wgpu::FrontFace frontFace(uint32_t renderPipelineIndex) const;
+	wgpu::CullMode cullMode(uint32_t renderPipelineIndex) const;
+	// Equal for two indices only if they are the same
+	const RenderPipelineKey& renderPipelineKey(uint32_t renderPipelineIndex) const;
+	// Combination of MaterialFeature bits
+	uint32_t materialFeatures(uint32_t renderPipelineIndex) const;
+	const std::vector<PunctualLight>& punctualLights() const;
+	bool hasDynamicNodes() const;
+	BufferPool::Stats uniformPoolStats() const;
+	uint32_t staticBatchCount() const;
+	// Node primitives drawn as part of a static batch
+	uint32_t batchedPrimitiveCount() const;
+	const LoadTimings& loadTimings() const;
+	// Bytes of the vertex and index buffers of the geometry arena
+	uint64_t geometryByteSize() const;
+	// Total written to textures, geometry and uniforms so far
+	uint64_t uploadedBytes() const;
+	// GPU memory of the textures, geometry arena and uniform pool
+	uint64_t byteSize() const;
+	// GPU memory of the scene once createFromModel() replaced it with
+	// 'model', as byteSize() would return it. Levels of detail and static
+	// batches are bounded from above, fragmentation is not accounted for.
+	uint64_t estimateByteSize(const tinygltf::Model& model) const;
+	const DrawStats& drawStats() const;
+	void resetDrawStats();
+
+	// Names to define when preprocessing the shader for given material features
+	static std::vector<std::string> shaderDefines(uint32_t materialFeatures);
+	// World-space bounding sphere of all drawn nodes
+	glm::vec3 boundsCenter() const;
+	float boundsRadius() const;
 
 private:
 	// NB: All init functions assume that the object is new (empty) or that
@@ -55,8 +182,9 @@ private:
 
 	void initDevice(wgpu::raii::Device device);
 
-	void initBuffers(const tinygltf::Model& model);
-	void terminateBuffers();
+	// Release the resources of the scene, but keep the geometry buffers for
+	// the next one
+	void clear();
 
 	void initTextures(const tinygltf::Model& model);
 	void terminateTextures();
@@ -64,26 +192,53 @@ private:
 	void initSamplers(const tinygltf::Model& model);
 	void terminateSamplers();
 
-	void initMaterials(const tinygltf::Model& model, wgpu::BindGroupLayout bindGroupLayout);
+	void initMaterials(const tinygltf::Model& model);
 	void terminateMaterials();
+	// (Re)create the bind group of a material, also when its uniforms move
+	void initMaterialBindGroup(uint32_t materialIndex);
 
-	void initNodes(const tinygltf::Model& model, wgpu::BindGroupLayout bindGroupLayout);
+	struct Node;
+	void initNodes(const tinygltf::Model& model);
 	void terminateNodes();
+	void initNodeBindGroup(Node& node);
+
+	// CPU-side copy of a primitive small enough to be batched, only kept
+	// while loading
+	struct BatchSource {
+		uint32_t meshIndex;
+		uint32_t primitiveIndex;
+		std::array<std::vector<float>, GeometryArena::STREAM_COUNT> streams;
+		// Full detail only
+		std::vector<uint32_t> indices;
+	};
 
-	void initDrawCalls(const tinygltf::Model& model);
+	void initDrawCalls(const tinygltf::Model& model, std::vector<BatchSource>& batchSources);
 	void terminateDrawCalls();
 
+	// Requires nodes and draw calls
+	void initBounds();
+
+	// Requires nodes, draw calls and bounds
+	void initStaticBatches(const std::vector<BatchSource>& batchSources);
+	void terminateStaticBatches();
+
 private:
 	// Device
 	wgpu::raii::Device m_device;
 	wgpu::raii::Queue m_queue;
 
-	// Buffers
-	std::vector<wgpu::raii::Buffer> m_buffers;
-	wgpu::raii::Buffer m_nullBuffer; // for attributes that are not provided
+	// Vertices and indices of all primitives
+	GeometryArena m_geometry;
+
+	// Uniforms of materials and nodes, which also outlive scenes
+	BufferPool m_uniformPool;
+	// Owned by the application
+	wgpu::BindGroupLayout m_materialBindGroupLayout = nullptr;
+	wgpu::BindGroupLayout m_nodeBindGroupLayout = nullptr;
 
 	// Texture
 	std::vector<wgpu::Texture> m_textures;
+	GpuMemory::Allocation m_textureMemory;
 	std::vector<wgpu::raii::TextureView> m_textureViews;
 	uint32_t m_defaultTextureIdx; // empty texture bound for materials that do not use a texture
 	// This is what GLTF calls a texture, as opposed to wgpu::Texture that corresponds to gltf::Image
@@ -99,39 +254,60 @@ private:
 
 	// Materials
 	struct Material {
+		std::string name;
 		wgpu::raii::BindGroup bindGroup;
-		wgpu::Buffer uniformBuffer = nullptr;
+		BufferPool::Handle uniformHandle = BufferPool::INVALID_HANDLE;
 		MaterialUniforms uniforms;
+		uint32_t features = 0;
+		// Index in m_textureViews and m_samplers of each texture binding:
+		// base color, metallic-roughness and normal
+		std::array<uint32_t, 3> textureViewIndices;
+		std::array<uint32_t, 3> samplerIndices;
 	};
 	std::vector<Material> m_materials;
 	uint32_t m_defaultMaterialIdx;
 
-	// We need to build one Render Pipeline per vertex buffer layout and per
-	// shader, we try to detect which calls use the same layout to minimize the
-	// number of Render Pipelines.
+	// We need to build one Render Pipeline per topology and per shader. All
+	// primitives share the vertex buffer layouts of the geometry arena.
 	struct RenderPipelineSettings {
-		std::vector<std::vector<wgpu::VertexAttribute>> vertexAttributes;
-		std::vector<wgpu::VertexBufferLayout> vertexBufferLayouts;
-		wgpu::PrimitiveTopology primitiveTopology;
+		wgpu::PrimitiveTopology primitiveTopology = wgpu::PrimitiveTopology::TriangleList;
+		uint32_t materialFeatures = 0;
+		// Back faces of triangles are culled unless the material is double
+		// sided. Mirrored instances see their winding reversed, so they are
+		// drawn with clockwise front faces.
+		wgpu::FrontFace frontFace = wgpu::FrontFace::CCW;
+		wgpu::CullMode cullMode = wgpu::CullMode::None;
+		// Computed by getOrCreateRenderPipelineIndex
+		RenderPipelineKey key;
 	};
 	std::vector<RenderPipelineSettings> m_renderPipelines;
+	// Index in m_renderPipelines of each distinct key
+	PipelineKeyMap<uint32_t> m_renderPipelineIndices;
 
-	// Draw Calls + Vertex Buffer Layouts
-	struct GpuBufferView {
-		uint32_t bufferIndex = WGPU_LIMIT_U32_UNDEFINED;
-		uint64_t byteOffset;
-		uint64_t byteLength;
-		uint64_t byteStride;
+	// Draw Calls
+	// A simplified version of a primitive's index buffer, stored in its
+	// geometry allocation after the full detail indices, and sharing its
+	// vertices.
+	struct MeshLod {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error; // object-space geometric error
 	};
 	struct MeshPrimitive {
 		// Draw Call Data
-		std::vector<GpuBufferView> attributeBufferViews;
-		GpuBufferView indexBufferView;
-		uint32_t indexBufferByteOffset;
-		wgpu::IndexFormat indexFormat;
-		uint32_t indexCount;
+		GeometryArena::Allocation geometry;
+		// Full detail indices, at the start of the allocation
+		uint32_t indexCount = 0;
 		uint32_t materialIndex;
 		uint32_t renderPipelineIndex;
+		// Used instead by mirrored nodes, only differs when one of them
+		// instantiates the mesh
+		uint32_t mirroredRenderPipelineIndex;
+		// Coarser levels of detail, lods[i] is level i + 1
+		std::vector<MeshLod> lods;
+		// Object-space bounding sphere
+		glm::vec3 boundsCenter = glm::vec3(0.0f);
+		float boundsRadius = 0.0f;
 	};
 	struct Mesh {
 		std::vector<MeshPrimitive> primitives;
@@ -140,14 +316,61 @@ private:
 
 	// Nodes
 	struct Node {
+		std::string name;
 		wgpu::raii::BindGroup bindGroup;
-		wgpu::Buffer uniformBuffer = nullptr;
+		BufferPool::Handle uniformHandle = BufferPool::INVALID_HANDLE;
 		NodeUniforms uniforms;
 		uint32_t meshIndex;
+		// Largest axis scale of the model matrix, to bring object-space LOD
+		// errors and bounds to world space
+		float maxScale = 1.0f;
+		// Level of detail currently selected for each primitive of the mesh
+		std::vector<uint32_t> primitiveLods;
+		// Primitives drawn by a static batch instead
+		std::vector<bool> isPrimitiveBatched;
+		bool isDynamic = false;
+		// Whether the model matrix reverses the winding of triangles, i.e.
+		// has a negative determinant
+		bool isMirrored = false;
 	};
 	std::vector<Node> m_nodes;
-	
+
+	// Static Batches
+	// Instances of small primitives merged with their vertices in world
+	// space. They are grouped by cell of a grid over the scene, so that each
+	// batch stays spatially compact.
+	struct StaticBatch {
+		GeometryArena::Allocation geometry;
+		uint32_t materialIndex;
+		uint32_t renderPipelineIndex;
+	};
+	std::vector<StaticBatch> m_staticBatches;
+	uint32_t m_batchedPrimitiveCount = 0;
+	// Bound for all batches, with an identity model matrix
+	Node m_batchNode;
+	bool m_staticBatching = true;
+
+	// Lights, gathered along with nodes
+	std::vector<PunctualLight> m_punctualLights;
+
+	// Scene bounds
+	glm::vec3 m_boundsCenter = glm::vec3(0.0f);
+	float m_boundsRadius = 0.0f;
+
+	// Levels of detail
+	// Maximum screen-space error, in pixels, tolerated when picking a LOD
+	float m_lodErrorThreshold = 1.0f;
+
+	// Statistics
+	LoadTimings m_loadTimings;
+	uint64_t m_uploadedTextureBytes = 0;
+	// Incremented by the const draw helpers
+	mutable DrawStats m_drawStats;
+
 private:
-	uint32_t getOrCreateRenderPipelineIndex(const RenderPipelineSettings& newSettings);
-	bool isCompatible(const RenderPipelineSettings& a, const RenderPipelineSettings& b) const;
+	void drawPrimitive(wgpu::RenderPassEncoder renderPass, const MeshPrimitive& prim, uint32_t lod) const;
+	static uint32_t renderPipelineIndex(const Node& node, const MeshPrimitive& prim);
+	void drawStaticBatches(wgpu::RenderPassEncoder renderPass, uint32_t renderPipelineIndex, bool bindMaterials) const;
+
+	uint32_t getOrCreateRenderPipelineIndex(RenderPipelineSettings&& newSettings);
 };
\ No newline at end of file
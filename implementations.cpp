@@ -2,18 +2,6 @@
 
 #define WEBGPU_CPP_IMPLEMENTATION
 #include "webgpu/webgpu.hpp"
-// TinyOBJLoader
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "resource-loaders/tiny_obj_loader.h"
-// TinyGLTF
-#define TINYGLTF_IMPLEMENTATION
-#include "resource-loaders/tiny_gltf.h"
-// STB Image 
-#define STB_IMAGE_IMPLEMENTATION
-#include "resource-loaders/stb_image.h"
-// STB Image Write
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "resource-loaders/stb_image_write.h"
 // WebGPU Standard Utils
 #define WEBGPU_STD_UTILS_IMPLEMENTATION
-#include "webgpu-utils/webgpu-std-utils.hpp"
\ No newline at end of file
+#include "webgpu-utils/webgpu-std-utils.hpp"
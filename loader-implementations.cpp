@@ -0,0 +1,14 @@
+// Kept apart from implementations.cpp, for tools that do not use WebGPU
+
+// TinyOBJLoader
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "resource-loaders/tiny_obj_loader.h"
+// TinyGLTF
+#define TINYGLTF_IMPLEMENTATION
+#include "resource-loaders/tiny_gltf.h"
+// STB Image 
+#define STB_IMAGE_IMPLEMENTATION
+#include "resource-loaders/stb_image.h"
+// STB Image Write
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "resource-loaders/stb_image_write.h"
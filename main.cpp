@@ -1,9 +1,106 @@
 #include "application.h"
+#include "stress-scene.h"
 
-int main()
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void printUsage(const char* program)
+{
+	std::cout
+		<< "Usage: " << program << " [options] [scene.gltf | stress:<key>=<value>,...]" << std::endl
+		<< "  --headless            Render offscreen, without window nor display" << std::endl
+		<< "  --headless-ui         Draw the UI in headless mode too" << std::endl
+		<< "  --size <W>x<H>        Size of the offscreen target (default 1280x720)" << std::endl
+		<< "  --frames <N>          Frames rendered in headless mode (default 1)" << std::endl
+		<< "  --output <file.png>   Image the last headless frame is written to" << std::endl
+		<< "  --fallback-adapter    Use a software adapter, e.g. lavapipe" << std::endl
+		<< "  --trace <file.json>   Record CPU scopes from startup to a Chrome trace" << std::endl
+		<< "  --metrics <file>      Log per-frame metrics as JSON lines, summarized at exit" << std::endl
+		<< "  --memory-budget <MiB> Warn about scenes that would exceed this GPU memory" << std::endl
+		<< "  --refuse-over-budget  Refuse to load such scenes instead" << std::endl
+		<< "Keys of generated stress scenes:" << std::endl
+		<< StressScene::describeKeys();
+}
+
+// Returns false if the command line is invalid
+static bool parseArguments(int argc, char* argv[], Application::LaunchOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (std::strcmp(arg, "--headless") == 0)
+		{
+			options.headless = true;
+		}
+		else if (std::strcmp(arg, "--headless-ui") == 0)
+		{
+			options.headlessUi = true;
+		}
+		else if (std::strcmp(arg, "--fallback-adapter") == 0)
+		{
+			options.forceFallbackAdapter = true;
+		}
+		else if (std::strcmp(arg, "--size") == 0 && hasValue)
+		{
+			unsigned int width, height;
+			if (std::sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) return false;
+			options.width = width;
+			options.height = height;
+		}
+		else if (std::strcmp(arg, "--frames") == 0 && hasValue)
+		{
+			int frameCount = std::atoi(argv[++i]);
+			if (frameCount <= 0) return false;
+			options.frameCount = static_cast<uint32_t>(frameCount);
+		}
+		else if (std::strcmp(arg, "--output") == 0 && hasValue)
+		{
+			options.outputPath = argv[++i];
+		}
+		else if (std::strcmp(arg, "--trace") == 0 && hasValue)
+		{
+			options.cpuTracePath = argv[++i];
+		}
+		else if (std::strcmp(arg, "--metrics") == 0 && hasValue)
+		{
+			options.metricsPath = argv[++i];
+		}
+		else if (std::strcmp(arg, "--memory-budget") == 0 && hasValue)
+		{
+			int budget = std::atoi(argv[++i]);
+			if (budget <= 0) return false;
+			options.gpuMemoryBudgetMiB = static_cast<uint32_t>(budget);
+		}
+		else if (std::strcmp(arg, "--refuse-over-budget") == 0)
+		{
+			options.refuseOverBudget = true;
+		}
+		else if (arg[0] != '-')
+		{
+			options.scenePath = arg;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
 {
+	Application::LaunchOptions options;
+	if (!parseArguments(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
 	Application app;
-	if (!app.onInit()) return 1;
+	if (!app.onInit(options)) return 1;
 
 #ifdef __EMSCRIPTEN__
 	auto callback = [](void* arg)
@@ -17,6 +114,7 @@ int main()
 	{
 		app.onFrame();
 	}
+	app.onFinish();
 #endif // __EMSCRIPTEN__
-	return 0;
-}
\ No newline at end of file
+	return app.hasFailed() ? 1 : 0;
+}
@@ -0,0 +1,331 @@
+#include "application.h"
+#include "allocation-tracker.h"
+
+#include "resource-loaders/json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Scripted benchmark: renders each scene given on the command line offscreen,
+ * with the camera orbiting around it, and reports load and frame timings as
+ * JSON. Warm-up frames are rendered but not measured.
+ */
+
+using json = nlohmann::json;
+
+struct BenchOptions {
+	Application::LaunchOptions launch;
+	uint32_t warmUpFrameCount = 30;
+	uint32_t measuredFrameCount = 300;
+	// Not the standard output, which the renderer logs to
+	std::string reportPath = "mega-bench.json";
+	// Fail if a measured frame allocates on the heap
+	bool expectNoAllocations = false;
+	std::vector<std::string> scenePaths;
+};
+
+static void printUsage(const char* program)
+{
+	std::cerr
+		<< "Usage: " << program << " [options] scene.gltf [scene.gltf...]" << std::endl
+		<< "Scenes can also be generated, as stress:<key>=<value>,... (see mega-stress-scene)" << std::endl
+		<< "  --size <W>x<H>        Size of the offscreen target (default 1280x720)" << std::endl
+		<< "  --warm-up <N>         Frames rendered before measuring (default 30)" << std::endl
+		<< "  --frames <N>          Frames measured per scene (default 300)" << std::endl
+		<< "  --output <file.json>  Where the report is written (default mega-bench.json)" << std::endl
+		<< "  --fallback-adapter    Use a software adapter, e.g. lavapipe" << std::endl
+		<< "  --ui                  Draw the UI too, as it looks without input" << std::endl
+		<< "  --trace <file.json>   Record CPU scopes of the whole run to a Chrome trace" << std::endl
+		<< "  --metrics <file>      Log per-frame metrics of the whole run as JSON lines" << std::endl
+		<< "  --memory-budget <MiB> Warn about scenes that would exceed this GPU memory" << std::endl
+		<< "  --refuse-over-budget  Skip such scenes instead" << std::endl
+		<< "  --no-allocations      Fail if a measured frame allocates (debug builds)" << std::endl;
+}
+
+// Returns false if the command line is invalid
+static bool parseArguments(int argc, char* argv[], BenchOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (std::strcmp(arg, "--fallback-adapter") == 0)
+		{
+			options.launch.forceFallbackAdapter = true;
+		}
+		else if (std::strcmp(arg, "--ui") == 0)
+		{
+			options.launch.headlessUi = true;
+		}
+		else if (std::strcmp(arg, "--size") == 0 && hasValue)
+		{
+			unsigned int width, height;
+			if (std::sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) return false;
+			options.launch.width = width;
+			options.launch.height = height;
+		}
+		else if (std::strcmp(arg, "--warm-up") == 0 && hasValue)
+		{
+			int frameCount = std::atoi(argv[++i]);
+			if (frameCount < 0) return false;
+			options.warmUpFrameCount = static_cast<uint32_t>(frameCount);
+		}
+		else if (std::strcmp(arg, "--frames") == 0 && hasValue)
+		{
+			int frameCount = std::atoi(argv[++i]);
+			if (frameCount <= 0) return false;
+			options.measuredFrameCount = static_cast<uint32_t>(frameCount);
+		}
+		else if (std::strcmp(arg, "--output") == 0 && hasValue)
+		{
+			options.reportPath = argv[++i];
+		}
+		else if (std::strcmp(arg, "--trace") == 0 && hasValue)
+		{
+			options.launch.cpuTracePath = argv[++i];
+		}
+		else if (std::strcmp(arg, "--metrics") == 0 && hasValue)
+		{
+			options.launch.metricsPath = argv[++i];
+		}
+		else if (std::strcmp(arg, "--memory-budget") == 0 && hasValue)
+		{
+			int budget = std::atoi(argv[++i]);
+			if (budget <= 0) return false;
+			options.launch.gpuMemoryBudgetMiB = static_cast<uint32_t>(budget);
+		}
+		else if (std::strcmp(arg, "--refuse-over-budget") == 0)
+		{
+			options.launch.refuseOverBudget = true;
+		}
+		else if (std::strcmp(arg, "--no-allocations") == 0)
+		{
+			options.expectNoAllocations = true;
+		}
+		else if (arg[0] != '-')
+		{
+			options.scenePaths.push_back(arg);
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return !options.scenePaths.empty();
+}
+
+// Distribution of a per-frame measure, null if it has no sample
+static json summarize(std::vector<float> samples)
+{
+	if (samples.empty()) return nullptr;
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&samples](float p) {
+		size_t idx = static_cast<size_t>(std::round(p * (samples.size() - 1)));
+		return samples[idx];
+	};
+	double sum = 0.0;
+	for (float sample : samples) sum += sample;
+	return {
+		{ "min", samples.front() },
+		{ "mean", sum / samples.size() },
+		{ "p50", percentile(0.5f) },
+		{ "p95", percentile(0.95f) },
+		{ "max", samples.back() },
+		{ "samples", samples.size() },
+	};
+}
+
+// Camera orbiting once around the scene over the measured frames, with a
+// slow vertical oscillation, at a distance proportional to its size
+static Application::CameraState cameraAt(float t, float sceneRadius)
+{
+	constexpr float PI = 3.14159265358979323846f;
+	Application::CameraState state;
+	state.angles = { 2.0f * PI * t, 0.4f + 0.25f * std::sin(2.0f * PI * t) };
+	state.zoom = -std::log(std::max(2.5f * sceneRadius, 1e-3f));
+	return state;
+}
+
+static json benchmarkScene(Application& app, const BenchOptions& options, const std::string& scenePath)
+{
+	json report;
+	report["scene"]["path"] = scenePath;
+
+	if (!app.loadScene(scenePath))
+	{
+		report["error"] = "Could not load scene";
+		return report;
+	}
+	const float sceneRadius = app.sceneBoundsRadius();
+
+	std::vector<float> cpuFrameTimes, cpuEncodeTimes, gpuFrameTimes, drawCallCounts, heapAllocationCounts;
+	uint32_t allocatingFrameCount = 0;
+	uint64_t lastGpuSampleCount = app.m_renderStats.gpuFrameTimeSampleCount;
+	const uint32_t frameCount = options.warmUpFrameCount + options.measuredFrameCount;
+	for (uint32_t frame = 0; frame < frameCount; ++frame)
+	{
+		// Warm-up frames already follow the path, from its end
+		const int32_t measuredFrame = static_cast<int32_t>(frame) - static_cast<int32_t>(options.warmUpFrameCount);
+		float t = static_cast<float>(measuredFrame) / options.measuredFrameCount;
+		app.setCameraState(cameraAt(t, sceneRadius));
+
+		auto frameStart = std::chrono::steady_clock::now();
+		app.onFrame();
+		float cpuFrameTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+
+		// The first frame waits for pipeline compilation
+		if (frame == 0)
+		{
+			report["load"]["firstFrameMs"] = cpuFrameTimeMs;
+		}
+		if (measuredFrame < 0) continue;
+
+		const Application::RenderStats& stats = app.m_renderStats;
+		cpuFrameTimes.push_back(cpuFrameTimeMs);
+		cpuEncodeTimes.push_back(stats.cpuEncodeTimeMs);
+		drawCallCounts.push_back(static_cast<float>(stats.draws.drawCalls));
+		heapAllocationCounts.push_back(static_cast<float>(stats.heapAllocations));
+		if (stats.heapAllocations > 0) ++allocatingFrameCount;
+		// GPU timings arrive a few frames late, and only once each
+		if (stats.gpuFrameTimeSampleCount != lastGpuSampleCount)
+		{
+			gpuFrameTimes.push_back(stats.gpuFrameTimeMs);
+			lastGpuSampleCount = stats.gpuFrameTimeSampleCount;
+		}
+	}
+
+	const Application::RenderStats& stats = app.m_renderStats;
+	report["load"]["parseMs"] = stats.load.parseMs;
+	report["load"]["imageDecodeMs"] = stats.load.imageDecodeMs;
+	report["load"]["texturesMs"] = stats.load.scene.texturesMs;
+	report["load"]["materialsMs"] = stats.load.scene.materialsMs;
+	report["load"]["nodesMs"] = stats.load.scene.nodesMs;
+	report["load"]["drawCallsMs"] = stats.load.scene.drawCallsMs;
+	report["load"]["staticBatchesMs"] = stats.load.scene.staticBatchesMs;
+	report["load"]["pipelineCreationMs"] = stats.load.pipelineCreationMs;
+
+	report["frames"]["cpuFrameMs"] = summarize(cpuFrameTimes);
+	report["frames"]["cpuEncodeMs"] = summarize(cpuEncodeTimes);
+	report["frames"]["gpuFrameMs"] = summarize(gpuFrameTimes);
+	report["frames"]["drawCalls"] = summarize(drawCallCounts);
+	if (AllocationTracker::ENABLED)
+	{
+		report["frames"]["heapAllocations"] = summarize(heapAllocationCounts);
+		report["frames"]["allocatingFrames"] = allocatingFrameCount;
+	}
+	// Rolling statistics over the last frames, per pass
+	report["frames"]["gpuPasses"] = json::object();
+	for (const GpuProfiler::ScopeStats& scope : stats.gpuScopes)
+	{
+		report["frames"]["gpuPasses"][scope.name] = {
+			{ "min", scope.minMs },
+			{ "avg", scope.avgMs },
+			{ "max", scope.maxMs },
+		};
+	}
+
+	report["scene"]["punctualLights"] = stats.punctualLightCount;
+	report["scene"]["cachedPipelines"] = stats.cachedPipelineCount;
+	report["scene"]["shaderVariants"] = stats.shaderVariantCount;
+	report["scene"]["staticBatches"] = stats.staticBatchCount;
+	report["scene"]["batchedPrimitives"] = stats.batchedPrimitiveCount;
+
+	report["memory"] = {
+		{ "geometryBytes", stats.geometryBytes },
+		{ "uniformPoolReservedBytes", stats.uniformPool.reservedBytes },
+		{ "uniformPoolUsedBytes", stats.uniformPool.usedBytes },
+		{ "uniformPoolPages", stats.uniformPool.pageCount },
+		{ "gpuBytes", stats.gpuMemory.totalBytes },
+		// Since the start of the run, not only this scene
+		{ "gpuPeakBytes", stats.gpuMemory.peakTotalBytes },
+	};
+	for (uint32_t categoryIdx = 0; categoryIdx < GpuMemory::CATEGORY_COUNT; ++categoryIdx)
+	{
+		report["memory"]["gpuCategories"][GpuMemory::categoryName(static_cast<GpuMemory::Category>(categoryIdx))] = {
+			{ "bytes", stats.gpuMemory.usedBytes[categoryIdx] },
+			{ "peakBytes", stats.gpuMemory.peakBytes[categoryIdx] },
+		};
+	}
+	return report;
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options;
+	if (!parseArguments(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	if (options.expectNoAllocations && !AllocationTracker::ENABLED)
+	{
+		std::cerr << "--no-allocations needs a build that tracks allocations, e.g. a debug build" << std::endl;
+		// Which CTest reports as skipped, see CMakeLists.txt
+		return 77;
+	}
+
+	// Frames are driven below, none is saved
+	options.launch.headless = true;
+	options.launch.frameCount = 0;
+	options.launch.outputPath.clear();
+	// Starts with the small default scene, so that every benchmarked scene is
+	// loaded, and reported when it fails, the same way
+	options.launch.scenePath.clear();
+
+	Application app;
+	if (!app.onInit(options.launch)) return 1;
+
+	json report;
+	report["config"] = {
+		{ "width", options.launch.width },
+		{ "height", options.launch.height },
+		{ "warmUpFrames", options.warmUpFrameCount },
+		{ "measuredFrames", options.measuredFrameCount },
+		{ "fallbackAdapter", options.launch.forceFallbackAdapter },
+		{ "ui", options.launch.headlessUi },
+		{ "gpuTimingAvailable", app.m_renderStats.gpuTimingAvailable },
+		{ "allocationTracking", AllocationTracker::ENABLED },
+	};
+#ifdef NDEBUG
+	report["config"]["build"] = "release";
+#else
+	report["config"]["build"] = "debug";
+#endif
+
+	report["scenes"] = json::array();
+	bool hasAllocatingFrames = false;
+	for (size_t sceneIdx = 0; sceneIdx < options.scenePaths.size(); ++sceneIdx)
+	{
+		json sceneReport = benchmarkScene(app, options, options.scenePaths[sceneIdx]);
+		// Scenes that failed to load have no frames
+		const uint32_t allocatingFrameCount = sceneReport.contains("frames") ? sceneReport["frames"].value("allocatingFrames", 0u) : 0;
+		if (options.expectNoAllocations && allocatingFrameCount > 0)
+		{
+			std::cerr << allocatingFrameCount << " of " << options.measuredFrameCount << " measured frames allocated on the heap with "
+				<< options.scenePaths[sceneIdx] << ", record a trace with --trace to find where" << std::endl;
+			hasAllocatingFrames = true;
+		}
+		report["scenes"].push_back(sceneReport);
+	}
+	app.onFinish();
+
+	std::ofstream file(options.reportPath);
+	if (!file)
+	{
+		std::cerr << "Could not write " << options.reportPath << std::endl;
+		return 1;
+	}
+	file << report.dump(2) << std::endl;
+	std::cout << "Wrote " << options.reportPath << std::endl;
+	return hasAllocatingFrames ? 1 : 0;
+}
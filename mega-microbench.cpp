@@ -0,0 +1,391 @@
+#include "micro-benchmark.h"
+
+#include "resource-loaders/tiny_gltf.h"
+
+#include "cpu-profiler.h"
+#include "resource-manager.h"
+#include "geometry-arena.h"
+#include "mesh-simplifier.h"
+#include "pipeline-key.h"
+
+#include <glm/glm/glm.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * CPU microbenchmarks of the loader and scene-build hot paths, on synthetic
+ * inputs of several sizes. Nothing here needs a GPU device: the functions
+ * that upload what they compute are measured on their CPU part only.
+ */
+
+using VertexAttributes = ResourceManager::VertexAttributes;
+using path = std::filesystem::path;
+
+struct MicroBenchOptions {
+	std::string filter;
+	std::string reportPath;
+	double minBatchTime = 0.05;
+};
+
+static void printUsage(const char* program)
+{
+	std::cerr
+		<< "Usage: " << program << " [options]" << std::endl
+		<< "  --filter <text>       Only run benchmarks whose name contains text" << std::endl
+		<< "  --min-time <ms>       Minimum duration of a timed batch (default 50)" << std::endl
+		<< "  --output <file.json>  Also write the results as JSON" << std::endl;
+}
+
+// Returns false if the command line is invalid
+static bool parseArguments(int argc, char* argv[], MicroBenchOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (std::strcmp(arg, "--filter") == 0 && hasValue)
+		{
+			options.filter = argv[++i];
+		}
+		else if (std::strcmp(arg, "--min-time") == 0 && hasValue)
+		{
+			double minTimeMs = std::atof(argv[++i]);
+			if (minTimeMs <= 0.0) return false;
+			options.minBatchTime = minTimeMs * 1e-3;
+		}
+		else if (std::strcmp(arg, "--output") == 0 && hasValue)
+		{
+			options.reportPath = argv[++i];
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Indexed grid of n x n quads over [0,1]^2, with a wavy height so that
+// simplification has to measure its error instead of collapsing a plane
+struct Grid {
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> uvs;
+	std::vector<uint32_t> indices;
+};
+
+static Grid makeGrid(uint32_t n)
+{
+	Grid grid;
+	for (uint32_t j = 0; j <= n; ++j)
+	{
+		for (uint32_t i = 0; i <= n; ++i)
+		{
+			glm::vec2 uv = glm::vec2(i, j) / static_cast<float>(n);
+			float height = 0.05f * std::sin(12.0f * uv.x) * std::cos(9.0f * uv.y);
+			grid.positions.push_back({ uv.x, height, uv.y });
+			grid.normals.push_back(glm::normalize(glm::vec3(-0.6f * std::cos(12.0f * uv.x) * std::cos(9.0f * uv.y), 1.0f, 0.45f * std::sin(12.0f * uv.x) * std::sin(9.0f * uv.y))));
+			grid.uvs.push_back(uv);
+		}
+	}
+	for (uint32_t j = 0; j < n; ++j)
+	{
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			uint32_t v00 = j * (n + 1) + i;
+			uint32_t v01 = v00 + 1;
+			uint32_t v10 = v00 + n + 1;
+			uint32_t v11 = v10 + 1;
+			grid.indices.insert(grid.indices.end(), { v00, v10, v01, v01, v10, v11 });
+		}
+	}
+	return grid;
+}
+
+// Same layout as loadGeometryFromObj produces: one vertex per corner
+static std::vector<VertexAttributes> makeTriangleSoup(const Grid& grid)
+{
+	std::vector<VertexAttributes> vertexData(grid.indices.size());
+	for (size_t i = 0; i < grid.indices.size(); ++i)
+	{
+		uint32_t idx = grid.indices[i];
+		vertexData[i].position = grid.positions[idx];
+		vertexData[i].normal = grid.normals[idx];
+		vertexData[i].uv = grid.uvs[idx];
+		vertexData[i].worldColor = glm::vec3(1.0f);
+		vertexData[i].objectColor = glm::vec3(1.0f);
+	}
+	return vertexData;
+}
+
+static bool writeObj(const path& filePath, const Grid& grid)
+{
+	std::ofstream file(filePath);
+	if (!file) return false;
+	for (const glm::vec3& p : grid.positions) file << "v " << p.x << " " << p.y << " " << p.z << "\n";
+	for (const glm::vec3& n : grid.normals) file << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+	for (const glm::vec2& uv : grid.uvs) file << "vt " << uv.x << " " << uv.y << "\n";
+	for (size_t i = 0; i < grid.indices.size(); i += 3)
+	{
+		file << "f";
+		for (size_t k = 0; k < 3; ++k)
+		{
+			uint32_t idx = grid.indices[i + k] + 1;
+			file << " " << idx << "/" << idx << "/" << idx;
+		}
+		file << "\n";
+	}
+	return static_cast<bool>(file);
+}
+
+// One mesh with positions, normals, texture coordinates and 32-bit indices,
+// with its buffer embedded (.gltf) or in the binary chunk (.glb)
+static bool writeGltf(const path& filePath, const Grid& grid, bool writeBinary)
+{
+	using namespace tinygltf;
+
+	Model model;
+	model.asset.version = "2.0";
+	Buffer buffer;
+	auto addView = [&](const void* data, size_t byteSize, int target) {
+		BufferView view;
+		view.buffer = 0;
+		view.byteOffset = buffer.data.size();
+		view.byteLength = byteSize;
+		view.target = target;
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+		buffer.data.insert(buffer.data.end(), bytes, bytes + byteSize);
+		model.bufferViews.push_back(view);
+		return static_cast<int>(model.bufferViews.size() - 1);
+	};
+	auto addAccessor = [&](int view, int componentType, size_t count, int type) {
+		Accessor accessor;
+		accessor.bufferView = view;
+		accessor.componentType = componentType;
+		accessor.count = count;
+		accessor.type = type;
+		model.accessors.push_back(accessor);
+		return static_cast<int>(model.accessors.size() - 1);
+	};
+
+	const size_t vertexCount = grid.positions.size();
+	Primitive prim;
+	prim.mode = TINYGLTF_MODE_TRIANGLES;
+	prim.attributes["POSITION"] = addAccessor(
+		addView(grid.positions.data(), vertexCount * sizeof(glm::vec3), TINYGLTF_TARGET_ARRAY_BUFFER),
+		TINYGLTF_COMPONENT_TYPE_FLOAT, vertexCount, TINYGLTF_TYPE_VEC3);
+	model.accessors.back().minValues = { 0.0, -0.05, 0.0 };
+	model.accessors.back().maxValues = { 1.0, 0.05, 1.0 };
+	prim.attributes["NORMAL"] = addAccessor(
+		addView(grid.normals.data(), vertexCount * sizeof(glm::vec3), TINYGLTF_TARGET_ARRAY_BUFFER),
+		TINYGLTF_COMPONENT_TYPE_FLOAT, vertexCount, TINYGLTF_TYPE_VEC3);
+	prim.attributes["TEXCOORD_0"] = addAccessor(
+		addView(grid.uvs.data(), vertexCount * sizeof(glm::vec2), TINYGLTF_TARGET_ARRAY_BUFFER),
+		TINYGLTF_COMPONENT_TYPE_FLOAT, vertexCount, TINYGLTF_TYPE_VEC2);
+	prim.indices = addAccessor(
+		addView(grid.indices.data(), grid.indices.size() * sizeof(uint32_t), TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER),
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, grid.indices.size(), TINYGLTF_TYPE_SCALAR);
+	model.buffers.push_back(buffer);
+
+	Mesh mesh;
+	mesh.primitives.push_back(prim);
+	model.meshes.push_back(mesh);
+	Node node;
+	node.mesh = 0;
+	model.nodes.push_back(node);
+	Scene scene;
+	scene.nodes.push_back(0);
+	model.scenes.push_back(scene);
+	model.defaultScene = 0;
+
+	TinyGLTF writer;
+	return writer.WriteGltfSceneToFile(&model, filePath.string(), false, true, false, writeBinary);
+}
+
+static void benchmarkMipMaps(MicroBenchmark& bench)
+{
+	std::mt19937 rng(42);
+	for (uint32_t size : { 256u, 1024u, 4096u })
+	{
+		std::vector<unsigned char> level0(4 * size * size);
+		for (unsigned char& value : level0) value = static_cast<unsigned char>(rng());
+		std::vector<unsigned char> level1(level0.size() / 4);
+		const std::string name = "mip-downsample/" + std::to_string(size);
+		bench.run(name, level0.size(), [&]() {
+			ResourceManager::downsampleMipLevel(level0.data(), size, size / 2, size / 2, level1.data());
+			MicroBenchmark::doNotOptimize(level1.data());
+		});
+	}
+}
+
+static void benchmarkTangentFrames(MicroBenchmark& bench)
+{
+	for (uint32_t n : { 16u, 64u, 256u })
+	{
+		// Normals are kept as they are, so running in place is idempotent
+		std::vector<VertexAttributes> vertexData = makeTriangleSoup(makeGrid(n));
+		const std::string name = "tangent-frames/" + std::to_string(vertexData.size() / 3) + "-triangles";
+		bench.run(name, vertexData.size() * sizeof(VertexAttributes), [&]() {
+			ResourceManager::populateTextureFrameAttributes(vertexData);
+			MicroBenchmark::doNotOptimize(vertexData.data());
+		});
+	}
+}
+
+// Simplification is what initDrawCalls spends its CPU time on, the rest of
+// it uploads to the geometry arena
+static void benchmarkLodChain(MicroBenchmark& bench)
+{
+	for (uint32_t n : { 32u, 128u, 256u })
+	{
+		Grid grid = makeGrid(n);
+		const std::string name = "lod-chain/" + std::to_string(grid.indices.size() / 3) + "-triangles";
+		bench.run(name, grid.indices.size() * sizeof(uint32_t), [&]() {
+			std::vector<MeshSimplifier::Lod> lods = MeshSimplifier::generateLodChain(grid.positions, grid.indices, 4);
+			MicroBenchmark::doNotOptimize(lods.data());
+		});
+	}
+}
+
+// Same key as GpuScene::getOrCreateRenderPipelineIndex builds
+static RenderPipelineKey makePipelineKey(const GeometryArena::VertexBufferLayouts& layouts, uint32_t variant)
+{
+	RenderPipelineKey key;
+	for (const wgpu::VertexBufferLayout& layout : layouts)
+	{
+		key.addVertexBufferLayout(layout);
+	}
+	key.add(static_cast<uint64_t>(WGPUPrimitiveTopology_TriangleList));
+	key.add(variant >> 1); // material features
+	key.add(static_cast<uint64_t>((variant & 1) ? WGPUFrontFace_CW : WGPUFrontFace_CCW));
+	key.add(static_cast<uint64_t>(WGPUCullMode_Back));
+	return key;
+}
+
+static void benchmarkPipelineKeys(MicroBenchmark& bench)
+{
+	const GeometryArena::VertexBufferLayouts layouts = GeometryArena::vertexBufferLayouts();
+	for (uint32_t variantCount : { 8u, 64u, 512u })
+	{
+		PipelineKeyMap<uint32_t> map;
+		for (uint32_t variant = 0; variant < variantCount; ++variant)
+		{
+			map.insert(makePipelineKey(layouts, variant), variant);
+		}
+
+		// One lookup per primitive, most of which hit an existing pipeline
+		uint32_t variant = 0;
+		bench.run("pipeline-key-lookup/" + std::to_string(variantCount) + "-variants", 0, [&]() {
+			RenderPipelineKey key = makePipelineKey(layouts, variant);
+			const uint32_t* idx = map.find(key);
+			MicroBenchmark::doNotOptimize(idx);
+			variant = (variant + 1) % variantCount;
+		});
+
+		bench.run("pipeline-key-build-map/" + std::to_string(variantCount) + "-variants", 0, [&]() {
+			PipelineKeyMap<uint32_t> newMap;
+			for (uint32_t v = 0; v < variantCount; ++v)
+			{
+				newMap.insert(makePipelineKey(layouts, v), v);
+			}
+			MicroBenchmark::doNotOptimize(newMap.size());
+		});
+	}
+}
+
+// Scopes are opened many times per frame, they should stay well under 50 ns
+static void benchmarkCpuProfiler(MicroBenchmark& bench)
+{
+	bench.run("cpu-profiler-scope/not-recording", 0, [&]() {
+		CPU_PROFILE_SCOPE("Benchmark");
+	});
+
+	CpuProfiler::setRecording(true);
+	bench.run("cpu-profiler-scope/recording", 0, [&]() {
+		CPU_PROFILE_SCOPE("Benchmark");
+	});
+	CpuProfiler::setRecording(false);
+	CpuProfiler::clear();
+}
+
+static void benchmarkLoaders(MicroBenchmark& bench, const path& directory)
+{
+	for (uint32_t n : { 16u, 64u, 256u })
+	{
+		Grid grid = makeGrid(n);
+		const std::string suffix = "/" + std::to_string(grid.indices.size() / 3) + "-triangles";
+
+		path objPath = directory / ("grid-" + std::to_string(n) + ".obj");
+		if (writeObj(objPath, grid))
+		{
+			std::vector<VertexAttributes> vertexData;
+			bench.run("load-obj" + suffix, std::filesystem::file_size(objPath), [&]() {
+				ResourceManager::loadGeometryFromObj(objPath, vertexData);
+				MicroBenchmark::doNotOptimize(vertexData.data());
+			});
+		}
+		else
+		{
+			std::cerr << "Could not write " << objPath << std::endl;
+		}
+
+		for (bool writeBinary : { false, true })
+		{
+			path gltfPath = directory / ("grid-" + std::to_string(n) + (writeBinary ? ".glb" : ".gltf"));
+			if (!writeGltf(gltfPath, grid, writeBinary))
+			{
+				std::cerr << "Could not write " << gltfPath << std::endl;
+				continue;
+			}
+			bench.run((writeBinary ? "load-glb" : "load-gltf") + suffix, std::filesystem::file_size(gltfPath), [&]() {
+				tinygltf::Model model;
+				ResourceManager::loadGeometryFromGltf(gltfPath, model);
+				MicroBenchmark::doNotOptimize(model.buffers.data());
+			});
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	MicroBenchOptions options;
+	if (!parseArguments(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	MicroBenchmark bench;
+	bench.setFilter(options.filter);
+	bench.setMinBatchTime(options.minBatchTime);
+
+	benchmarkMipMaps(bench);
+	benchmarkTangentFrames(bench);
+	benchmarkLodChain(bench);
+	benchmarkPipelineKeys(bench);
+	benchmarkCpuProfiler(bench);
+
+	std::error_code error;
+	path directory = std::filesystem::temp_directory_path(error) / "mega-microbench";
+	std::filesystem::create_directories(directory, error);
+	if (error)
+	{
+		std::cerr << "Could not create " << directory << ", skipping loader benchmarks" << std::endl;
+	}
+	else
+	{
+		benchmarkLoaders(bench, directory);
+		std::filesystem::remove_all(directory, error);
+	}
+
+	if (!options.reportPath.empty() && !bench.writeJson(options.reportPath)) return 1;
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include "stress-scene.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+/**
+ * Writes a generated stress scene to a .glb or .gltf file, for tools that
+ * only read files or to keep a scene fixed across versions of the generator.
+ */
+
+static void printUsage(const char* program)
+{
+	std::cerr
+		<< "Usage: " << program << " [<key>=<value>[,...]...] output.glb|output.gltf" << std::endl
+		<< StressScene::describeKeys();
+}
+
+int main(int argc, char* argv[])
+{
+	StressScene::Parameters parameters;
+	std::string outputPath;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (arg.find('=') != std::string::npos)
+		{
+			if (!StressScene::parse(arg, parameters))
+			{
+				printUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if (outputPath.empty() && arg[0] != '-')
+		{
+			outputPath = arg;
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (outputPath.empty())
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	tinygltf::Model model = StressScene::generate(parameters);
+	float generateTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	if (!StressScene::write(model, outputPath)) return 1;
+	float writeTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout
+		<< "Wrote " << outputPath << ": "
+		<< model.nodes.size() << " nodes, "
+		<< model.meshes.size() << " meshes, "
+		<< model.materials.size() << " materials, "
+		<< model.images.size() << " textures "
+		<< "(generated in " << generateTimeMs << " ms, written in " << writeTimeMs << " ms)" << std::endl;
+	return 0;
+}
@@ -0,0 +1,306 @@
+#include "mesh-simplifier.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <limits>
+#include <cstring>
+#include <cmath>
+
+using glm::vec3;
+
+namespace {
+
+// Symmetric 4x4 matrix representing the sum of squared distances to a set
+// of planes, weighted by the area of the triangle each plane comes from.
+// Doubles are used because positions far from the origin make the constant
+// term large enough to cancel out the smaller ones in single precision.
+struct Quadric {
+	double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+	double b0 = 0, b1 = 0, b2 = 0;
+	double c = 0;
+	double weight = 0;
+
+	void addPlane(const vec3& n, float d, float w) {
+		a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+		a11 += w * n.y * n.y; a12 += w * n.y * n.z;
+		a22 += w * n.z * n.z;
+		b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+		c += w * d * d;
+		weight += w;
+	}
+
+	void add(const Quadric& q) {
+		a00 += q.a00; a01 += q.a01; a02 += q.a02;
+		a11 += q.a11; a12 += q.a12;
+		a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2;
+		c += q.c;
+		weight += q.weight;
+	}
+
+	// Mean squared distance of p to the planes
+	double evaluate(const vec3& p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double r =
+			a00 * x * x + a11 * y * y + a22 * z * z
+			+ 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+			+ 2 * (b0 * x + b1 * y + b2 * z)
+			+ c;
+		return weight > 0 ? std::max(r, 0.0) / weight : 0.0;
+	}
+
+	static Quadric sum(const Quadric& a, const Quadric& b) {
+		Quadric q = a;
+		q.add(b);
+		return q;
+	}
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	double error;
+};
+
+struct PositionHash {
+	size_t operator()(const vec3& p) const {
+		uint32_t bits[3];
+		std::memcpy(bits, &p, sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	}
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+	return a < b
+		? (static_cast<uint64_t>(a) << 32) | b
+		: (static_cast<uint64_t>(b) << 32) | a;
+}
+
+// Lock vertices that must not move: those that share their position with
+// another vertex (normal/UV seams) and those on open or non-manifold edges.
+std::vector<uint8_t> computeLockedVertices(const std::vector<vec3>& positions, const std::vector<uint32_t>& indices) {
+	std::vector<uint8_t> locked(positions.size(), 0);
+
+	std::vector<uint8_t> referenced(positions.size(), 0);
+	for (uint32_t idx : indices) referenced[idx] = 1;
+
+	std::unordered_map<vec3, uint32_t, PositionHash> firstVertexAtPosition;
+	firstVertexAtPosition.reserve(positions.size());
+	for (uint32_t v = 0; v < positions.size(); ++v) {
+		if (!referenced[v]) continue;
+		auto [it, inserted] = firstVertexAtPosition.emplace(positions[v], v);
+		if (!inserted) {
+			locked[v] = 1;
+			locked[it->second] = 1;
+		}
+	}
+
+	std::vector<uint64_t> edges;
+	edges.reserve(indices.size());
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		for (int k = 0; k < 3; ++k) {
+			edges.push_back(edgeKey(indices[t + k], indices[t + (k + 1) % 3]));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size();) {
+		size_t j = i;
+		while (j < edges.size() && edges[j] == edges[i]) ++j;
+		if (j - i != 2) {
+			locked[static_cast<uint32_t>(edges[i] >> 32)] = 1;
+			locked[static_cast<uint32_t>(edges[i] & 0xffffffff)] = 1;
+		}
+		i = j;
+	}
+
+	return locked;
+}
+
+// Reject collapses that would flip or squash one of the remaining triangles
+// around 'from'.
+bool collapseFlipsTriangles(
+	const Collapse& collapse,
+	const std::vector<vec3>& positions,
+	const std::vector<uint32_t>& indices,
+	const std::vector<uint32_t>& adjacencyOffsets,
+	const std::vector<uint32_t>& adjacency
+) {
+	for (uint32_t i = adjacencyOffsets[collapse.from]; i < adjacencyOffsets[collapse.from + 1]; ++i) {
+		const uint32_t* tri = &indices[3 * adjacency[i]];
+		if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) continue;
+
+		vec3 p[3], q[3];
+		for (int k = 0; k < 3; ++k) {
+			p[k] = positions[tri[k]];
+			q[k] = tri[k] == collapse.from ? positions[collapse.to] : p[k];
+		}
+		vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+		vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+		if (glm::dot(n0, n1) <= 0.25f * glm::length(n0) * glm::length(n1)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+} // anonymous namespace
+
+float MeshSimplifier::simplify(
+	const std::vector<vec3>& positions,
+	const std::vector<uint32_t>& indices,
+	size_t targetIndexCount,
+	float maxError,
+	std::vector<uint32_t>& destination
+) {
+	destination = indices;
+	const uint32_t vertexCount = static_cast<uint32_t>(positions.size());
+	if (destination.size() <= targetIndexCount || vertexCount == 0) return 0.0f;
+
+	const std::vector<uint8_t> locked = computeLockedVertices(positions, destination);
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t + 2 < destination.size(); t += 3) {
+		const vec3& p0 = positions[destination[t + 0]];
+		const vec3& p1 = positions[destination[t + 1]];
+		const vec3& p2 = positions[destination[t + 2]];
+		vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float doubleArea = glm::length(n);
+		if (doubleArea <= 0.0f) continue;
+		n /= doubleArea;
+		float d = -glm::dot(n, p0);
+		for (int k = 0; k < 3; ++k) {
+			quadrics[destination[t + k]].addPlane(n, d, 0.5f * doubleArea);
+		}
+	}
+
+	const double maxErrorSquared = static_cast<double>(maxError) * maxError;
+	double resultError = 0.0;
+
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint8_t> touched(vertexCount);
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+
+	// Each pass performs a batch of independent collapses, cheapest first,
+	// then compacts the index buffer.
+	while (destination.size() > targetIndexCount) {
+		const uint32_t triangleCount = static_cast<uint32_t>(destination.size() / 3);
+
+		// Vertex to triangle adjacency (CSR)
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (uint32_t idx : destination) ++adjacencyOffsets[idx + 1];
+		std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+		adjacency.resize(destination.size());
+		{
+			std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (uint32_t t = 0; t < triangleCount; ++t) {
+				for (int k = 0; k < 3; ++k) {
+					adjacency[cursor[destination[3 * t + k]]++] = t;
+				}
+			}
+		}
+
+		// Candidate collapses, one per interior edge
+		collapses.clear();
+		for (uint32_t t = 0; t < triangleCount; ++t) {
+			for (int k = 0; k < 3; ++k) {
+				uint32_t a = destination[3 * t + k];
+				uint32_t b = destination[3 * t + (k + 1) % 3];
+				if (a >= b || (locked[a] && locked[b])) continue;
+				Quadric q = Quadric::sum(quadrics[a], quadrics[b]);
+				double errorAtB = locked[a] ? std::numeric_limits<double>::max() : q.evaluate(positions[b]);
+				double errorAtA = locked[b] ? std::numeric_limits<double>::max() : q.evaluate(positions[a]);
+				collapses.push_back(
+					errorAtB <= errorAtA
+					? Collapse{ a, b, errorAtB }
+					: Collapse{ b, a, errorAtA }
+				);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			return x.error < y.error;
+		});
+
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), 0);
+
+		// A collapse removes two triangles on a closed mesh
+		const size_t trianglesToRemove = (destination.size() - targetIndexCount) / 3;
+		size_t removedTriangles = 0;
+		size_t collapseCount = 0;
+		for (const Collapse& collapse : collapses) {
+			if (removedTriangles >= trianglesToRemove) break;
+			if (collapse.error > maxErrorSquared) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+			if (collapseFlipsTriangles(collapse, positions, destination, adjacencyOffsets, adjacency)) continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			resultError = std::max(resultError, collapse.error);
+
+			// Freeze the whole neighborhood so that the flip test of later
+			// collapses in this pass sees up to date positions.
+			for (uint32_t i = adjacencyOffsets[collapse.from]; i < adjacencyOffsets[collapse.from + 1]; ++i) {
+				const uint32_t* tri = &destination[3 * adjacency[i]];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+			touched[collapse.to] = 1;
+
+			removedTriangles += 2;
+			++collapseCount;
+		}
+
+		if (collapseCount == 0) break;
+
+		// Apply collapses and drop triangles that became degenerate
+		size_t writeIdx = 0;
+		for (size_t t = 0; t + 2 < destination.size(); t += 3) {
+			uint32_t a = remap[destination[t + 0]];
+			uint32_t b = remap[destination[t + 1]];
+			uint32_t c = remap[destination[t + 2]];
+			if (a == b || b == c || c == a) continue;
+			destination[writeIdx++] = a;
+			destination[writeIdx++] = b;
+			destination[writeIdx++] = c;
+		}
+		destination.resize(writeIdx);
+	}
+
+	return static_cast<float>(std::sqrt(resultError));
+}
+
+std::vector<MeshSimplifier::Lod> MeshSimplifier::generateLodChain(
+	const std::vector<vec3>& positions,
+	const std::vector<uint32_t>& indices,
+	uint32_t maxLevelCount,
+	float reduction,
+	size_t minIndexCount
+) {
+	std::vector<Lod> chain;
+	chain.reserve(maxLevelCount);
+
+	const std::vector<uint32_t>* source = &indices;
+	float accumulatedError = 0.0f;
+	for (uint32_t level = 0; level < maxLevelCount; ++level) {
+		size_t targetIndexCount = static_cast<size_t>(source->size() / 3 * reduction) * 3;
+		if (targetIndexCount < minIndexCount) break;
+
+		Lod lod;
+		float levelError = simplify(positions, *source, targetIndexCount, std::numeric_limits<float>::max(), lod.indices);
+
+		// Simplification got stuck on locked seams or borders, such a level
+		// costs memory without saving much rasterization.
+		size_t halfwayIndexCount = targetIndexCount + (source->size() - targetIndexCount) / 2;
+		if (lod.indices.empty() || lod.indices.size() > halfwayIndexCount) break;
+
+		// Each level is simplified from the previous one, so errors add up
+		accumulatedError += levelError;
+		lod.error = accumulatedError;
+		chain.push_back(std::move(lod));
+		source = &chain.back().indices;
+	}
+
+	return chain;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * Simplification of indexed triangle lists based on quadric error metrics
+ * (Garland & Heckbert).
+ *
+ * Only the index buffer is rewritten: collapses always move a vertex onto one
+ * of its neighbors, so every level of detail keeps referencing the vertex
+ * buffers of the original primitive. Vertices that lie on a mesh border or on
+ * an attribute seam (several vertices sharing the same position) are locked,
+ * which keeps silhouettes and UV islands closed across levels.
+ */
+class MeshSimplifier {
+public:
+	struct Lod {
+		std::vector<uint32_t> indices;
+		// Object-space geometric error of this level with respect to the
+		// original mesh, in the same unit as the positions: the RMS distance
+		// to the original planes of the worst collapse, summed over levels.
+		// An estimate rather than a bound on the actual (Hausdorff) distance.
+		float error = 0.0f;
+	};
+
+	// Simplify 'indices' down to at most 'targetIndexCount' indices, without
+	// exceeding 'maxError'. Returns the error of the result.
+	static float simplify(
+		const std::vector<glm::vec3>& positions,
+		const std::vector<uint32_t>& indices,
+		size_t targetIndexCount,
+		float maxError,
+		std::vector<uint32_t>& destination
+	);
+
+	// Build a chain of successively coarser levels, each one targeting
+	// 'reduction' times the index count of the previous one. The original
+	// geometry is not part of the returned chain.
+	static std::vector<Lod> generateLodChain(
+		const std::vector<glm::vec3>& positions,
+		const std::vector<uint32_t>& indices,
+		uint32_t maxLevelCount,
+		float reduction = 0.5f,
+		size_t minIndexCount = 3 * 32
+	);
+};
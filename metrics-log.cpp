@@ -0,0 +1,159 @@
+#include "metrics-log.h"
+#include "allocation-tracker.h"
+#include "cpu-profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <iostream>
+
+MetricsLog::~MetricsLog() {
+	close();
+}
+
+bool MetricsLog::open(const std::string& path) {
+	close();
+	m_file = std::fopen(path.c_str(), "w");
+	if (!m_file) {
+		std::cerr << "Could not write metrics to " << path << std::endl;
+		return false;
+	}
+	m_path = path;
+	m_readIndex = 0;
+	m_writeIndex = 0;
+	m_droppedCount = 0;
+	m_writtenCount = 0;
+	m_frameTimes = {};
+	m_cpuTimes = {};
+	m_gpuTimes = {};
+	m_stopping = false;
+	m_writer = std::thread([this]() { runWriter(); });
+	return true;
+}
+
+void MetricsLog::close() {
+	if (!m_file) return;
+	m_stopping.store(true, std::memory_order_release);
+	if (m_writer.joinable()) {
+		m_writer.join();
+	}
+	std::fclose(m_file);
+	m_file = nullptr;
+	printSummary();
+}
+
+bool MetricsLog::push(const Record& record) {
+	if (!m_file) return false;
+	const uint64_t writeIndex = m_writeIndex.load(std::memory_order_relaxed);
+	if (writeIndex - m_readIndex.load(std::memory_order_acquire) == QUEUE_CAPACITY) {
+		++m_droppedCount;
+		return false;
+	}
+	m_queue[writeIndex % QUEUE_CAPACITY] = record;
+	m_writeIndex.store(writeIndex + 1, std::memory_order_release);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+void MetricsLog::runWriter() {
+	CpuProfiler::setThreadName("Metrics log");
+	while (true) {
+		// Nothing is pushed once stopping, so an empty queue seen after is final
+		const bool stopping = m_stopping.load(std::memory_order_acquire);
+		if (drain()) continue;
+		if (stopping) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+bool MetricsLog::drain() {
+	const uint64_t writeIndex = m_writeIndex.load(std::memory_order_acquire);
+	uint64_t readIndex = m_readIndex.load(std::memory_order_relaxed);
+	if (readIndex == writeIndex) return false;
+	for (; readIndex < writeIndex; ++readIndex) {
+		write(m_queue[readIndex % QUEUE_CAPACITY]);
+		// Hand the slot back right away, so that the frame loop drops as few
+		// records as possible while we format
+		m_readIndex.store(readIndex + 1, std::memory_order_release);
+	}
+	// Records survive the process being killed, e.g. at the end of a soak test
+	std::fflush(m_file);
+	return true;
+}
+
+void MetricsLog::write(const Record& record) {
+	std::fprintf(m_file, "{\"frame\":%" PRIu64 ",\"t\":%" PRIu64 ".%06" PRIu64 ",\"frameMs\":%.3f,\"cpuMs\":%.3f",
+		record.frame,
+		record.timestampUs / 1000000,
+		record.timestampUs % 1000000,
+		record.frameMs,
+		record.cpuMs
+	);
+	if (record.hasGpuTime) {
+		std::fprintf(m_file, ",\"gpuMs\":%.3f", record.gpuMs);
+	}
+	std::fprintf(m_file, ",\"drawCalls\":%u,\"triangles\":%" PRIu64 ",\"pipelineSwitches\":%u,\"bindGroupSwitches\":%u,\"shadowCascades\":%u,\"uploadBytes\":%" PRIu64 ",\"gpuMemoryBytes\":%" PRIu64,
+		record.drawCalls,
+		record.triangles,
+		record.pipelineSwitches,
+		record.bindGroupSwitches,
+		record.shadowCascadesRendered,
+		record.uploadBytes,
+		record.gpuMemoryBytes
+	);
+	if (AllocationTracker::ENABLED) {
+		std::fprintf(m_file, ",\"heapAllocations\":%" PRIu64, record.heapAllocations);
+	}
+	std::fprintf(m_file, "}\n");
+
+	++m_writtenCount;
+	m_frameTimes.add(record.frameMs);
+	m_cpuTimes.add(record.cpuMs);
+	if (record.hasGpuTime) {
+		m_gpuTimes.add(record.gpuMs);
+	}
+}
+
+void MetricsLog::printSummary() const {
+	std::cout << "Logged " << m_writtenCount << " frames to " << m_path;
+	if (m_droppedCount > 0) {
+		std::cout << ", " << m_droppedCount << " dropped";
+	}
+	std::cout << std::endl;
+
+	auto printPercentiles = [](const char* name, const TimeHistogram& histogram) {
+		if (histogram.sampleCount == 0) return;
+		std::printf("  %-5s p50 %7.2f ms  p95 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n",
+			name, histogram.percentile(0.5f), histogram.percentile(0.95f), histogram.percentile(0.99f), histogram.maxMs);
+	};
+	printPercentiles("Frame", m_frameTimes);
+	printPercentiles("CPU", m_cpuTimes);
+	printPercentiles("GPU", m_gpuTimes);
+	std::fflush(stdout);
+}
+
+void MetricsLog::TimeHistogram::add(float ms) {
+	uint32_t bucket = 0;
+	if (ms >= MIN_MS) {
+		const float position = std::log10(ms / MIN_MS) * BUCKETS_PER_DECADE;
+		bucket = std::min(static_cast<uint32_t>(position) + 1, BUCKET_COUNT - 1);
+	}
+	++counts[bucket];
+	++sampleCount;
+	maxMs = std::max(maxMs, ms);
+}
+
+float MetricsLog::TimeHistogram::percentile(float p) const {
+	const uint64_t rank = static_cast<uint64_t>(std::round(p * (sampleCount - 1)));
+	uint64_t cumulativeCount = 0;
+	uint32_t bucket = 0;
+	for (; bucket < BUCKET_COUNT - 1; ++bucket) {
+		cumulativeCount += counts[bucket];
+		if (cumulativeCount > rank) break;
+	}
+	const float upperEdge = MIN_MS * std::pow(10.0f, static_cast<float>(bucket) / BUCKETS_PER_DECADE);
+	return std::min(upperEdge, maxMs);
+}
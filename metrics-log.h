@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+/**
+ * Appends one JSON object per frame to a file, for soak tests that outlast
+ * what the performance window shows.
+ *
+ * The frame loop only copies its record into a single-producer,
+ * single-consumer ring buffer; a background thread formats and writes them.
+ * When the writer falls behind by QUEUE_CAPACITY records, new ones are
+ * dropped and counted rather than waited for. Closing the log drains the
+ * queue and prints percentiles of the logged frame times, read from
+ * histograms so that memory stays constant however long the run.
+ */
+class MetricsLog {
+public:
+	struct Record {
+		uint64_t frame = 0;
+		// Microseconds since the Unix epoch, at the end of the frame
+		uint64_t timestampUs = 0;
+		float frameMs = 0.0f;
+		float cpuMs = 0.0f;
+		// Only set on frames that received a GPU measurement, which arrive a
+		// few frames late
+		bool hasGpuTime = false;
+		float gpuMs = 0.0f;
+		uint32_t drawCalls = 0;
+		uint64_t triangles = 0;
+		uint32_t pipelineSwitches = 0;
+		uint32_t bindGroupSwitches = 0;
+		// Shadow cascades whose cached static casters had to be drawn again
+		uint32_t shadowCascadesRendered = 0;
+		uint64_t uploadBytes = 0;
+		// All categories of GpuMemory
+		uint64_t gpuMemoryBytes = 0;
+		// Of the main thread, only written with the AllocationTracker
+		uint64_t heapAllocations = 0;
+	};
+
+	~MetricsLog();
+
+	// Truncates the file
+	bool open(const std::string& path);
+	// Write what is queued, then print the summary. Does nothing if the log
+	// is not open.
+	void close();
+	bool isOpen() const { return m_file != nullptr; }
+
+	// Never blocks, returns false if the record was dropped
+	bool push(const Record& record);
+
+	static constexpr uint32_t QUEUE_CAPACITY = 1024;
+
+private:
+	// Log-spaced buckets of milliseconds, each about 3.7% wider than the
+	// previous, from MIN_MS up to 10 s. The first and last buckets also
+	// hold what is below and above.
+	struct TimeHistogram {
+		static constexpr float MIN_MS = 0.01f;
+		static constexpr uint32_t BUCKETS_PER_DECADE = 64;
+		static constexpr uint32_t BUCKET_COUNT = 6 * BUCKETS_PER_DECADE + 1;
+
+		std::array<uint64_t, BUCKET_COUNT> counts = {};
+		uint64_t sampleCount = 0;
+		float maxMs = 0.0f;
+
+		void add(float ms);
+		// Upper edge of the bucket holding the quantile, at most maxMs
+		float percentile(float p) const;
+	};
+
+	void runWriter();
+	// Write all queued records, returns false if there was none
+	bool drain();
+	void write(const Record& record);
+	void printSummary() const;
+
+private:
+	std::FILE* m_file = nullptr;
+	std::string m_path;
+	std::thread m_writer;
+	std::atomic<bool> m_stopping{ false };
+
+	// Slots are read from m_readIndex and written at m_writeIndex, both only
+	// ever grow. Each index is modified by one thread only.
+	std::array<Record, QUEUE_CAPACITY> m_queue;
+	std::atomic<uint64_t> m_readIndex{ 0 };
+	std::atomic<uint64_t> m_writeIndex{ 0 };
+	// Only touched by the frame loop
+	uint64_t m_droppedCount = 0;
+
+	// Kept by the writer thread for the summary
+	uint64_t m_writtenCount = 0;
+	TimeHistogram m_frameTimes;
+	TimeHistogram m_cpuTimes;
+	TimeHistogram m_gpuTimes;
+};
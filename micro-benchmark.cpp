@@ -0,0 +1,73 @@
+#include "micro-benchmark.h"
+
+#include "resource-loaders/json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+void MicroBenchmark::run(const std::string& name, uint64_t bytesPerOp, const std::function<void()>& operation) {
+	if (!m_filter.empty() && name.find(m_filter) == std::string::npos) return;
+
+	// Warm caches and allocators up, and size batches from this first call
+	auto start = Clock::now();
+	operation();
+	double firstCallTime = std::chrono::duration<double>(Clock::now() - start).count();
+	uint64_t batchSize = static_cast<uint64_t>(m_minBatchTime / std::max(firstCallTime, 1e-9));
+	batchSize = std::clamp<uint64_t>(batchSize, 1, 1ull << 30);
+
+	Result result;
+	result.name = name;
+	std::vector<double> nsPerOp;
+	for (uint32_t batch = 0; batch < BATCH_COUNT; ++batch) {
+		// Grow batches that turn out too short, e.g. when the first call
+		// paid for page faults
+		double elapsed;
+		while (true) {
+			start = Clock::now();
+			for (uint64_t i = 0; i < batchSize; ++i) {
+				operation();
+			}
+			elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+			result.iterations += batchSize;
+			if (elapsed >= 0.5 * m_minBatchTime || batchSize >= (1ull << 30)) break;
+			batchSize *= 2;
+		}
+		nsPerOp.push_back(elapsed * 1e9 / batchSize);
+	}
+	std::sort(nsPerOp.begin(), nsPerOp.end());
+	result.nsPerOp = nsPerOp[nsPerOp.size() / 2];
+	result.bytesPerSecond = bytesPerOp > 0 ? bytesPerOp * 1e9 / result.nsPerOp : 0.0;
+	m_results.push_back(result);
+
+	printf("%-48s %14.1f ns/op", result.name.c_str(), result.nsPerOp);
+	if (result.bytesPerSecond > 0.0) {
+		printf(" %10.1f MB/s", result.bytesPerSecond * 1e-6);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+bool MicroBenchmark::writeJson(const std::string& path) const {
+	nlohmann::json report = nlohmann::json::array();
+	for (const Result& result : m_results) {
+		report.push_back({
+			{ "name", result.name },
+			{ "iterations", result.iterations },
+			{ "nsPerOp", result.nsPerOp },
+			{ "bytesPerSecond", result.bytesPerSecond },
+		});
+	}
+
+	std::ofstream file(path);
+	if (!file) {
+		std::cerr << "Could not write " << path << std::endl;
+		return false;
+	}
+	file << report.dump(2) << std::endl;
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Minimal harness for CPU microbenchmarks.
+ *
+ * An operation is called in batches that last at least minBatchTime, after
+ * a warm-up call. The time per operation is the median over the batches,
+ * which is less sensitive to preemption than the mean.
+ */
+class MicroBenchmark {
+public:
+	struct Result {
+		std::string name;
+		uint64_t iterations = 0;
+		double nsPerOp = 0.0;
+		// 0 when the benchmark does not declare how many bytes an operation
+		// processes
+		double bytesPerSecond = 0.0;
+	};
+
+	// Only benchmarks whose name contains filter run, all of them if empty
+	void setFilter(const std::string& filter) { m_filter = filter; }
+	void setMinBatchTime(double seconds) { m_minBatchTime = seconds; }
+
+	// Time 'operation', which processes bytesPerOp bytes of input
+	void run(const std::string& name, uint64_t bytesPerOp, const std::function<void()>& operation);
+
+	const std::vector<Result>& results() const { return m_results; }
+
+	bool writeJson(const std::string& path) const;
+
+	// Keep the compiler from optimizing away a computation whose result is
+	// otherwise unused
+	template <typename T>
+	static void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		static volatile const void* sink;
+		sink = &value;
+#endif
+	}
+
+private:
+	static constexpr uint32_t BATCH_COUNT = 7;
+
+	std::string m_filter;
+	double m_minBatchTime = 0.05;
+	std::vector<Result> m_results;
+};
@@ -0,0 +1,91 @@
+#include "offset-allocator.h"
+
+#include <cassert>
+#include <iterator>
+
+void OffsetAllocator::init(uint32_t capacity) {
+	m_capacity = capacity;
+	reset();
+}
+
+void OffsetAllocator::grow(uint32_t newCapacity) {
+	assert(newCapacity >= m_capacity);
+	if (newCapacity == m_capacity) return;
+	uint32_t oldCapacity = m_capacity;
+	m_capacity = newCapacity;
+	// Freeing the new space merges it with a free range at the end, if any
+	m_usedSize += newCapacity - oldCapacity;
+	free(oldCapacity, newCapacity - oldCapacity);
+}
+
+void OffsetAllocator::reset() {
+	m_freeByOffset.clear();
+	m_freeBySize.clear();
+	m_usedSize = 0;
+	if (m_capacity > 0) {
+		insertFreeRange(0, m_capacity);
+	}
+}
+
+uint32_t OffsetAllocator::allocate(uint32_t size) {
+	if (size == 0) return INVALID_OFFSET;
+
+	// Smallest free range that fits
+	auto bestIt = m_freeBySize.lower_bound({ size, 0 });
+	if (bestIt == m_freeBySize.end()) return INVALID_OFFSET;
+	auto [rangeSize, offset] = *bestIt;
+
+	eraseFreeRange(m_freeByOffset.find(offset));
+	if (rangeSize > size) {
+		insertFreeRange(offset + size, rangeSize - size);
+	}
+	m_usedSize += size;
+	return offset;
+}
+
+void OffsetAllocator::free(uint32_t offset, uint32_t size) {
+	if (size == 0) return;
+	assert(offset + size <= m_capacity);
+	assert(m_usedSize >= size);
+	m_usedSize -= size;
+
+	// Merge with the free range that ends where this one starts
+	auto nextIt = m_freeByOffset.lower_bound(offset);
+	if (nextIt != m_freeByOffset.begin()) {
+		auto previousIt = std::prev(nextIt);
+		assert(previousIt->first + previousIt->second <= offset); // double free
+		if (previousIt->first + previousIt->second == offset) {
+			offset = previousIt->first;
+			size += previousIt->second;
+			eraseFreeRange(previousIt);
+		}
+	}
+
+	// And with the one that starts where it ends
+	if (nextIt != m_freeByOffset.end()) {
+		assert(offset + size <= nextIt->first); // double free
+		if (offset + size == nextIt->first) {
+			size += nextIt->second;
+			eraseFreeRange(nextIt);
+		}
+	}
+
+	insertFreeRange(offset, size);
+}
+
+uint32_t OffsetAllocator::largestFreeRange() const {
+	return m_freeBySize.empty() ? 0 : m_freeBySize.rbegin()->first;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+void OffsetAllocator::insertFreeRange(uint32_t offset, uint32_t size) {
+	m_freeByOffset.emplace(offset, size);
+	m_freeBySize.emplace(size, offset);
+}
+
+void OffsetAllocator::eraseFreeRange(std::map<uint32_t, uint32_t>::iterator it) {
+	m_freeBySize.erase({ it->second, it->first });
+	m_freeByOffset.erase(it);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+
+/**
+ * Hands out ranges of a linear space (elements of a buffer) and takes them
+ * back. Allocation is best fit, and freed ranges merge with their free
+ * neighbors, so that space released by a streamed out mesh can be reused by
+ * the next one. Both are O(log n) in the number of free ranges.
+ *
+ * This only does the bookkeeping, the owner maps offsets to actual memory.
+ */
+class OffsetAllocator {
+public:
+	static constexpr uint32_t INVALID_OFFSET = ~0u;
+
+	void init(uint32_t capacity);
+	// Extend the space, e.g. after the buffer behind it was reallocated
+	void grow(uint32_t newCapacity);
+	// Free everything
+	void reset();
+
+	// INVALID_OFFSET if there is no free range of this size
+	uint32_t allocate(uint32_t size);
+	void free(uint32_t offset, uint32_t size);
+
+	uint32_t capacity() const { return m_capacity; }
+	uint32_t usedSize() const { return m_usedSize; }
+	uint32_t freeRangeCount() const { return static_cast<uint32_t>(m_freeByOffset.size()); }
+	uint32_t largestFreeRange() const;
+
+private:
+	void insertFreeRange(uint32_t offset, uint32_t size);
+	void eraseFreeRange(std::map<uint32_t, uint32_t>::iterator it);
+
+private:
+	uint32_t m_capacity = 0;
+	uint32_t m_usedSize = 0;
+	// Offset to size
+	std::map<uint32_t, uint32_t> m_freeByOffset;
+	// (size, offset), to find the best fit
+	std::set<std::pair<uint32_t, uint32_t>> m_freeBySize;
+};
@@ -0,0 +1,235 @@
+#include "pipeline-compiler.h"
+#include "cpu-profiler.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+using namespace wgpu;
+
+#ifdef WEBGPU_BACKEND_WGPU
+// A copy of a descriptor and everything it points to, so that the pipeline can
+// be created after compileAsync() returned
+struct PipelineCompiler::DescriptorStorage {
+	RenderPipelineDescriptor descriptor;
+	std::string label;
+	std::string vertexEntryPoint;
+	std::string fragmentEntryPoint;
+	std::vector<VertexBufferLayout> vertexBuffers;
+	std::vector<std::vector<VertexAttribute>> vertexAttributes;
+	FragmentState fragment;
+	std::vector<ColorTargetState> targets;
+	std::vector<BlendState> blendStates;
+	DepthStencilState depthStencil;
+
+	explicit DescriptorStorage(const RenderPipelineDescriptor& source)
+		: descriptor(source)
+	{
+		assert(source.vertex.constantCount == 0);
+		if (source.label) {
+			label = source.label;
+			descriptor.label = label.c_str();
+		}
+		if (source.vertex.entryPoint) {
+			vertexEntryPoint = source.vertex.entryPoint;
+			descriptor.vertex.entryPoint = vertexEntryPoint.c_str();
+		}
+
+		vertexBuffers.assign(source.vertex.buffers, source.vertex.buffers + source.vertex.bufferCount);
+		vertexAttributes.resize(vertexBuffers.size());
+		for (size_t i = 0; i < vertexBuffers.size(); ++i) {
+			const VertexBufferLayout& layout = vertexBuffers[i];
+			vertexAttributes[i].assign(layout.attributes, layout.attributes + layout.attributeCount);
+			vertexBuffers[i].attributes = vertexAttributes[i].data();
+		}
+		descriptor.vertex.buffers = vertexBuffers.data();
+
+		if (source.fragment) {
+			assert(source.fragment->constantCount == 0);
+			fragment = *source.fragment;
+			if (fragment.entryPoint) {
+				fragmentEntryPoint = fragment.entryPoint;
+				fragment.entryPoint = fragmentEntryPoint.c_str();
+			}
+			targets.assign(fragment.targets, fragment.targets + fragment.targetCount);
+			blendStates.resize(targets.size());
+			for (size_t i = 0; i < targets.size(); ++i) {
+				if (targets[i].blend) {
+					blendStates[i] = *targets[i].blend;
+					targets[i].blend = &blendStates[i];
+				}
+			}
+			fragment.targets = targets.data();
+			descriptor.fragment = &fragment;
+		}
+
+		if (source.depthStencil) {
+			depthStencil = *source.depthStencil;
+			descriptor.depthStencil = &depthStencil;
+		}
+
+		// The caller may release its layout before the worker gets to it
+		if (descriptor.layout) {
+			wgpuPipelineLayoutReference(descriptor.layout);
+		}
+	}
+
+	~DescriptorStorage() {
+		if (descriptor.layout) {
+			wgpuPipelineLayoutRelease(descriptor.layout);
+		}
+	}
+};
+#endif // WEBGPU_BACKEND_WGPU
+
+void PipelineCompiler::init(Device device) {
+	m_device = device;
+#ifdef WEBGPU_BACKEND_WGPU
+	m_stopping = false;
+	m_worker = std::thread([this]() { runWorker(); });
+#endif
+}
+
+void PipelineCompiler::terminate() {
+#ifdef WEBGPU_BACKEND_WGPU
+	{
+		std::lock_guard lock(m_jobMutex);
+		m_stopping = true;
+		m_jobs.clear();
+	}
+	m_jobCondition.notify_one();
+	if (m_worker.joinable()) {
+		m_worker.join();
+	}
+#elif defined(WEBGPU_BACKEND_DAWN)
+	// Callbacks refer to this object, let them fire before it goes away
+	while (m_inFlightCount > 0) {
+		m_device.tick();
+		poll();
+	}
+	m_callbacks.clear();
+#endif
+	// In a browser callbacks only fire once we return to the event loop, so
+	// pending ones are left alive
+	clear();
+	poll();
+	m_device = nullptr;
+}
+
+uint32_t PipelineCompiler::compileAsync(const RenderPipelineDescriptor& descriptor) {
+	uint32_t id = static_cast<uint32_t>(m_pipelines.size());
+	m_pipelines.push_back(nullptr);
+	m_status.push_back(Status::Pending);
+	++m_pendingCount;
+
+	uint64_t generation = m_generation;
+#ifdef WEBGPU_BACKEND_WGPU
+	{
+		std::lock_guard lock(m_jobMutex);
+		m_jobs.push_back({ generation, id, std::make_unique<DescriptorStorage>(descriptor) });
+	}
+	m_jobCondition.notify_one();
+#else
+	++m_inFlightCount;
+	m_callbacks.push_back(m_device.createRenderPipelineAsync(
+		descriptor,
+		[this, generation, id](CreatePipelineAsyncStatus status, RenderPipeline pipeline, char const* message) {
+			if (status != CreatePipelineAsyncStatus::Success) {
+				std::cerr << "Could not create render pipeline: " << (message ? message : "") << std::endl;
+				pipeline = nullptr;
+			}
+			pushResult({ generation, id, pipeline });
+		}
+	));
+#endif
+	return id;
+}
+
+void PipelineCompiler::poll() {
+	std::vector<Result> results;
+	{
+		std::lock_guard lock(m_resultMutex);
+		results.swap(m_results);
+	}
+
+	for (const Result& result : results) {
+#ifndef WEBGPU_BACKEND_WGPU
+		--m_inFlightCount;
+#endif
+		if (result.generation != m_generation) {
+			// Abandoned by clear()
+			if (result.pipeline) {
+				wgpuRenderPipelineRelease(result.pipeline);
+			}
+			continue;
+		}
+		m_pipelines[result.id] = result.pipeline;
+		m_status[result.id] = result.pipeline ? Status::Ready : Status::Failed;
+		--m_pendingCount;
+	}
+
+#ifndef WEBGPU_BACKEND_WGPU
+	if (m_inFlightCount == 0) {
+		m_callbacks.clear();
+	}
+#endif
+}
+
+RenderPipeline PipelineCompiler::pipeline(uint32_t id) const {
+	return id < m_pipelines.size() ? m_pipelines[id] : nullptr;
+}
+
+PipelineCompiler::Status PipelineCompiler::status(uint32_t id) const {
+	return id < m_status.size() ? m_status[id] : Status::Failed;
+}
+
+void PipelineCompiler::clear() {
+	for (RenderPipeline pipeline : m_pipelines) {
+		if (pipeline) {
+			pipeline.release();
+		}
+	}
+	m_pipelines.clear();
+	m_status.clear();
+	m_pendingCount = 0;
+	++m_generation;
+
+#ifdef WEBGPU_BACKEND_WGPU
+	// Jobs that did not start yet are simply dropped
+	std::lock_guard lock(m_jobMutex);
+	m_jobs.clear();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+void PipelineCompiler::pushResult(const Result& result) {
+	std::lock_guard lock(m_resultMutex);
+	m_results.push_back(result);
+}
+
+#ifdef WEBGPU_BACKEND_WGPU
+void PipelineCompiler::runWorker() {
+	CpuProfiler::setThreadName("Pipeline compiler");
+	while (true) {
+		Job job;
+		{
+			std::unique_lock lock(m_jobMutex);
+			m_jobCondition.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+			if (m_stopping) {
+				return;
+			}
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		CPU_PROFILE_SCOPE("Compile pipeline");
+		RenderPipeline pipeline = m_device.createRenderPipeline(job.storage->descriptor);
+		if (!pipeline) {
+			std::cerr << "Could not create render pipeline " << job.id << std::endl;
+		}
+		pushResult({ job.generation, job.id, pipeline });
+	}
+}
+#endif // WEBGPU_BACKEND_WGPU
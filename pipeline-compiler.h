@@ -0,0 +1,92 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Creates render pipelines without blocking the frame loop.
+ *
+ * Dawn and browsers compile them with createRenderPipelineAsync. wgpu-native
+ * does not implement it, so there a worker thread calls createRenderPipeline
+ * (wgpu devices may be used from any thread).
+ *
+ * Pipelines are identified by the index compileAsync() returns, and are
+ * nullptr until poll() has collected them. Callers draw with a fallback or
+ * skip the draw meanwhile.
+ */
+class PipelineCompiler {
+public:
+	enum class Status {
+		Pending,
+		Ready,
+		Failed,
+	};
+
+	void init(wgpu::Device device);
+	// Waits for the compilation in progress, if any
+	void terminate();
+
+	// Start creating a pipeline. The descriptor and what it points to only
+	// need to outlive the call. Overridable constants are not supported.
+	uint32_t compileAsync(const wgpu::RenderPipelineDescriptor& descriptor);
+
+	// Collect pipelines that finished compiling, call once per frame
+	void poll();
+
+	// nullptr while compiling, or if compilation failed
+	wgpu::RenderPipeline pipeline(uint32_t id) const;
+	// Failed for ids that clear() abandoned
+	Status status(uint32_t id) const;
+	uint32_t pendingCount() const { return m_pendingCount; }
+
+	// Release all pipelines. Compilations in progress are abandoned, their
+	// result is released when it arrives.
+	void clear();
+
+private:
+	struct DescriptorStorage;
+	struct Result {
+		uint64_t generation;
+		uint32_t id;
+		wgpu::RenderPipeline pipeline;
+	};
+
+	void pushResult(const Result& result);
+
+private:
+	wgpu::Device m_device = nullptr;
+	// Incremented by clear(), to recognize results of abandoned compilations
+	uint64_t m_generation = 0;
+	std::vector<wgpu::RenderPipeline> m_pipelines;
+	std::vector<Status> m_status;
+	uint32_t m_pendingCount = 0;
+
+	// Written by the worker thread or the async callbacks
+	std::mutex m_resultMutex;
+	std::vector<Result> m_results;
+
+#ifdef WEBGPU_BACKEND_WGPU
+	struct Job {
+		uint64_t generation;
+		uint32_t id;
+		std::unique_ptr<DescriptorStorage> storage;
+	};
+	void runWorker();
+
+	std::thread m_worker;
+	std::mutex m_jobMutex;
+	std::condition_variable m_jobCondition;
+	std::deque<Job> m_jobs;
+	bool m_stopping = false;
+#else
+	// Must stay alive until their callback fired
+	std::vector<std::unique_ptr<wgpu::CreateRenderPipelineAsyncCallback>> m_callbacks;
+	uint32_t m_inFlightCount = 0;
+#endif
+};
@@ -0,0 +1,46 @@
+#include "pipeline-key.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace wgpu;
+
+// Tags buffer words, so that keys with attributes spread differently over
+// buffers do not collide
+constexpr uint64_t VERTEX_BUFFER_TAG = 1ull << 63;
+
+void RenderPipelineKey::addVertexBufferLayout(const VertexBufferLayout& layout) {
+	assert(layout.arrayStride <= 0xffffffffull);
+	add(
+		VERTEX_BUFFER_TAG
+		| (static_cast<uint64_t>(layout.attributeCount) << 40)
+		| (static_cast<uint64_t>(layout.stepMode) << 32)
+		| layout.arrayStride
+	);
+
+	// Only the set of attributes matters, not the order they are listed in
+	std::vector<uint64_t> attributeWords(layout.attributeCount);
+	for (size_t attrIdx = 0; attrIdx < layout.attributeCount; ++attrIdx) {
+		const VertexAttribute& attrib = layout.attributes[attrIdx];
+		assert(attrib.offset <= 0xffffffffull);
+		attributeWords[attrIdx] =
+			(static_cast<uint64_t>(attrib.shaderLocation) << 48)
+			| (static_cast<uint64_t>(attrib.format) << 32)
+			| attrib.offset;
+	}
+	std::sort(attributeWords.begin(), attributeWords.end());
+	for (uint64_t word : attributeWords) {
+		add(word);
+	}
+}
+
+void RenderPipelineKey::add(uint64_t value) {
+	m_words.push_back(value);
+
+	// boost::hash_combine, on a splitmix64-mixed value
+	uint64_t x = value + 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	m_hash ^= static_cast<size_t>(x) + 0x9e3779b9 + (m_hash << 6) + (m_hash >> 2);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Canonical description of the state a render pipeline is built from.
+ *
+ * Two keys are equal when the pipelines they describe are interchangeable:
+ * attributes of a vertex buffer are sorted by shader location, so that the
+ * order in which a file lists them does not matter. The hash is updated as
+ * state is added, so lookups never have to walk the state again.
+ */
+class RenderPipelineKey {
+public:
+	// Stride, step mode and attributes of the buffer bound at the next slot
+	void addVertexBufferLayout(const wgpu::VertexBufferLayout& layout);
+	// Any other state the pipeline depends on (topology, formats, features...)
+	void add(uint64_t value);
+
+	size_t hash() const { return m_hash; }
+
+	bool operator==(const RenderPipelineKey& other) const {
+		return m_hash == other.m_hash && m_words == other.m_words;
+	}
+	bool operator!=(const RenderPipelineKey& other) const { return !(*this == other); }
+
+private:
+	std::vector<uint64_t> m_words;
+	size_t m_hash = 0;
+};
+
+/**
+ * Open addressing hash table from pipeline keys to values, with linear
+ * probing. Entries are never removed one by one, so there are no tombstones.
+ */
+template <typename Value>
+class PipelineKeyMap {
+public:
+	// nullptr if the key is not in the table
+	const Value* find(const RenderPipelineKey& key) const {
+		if (m_entries.empty()) return nullptr;
+		const size_t mask = m_slots.size() - 1;
+		for (size_t slot = key.hash() & mask; m_slots[slot] != EMPTY; slot = (slot + 1) & mask) {
+			const auto& [entryKey, value] = m_entries[m_slots[slot]];
+			if (entryKey == key) return &value;
+		}
+		return nullptr;
+	}
+
+	// The key must not be in the table yet
+	void insert(const RenderPipelineKey& key, const Value& value) {
+		// Keep the load factor under 1/2 so that probe sequences stay short
+		if (2 * (m_entries.size() + 1) > m_slots.size()) {
+			rehash(std::max<size_t>(16, 2 * m_slots.size()));
+		}
+		m_entries.emplace_back(key, value);
+		place(static_cast<uint32_t>(m_entries.size() - 1));
+	}
+
+	void clear() {
+		m_slots.clear();
+		m_entries.clear();
+	}
+
+	size_t size() const { return m_entries.size(); }
+
+	// In insertion order
+	const std::vector<std::pair<RenderPipelineKey, Value>>& entries() const { return m_entries; }
+
+private:
+	static constexpr uint32_t EMPTY = ~0u;
+
+	void rehash(size_t slotCount) {
+		m_slots.assign(slotCount, EMPTY);
+		for (uint32_t entryIdx = 0; entryIdx < m_entries.size(); ++entryIdx) {
+			place(entryIdx);
+		}
+	}
+
+	void place(uint32_t entryIdx) {
+		const size_t mask = m_slots.size() - 1;
+		size_t slot = m_entries[entryIdx].first.hash() & mask;
+		while (m_slots[slot] != EMPTY) {
+			slot = (slot + 1) & mask;
+		}
+		m_slots[slot] = entryIdx;
+	}
+
+private:
+	// Power of two sized, indices into m_entries
+	std::vector<uint32_t> m_slots;
+	std::vector<std::pair<RenderPipelineKey, Value>> m_entries;
+};
@@ -1,4 +1,5 @@
 #include "application.h"
+#include "cpu-profiler.h"
 #include "resource-manager.h"
 
 #include <webgpu/webgpu.hpp>
@@ -12,6 +13,7 @@
 
 #include "webgpu-utils/webgpu-std-utils.hpp"
 
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 
@@ -35,11 +37,14 @@ ShaderModule ResourceManager::loadShaderModule(const path& path, Device device)
     std::string shaderSource(size, ' ');
     file.seekg(0);
     file.read(shaderSource.data(), size);
+    return createShaderModule(shaderSource, device);
+}
 
+ShaderModule ResourceManager::createShaderModule(const std::string& source, Device device) {
     ShaderModuleWGSLDescriptor shaderCodeDesc{};
     shaderCodeDesc.chain.next = nullptr;
     shaderCodeDesc.chain.sType = SType::ShaderModuleWGSLDescriptor;
-    shaderCodeDesc.code = shaderSource.c_str();
+    shaderCodeDesc.code = source.c_str();
     ShaderModuleDescriptor shaderDesc{};
     shaderDesc.hintCount = 0;
     shaderDesc.hints = nullptr;
@@ -48,6 +53,7 @@ ShaderModule ResourceManager::loadShaderModule(const path& path, Device device)
 }
 
 bool ResourceManager::loadGeometryFromObj(const path& path, std::vector<VertexAttributes>& vertexData) {
+    CPU_PROFILE_SCOPE("Load OBJ");
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
@@ -107,6 +113,7 @@ bool ResourceManager::loadGeometryFromObj(const path& path, std::vector<VertexAt
 }
 
 Texture ResourceManager::loadTexture(const path& path, Device device, TextureView* pTextureView) {
+    CPU_PROFILE_SCOPE("Load texture");
     int width, height, channels;
     unsigned char* pixelData = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
     if (nullptr == pixelData) return nullptr;
@@ -141,13 +148,25 @@ Texture ResourceManager::loadTexture(const path& path, Device device, TextureVie
     return texture;
 }
 
-bool ResourceManager::loadGeometryFromGltf(const path& path, tinygltf::Model& model) {
+bool ResourceManager::loadGeometryFromGltf(const path& path, tinygltf::Model& model, float* imageDecodeTimeMs) {
+    CPU_PROFILE_SCOPE("Load glTF");
     using namespace tinygltf;
 
     TinyGLTF loader;
     std::string err;
     std::string warn;
 
+    if (imageDecodeTimeMs) {
+        // Same decoder as by default, timed
+        loader.SetImageLoader([imageDecodeTimeMs](Image* image, const int imageIdx, std::string* decodeErr, std::string* decodeWarn, int reqWidth, int reqHeight, const unsigned char* bytes, int size, void*) {
+            CPU_PROFILE_SCOPE("Decode image");
+            auto start = std::chrono::steady_clock::now();
+            bool success = LoadImageData(image, imageIdx, decodeErr, decodeWarn, reqWidth, reqHeight, bytes, size, nullptr);
+            *imageDecodeTimeMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return success;
+        }, nullptr);
+    }
+
     bool success = false;
     if (path.extension() == ".glb") {
         success = loader.LoadBinaryFromFile(&model, &err, &warn, path.string());
@@ -234,6 +253,30 @@ glm::mat3x3 ResourceManager::computeTBN(const VertexAttributes corners[3], const
     return mat3x3(T, B, N);
 }
 
+void ResourceManager::downsampleMipLevel(
+    const unsigned char* previousPixels,
+    uint32_t previousWidth,
+    uint32_t width,
+    uint32_t height,
+    unsigned char* pixels)
+{
+    for (uint32_t i = 0; i < width; ++i) {
+        for (uint32_t j = 0; j < height; ++j) {
+            unsigned char* p = &pixels[4 * (j * width + i)];
+            // Get the corresponding 4 pixels from the previous level
+            const unsigned char* p00 = &previousPixels[4 * ((2 * j + 0) * previousWidth + (2 * i + 0))];
+            const unsigned char* p01 = &previousPixels[4 * ((2 * j + 0) * previousWidth + (2 * i + 1))];
+            const unsigned char* p10 = &previousPixels[4 * ((2 * j + 1) * previousWidth + (2 * i + 0))];
+            const unsigned char* p11 = &previousPixels[4 * ((2 * j + 1) * previousWidth + (2 * i + 1))];
+            // Average
+            p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
+            p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
+            p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
+            p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
+        }
+    }
+}
+
 void ResourceManager::loadDialogArgs(FileDialogArgs& args) {
     args.filters[0] = { "Scenes", "glb,gltf" };
     args.args.filterList = args.filters;
@@ -272,22 +315,13 @@ static void writeMipMaps(
             memcpy(pixels.data(), pixelData, pixels.size());
         }
         else {
-            // Create mip level data
-            for (uint32_t i = 0; i < mipLevelSize.width; ++i) {
-                for (uint32_t j = 0; j < mipLevelSize.height; ++j) {
-                    unsigned char* p = &pixels[4 * (j * mipLevelSize.width + i)];
-                    // Get the corresponding 4 pixels from the previous level
-                    unsigned char* p00 = &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 0))];
-                    unsigned char* p01 = &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 1))];
-                    unsigned char* p10 = &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 0))];
-                    unsigned char* p11 = &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 1))];
-                    // Average
-                    p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
-                    p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
-                    p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
-                    p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
-                }
-            }
+            ResourceManager::downsampleMipLevel(
+                previousLevelPixels.data(),
+                previousMipLevelSize.width,
+                mipLevelSize.width,
+                mipLevelSize.height,
+                pixels.data()
+            );
         }
 
         // Upload data to the GPU texture
@@ -29,14 +29,31 @@ public:
 
     static ShaderModule loadShaderModule(const path& path, Device device);
 
+    static ShaderModule createShaderModule(const std::string& source, Device device);
+
     static bool loadGeometryFromObj(const path& path, std::vector<VertexAttributes>& vertexData);
 
-    static bool loadGeometryFromGltf(const path& path, tinygltf::Model& model);
+    // Images are decoded while loading, the time it takes is added to
+    // imageDecodeTimeMs if provided
+    static bool loadGeometryFromGltf(const path& path, tinygltf::Model& model, float* imageDecodeTimeMs = nullptr);
 
     static Texture loadTexture(const path& path, Device device, TextureView* pTextureView = nullptr);
 
     static path openFileDialog();
 
+    // Compute a mip level of width x height RGBA8 pixels by averaging 2x2
+    // blocks of the previous level, which is previousWidth pixels wide
+    static void downsampleMipLevel(
+        const unsigned char* previousPixels,
+        uint32_t previousWidth,
+        uint32_t width,
+        uint32_t height,
+        unsigned char* pixels
+    );
+
+    static mat3x3 computeTBN(const VertexAttributes corners[3], const vec3& expectedN);
+    static void populateTextureFrameAttributes(std::vector<VertexAttributes>& vertexData);
+
 private:
     struct FileDialogArgs {
         nfdopendialogu8args_t args;
@@ -45,8 +62,6 @@ private:
     };
 
 private:
-    static mat3x3 computeTBN(const VertexAttributes corners[3], const vec3& expectedN);
-    static void populateTextureFrameAttributes(std::vector<VertexAttributes>& vertexData);
     static void loadDialogArgs(FileDialogArgs& args);
 
 };
\ No newline at end of file
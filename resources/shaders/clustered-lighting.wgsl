@@ -0,0 +1,138 @@
+// Light assignment of clustered forward lighting (see ClusteredLighting).
+//
+// One invocation per cluster. Lights are brought to view space in batches
+// through workgroup memory, so that each one is transformed once per
+// workgroup rather than once per cluster.
+
+// Must match ClusteredLighting::MAX_LIGHTS_PER_CLUSTER
+const MAX_LIGHTS_PER_CLUSTER = 127u;
+const WORKGROUP_SIZE = 64u;
+
+const LIGHT_DIRECTIONAL = 0u;
+
+struct GlobalUniforms {
+	projectionMatrix: mat4x4f,
+	viewMatrix: mat4x4f,
+	modelMatrix: mat4x4f,
+	worldColor: vec4f,
+	cameraWorldPosition: vec3f,
+	time: f32,
+	gamma: f32,
+};
+
+struct ClusterUniforms {
+	gridSize: vec3u,
+	lightCount: u32,
+	renderSize: vec2f,
+	zNear: f32,
+	zFar: f32,
+}
+
+struct LightingUniforms {
+	directions: array<vec4f, 2>,
+	colors: array<vec4f, 2>,
+	clusters: ClusterUniforms,
+}
+
+struct Light {
+	position: vec3f,
+	range: f32,
+	color: vec3f,
+	kind: u32,
+	direction: vec3f,
+	spotScale: f32,
+	spotOffset: f32,
+}
+
+@group(0) @binding(0) var<uniform> uGlobal: GlobalUniforms;
+@group(0) @binding(1) var<uniform> uLighting: LightingUniforms;
+@group(0) @binding(2) var<storage, read> lights: array<Light>;
+// Per cluster: light count, then MAX_LIGHTS_PER_CLUSTER light indices
+@group(0) @binding(3) var<storage, read_write> clusterLights: array<u32>;
+
+// View-space bounding spheres of the current batch of lights, a negative
+// radius stands for a directional light that touches every cluster
+var<workgroup> batchSpheres: array<vec4f, WORKGROUP_SIZE>;
+
+// View-space depth of the boundary between slices k - 1 and k
+fn sliceDepth(k: u32) -> f32 {
+	let clusters = uLighting.clusters;
+	return clusters.zNear * pow(clusters.zFar / clusters.zNear, f32(k) / f32(clusters.gridSize.z));
+}
+
+fn sphereIntersectsBox(sphere: vec4f, boxMin: vec3f, boxMax: vec3f) -> bool {
+	if (sphere.w < 0.0) {
+		return true;
+	}
+	let closest = clamp(sphere.xyz, boxMin, boxMax);
+	let d = closest - sphere.xyz;
+	return dot(d, d) <= sphere.w * sphere.w;
+}
+
+@compute @workgroup_size(WORKGROUP_SIZE)
+fn cs_assign_lights(
+	@builtin(global_invocation_id) id: vec3u,
+	@builtin(local_invocation_index) localIndex: u32,
+) {
+	let grid = uLighting.clusters.gridSize;
+	let clusterCount = grid.x * grid.y * grid.z;
+	let clusterIndex = id.x;
+	// Out of range invocations still take part in loading batches
+	let isCluster = clusterIndex < clusterCount;
+	let cell = vec3u(
+		clusterIndex % grid.x,
+		(clusterIndex / grid.x) % grid.y,
+		min(clusterIndex / (grid.x * grid.y), grid.z - 1u),
+	);
+
+	// Froxel bounds in view space. Tiles are counted from the top-left
+	// corner like fragment coordinates, and view-space x and y at depth z
+	// are ndc * z / projection scale (symmetric perspective projection).
+	let ndcMin = vec2f(
+		-1.0 + 2.0 * f32(cell.x) / f32(grid.x),
+		1.0 - 2.0 * f32(cell.y + 1u) / f32(grid.y),
+	);
+	let ndcMax = vec2f(
+		-1.0 + 2.0 * f32(cell.x + 1u) / f32(grid.x),
+		1.0 - 2.0 * f32(cell.y) / f32(grid.y),
+	);
+	let projectionScale = vec2f(uGlobal.projectionMatrix[0][0], uGlobal.projectionMatrix[1][1]);
+	let zMin = sliceDepth(cell.z);
+	let zMax = sliceDepth(cell.z + 1u);
+	let nearMin = ndcMin * zMin / projectionScale;
+	let nearMax = ndcMax * zMin / projectionScale;
+	let farMin = ndcMin * zMax / projectionScale;
+	let farMax = ndcMax * zMax / projectionScale;
+	let boxMin = vec3f(min(nearMin, farMin), zMin);
+	let boxMax = vec3f(max(nearMax, farMax), zMax);
+
+	let base = clusterIndex * (MAX_LIGHTS_PER_CLUSTER + 1u);
+	let lightCount = uLighting.clusters.lightCount;
+	var count = 0u;
+	for (var batchStart = 0u; batchStart < lightCount; batchStart += WORKGROUP_SIZE) {
+		let lightIndex = batchStart + localIndex;
+		if (lightIndex < lightCount) {
+			let light = lights[lightIndex];
+			if (light.kind == LIGHT_DIRECTIONAL) {
+				batchSpheres[localIndex] = vec4f(0.0, 0.0, 0.0, -1.0);
+			} else {
+				let viewPosition = (uGlobal.viewMatrix * vec4f(light.position, 1.0)).xyz;
+				batchSpheres[localIndex] = vec4f(viewPosition, light.range);
+			}
+		}
+		workgroupBarrier();
+
+		let batchCount = min(WORKGROUP_SIZE, lightCount - batchStart);
+		for (var i = 0u; i < batchCount; i++) {
+			if (isCluster && count < MAX_LIGHTS_PER_CLUSTER && sphereIntersectsBox(batchSpheres[i], boxMin, boxMax)) {
+				clusterLights[base + 1u + count] = batchStart + i;
+				count++;
+			}
+		}
+		workgroupBarrier();
+	}
+
+	if (isCluster) {
+		clusterLights[base] = count;
+	}
+}
@@ -0,0 +1,35 @@
+// Resolve of weighted blended order-independent transparency.
+//
+// Blended surfaces were summed into accumulationTexture, weighted by depth
+// and opacity, while revealageTexture holds the product of their (1 - alpha).
+// fs_composite turns this into an average color and a coverage, blended over
+// the opaque scene with the usual "over" operator.
+
+struct CompositeVertexOutput {
+	@builtin(position) position: vec4f,
+}
+
+@group(0) @binding(0) var accumulationTexture: texture_2d<f32>;
+@group(0) @binding(1) var revealageTexture: texture_2d<f32>;
+
+@vertex
+fn vs_composite(@builtin(vertex_index) vertexIndex: u32) -> CompositeVertexOutput {
+	let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+	var out: CompositeVertexOutput;
+	out.position = vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+	return out;
+}
+
+@fragment
+fn fs_composite(in: CompositeVertexOutput) -> @location(0) vec4f {
+	let p = vec2i(in.position.xy);
+	let revealage = textureLoad(revealageTexture, p, 0).r;
+	// Nothing transparent covers this pixel
+	if (revealage >= 1.0) {
+		discard;
+	}
+
+	let accumulation = textureLoad(accumulationTexture, p, 0);
+	let averageColor = accumulation.rgb / max(accumulation.a, 1e-5);
+	return vec4f(averageColor, 1.0 - revealage);
+}
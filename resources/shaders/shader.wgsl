@@ -1,5 +1,27 @@
+// Variants of this shader are built by ShaderLibrary, with these names
+// defined or not:
+//   HAS_BASE_COLOR_TEXTURE, HAS_METALLIC_ROUGHNESS_TEXTURE, HAS_NORMAL_TEXTURE
+//     textures present in the material, others are not sampled
+//   ALPHA_MODE_MASK, ALPHA_MODE_BLEND (opaque when neither is defined)
+//   HIGH_QUALITY  Burley diffuse and filtered shadows
+
 const PI = 3.14159265359;
 
+#ifdef HIGH_QUALITY
+const HIGH_QUALITY_SHADING = 1u;
+#else
+const HIGH_QUALITY_SHADING = 0u;
+#endif
+
+// Must match ClusteredLighting::MAX_LIGHTS_PER_CLUSTER
+const MAX_LIGHTS_PER_CLUSTER = 127u;
+
+const LIGHT_DIRECTIONAL = 0u;
+const LIGHT_SPOT = 2u;
+
+// Must match ShadowMaps::CASCADE_COUNT
+const SHADOW_CASCADE_COUNT = 4u;
+
 // /* **************** SHADING **************** */
 
 // /**
@@ -104,31 +126,88 @@ fn Fd_Burley(NoV: f32, NoL: f32, LoH: f32, roughness: f32) -> f32 {
     return lightScatter * viewScatter / PI;
 }
 
-// /*
+#ifdef HAS_NORMAL_TEXTURE
 // /**
 //  * Sample a local normal from the normal map and rotate it using the normal
-//  * frame to get a global normal.
+//  * frame to get a global normal. Vertices carry no tangent, so the frame is
+//  * rebuilt from screen-space derivatives of the position and uv.
 //  */
-// fn sampleNormal(in: VertexOutput, normalMapStrength: f32) -> vec3f {
-// 	let encodedN = textureSample(normalTexture, normalSampler, in.uv).rgb;
-// 	let localN = encodedN - 0.5;
-// 	let rotation = mat3x3f(
-// 		normalize(in.tangent),
-// 		normalize(in.bitangent),
-// 		normalize(in.normal),
-// 	);
-// 	let rotatedN = normalize(rotation * localN);
-// 	return normalize(mix(in.normal, rotatedN, normalMapStrength));
-// }
-// */
+fn sampleNormal(normal: vec3f, worldPosition: vec3f, uv: vec2f, normalMapStrength: f32) -> vec3f {
+    let dp1 = dpdx(worldPosition);
+    let dp2 = dpdy(worldPosition);
+    let duv1 = dpdx(uv);
+    let duv2 = dpdy(uv);
+    let dp2perp = cross(dp2, normal);
+    let dp1perp = cross(normal, dp1);
+    let tangent = dp2perp * duv1.x + dp1perp * duv2.x;
+    let bitangent = dp2perp * duv1.y + dp1perp * duv2.y;
+    let invScale = inverseSqrt(max(max(dot(tangent, tangent), dot(bitangent, bitangent)), 1e-20));
+    let rotation = mat3x3f(tangent * invScale, bitangent * invScale, normal);
+
+    let encodedN = textureSample(normalTexture, normalSampler, uv).rgb;
+    let localN = encodedN * 2.0 - 1.0;
+    let rotatedN = normalize(rotation * localN);
+    return normalize(mix(normal, rotatedN, normalMapStrength));
+}
+#endif
 
 // /* **************** UTILITIES **************** */
 
-// check that the provided baseColor is not vec3f(0.0), i.e. "colorless"
-fn validateColor(color: vec3f) -> bool {
-    return all(color != vec3f(0.0)); 
+// Index of the cluster containing a fragment, in the layout of clusterLights
+fn clusterIndex(fragCoord: vec2f, viewDepth: f32) -> u32 {
+    let clusters = uLighting.clusters;
+    let tile = min(vec2u(fragCoord / clusters.renderSize * vec2f(clusters.gridSize.xy)), clusters.gridSize.xy - 1u);
+    let slice = log(max(viewDepth, clusters.zNear) / clusters.zNear) / log(clusters.zFar / clusters.zNear) * f32(clusters.gridSize.z);
+    let z = min(u32(max(slice, 0.0)), clusters.gridSize.z - 1u);
+    return tile.x + clusters.gridSize.x * (tile.y + clusters.gridSize.y * z);
 }
 
+// Smooth cut-off at the light range, as recommended by KHR_lights_punctual
+fn rangeAttenuation(distanceSquared: f32, range: f32) -> f32 {
+    let ratio = distanceSquared / (range * range);
+    let falloff = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+    return falloff * falloff / distanceSquared;
+}
+
+// Fraction of the light of directional light 'lightIndex' that reaches a
+// point, from the cascade covering its view depth. 3x3 taps of 2x2 hardware
+// PCF each in high quality, a single one otherwise. Offset along the normal
+// by a texel against self-shadowing.
+fn shadowFactor(lightIndex: u32, worldPosition: vec3f, normal: vec3f, viewDepth: f32) -> f32 {
+    if uShadows.enabled == 0u {
+        return 1.0;
+    }
+    var cascade = 0u;
+    while cascade < SHADOW_CASCADE_COUNT && viewDepth > uShadows.splits[cascade] {
+        cascade++;
+    }
+    if cascade == SHADOW_CASCADE_COUNT {
+        return 1.0;
+    }
+
+    let layer = lightIndex * SHADOW_CASCADE_COUNT + cascade;
+    let offsetPosition = worldPosition + normal * (1.5 * uShadows.texelWorldSizes[cascade]);
+    let clip = uShadows.viewProjections[layer] * vec4f(offsetPosition, 1.0);
+    let uv = clip.xy * vec2f(0.5, -0.5) + 0.5;
+    if any(uv < vec2f(0.0)) || any(uv > vec2f(1.0)) || clip.z > 1.0 {
+        return 1.0;
+    }
+
+#ifdef HIGH_QUALITY
+    var lit = 0.0;
+    for (var y = -1; y <= 1; y++) {
+        for (var x = -1; x <= 1; x++) {
+            let tapUv = uv + vec2f(f32(x), f32(y)) * uShadows.invMapSize;
+            lit += textureSampleCompareLevel(shadowMap, shadowSampler, tapUv, layer, clip.z);
+        }
+    }
+    return lit / 9.0;
+#else
+    return textureSampleCompareLevel(shadowMap, shadowSampler, uv, layer, clip.z);
+#endif
+}
+
+
 
 // /* **************** BINDINGS **************** */
 
@@ -140,7 +219,8 @@ struct VertexInput {
 };
 
 struct VertexOutput {
-	@builtin(position) position: vec4f,
+	// invariant so that depth matches the one written by vs_depth bit for bit
+	@builtin(position) @invariant position: vec4f,
 	@location(0) color: vec3f,
 	@location(1) normal: vec3f,
 	@location(2) uv: vec2f,
@@ -154,18 +234,54 @@ struct GlobalUniforms {
 	projectionMatrix: mat4x4f,
 	viewMatrix: mat4x4f,
 	modelMatrix: mat4x4f,
+	worldColor: vec4f,
 	cameraWorldPosition: vec3f,
-	worldColor: vec3f,
 	time: f32,
 	gamma: f32,
 };
 
+// /**
+//  * Froxel grid of the clustered lights, see ClusteredLighting
+//  */
+struct ClusterUniforms {
+	gridSize: vec3u,
+	lightCount: u32,
+	renderSize: vec2f,
+	zNear: f32,
+	zFar: f32,
+}
+
 // /**
 //  * A structure holding the lighting settings
 //  */
 struct LightingUniforms {
 	directions: array<vec4f, 2>,
 	colors: array<vec4f, 2>,
+	clusters: ClusterUniforms,
+}
+
+// /**
+//  * A punctual light (KHR_lights_punctual), in world space
+//  */
+struct Light {
+	position: vec3f,
+	range: f32,
+	color: vec3f,
+	kind: u32,
+	direction: vec3f,
+	spotScale: f32,
+	spotOffset: f32,
+}
+
+// /**
+//  * Cascaded shadow maps of the directional lights, see ShadowMaps
+//  */
+struct ShadowUniforms {
+	viewProjections: array<mat4x4f, 8>,
+	splits: vec4f,
+	texelWorldSizes: vec4f,
+	invMapSize: f32,
+	enabled: u32,
 }
 
 // /**
@@ -183,13 +299,19 @@ struct MaterialUniforms {
 	metallicFactor: f32,
 	roughnessFactor: f32,
 	baseColorTexCoords: u32,
-	metallicTexCoords: u32,
-	roughnessTexCoords: u32,
+	metallicRoughnessTexCoords: u32,
+	normalTexCoords: u32,
+	alphaCutoff: f32,
 }
 
 // General bind group
 @group(0) @binding(0) var<uniform> uGlobal: GlobalUniforms;
 @group(0) @binding(1) var<uniform> uLighting: LightingUniforms;
+@group(0) @binding(2) var<storage, read> lights: array<Light>;
+@group(0) @binding(3) var<storage, read> clusterLights: array<u32>;
+@group(0) @binding(4) var<storage, read> uShadows: ShadowUniforms;
+@group(0) @binding(5) var shadowMap: texture_depth_2d_array;
+@group(0) @binding(6) var shadowSampler: sampler_comparison;
 
 // Material bind group
 @group(1) @binding(0) var<uniform> uMaterial: MaterialUniforms;
@@ -217,46 +339,136 @@ fn vs_main(in: VertexInput) -> VertexOutput {
     return out;
 }
 
-// /* **************** FRAGMENT MAIN **************** */
+// /**
+//  * Position-only vertex stage of the depth pre-pass. Must compute the clip
+//  * position exactly like vs_main does.
+//  */
+@vertex
+fn vs_depth(@location(0) position: vec3f) -> @builtin(position) @invariant vec4f {
+    let worldPosition = uNode.modelMatrix * vec4f(position, 1.0) * uGlobal.modelMatrix;
+    return uGlobal.projectionMatrix * uGlobal.viewMatrix * worldPosition;
+}
 
-@fragment
-fn fs_main(in: VertexOutput) -> @location(0) vec4f {
-	// Sample texture
-    var baseColor = textureSample(baseColorTexture, baseColorSampler, in.uv).rgb;
+// /* **************** FRAGMENT MAIN **************** */
 
-    let noTextureVecDefault = vec3f(0.0);
+#ifdef ALPHA_MODE_BLEND
+// /**
+//  * Blended surfaces use weighted blended order-independent transparency
+//  * (McGuire and Bavoil 2013): they are summed in any order into an
+//  * accumulation target, weighted so that the closest and most opaque ones
+//  * dominate, while the revealage target multiplies their transmittance. The
+//  * composite pass then normalizes the sum over the opaque image.
+//  */
+struct TransparentOutput {
+    @location(0) accumulation: vec4f,
+    @location(1) revealage: f32,
+};
 
-    if !validateColor(baseColor) {
-        baseColor = uMaterial.baseColorFactor.rgb;
-    }
+fn transparentOutput(color: vec3f, alpha: f32, depth: f32) -> TransparentOutput {
+    let weight = clamp(pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - depth * 0.9, 3.0), 1e-2, 3e3);
+    var out: TransparentOutput;
+    out.accumulation = vec4f(color * alpha, alpha) * weight;
+    out.revealage = alpha;
+    return out;
+}
 
-    let metallicRoughness = textureSample(metallicRoughnessTexture, metallicRoughnessSampler, in.uv).rgb;
+@fragment
+fn fs_main(in: VertexOutput, @builtin(front_facing) isFrontFacing: bool) -> TransparentOutput {
+#else
+@fragment
+fn fs_main(in: VertexOutput, @builtin(front_facing) isFrontFacing: bool) -> @location(0) vec4f {
+#endif
+	// Sample textures, factors scale them as specified by glTF
+    var baseColor = uMaterial.baseColorFactor;
+#ifdef HAS_BASE_COLOR_TEXTURE
+    baseColor *= textureSample(baseColorTexture, baseColorSampler, in.uv);
+#endif
+
+    var metallic = uMaterial.metallicFactor;
+    var roughness = uMaterial.roughnessFactor;
+#ifdef HAS_METALLIC_ROUGHNESS_TEXTURE
+    let metallicRoughness = textureSample(metallicRoughnessTexture, metallicRoughnessSampler, in.uv);
+    metallic *= metallicRoughness.b;
+    roughness *= metallicRoughness.g;
+#endif
 
     let material = MaterialProperties(
-        baseColor,
-        metallicRoughness.y,
-        metallicRoughness.x,
+        baseColor.rgb,
+        roughness,
+        metallic,
         1.0, // reflectance
-        1u, // high quality
+        HIGH_QUALITY_SHADING,
     );
 
+    let worldPosition = uGlobal.cameraWorldPosition - in.viewDirection;
+    let viewDepth = (uGlobal.viewMatrix * vec4f(worldPosition, 1.0)).z;
+
+    var normal = normalize(in.normal);
+#ifdef DOUBLE_SIDED
+    // Back faces are lit as seen from their own side
+    if !isFrontFacing {
+        normal = -normal;
+    }
+#endif
+#ifdef HAS_NORMAL_TEXTURE
     let normalMapStrength = 1.0;
-	//let N = sampleNormal(in, normalMapStrength);
-    let N = normalize(in.normal);
+    let N = sampleNormal(normal, worldPosition, in.uv, normalMapStrength);
+#else
+    let N = normal;
+#endif
     let V = normalize(in.viewDirection);
 
+#ifdef ALPHA_MODE_MASK
+    if baseColor.a < uMaterial.alphaCutoff {
+        discard;
+    }
+#endif
+
 	// Compute shading
     var color = vec3f(0.0);
     for (var i: i32 = 0; i < 2; i++) {
         let L = normalize(uLighting.directions[i].xyz);
-        let lightEnergy = uLighting.colors[i].rgb;
+        let lightEnergy = uLighting.colors[i].rgb * shadowFactor(u32(i), worldPosition, N, viewDepth);
         color += brdf(material, N, L, V) * lightEnergy;
     }
 
+	// Punctual lights binned in the cluster of this fragment
+    let clusterBase = clusterIndex(in.position.xy, viewDepth) * (MAX_LIGHTS_PER_CLUSTER + 1u);
+    let clusterLightCount = clusterLights[clusterBase];
+    for (var i = 0u; i < clusterLightCount; i++) {
+        let light = lights[clusterLights[clusterBase + 1u + i]];
+        var L = -light.direction;
+        var attenuation = 1.0;
+        if light.kind != LIGHT_DIRECTIONAL {
+            let toLight = light.position - worldPosition;
+            let distanceSquared = max(dot(toLight, toLight), 1e-8);
+            L = toLight * inverseSqrt(distanceSquared);
+            attenuation = rangeAttenuation(distanceSquared, light.range);
+            if light.kind == LIGHT_SPOT {
+                let cone = clamp(dot(light.direction, -L) * light.spotScale + light.spotOffset, 0.0, 1.0);
+                attenuation *= cone * cone;
+            }
+        }
+        let NoL = max(dot(N, L), 0.0);
+        color += brdf(material, N, L, V) * light.color * (attenuation * NoL);
+    }
+
 	// Debug normals
 	//color = N * 0.5 + 0.5;
 	
 	// Gamma-correction
     let corrected_color = pow(color, vec3f(uGlobal.gamma));
+#ifdef ALPHA_MODE_BLEND
+    return transparentOutput(corrected_color, baseColor.a, in.position.z);
+#else
     return vec4f(corrected_color, 1.0);
-}
\ No newline at end of file
+#endif
+}
+// /**
+//  * Flat color drawn with vs_depth while the pipeline of a primitive is still
+//  * being compiled.
+//  */
+@fragment
+fn fs_fallback() -> @location(0) vec4f {
+    return vec4f(0.5, 0.5, 0.5, 1.0);
+}
@@ -0,0 +1,19 @@
+// Depth-only rendering of shadow casters into one layer of ShadowMaps.
+
+struct ShadowPassUniforms {
+	viewProjection: mat4x4f,
+}
+
+struct NodeUniforms {
+	modelMatrix: mat4x4f,
+}
+
+@group(0) @binding(0) var<uniform> uPass: ShadowPassUniforms;
+
+// Node bind group, shared with the main pipelines
+@group(2) @binding(0) var<uniform> uNode: NodeUniforms;
+
+@vertex
+fn vs_shadow(@location(0) position: vec3f) -> @builtin(position) vec4f {
+	return uPass.viewProjection * uNode.modelMatrix * vec4f(position, 1.0);
+}
@@ -0,0 +1,136 @@
+// Upscaling of the 3D passes to the native resolution.
+//
+// cs_upscale is an edge-adaptive Lanczos upscale: the kernel is oriented along
+// the local luma gradient and stretched along edges, so that they stay crisp
+// instead of being blurred isotropically. fs_present then writes the result
+// to the surface with contrast-adaptive sharpening.
+
+struct UpscaleParams {
+	// Size of the rendered region, in the top-left corner of the source
+	renderSize: vec2u,
+	outputSize: vec2u,
+	// 0 disables sharpening, 1 is the strongest
+	sharpness: f32,
+	_pad0: f32,
+	_pad1: vec2f,
+}
+
+@group(0) @binding(0) var sourceTexture: texture_2d<f32>;
+@group(0) @binding(1) var outputTexture: texture_storage_2d<rgba16float, write>;
+@group(0) @binding(2) var<uniform> params: UpscaleParams;
+
+fn luma(color: vec3f) -> f32 {
+	return dot(color, vec3f(0.299, 0.587, 0.114));
+}
+
+// Polynomial approximation of the Lanczos-2 kernel, for |x| < 2
+fn lanczos2(x: f32) -> f32 {
+	let x2 = min(x * x, 4.0);
+	let a = 0.4 * x2 - 1.0;
+	let b = 0.25 * x2 - 1.0;
+	return (25.0 / 16.0 * a * a - (25.0 / 16.0 - 1.0)) * b * b;
+}
+
+fn loadSource(texel: vec2i) -> vec3f {
+	let maxTexel = vec2i(params.renderSize) - 1;
+	return textureLoad(sourceTexture, clamp(texel, vec2i(0), maxTexel), 0).rgb;
+}
+
+@compute @workgroup_size(8, 8)
+fn cs_upscale(@builtin(global_invocation_id) id: vec3u) {
+	if (any(id.xy >= params.outputSize)) {
+		return;
+	}
+
+	if (all(params.renderSize == params.outputSize)) {
+		textureStore(outputTexture, id.xy, vec4f(loadSource(vec2i(id.xy)), 1.0));
+		return;
+	}
+
+	// Position of the output pixel center in source texel space
+	let scale = vec2f(params.renderSize) / vec2f(params.outputSize);
+	let sourcePosition = (vec2f(id.xy) + 0.5) * scale - 0.5;
+	let base = vec2i(floor(sourcePosition));
+	let f = sourcePosition - floor(sourcePosition);
+
+	// Edge direction from the four closest texels
+	let c00 = loadSource(base);
+	let c10 = loadSource(base + vec2i(1, 0));
+	let c01 = loadSource(base + vec2i(0, 1));
+	let c11 = loadSource(base + vec2i(1, 1));
+	let l00 = luma(c00);
+	let l10 = luma(c10);
+	let l01 = luma(c01);
+	let l11 = luma(c11);
+	let gradient = vec2f((l10 - l00) + (l11 - l01), (l01 - l00) + (l11 - l10));
+	let gradientLength = length(gradient);
+	let across = select(vec2f(1.0, 0.0), gradient / gradientLength, gradientLength > 1e-5);
+	let along = vec2f(-across.y, across.x);
+	// Relative to local contrast, so that dark edges are treated like bright ones
+	let contrast = max(max(l00, l10), max(l01, l11)) - min(min(l00, l10), min(l01, l11));
+	let edgeStrength = saturate(gradientLength / (2.0 * contrast + 1e-3));
+	let alongStretch = 1.0 - 0.5 * edgeStrength;
+
+	var colorSum = vec3f(0.0);
+	var weightSum = 0.0;
+	for (var y = -1; y <= 2; y++) {
+		for (var x = -1; x <= 2; x++) {
+			let offset = vec2f(f32(x), f32(y)) - f;
+			let d = vec2f(dot(offset, across), dot(offset, along) * alongStretch);
+			let weight = lanczos2(length(d));
+			colorSum += loadSource(base + vec2i(x, y)) * weight;
+			weightSum += weight;
+		}
+	}
+	var color = colorSum / max(weightSum, 1e-4);
+
+	// Negative lobes ring around edges, stay within the range of the closest texels
+	let minColor = min(min(c00, c10), min(c01, c11));
+	let maxColor = max(max(c00, c10), max(c01, c11));
+	color = clamp(color, minColor, maxColor);
+
+	textureStore(outputTexture, id.xy, vec4f(color, 1.0));
+}
+
+@group(0) @binding(3) var upscaledTexture: texture_2d<f32>;
+
+struct PresentVertexOutput {
+	@builtin(position) position: vec4f,
+}
+
+// Full-screen triangle, no vertex buffer
+@vertex
+fn vs_present(@builtin(vertex_index) vertexIndex: u32) -> PresentVertexOutput {
+	let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+	var out: PresentVertexOutput;
+	out.position = vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+	return out;
+}
+
+fn loadUpscaled(texel: vec2i) -> vec3f {
+	let maxTexel = vec2i(params.outputSize) - 1;
+	return textureLoad(upscaledTexture, clamp(texel, vec2i(0), maxTexel), 0).rgb;
+}
+
+@fragment
+fn fs_present(in: PresentVertexOutput) -> @location(0) vec4f {
+	let p = vec2i(in.position.xy);
+	let center = loadUpscaled(p);
+	if (params.sharpness <= 0.0) {
+		return vec4f(center, 1.0);
+	}
+
+	// Contrast-adaptive sharpening: a negative lobe on the 4 neighbors, weaker
+	// where local contrast is already high so that edges do not overshoot
+	let north = loadUpscaled(p + vec2i(0, -1));
+	let south = loadUpscaled(p + vec2i(0, 1));
+	let west = loadUpscaled(p + vec2i(-1, 0));
+	let east = loadUpscaled(p + vec2i(1, 0));
+	let minColor = min(center, min(min(north, south), min(west, east)));
+	let maxColor = max(center, max(max(north, south), max(west, east)));
+	let amplitude = sqrt(saturate(min(minColor, 1.0 - maxColor) / max(maxColor, vec3f(1e-4))));
+	let peak = -1.0 / mix(8.0, 5.0, params.sharpness);
+	let w = amplitude * peak;
+	let color = (center + (north + south + west + east) * w) / (1.0 + 4.0 * w);
+	return vec4f(saturate(color), 1.0);
+}
@@ -0,0 +1,151 @@
+#include "shader-library.h"
+#include "resource-manager.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace wgpu;
+
+// Guards against include cycles
+constexpr uint32_t MAX_INCLUDE_DEPTH = 16;
+
+void ShaderLibrary::init(Device device) {
+	m_device = device;
+}
+
+void ShaderLibrary::terminate() {
+	for (auto& [key, module] : m_modules) {
+		module.release();
+	}
+	m_modules.clear();
+	m_device = nullptr;
+}
+
+ShaderModule ShaderLibrary::getOrCreateModule(const path& filePath, const std::vector<std::string>& defines) {
+	// Sorted and deduplicated, so that the key does not depend on the order
+	std::set<std::string> defineSet(defines.begin(), defines.end());
+	std::string key = filePath.string();
+	for (const std::string& define : defineSet) {
+		key += "|" + define;
+	}
+
+	auto it = m_modules.find(key);
+	if (it != m_modules.end()) {
+		return it->second;
+	}
+
+	std::string source;
+	if (!preprocess(filePath, defineSet, source)) {
+		return nullptr;
+	}
+	std::cout << "Compiling shader variant " << key << std::endl;
+	ShaderModule module = ResourceManager::createShaderModule(source, m_device);
+	if (module) {
+		m_modules[key] = module;
+	}
+	return module;
+}
+
+bool ShaderLibrary::preprocess(const path& filePath, const std::set<std::string>& defines, std::string& output) {
+	output.clear();
+	std::set<path> includedFiles;
+	return preprocessFile(filePath, defines, includedFiles, 0, output);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+bool ShaderLibrary::preprocessFile(
+	const path& filePath,
+	const std::set<std::string>& defines,
+	std::set<path>& includedFiles,
+	uint32_t depth,
+	std::string& output
+) {
+	if (depth > MAX_INCLUDE_DEPTH) {
+		std::cerr << "Shader includes nested too deeply in " << filePath << std::endl;
+		return false;
+	}
+	std::ifstream file(filePath);
+	if (!file.is_open()) {
+		std::cerr << "Could not open shader " << filePath << std::endl;
+		return false;
+	}
+	includedFiles.insert(filePath.lexically_normal());
+
+	// One entry per open #ifdef/#ifndef
+	struct Conditional {
+		bool parentActive;
+		bool condition;
+		bool hasElse;
+	};
+	std::vector<Conditional> conditionals;
+	bool active = true;
+
+	std::string line;
+	uint32_t lineNumber = 0;
+	while (std::getline(file, line)) {
+		++lineNumber;
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line[start] != '#') {
+			// Skipped lines are kept empty so that line numbers of compilation
+			// errors still match the file
+			if (active) output += line;
+			output += '\n';
+			continue;
+		}
+
+		std::istringstream directiveStream(line.substr(start + 1));
+		std::string directive;
+		std::string argument;
+		directiveStream >> directive >> argument;
+
+		auto fail = [&](const std::string& message) {
+			std::cerr << filePath.string() << ":" << lineNumber << ": " << message << std::endl;
+			return false;
+		};
+
+		if (directive == "ifdef" || directive == "ifndef") {
+			if (argument.empty()) return fail("#" + directive + " expects a name");
+			bool isDefined = defines.count(argument) > 0;
+			bool condition = directive == "ifdef" ? isDefined : !isDefined;
+			conditionals.push_back({ active, condition, false });
+			active = active && condition;
+		}
+		else if (directive == "else") {
+			if (conditionals.empty() || conditionals.back().hasElse) return fail("unexpected #else");
+			Conditional& conditional = conditionals.back();
+			conditional.hasElse = true;
+			active = conditional.parentActive && !conditional.condition;
+		}
+		else if (directive == "endif") {
+			if (conditionals.empty()) return fail("unexpected #endif");
+			active = conditionals.back().parentActive;
+			conditionals.pop_back();
+		}
+		else if (directive == "include") {
+			if (argument.size() < 2 || argument.front() != '"' || argument.back() != '"') {
+				return fail("#include expects a quoted file name");
+			}
+			if (active) {
+				path includePath = (filePath.parent_path() / argument.substr(1, argument.size() - 2)).lexically_normal();
+				if (includedFiles.count(includePath) == 0) {
+					if (!preprocessFile(includePath, defines, includedFiles, depth + 1, output)) {
+						return fail("in file included from here");
+					}
+				}
+			}
+		}
+		else {
+			return fail("unknown directive #" + directive);
+		}
+		output += '\n';
+	}
+
+	if (!conditionals.empty()) {
+		std::cerr << filePath.string() << ": missing #endif" << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <filesystem>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Compiles permutations of WGSL sources and caches them.
+ *
+ * Sources go through a minimal preprocessor before compilation. Directives
+ * must start their line:
+ *   #include "file.wgsl"   relative to the including file, inserted once
+ *   #ifdef NAME / #ifndef NAME / #else / #endif
+ *
+ * A permutation is a source path and a set of defined names. Modules are only
+ * compiled the first time a permutation is requested, so the number of
+ * variants follows what the loaded scenes actually use rather than every
+ * combination of features.
+ */
+class ShaderLibrary {
+public:
+	using path = std::filesystem::path;
+
+	void init(wgpu::Device device);
+	void terminate();
+
+	// Owned by the library, nullptr if the source could not be loaded
+	wgpu::ShaderModule getOrCreateModule(const path& filePath, const std::vector<std::string>& defines);
+
+	size_t moduleCount() const { return m_modules.size(); }
+
+	// Expand the directives of a source file, returns false and prints the
+	// reason on error
+	static bool preprocess(const path& filePath, const std::set<std::string>& defines, std::string& output);
+
+private:
+	static bool preprocessFile(
+		const path& filePath,
+		const std::set<std::string>& defines,
+		std::set<path>& includedFiles,
+		uint32_t depth,
+		std::string& output
+	);
+
+private:
+	wgpu::Device m_device = nullptr;
+	std::unordered_map<std::string, wgpu::ShaderModule> m_modules;
+};
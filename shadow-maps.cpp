@@ -0,0 +1,412 @@
+#include "shadow-maps.h"
+#include "cpu-profiler.h"
+#include "resource-manager.h"
+#include "webgpu-utils/webgpu-std-utils.hpp"
+
+#include <glm/glm/ext.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+// Blend between logarithmic (1) and uniform (0) cascade splits
+constexpr float SPLIT_LAMBDA = 0.75f;
+
+bool ShadowMaps::init(
+	Device device,
+	BindGroupLayout emptyBindGroupLayout,
+	BindGroupLayout nodeBindGroupLayout,
+	uint32_t minUniformBufferOffsetAlignment
+) {
+	m_device = device;
+	m_queue = device.getQueue();
+	m_emptyBindGroupLayout = emptyBindGroupLayout;
+	m_nodeBindGroupLayout = nodeBindGroupLayout;
+
+	// Shadow map and its cache
+	TextureDescriptor textureDesc;
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = DEPTH_FORMAT;
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.size = { MAP_SIZE, MAP_SIZE, LAYER_COUNT };
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+
+	textureDesc.label = "Shadow maps";
+	textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	m_shadowTexture = m_device.createTexture(textureDesc);
+
+	textureDesc.label = "Static shadow cache";
+	textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+	m_cacheTexture = m_device.createTexture(textureDesc);
+	m_textureMemory.set(GpuMemory::Category::Depth, 2 * GpuMemory::textureByteSize(textureDesc));
+
+	TextureViewDescriptor viewDesc;
+	viewDesc.aspect = TextureAspect::DepthOnly;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.format = DEPTH_FORMAT;
+
+	viewDesc.dimension = TextureViewDimension::_2DArray;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = LAYER_COUNT;
+	m_shadowArrayView = m_shadowTexture->createView(viewDesc);
+
+	viewDesc.dimension = TextureViewDimension::_2D;
+	viewDesc.arrayLayerCount = 1;
+	for (uint32_t layer = 0; layer < LAYER_COUNT; ++layer) {
+		viewDesc.baseArrayLayer = layer;
+		m_shadowLayerViews[layer] = m_shadowTexture->createView(viewDesc);
+		m_cacheLayerViews[layer] = m_cacheTexture->createView(viewDesc);
+	}
+
+	// Hardware 2x2 percentage closer filtering
+	SamplerDescriptor samplerDesc;
+	samplerDesc.label = "Shadow";
+	samplerDesc.addressModeU = AddressMode::ClampToEdge;
+	samplerDesc.addressModeV = AddressMode::ClampToEdge;
+	samplerDesc.addressModeW = AddressMode::ClampToEdge;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Nearest;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 1.0f;
+	samplerDesc.compare = CompareFunction::LessEqual;
+	samplerDesc.maxAnisotropy = 1;
+	m_sampler = m_device.createSampler(samplerDesc);
+
+	// Buffers
+	BufferDescriptor bufferDesc;
+	bufferDesc.mappedAtCreation = false;
+
+	bufferDesc.label = "Shadow uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+	m_uniformBuffer = m_device.createBuffer(bufferDesc);
+	m_uniforms = {};
+	m_queue.writeBuffer(*m_uniformBuffer, 0, &m_uniforms, sizeof(Uniforms));
+
+	m_passUniformStride = alignToNextMultipleOf(static_cast<uint32_t>(sizeof(glm::mat4)), minUniformBufferOffsetAlignment);
+	bufferDesc.label = "Shadow pass uniforms";
+	bufferDesc.size = LAYER_COUNT * m_passUniformStride;
+	bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+	m_passUniformBuffer = m_device.createBuffer(bufferDesc);
+	// Shadow uniforms are read as storage, but are uniforms all the same
+	m_uniformMemory.set(GpuMemory::Category::Uniform, sizeof(Uniforms) + bufferDesc.size);
+
+	// Bind groups of the shadow passes
+	BindGroupLayoutEntry passLayoutEntry = Default;
+	passLayoutEntry.binding = 0;
+	passLayoutEntry.visibility = ShaderStage::Vertex;
+	passLayoutEntry.buffer.type = BufferBindingType::Uniform;
+	passLayoutEntry.buffer.hasDynamicOffset = true;
+	passLayoutEntry.buffer.minBindingSize = sizeof(glm::mat4);
+
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.label = "Shadow pass";
+	bindGroupLayoutDesc.entryCount = 1;
+	bindGroupLayoutDesc.entries = &passLayoutEntry;
+	m_passBindGroupLayout = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+	BindGroupEntry passEntry = Default;
+	passEntry.binding = 0;
+	passEntry.buffer = *m_passUniformBuffer;
+	passEntry.offset = 0;
+	passEntry.size = sizeof(glm::mat4);
+
+	BindGroupDescriptor bindGroupDesc;
+	bindGroupDesc.label = "Shadow pass";
+	bindGroupDesc.layout = *m_passBindGroupLayout;
+	bindGroupDesc.entryCount = 1;
+	bindGroupDesc.entries = &passEntry;
+	m_passBindGroup = m_device.createBindGroup(bindGroupDesc);
+
+	bindGroupDesc.label = "Empty";
+	bindGroupDesc.layout = m_emptyBindGroupLayout;
+	bindGroupDesc.entryCount = 0;
+	bindGroupDesc.entries = nullptr;
+	m_emptyBindGroup = m_device.createBindGroup(bindGroupDesc);
+
+	m_shaderModule = ResourceManager::loadShaderModule(RESOURCE_DIR "/shaders/shadow.wgsl", m_device);
+	if (!m_shaderModule) {
+		std::cerr << "Could not load shadow shader!" << std::endl;
+		return false;
+	}
+
+	invalidate();
+	return m_shadowArrayView && m_sampler && m_uniformBuffer && m_passBindGroup;
+}
+
+void ShadowMaps::terminate() {
+	terminatePipelines();
+	m_shaderModule = {};
+	m_emptyBindGroup = {};
+	m_passBindGroup = {};
+	m_passBindGroupLayout = {};
+	m_passUniformBuffer = {};
+	m_uniformBuffer = {};
+	m_uniformMemory.reset();
+	m_sampler = {};
+	for (uint32_t layer = 0; layer < LAYER_COUNT; ++layer) {
+		m_cacheLayerViews[layer] = {};
+		m_shadowLayerViews[layer] = {};
+	}
+	m_shadowArrayView = {};
+	m_cacheTexture = {};
+	m_shadowTexture = {};
+	m_textureMemory.reset();
+	m_emptyBindGroupLayout = nullptr;
+	m_nodeBindGroupLayout = nullptr;
+	if (m_queue) m_queue.release();
+	m_queue = nullptr;
+	m_device = nullptr;
+}
+
+bool ShadowMaps::initPipelines(const GpuScene& scene) {
+	std::vector<BindGroupLayout> bindGroupLayouts = {
+		*m_passBindGroupLayout,
+		m_emptyBindGroupLayout,
+		m_nodeBindGroupLayout
+	};
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = static_cast<uint32_t>(bindGroupLayouts.size());
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)bindGroupLayouts.data();
+	PipelineLayout layout = m_device.createPipelineLayout(layoutDesc);
+
+	// Slope-scaled bias against self-shadowing, the shading pass adds a
+	// normal offset on top
+	DepthStencilState depthStencilState = Default;
+	depthStencilState.format = DEPTH_FORMAT;
+	depthStencilState.depthCompare = CompareFunction::Less;
+	depthStencilState.depthWriteEnabled = true;
+	depthStencilState.depthBias = 1;
+	depthStencilState.depthBiasSlopeScale = 1.5f;
+	depthStencilState.depthBiasClamp = 0.0f;
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+
+	RenderPipelineDescriptor pipelineDesc;
+	pipelineDesc.label = "Shadow";
+	pipelineDesc.layout = layout;
+	pipelineDesc.vertex.module = *m_shaderModule;
+	pipelineDesc.vertex.entryPoint = "vs_shadow";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	pipelineDesc.primitive.cullMode = CullMode::None;
+	pipelineDesc.fragment = nullptr;
+	pipelineDesc.depthStencil = &depthStencilState;
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	bool success = true;
+	for (uint32_t pipelineIdx = 0; pipelineIdx < scene.renderPipelineCount(); ++pipelineIdx) {
+		VertexBufferLayout positionLayout = scene.positionVertexBufferLayout(pipelineIdx);
+		pipelineDesc.vertex.bufferCount = 1;
+		pipelineDesc.vertex.buffers = &positionLayout;
+		pipelineDesc.primitive.topology = scene.primitiveTopology(pipelineIdx);
+
+		RenderPipeline pipeline = m_device.createRenderPipeline(pipelineDesc);
+		if (pipeline == nullptr) {
+			success = false;
+			break;
+		}
+		m_pipelines.push_back(pipeline);
+	}
+
+	layout.release();
+	return success;
+}
+
+void ShadowMaps::terminatePipelines() {
+	for (RenderPipeline pipeline : m_pipelines) {
+		pipeline.release();
+	}
+	m_pipelines.clear();
+}
+
+void ShadowMaps::invalidate() {
+	m_cacheValid.fill(false);
+}
+
+void ShadowMaps::update(
+	const glm::mat4& viewMatrix,
+	const glm::mat4& projectionMatrix,
+	float zNear,
+	float shadowDistance,
+	const std::array<glm::vec4, LIGHT_COUNT>& lightDirections,
+	const GpuScene& scene,
+	bool enabled
+) {
+	Uniforms uniforms = m_uniforms;
+	uniforms.enabled = enabled ? 1 : 0;
+	uniforms.invMapSize = 1.0f / MAP_SIZE;
+
+	if (enabled) {
+		const glm::mat4 cameraToWorld = glm::inverse(viewMatrix);
+		const glm::vec3 cameraPosition = glm::vec3(cameraToWorld[3]);
+		// Distance to the view axis of frustum corners, per unit of depth
+		const float tanX = 1.0f / projectionMatrix[0][0];
+		const float tanY = 1.0f / projectionMatrix[1][1];
+		const float cornerSlope2 = tanX * tanX + tanY * tanY;
+
+		for (uint32_t cascade = 0; cascade < CASCADE_COUNT; ++cascade) {
+			const float sliceFar = splitDistance(cascade + 1, zNear, shadowDistance);
+
+			// Sphere around the camera through the far corners of the slice,
+			// which holds the slice whatever the camera orientation. Larger
+			// than the tightest sphere of the slice, but turning the camera
+			// then leaves the projection, and the static cache, untouched.
+			float radius = sliceFar * std::sqrt(1.0f + cornerSlope2);
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+			const glm::vec3 center = cameraPosition;
+			const float texelSize = 2.0f * radius / MAP_SIZE;
+
+			uniforms.splits[cascade] = sliceFar;
+			uniforms.texelWorldSizes[cascade] = texelSize;
+
+			for (uint32_t lightIdx = 0; lightIdx < LIGHT_COUNT; ++lightIdx) {
+				glm::vec3 toLight = glm::vec3(lightDirections[lightIdx]);
+				float length = glm::length(toLight);
+				toLight = length > 1e-6f ? toLight / length : glm::vec3(0.0f, 0.0f, 1.0f);
+				glm::vec3 up = std::abs(toLight.z) > 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+				const glm::mat4 lightView = glm::lookAtLH(glm::vec3(0.0f), -toLight, up);
+
+				// Snap the cascade to whole texels in light space, so that
+				// static shadows neither shimmer nor need to be rendered again
+				// for sub-texel camera motion
+				glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+				lightCenter = glm::floor(lightCenter / texelSize) * texelSize;
+
+				// Extend towards the light to catch every caster of the scene
+				float sceneNear = (lightView * glm::vec4(scene.boundsCenter(), 1.0f)).z - scene.boundsRadius();
+				float zMin = std::min(lightCenter.z - radius, sceneNear);
+				float zMax = lightCenter.z + radius;
+
+				const glm::mat4 lightProjection = glm::orthoLH_ZO(
+					lightCenter.x - radius, lightCenter.x + radius,
+					lightCenter.y - radius, lightCenter.y + radius,
+					zMin, zMax
+				);
+				uniforms.viewProjections[lightIdx * CASCADE_COUNT + cascade] = lightProjection * lightView;
+			}
+		}
+	}
+
+	for (uint32_t layer = 0; layer < LAYER_COUNT; ++layer) {
+		if (uniforms.viewProjections[layer] != m_uniforms.viewProjections[layer]) {
+			m_queue.writeBuffer(*m_passUniformBuffer, layer * m_passUniformStride, &uniforms.viewProjections[layer], sizeof(glm::mat4));
+			m_uploadedBytes += sizeof(glm::mat4);
+		}
+	}
+	if (std::memcmp(&uniforms, &m_uniforms, sizeof(Uniforms)) != 0) {
+		m_queue.writeBuffer(*m_uniformBuffer, 0, &uniforms, sizeof(Uniforms));
+		m_uploadedBytes += sizeof(Uniforms);
+		m_uniforms = uniforms;
+	}
+}
+
+uint32_t ShadowMaps::render(CommandEncoder encoder, GpuScene& scene, GpuProfiler& profiler) {
+	CPU_PROFILE_SCOPE("Encode shadows");
+	if (!m_uniforms.enabled || m_pipelines.empty()) return 0;
+
+	const bool hasDynamicCasters = scene.hasDynamicNodes();
+	uint32_t renderedCascadeCount = 0;
+	for (uint32_t layer = 0; layer < LAYER_COUNT; ++layer) {
+		const glm::mat4& viewProjection = m_uniforms.viewProjections[layer];
+		bool isCacheStale = !m_cacheValid[layer] || m_cachedViewProjections[layer] != viewProjection;
+		if (isCacheStale) {
+			renderLayer(encoder, scene, *m_cacheLayerViews[layer], layer, GpuScene::NodeFilter::Static, LoadOp::Clear, profiler);
+			m_cachedViewProjections[layer] = viewProjection;
+			m_cacheValid[layer] = true;
+			++renderedCascadeCount;
+		}
+
+		// Otherwise the shadow map already holds the cache
+		if (isCacheStale || hasDynamicCasters) {
+			ImageCopyTexture source;
+			source.texture = *m_cacheTexture;
+			source.mipLevel = 0;
+			source.origin = { 0, 0, layer };
+			source.aspect = TextureAspect::All;
+			ImageCopyTexture destination = source;
+			destination.texture = *m_shadowTexture;
+			Extent3D copySize;
+			copySize.width = MAP_SIZE;
+			copySize.height = MAP_SIZE;
+			copySize.depthOrArrayLayers = 1;
+			encoder.copyTextureToTexture(source, destination, copySize);
+
+			if (hasDynamicCasters) {
+				renderLayer(encoder, scene, *m_shadowLayerViews[layer], layer, GpuScene::NodeFilter::Dynamic, LoadOp::Load, profiler);
+			}
+		}
+	}
+	return renderedCascadeCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+void ShadowMaps::renderLayer(
+	CommandEncoder encoder,
+	GpuScene& scene,
+	TextureView target,
+	uint32_t layer,
+	GpuScene::NodeFilter filter,
+	LoadOp loadOp,
+	GpuProfiler& profiler
+) {
+	RenderPassDepthStencilAttachment depthStencilAttachment;
+	depthStencilAttachment.view = target;
+	depthStencilAttachment.depthClearValue = 1.0f;
+	depthStencilAttachment.depthLoadOp = loadOp;
+	depthStencilAttachment.depthStoreOp = StoreOp::Store;
+	depthStencilAttachment.depthReadOnly = false;
+	depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+	depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Store;
+#else
+	depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif
+	depthStencilAttachment.stencilReadOnly = true;
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = filter == GpuScene::NodeFilter::Static ? "Static shadows" : "Dynamic shadows";
+	renderPassDesc.colorAttachmentCount = 0;
+	renderPassDesc.colorAttachments = nullptr;
+	renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+	renderPassDesc.timestampWrites = profiler.renderPassTimestampWrites(renderPassDesc.label);
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+
+	uint32_t offset = layer * m_passUniformStride;
+	renderPass.setBindGroup(0, *m_passBindGroup, 1, &offset);
+	renderPass.setBindGroup(1, *m_emptyBindGroup, 0, nullptr);
+	scene.bindPositions(renderPass);
+	for (uint32_t pipelineIdx = 0; pipelineIdx < m_pipelines.size(); ++pipelineIdx) {
+		// Translucent surfaces do not cast shadows, alpha tested ones cast
+		// them as if they were opaque
+		if (scene.materialFeatures(pipelineIdx) & GpuScene::AlphaBlend) continue;
+		renderPass.setPipeline(m_pipelines[pipelineIdx]);
+		scene.drawDepth(renderPass, pipelineIdx, filter);
+	}
+
+	renderPass.end();
+	renderPass.release();
+}
+
+float ShadowMaps::splitDistance(uint32_t index, float zNear, float zFar) {
+	// "Practical" split scheme, see GPU Gems 3, chapter 10
+	float t = static_cast<float>(index) / CASCADE_COUNT;
+	float logSplit = zNear * std::pow(zFar / zNear, t);
+	float uniformSplit = zNear + (zFar - zNear) * t;
+	return SPLIT_LAMBDA * logSplit + (1.0f - SPLIT_LAMBDA) * uniformSplit;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "gpu-memory.h"
+#include "gpu-profiler.h"
+#include "gpu-scene.h"
+
+#include <webgpu/webgpu.hpp>
+#include <webgpu/webgpu-raii.hpp>
+#include <glm/glm/glm.hpp>
+
+#include <array>
+#include <vector>
+
+/**
+ * Cascaded shadow maps for the directional lights of the lighting uniforms.
+ *
+ * The shadow distance is split into CASCADE_COUNT slices, each covered by an
+ * orthographic light projection. Cascades are fitted to a sphere around the
+ * camera that holds their slice in any orientation, and snapped to shadow
+ * map texels, so that their projection only changes when the camera moved
+ * by at least a texel, and never when it merely turns.
+ *
+ * Static casters are rendered into a cache texture, and only again when the
+ * projection of their cascade changes. Dynamic casters (animated nodes) are
+ * drawn every frame on top of a copy of the cache. With a still camera and
+ * no dynamic caster, no shadow work is recorded at all.
+ */
+class ShadowMaps {
+public:
+	// Must match Application::LightingUniforms::directions
+	static constexpr uint32_t LIGHT_COUNT = 2;
+	// Must match resources/shaders/shader.wgsl
+	static constexpr uint32_t CASCADE_COUNT = 4;
+	static constexpr uint32_t LAYER_COUNT = LIGHT_COUNT * CASCADE_COUNT;
+	static constexpr uint32_t MAP_SIZE = 1024;
+
+	// Read when shading, in a storage buffer as it exceeds the uniform
+	// binding size limit
+	struct Uniforms {
+		// Layer light * CASCADE_COUNT + cascade
+		std::array<glm::mat4, LAYER_COUNT> viewProjections;
+		// View depth at which each cascade ends
+		glm::vec4 splits;
+		// World-space size of a shadow map texel in each cascade
+		glm::vec4 texelWorldSizes;
+		float invMapSize;
+		uint32_t enabled;
+		float _pad[2];
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+public:
+	bool init(
+		wgpu::Device device,
+		wgpu::BindGroupLayout emptyBindGroupLayout,
+		wgpu::BindGroupLayout nodeBindGroupLayout,
+		uint32_t minUniformBufferOffsetAlignment
+	);
+	void terminate();
+
+	// One pipeline per render pipeline of the scene, like the depth pre-pass
+	bool initPipelines(const GpuScene& scene);
+	void terminatePipelines();
+
+	// Drop cached static shadows, e.g. after loading another scene
+	void invalidate();
+
+	// Fit cascades to the camera and upload them if they changed
+	void update(
+		const glm::mat4& viewMatrix,
+		const glm::mat4& projectionMatrix,
+		float zNear,
+		float shadowDistance,
+		const std::array<glm::vec4, LIGHT_COUNT>& lightDirections,
+		const GpuScene& scene,
+		bool enabled
+	);
+
+	// Record the shadow passes that are needed this frame, returns the number
+	// of cascades whose static casters had to be rendered again. Static and
+	// dynamic casters are profiled as separate scopes.
+	uint32_t render(wgpu::CommandEncoder encoder, GpuScene& scene, GpuProfiler& profiler);
+
+	// Bound in the global bind group of the main pipelines
+	wgpu::Buffer uniformBuffer() const { return *m_uniformBuffer; }
+	uint64_t uniformBufferSize() const { return sizeof(Uniforms); }
+	wgpu::TextureView textureView() const { return *m_shadowArrayView; }
+	wgpu::Sampler sampler() const { return *m_sampler; }
+
+	// Total uploaded by update() so far
+	uint64_t uploadedBytes() const { return m_uploadedBytes; }
+
+private:
+	void renderLayer(
+		wgpu::CommandEncoder encoder,
+		GpuScene& scene,
+		wgpu::TextureView target,
+		uint32_t layer,
+		GpuScene::NodeFilter filter,
+		wgpu::LoadOp loadOp,
+		GpuProfiler& profiler
+	);
+
+	static float splitDistance(uint32_t index, float zNear, float zFar);
+
+private:
+	static constexpr wgpu::TextureFormat DEPTH_FORMAT = wgpu::TextureFormat::Depth32Float;
+
+	wgpu::Device m_device = nullptr;
+	wgpu::Queue m_queue = nullptr;
+
+	wgpu::raii::ShaderModule m_shaderModule;
+	wgpu::BindGroupLayout m_emptyBindGroupLayout = nullptr;
+	wgpu::BindGroupLayout m_nodeBindGroupLayout = nullptr;
+	wgpu::raii::BindGroupLayout m_passBindGroupLayout;
+	wgpu::raii::BindGroup m_passBindGroup;
+	wgpu::raii::BindGroup m_emptyBindGroup;
+	std::vector<wgpu::RenderPipeline> m_pipelines;
+
+	// Sampled when shading, holds static and dynamic casters
+	wgpu::raii::Texture m_shadowTexture;
+	wgpu::raii::TextureView m_shadowArrayView;
+	std::array<wgpu::raii::TextureView, LAYER_COUNT> m_shadowLayerViews;
+	// Static casters only
+	wgpu::raii::Texture m_cacheTexture;
+	std::array<wgpu::raii::TextureView, LAYER_COUNT> m_cacheLayerViews;
+	// Of both textures
+	GpuMemory::Allocation m_textureMemory;
+	wgpu::raii::Sampler m_sampler;
+
+	wgpu::raii::Buffer m_uniformBuffer;
+	// One light view-projection per layer, bound with a dynamic offset
+	wgpu::raii::Buffer m_passUniformBuffer;
+	uint32_t m_passUniformStride = 256;
+	GpuMemory::Allocation m_uniformMemory;
+
+	// Last uploaded uniforms
+	Uniforms m_uniforms = {};
+	// Projection each layer of the cache was rendered with
+	std::array<glm::mat4, LAYER_COUNT> m_cachedViewProjections;
+	std::array<bool, LAYER_COUNT> m_cacheValid = {};
+
+	uint64_t m_uploadedBytes = 0;
+};
@@ -0,0 +1,384 @@
+#include "stress-scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+using namespace tinygltf;
+
+static constexpr double PI = 3.14159265358979323846;
+// Distance between the roots of two neighboring chains, spheres have a
+// radius of about 1
+static constexpr double NODE_SPACING = 3.0;
+static constexpr double CHAIN_STEP = 2.2;
+static constexpr double CHAIN_TWIST = 0.3;
+
+static bool parseUint(const std::string& value, uint32_t& result) {
+	if (value.empty()) return false;
+	char* end;
+	unsigned long parsed = std::strtoul(value.c_str(), &end, 10);
+	if (*end != '\0' || parsed > UINT32_MAX) return false;
+	result = static_cast<uint32_t>(parsed);
+	return true;
+}
+
+static bool parseFraction(const std::string& value, float& result) {
+	if (value.empty()) return false;
+	char* end;
+	float parsed = std::strtof(value.c_str(), &end);
+	if (*end != '\0' || !(parsed >= 0.0f && parsed <= 1.0f)) return false;
+	result = parsed;
+	return true;
+}
+
+bool StressScene::parse(const std::string& description, Parameters& parameters) {
+	std::istringstream stream(description);
+	std::string entry;
+	while (std::getline(stream, entry, ',')) {
+		if (entry.empty()) continue;
+		size_t separator = entry.find('=');
+		if (separator == std::string::npos) {
+			std::cerr << "Stress scene: expected key=value, got '" << entry << "'" << std::endl;
+			return false;
+		}
+		const std::string key = entry.substr(0, separator);
+		const std::string value = entry.substr(separator + 1);
+
+		uint32_t variants = 0;
+		bool isValid = false;
+		if (key == "nodes") isValid = parseUint(value, parameters.nodeCount);
+		else if (key == "depth") isValid = parseUint(value, parameters.hierarchyDepth) && parameters.hierarchyDepth > 0;
+		else if (key == "meshes") isValid = parseUint(value, parameters.meshCount) && parameters.meshCount > 0;
+		else if (key == "triangles") isValid = parseUint(value, parameters.trianglesPerMesh);
+		else if (key == "materials") isValid = parseUint(value, parameters.materialCount) && parameters.materialCount > 0;
+		else if (key == "variants") {
+			isValid = parseUint(value, variants) && variants <= 1;
+			parameters.materialVariants = variants == 1;
+		}
+		else if (key == "textures") isValid = parseUint(value, parameters.textureCount);
+		else if (key == "texture-size") isValid = parseUint(value, parameters.textureSize) && parameters.textureSize > 0;
+		else if (key == "lights") isValid = parseUint(value, parameters.lightCount);
+		else if (key == "mirrored") isValid = parseFraction(value, parameters.mirroredFraction);
+		else if (key == "animated") isValid = parseFraction(value, parameters.animatedFraction);
+		else if (key == "seed") isValid = parseUint(value, parameters.seed);
+		else {
+			std::cerr << "Stress scene: unknown key '" << key << "'" << std::endl;
+			return false;
+		}
+
+		if (!isValid) {
+			std::cerr << "Stress scene: invalid value '" << value << "' for " << key << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string StressScene::describeKeys() {
+	return
+		"  nodes=<N>         Nodes instancing a mesh (default 1000)\n"
+		"  depth=<N>         Length of parent-child chains, 1 for a flat scene (default 1)\n"
+		"  meshes=<N>        Distinct sphere geometries (default 16)\n"
+		"  triangles=<N>     Approximate triangle count of each geometry (default 512)\n"
+		"  materials=<N>     Materials, each with a mesh of its own (default 16)\n"
+		"  variants=<0|1>    Cycle alpha modes, double sidedness and normal maps (default 1)\n"
+		"  textures=<N>      Checkerboard textures (default 4)\n"
+		"  texture-size=<N>  Width and height of the textures (default 256)\n"
+		"  lights=<N>        Point lights (default 8)\n"
+		"  mirrored=<0..1>   Share of nodes with a negative scale (default 0)\n"
+		"  animated=<0..1>   Share of chains moved by an animation (default 0)\n"
+		"  seed=<N>          Seed of the random colors and placements (default 1)\n";
+}
+
+namespace {
+// Appends views and accessors to a model that has a single buffer
+class ModelBuilder {
+public:
+	explicit ModelBuilder(Model& model) : m_model(model) {
+		m_model.buffers.resize(1);
+	}
+
+	int addAccessor(const void* data, size_t byteSize, int target, int componentType, size_t count, int type) {
+		std::vector<unsigned char>& bytes = m_model.buffers[0].data;
+		// Keep every view 4-byte aligned, as accessors require
+		bytes.resize((bytes.size() + 3) & ~size_t(3));
+
+		BufferView view;
+		view.buffer = 0;
+		view.byteOffset = bytes.size();
+		view.byteLength = byteSize;
+		view.target = target;
+		const unsigned char* begin = reinterpret_cast<const unsigned char*>(data);
+		bytes.insert(bytes.end(), begin, begin + byteSize);
+		m_model.bufferViews.push_back(view);
+
+		Accessor accessor;
+		accessor.bufferView = static_cast<int>(m_model.bufferViews.size() - 1);
+		accessor.componentType = componentType;
+		accessor.count = count;
+		accessor.type = type;
+		m_model.accessors.push_back(accessor);
+		return static_cast<int>(m_model.accessors.size() - 1);
+	}
+
+	int addFloats(const std::vector<float>& values, int type, int componentCount, int target = 0) {
+		return addAccessor(values.data(), values.size() * sizeof(float), target, TINYGLTF_COMPONENT_TYPE_FLOAT, values.size() / componentCount, type);
+	}
+
+	Accessor& accessor(int idx) { return m_model.accessors[idx]; }
+
+private:
+	Model& m_model;
+};
+} // namespace
+
+// UV sphere with bumps, so that meshes are told apart and LODs have
+// curvature to preserve
+static Primitive addSphere(ModelBuilder& builder, uint32_t triangleCount, uint32_t geometryIdx) {
+	// A sphere of r rings and 2r segments has about 4r^2 triangles
+	const uint32_t rings = std::max(3u, static_cast<uint32_t>(std::sqrt(triangleCount / 4.0)));
+	const uint32_t segments = 2 * rings;
+	const double bumpFrequency = 2.0 + geometryIdx % 5;
+
+	std::vector<float> positions, normals, uvs;
+	for (uint32_t j = 0; j <= rings; ++j) {
+		const double theta = PI * j / rings;
+		for (uint32_t i = 0; i <= segments; ++i) {
+			const double phi = 2.0 * PI * i / segments;
+			const double nx = std::sin(theta) * std::cos(phi);
+			const double ny = std::cos(theta);
+			const double nz = std::sin(theta) * std::sin(phi);
+			const double radius = 1.0 + 0.1 * std::sin(bumpFrequency * theta) * std::sin(bumpFrequency * phi);
+			positions.insert(positions.end(), { float(radius * nx), float(radius * ny), float(radius * nz) });
+			normals.insert(normals.end(), { float(nx), float(ny), float(nz) });
+			uvs.insert(uvs.end(), { float(i) / segments, float(j) / rings });
+		}
+	}
+
+	std::vector<uint32_t> indices;
+	for (uint32_t j = 0; j < rings; ++j) {
+		for (uint32_t i = 0; i < segments; ++i) {
+			uint32_t v00 = j * (segments + 1) + i;
+			uint32_t v01 = v00 + 1;
+			uint32_t v10 = v00 + segments + 1;
+			uint32_t v11 = v10 + 1;
+			indices.insert(indices.end(), { v00, v01, v10, v01, v11, v10 });
+		}
+	}
+
+	Primitive prim;
+	prim.mode = TINYGLTF_MODE_TRIANGLES;
+	prim.attributes["POSITION"] = builder.addFloats(positions, TINYGLTF_TYPE_VEC3, 3, TINYGLTF_TARGET_ARRAY_BUFFER);
+	builder.accessor(prim.attributes["POSITION"]).minValues = { -1.1, -1.1, -1.1 };
+	builder.accessor(prim.attributes["POSITION"]).maxValues = { 1.1, 1.1, 1.1 };
+	prim.attributes["NORMAL"] = builder.addFloats(normals, TINYGLTF_TYPE_VEC3, 3, TINYGLTF_TARGET_ARRAY_BUFFER);
+	prim.attributes["TEXCOORD_0"] = builder.addFloats(uvs, TINYGLTF_TYPE_VEC2, 2, TINYGLTF_TARGET_ARRAY_BUFFER);
+	prim.indices = builder.addAccessor(
+		indices.data(), indices.size() * sizeof(uint32_t), TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER,
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, indices.size(), TINYGLTF_TYPE_SCALAR
+	);
+	return prim;
+}
+
+static Image makeCheckerboard(uint32_t size, std::mt19937& rng, uint32_t textureIdx) {
+	std::uniform_int_distribution<int> channel(0, 255);
+	const unsigned char colors[2][4] = {
+		{ static_cast<unsigned char>(channel(rng)), static_cast<unsigned char>(channel(rng)), static_cast<unsigned char>(channel(rng)), 255 },
+		{ static_cast<unsigned char>(channel(rng)), static_cast<unsigned char>(channel(rng)), static_cast<unsigned char>(channel(rng)), 255 },
+	};
+	const uint32_t cellSize = std::max(1u, size / 8);
+
+	Image image;
+	image.name = "Checkerboard " + std::to_string(textureIdx);
+	image.mimeType = "image/png";
+	image.width = static_cast<int>(size);
+	image.height = static_cast<int>(size);
+	image.component = 4;
+	image.bits = 8;
+	image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+	image.image.resize(4 * size_t(size) * size);
+	for (uint32_t y = 0; y < size; ++y) {
+		for (uint32_t x = 0; x < size; ++x) {
+			const unsigned char* color = colors[(x / cellSize + y / cellSize) % 2];
+			std::memcpy(&image.image[4 * (size_t(y) * size + x)], color, 4);
+		}
+	}
+	return image;
+}
+
+tinygltf::Model StressScene::generate(const Parameters& parameters) {
+	std::mt19937 rng(parameters.seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+	Model model;
+	model.asset.version = "2.0";
+	model.asset.generator = "mega stress scene";
+	ModelBuilder builder(model);
+
+	// Textures
+	if (parameters.textureCount > 0) {
+		Sampler sampler;
+		sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR;
+		sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
+		sampler.wrapS = TINYGLTF_TEXTURE_WRAP_REPEAT;
+		sampler.wrapT = TINYGLTF_TEXTURE_WRAP_REPEAT;
+		model.samplers.push_back(sampler);
+	}
+	for (uint32_t textureIdx = 0; textureIdx < parameters.textureCount; ++textureIdx) {
+		model.images.push_back(makeCheckerboard(parameters.textureSize, rng, textureIdx));
+		Texture texture;
+		texture.source = static_cast<int>(textureIdx);
+		texture.sampler = 0;
+		model.textures.push_back(texture);
+	}
+
+	// Materials
+	for (uint32_t materialIdx = 0; materialIdx < parameters.materialCount; ++materialIdx) {
+		Material material;
+		material.name = "Material " + std::to_string(materialIdx);
+		material.pbrMetallicRoughness.baseColorFactor = { unit(rng), unit(rng), unit(rng), 1.0 };
+		material.pbrMetallicRoughness.metallicFactor = (materialIdx % 5) / 4.0;
+		material.pbrMetallicRoughness.roughnessFactor = 0.1 + 0.9 * unit(rng);
+		if (parameters.textureCount > 0) {
+			material.pbrMetallicRoughness.baseColorTexture.index = static_cast<int>(materialIdx % parameters.textureCount);
+		}
+		if (parameters.materialVariants) {
+			switch (materialIdx % 4) {
+			case 2:
+				material.alphaMode = "MASK";
+				material.alphaCutoff = 0.5;
+				break;
+			case 3:
+				material.alphaMode = "BLEND";
+				material.pbrMetallicRoughness.baseColorFactor[3] = 0.5;
+				break;
+			default:
+				material.alphaMode = "OPAQUE";
+			}
+			material.doubleSided = (materialIdx / 4) % 2 == 1;
+			if ((materialIdx / 8) % 2 == 1 && parameters.textureCount > 0) {
+				material.normalTexture.index = static_cast<int>((materialIdx + 1) % parameters.textureCount);
+			}
+		}
+		model.materials.push_back(material);
+	}
+
+	// Meshes, all materials share the geometry of the mesh they cycle to
+	std::vector<Primitive> geometries;
+	for (uint32_t geometryIdx = 0; geometryIdx < parameters.meshCount; ++geometryIdx) {
+		geometries.push_back(addSphere(builder, parameters.trianglesPerMesh, geometryIdx));
+	}
+	const uint32_t meshCount = std::max(parameters.meshCount, parameters.materialCount);
+	for (uint32_t meshIdx = 0; meshIdx < meshCount; ++meshIdx) {
+		Mesh mesh;
+		mesh.name = "Mesh " + std::to_string(meshIdx);
+		mesh.primitives.push_back(geometries[meshIdx % parameters.meshCount]);
+		mesh.primitives.back().material = static_cast<int>(meshIdx % parameters.materialCount);
+		model.meshes.push_back(mesh);
+	}
+
+	// Nodes, in chains of hierarchyDepth whose roots lie on a square grid
+	Scene scene;
+	const uint32_t depth = std::max(1u, parameters.hierarchyDepth);
+	const uint32_t chainCount = (parameters.nodeCount + depth - 1) / depth;
+	const uint32_t gridSide = std::max(1u, static_cast<uint32_t>(std::ceil(std::sqrt(double(chainCount)))));
+	const double gridOffset = 0.5 * NODE_SPACING * (gridSide - 1);
+
+	Animation animation;
+	animation.name = "Stress animation";
+	int animationTimesAccessor = -1;
+
+	for (uint32_t nodeIdx = 0; nodeIdx < parameters.nodeCount; ++nodeIdx) {
+		const uint32_t chainIdx = nodeIdx / depth;
+		const bool isRoot = nodeIdx % depth == 0;
+
+		Node node;
+		node.name = "Node " + std::to_string(nodeIdx);
+		node.mesh = static_cast<int>(nodeIdx % meshCount);
+		if (isRoot) {
+			node.translation = {
+				NODE_SPACING * (chainIdx % gridSide) - gridOffset,
+				0.0,
+				NODE_SPACING * (chainIdx / gridSide) - gridOffset,
+			};
+			scene.nodes.push_back(static_cast<int>(nodeIdx));
+		}
+		else {
+			node.translation = { 0.0, CHAIN_STEP, 0.0 };
+			node.rotation = { 0.0, std::sin(0.5 * CHAIN_TWIST), 0.0, std::cos(0.5 * CHAIN_TWIST) };
+			model.nodes[nodeIdx - 1].children.push_back(static_cast<int>(nodeIdx));
+		}
+		if (unit(rng) < parameters.mirroredFraction) {
+			node.scale = { -1.0, 1.0, 1.0 };
+		}
+
+		if (isRoot && unit(rng) < parameters.animatedFraction) {
+			if (animationTimesAccessor < 0) {
+				animationTimesAccessor = builder.addFloats({ 0.0f, 1.0f }, TINYGLTF_TYPE_SCALAR, 1);
+				builder.accessor(animationTimesAccessor).minValues = { 0.0 };
+				builder.accessor(animationTimesAccessor).maxValues = { 1.0 };
+			}
+			// Bob up and down
+			const std::vector<float> translations = {
+				float(node.translation[0]), 0.0f, float(node.translation[2]),
+				float(node.translation[0]), 1.0f, float(node.translation[2]),
+			};
+			AnimationSampler sampler;
+			sampler.input = animationTimesAccessor;
+			sampler.output = builder.addFloats(translations, TINYGLTF_TYPE_VEC3, 3);
+			sampler.interpolation = "LINEAR";
+			animation.samplers.push_back(sampler);
+
+			AnimationChannel channel;
+			channel.sampler = static_cast<int>(animation.samplers.size() - 1);
+			channel.target_node = static_cast<int>(nodeIdx);
+			channel.target_path = "translation";
+			animation.channels.push_back(channel);
+		}
+
+		model.nodes.push_back(node);
+	}
+	if (!animation.channels.empty()) {
+		model.animations.push_back(animation);
+	}
+
+	// Point lights, scattered above the grid
+	const double extent = gridOffset + NODE_SPACING;
+	for (uint32_t lightIdx = 0; lightIdx < parameters.lightCount; ++lightIdx) {
+		Light light;
+		light.name = "Light " + std::to_string(lightIdx);
+		light.type = "point";
+		light.color = { 0.5 + 0.5 * unit(rng), 0.5 + 0.5 * unit(rng), 0.5 + 0.5 * unit(rng) };
+		light.intensity = 20.0;
+		light.range = 4.0 * NODE_SPACING;
+		model.lights.push_back(light);
+
+		Node node;
+		node.name = light.name;
+		node.light = static_cast<int>(lightIdx);
+		node.translation = { extent * (2.0 * unit(rng) - 1.0), 3.0, extent * (2.0 * unit(rng) - 1.0) };
+		scene.nodes.push_back(static_cast<int>(model.nodes.size()));
+		model.nodes.push_back(node);
+	}
+	if (parameters.lightCount > 0) {
+		model.extensionsUsed.push_back("KHR_lights_punctual");
+	}
+
+	model.scenes.push_back(scene);
+	model.defaultScene = 0;
+	return model;
+}
+
+bool StressScene::write(const tinygltf::Model& model, const std::filesystem::path& path) {
+	const bool writeBinary = path.extension() == ".glb";
+	TinyGLTF writer;
+	bool success = writer.WriteGltfSceneToFile(&model, path.string(), true, true, !writeBinary, writeBinary);
+	if (!success) {
+		std::cerr << "Could not write " << path << std::endl;
+	}
+	return success;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "resource-loaders/tiny_gltf.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * Procedural glTF scenes with controlled sizes, to find where each part of
+ * the renderer stops scaling: node count, hierarchy depth, material and
+ * pipeline count, geometry and texture sizes, lights.
+ *
+ * Scenes are described by a list of key=value pairs, such as
+ * "nodes=100000,materials=10000,depth=8". The application loads a scene path
+ * of the form "stress:<description>" by generating it in memory.
+ */
+class StressScene {
+public:
+	static constexpr const char* PATH_PREFIX = "stress:";
+
+	struct Parameters {
+		// Nodes that instance a mesh, lights come in addition
+		uint32_t nodeCount = 1000;
+		// Length of the parent-child chains nodes are arranged in, 1 for a
+		// flat scene
+		uint32_t hierarchyDepth = 1;
+		// Distinct geometries, each a sphere of about trianglesPerMesh
+		// triangles. Every material gets a mesh of its own, so there are
+		// max(meshCount, materialCount) glTF meshes.
+		uint32_t meshCount = 16;
+		uint32_t trianglesPerMesh = 512;
+		uint32_t materialCount = 16;
+		// When set, materials cycle through alpha modes, double sidedness
+		// and normal mapping, so that they need several render pipelines
+		bool materialVariants = true;
+		// RGBA8 checkerboards of textureSize x textureSize texels
+		uint32_t textureCount = 4;
+		uint32_t textureSize = 256;
+		uint32_t lightCount = 8;
+		// Share of the nodes scaled by -1 along X, which need pipelines
+		// with clockwise front faces
+		float mirroredFraction = 0.0f;
+		// Share of the root nodes moved by an animation, which makes them
+		// and their subtree dynamic
+		float animatedFraction = 0.0f;
+		uint32_t seed = 1;
+	};
+
+	// Update 'parameters' from a description. Returns false, leaving the
+	// parameters partially updated, on an unknown key or an invalid value.
+	static bool parse(const std::string& description, Parameters& parameters);
+
+	// Keys accepted by parse(), with their meaning, one per line
+	static std::string describeKeys();
+
+	static tinygltf::Model generate(const Parameters& parameters);
+
+	// Binary (.glb) or text (.gltf) depending on the extension, with buffers
+	// and images embedded
+	static bool write(const tinygltf::Model& model, const std::filesystem::path& path);
+};
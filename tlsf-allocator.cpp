@@ -0,0 +1,222 @@
+#include "tlsf-allocator.h"
+
+#include <algorithm>
+#include <cassert>
+
+static uint32_t floorLog2(uint32_t x) {
+	uint32_t log2 = 0;
+	while (x >>= 1) ++log2;
+	return log2;
+}
+
+static uint32_t lowestBit(uint32_t x) {
+	uint32_t index = 0;
+	while ((x & 1) == 0) {
+		x >>= 1;
+		++index;
+	}
+	return index;
+}
+
+void TlsfAllocator::init(uint32_t size, uint32_t granularity) {
+	assert(granularity > 0);
+	m_granularity = granularity;
+	m_unitCount = size / granularity;
+	m_usedUnits = 0;
+	m_freeBlockCount = 0;
+	m_blocks.clear();
+	m_unusedBlocks.clear();
+	m_allocatedBlocks.clear();
+	m_flBitmap = 0;
+	m_slBitmaps.fill(0);
+	for (auto& lists : m_freeLists) {
+		lists.fill(NONE);
+	}
+
+	if (m_unitCount > 0) {
+		uint32_t blockIdx = createBlock();
+		m_blocks[blockIdx].offset = 0;
+		m_blocks[blockIdx].size = m_unitCount;
+		insertFreeBlock(blockIdx);
+	}
+}
+
+uint32_t TlsfAllocator::allocate(uint32_t size) {
+	if (size == 0) return INVALID_OFFSET;
+	const uint32_t units = (size + m_granularity - 1) / m_granularity;
+
+	uint32_t blockIdx = findFreeBlock(units);
+	if (blockIdx == NONE) return INVALID_OFFSET;
+	removeFreeBlock(blockIdx);
+
+	// Give the remainder back
+	if (m_blocks[blockIdx].size > units) {
+		uint32_t remainderIdx = createBlock();
+		Block& block = m_blocks[blockIdx];
+		Block& remainder = m_blocks[remainderIdx];
+		remainder.offset = block.offset + units;
+		remainder.size = block.size - units;
+		remainder.previousPhysical = blockIdx;
+		remainder.nextPhysical = block.nextPhysical;
+		if (block.nextPhysical != NONE) {
+			m_blocks[block.nextPhysical].previousPhysical = remainderIdx;
+		}
+		block.nextPhysical = remainderIdx;
+		block.size = units;
+		insertFreeBlock(remainderIdx);
+	}
+
+	m_usedUnits += units;
+	m_allocatedBlocks[m_blocks[blockIdx].offset] = blockIdx;
+	return m_blocks[blockIdx].offset * m_granularity;
+}
+
+void TlsfAllocator::free(uint32_t offset) {
+	auto it = m_allocatedBlocks.find(offset / m_granularity);
+	assert(it != m_allocatedBlocks.end());
+	if (it == m_allocatedBlocks.end()) return;
+	uint32_t blockIdx = it->second;
+	m_allocatedBlocks.erase(it);
+	m_usedUnits -= m_blocks[blockIdx].size;
+
+	// Merge with the previous block
+	uint32_t previousIdx = m_blocks[blockIdx].previousPhysical;
+	if (previousIdx != NONE && m_blocks[previousIdx].isFree) {
+		removeFreeBlock(previousIdx);
+		Block& previous = m_blocks[previousIdx];
+		previous.size += m_blocks[blockIdx].size;
+		previous.nextPhysical = m_blocks[blockIdx].nextPhysical;
+		if (previous.nextPhysical != NONE) {
+			m_blocks[previous.nextPhysical].previousPhysical = previousIdx;
+		}
+		destroyBlock(blockIdx);
+		blockIdx = previousIdx;
+	}
+
+	// And with the next one
+	uint32_t nextIdx = m_blocks[blockIdx].nextPhysical;
+	if (nextIdx != NONE && m_blocks[nextIdx].isFree) {
+		removeFreeBlock(nextIdx);
+		Block& block = m_blocks[blockIdx];
+		block.size += m_blocks[nextIdx].size;
+		block.nextPhysical = m_blocks[nextIdx].nextPhysical;
+		if (block.nextPhysical != NONE) {
+			m_blocks[block.nextPhysical].previousPhysical = blockIdx;
+		}
+		destroyBlock(nextIdx);
+	}
+
+	insertFreeBlock(blockIdx);
+}
+
+uint32_t TlsfAllocator::allocationSize(uint32_t offset) const {
+	auto it = m_allocatedBlocks.find(offset / m_granularity);
+	return it != m_allocatedBlocks.end() ? m_blocks[it->second].size * m_granularity : 0;
+}
+
+uint32_t TlsfAllocator::largestFreeBlock() const {
+	if (m_flBitmap == 0) return 0;
+	// Blocks of the highest non empty class are the largest, but they are
+	// not sorted within it
+	uint32_t fl = floorLog2(m_flBitmap);
+	uint32_t sl = floorLog2(m_slBitmaps[fl]);
+	uint32_t largest = 0;
+	for (uint32_t blockIdx = m_freeLists[fl][sl]; blockIdx != NONE; blockIdx = m_blocks[blockIdx].nextFree) {
+		largest = std::max(largest, m_blocks[blockIdx].size);
+	}
+	return largest * m_granularity;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Private methods
+
+void TlsfAllocator::mapping(uint32_t size, uint32_t& fl, uint32_t& sl) {
+	if (size < SL_COUNT) {
+		// Small sizes all go in the first level, one class per size
+		fl = 0;
+		sl = size;
+	}
+	else {
+		uint32_t log2 = floorLog2(size);
+		fl = log2 - SL_BITS + 1;
+		sl = (size >> (log2 - SL_BITS)) - SL_COUNT;
+	}
+}
+
+uint32_t TlsfAllocator::createBlock() {
+	if (!m_unusedBlocks.empty()) {
+		uint32_t blockIdx = m_unusedBlocks.back();
+		m_unusedBlocks.pop_back();
+		m_blocks[blockIdx] = Block{};
+		return blockIdx;
+	}
+	m_blocks.push_back(Block{});
+	return static_cast<uint32_t>(m_blocks.size() - 1);
+}
+
+void TlsfAllocator::destroyBlock(uint32_t blockIdx) {
+	m_unusedBlocks.push_back(blockIdx);
+}
+
+void TlsfAllocator::insertFreeBlock(uint32_t blockIdx) {
+	Block& block = m_blocks[blockIdx];
+	uint32_t fl, sl;
+	mapping(block.size, fl, sl);
+
+	block.isFree = true;
+	block.previousFree = NONE;
+	block.nextFree = m_freeLists[fl][sl];
+	if (block.nextFree != NONE) {
+		m_blocks[block.nextFree].previousFree = blockIdx;
+	}
+	m_freeLists[fl][sl] = blockIdx;
+	m_flBitmap |= 1u << fl;
+	m_slBitmaps[fl] |= 1u << sl;
+	++m_freeBlockCount;
+}
+
+void TlsfAllocator::removeFreeBlock(uint32_t blockIdx) {
+	Block& block = m_blocks[blockIdx];
+	uint32_t fl, sl;
+	mapping(block.size, fl, sl);
+
+	if (block.previousFree != NONE) {
+		m_blocks[block.previousFree].nextFree = block.nextFree;
+	}
+	else {
+		m_freeLists[fl][sl] = block.nextFree;
+	}
+	if (block.nextFree != NONE) {
+		m_blocks[block.nextFree].previousFree = block.previousFree;
+	}
+	if (m_freeLists[fl][sl] == NONE) {
+		m_slBitmaps[fl] &= ~(1u << sl);
+		if (m_slBitmaps[fl] == 0) {
+			m_flBitmap &= ~(1u << fl);
+		}
+	}
+	block.isFree = false;
+	--m_freeBlockCount;
+}
+
+uint32_t TlsfAllocator::findFreeBlock(uint32_t size) const {
+	// Round up to the next class, so that any block of the class found fits
+	if (size >= SL_COUNT) {
+		uint32_t roundedSize = size + (1u << (floorLog2(size) - SL_BITS)) - 1;
+		if (roundedSize < size) return NONE; // overflow
+		size = roundedSize;
+	}
+	uint32_t fl, sl;
+	mapping(size, fl, sl);
+	if (fl >= FL_COUNT) return NONE;
+
+	uint32_t slMap = m_slBitmaps[fl] & (~0u << sl);
+	if (slMap == 0) {
+		uint32_t flMap = fl + 1 < FL_COUNT ? m_flBitmap & (~0u << (fl + 1)) : 0;
+		if (flMap == 0) return NONE;
+		fl = lowestBit(flMap);
+		slMap = m_slBitmaps[fl];
+	}
+	sl = lowestBit(slMap);
+	return m_freeLists[fl][sl];
+}
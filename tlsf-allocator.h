@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Two-Level Segregated Fit allocator of a linear range of bytes.
+ *
+ * Free blocks are kept in lists by size class: a first level per power of
+ * two, split linearly into SL_COUNT second level classes. Bitmaps of non
+ * empty lists make both allocation and free O(1), and the waste bounded by
+ * the class granularity. Freed blocks merge with their free neighbors.
+ *
+ * All sizes and offsets are multiples of the granularity given to init(),
+ * which is thus also the alignment of every allocation.
+ */
+class TlsfAllocator {
+public:
+	static constexpr uint32_t INVALID_OFFSET = ~0u;
+
+	void init(uint32_t size, uint32_t granularity);
+
+	// INVALID_OFFSET if no free block is large enough
+	uint32_t allocate(uint32_t size);
+	void free(uint32_t offset);
+
+	uint32_t size() const { return m_unitCount * m_granularity; }
+	uint32_t usedSize() const { return m_usedUnits * m_granularity; }
+	// Size of the block allocated at an offset (rounded up to the granularity)
+	uint32_t allocationSize(uint32_t offset) const;
+	uint32_t allocationCount() const { return static_cast<uint32_t>(m_allocatedBlocks.size()); }
+	uint32_t freeBlockCount() const { return m_freeBlockCount; }
+	uint32_t largestFreeBlock() const;
+	bool isEmpty() const { return m_usedUnits == 0; }
+
+private:
+	static constexpr uint32_t SL_BITS = 4;
+	static constexpr uint32_t SL_COUNT = 1 << SL_BITS;
+	static constexpr uint32_t FL_COUNT = 32;
+	static constexpr uint32_t NONE = ~0u;
+
+	struct Block {
+		// In units of m_granularity
+		uint32_t offset = 0;
+		uint32_t size = 0;
+		// Neighbors in memory
+		uint32_t previousPhysical = NONE;
+		uint32_t nextPhysical = NONE;
+		// Neighbors in the free list of its size class
+		uint32_t previousFree = NONE;
+		uint32_t nextFree = NONE;
+		bool isFree = false;
+	};
+
+	static void mapping(uint32_t size, uint32_t& fl, uint32_t& sl);
+
+	uint32_t createBlock();
+	void destroyBlock(uint32_t blockIdx);
+	void insertFreeBlock(uint32_t blockIdx);
+	void removeFreeBlock(uint32_t blockIdx);
+	// Smallest non empty class whose blocks are all at least this large
+	uint32_t findFreeBlock(uint32_t size) const;
+
+private:
+	uint32_t m_granularity = 1;
+	uint32_t m_unitCount = 0;
+	uint32_t m_usedUnits = 0;
+	uint32_t m_freeBlockCount = 0;
+
+	std::vector<Block> m_blocks;
+	// Entries of m_blocks that can be reused
+	std::vector<uint32_t> m_unusedBlocks;
+
+	uint32_t m_flBitmap = 0;
+	std::array<uint32_t, FL_COUNT> m_slBitmaps = {};
+	std::array<std::array<uint32_t, SL_COUNT>, FL_COUNT> m_freeLists;
+
+	// Offset in units to block
+	std::unordered_map<uint32_t, uint32_t> m_allocatedBlocks;
+};
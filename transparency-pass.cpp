@@ -0,0 +1,247 @@
+#include "transparency-pass.h"
+#include "resource-manager.h"
+
+#include <iostream>
+#include <vector>
+
+using namespace wgpu;
+
+// Weighted premultiplied colors and alphas are summed
+static const BlendState ACCUMULATION_BLEND = []() {
+	BlendState blend;
+	blend.color.srcFactor = BlendFactor::One;
+	blend.color.dstFactor = BlendFactor::One;
+	blend.color.operation = BlendOperation::Add;
+	blend.alpha = blend.color;
+	return blend;
+}();
+
+// Transmittances (1 - alpha) are multiplied
+static const BlendState REVEALAGE_BLEND = []() {
+	BlendState blend;
+	blend.color.srcFactor = BlendFactor::Zero;
+	blend.color.dstFactor = BlendFactor::OneMinusSrc;
+	blend.color.operation = BlendOperation::Add;
+	blend.alpha = blend.color;
+	return blend;
+}();
+
+bool TransparencyPass::init(Device device, TextureFormat sceneColorFormat) {
+	m_device = device;
+	return initPipeline(sceneColorFormat);
+}
+
+void TransparencyPass::terminate() {
+	m_bindGroup = {};
+	m_revealageTextureView = {};
+	m_revealageTexture = {};
+	m_accumulationTextureView = {};
+	m_accumulationTexture = {};
+	m_textureMemory.reset();
+	m_resolvePipeline = {};
+	m_bindGroupLayout = {};
+	m_shaderModule = {};
+	m_device = nullptr;
+}
+
+bool TransparencyPass::resize(uint32_t width, uint32_t height) {
+	m_bindGroup = {};
+	m_revealageTextureView = {};
+	m_revealageTexture = {};
+	m_accumulationTextureView = {};
+	m_accumulationTexture = {};
+
+	const std::array<ColorTargetState, 2> targets = colorTargets();
+
+	TextureDescriptor textureDesc;
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.size = { width, height, 1 };
+	textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+
+	TextureViewDescriptor viewDesc;
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = TextureViewDimension::_2D;
+
+	textureDesc.label = "Transparency accumulation";
+	textureDesc.format = targets[0].format;
+	m_accumulationTexture = m_device.createTexture(textureDesc);
+	uint64_t textureBytes = GpuMemory::textureByteSize(textureDesc);
+	viewDesc.format = textureDesc.format;
+	m_accumulationTextureView = m_accumulationTexture->createView(viewDesc);
+
+	textureDesc.label = "Transparency revealage";
+	textureDesc.format = targets[1].format;
+	m_revealageTexture = m_device.createTexture(textureDesc);
+	textureBytes += GpuMemory::textureByteSize(textureDesc);
+	m_textureMemory.set(GpuMemory::Category::RenderTarget, textureBytes);
+	viewDesc.format = textureDesc.format;
+	m_revealageTextureView = m_revealageTexture->createView(viewDesc);
+
+	std::vector<BindGroupEntry> entries(2, Default);
+	entries[0].binding = 0;
+	entries[0].textureView = *m_accumulationTextureView;
+	entries[1].binding = 1;
+	entries[1].textureView = *m_revealageTextureView;
+
+	BindGroupDescriptor bindGroupDesc;
+	bindGroupDesc.label = "Transparency resolve";
+	bindGroupDesc.layout = *m_bindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)entries.size();
+	bindGroupDesc.entries = entries.data();
+	m_bindGroup = m_device.createBindGroup(bindGroupDesc);
+
+	return m_accumulationTextureView && m_revealageTextureView && m_bindGroup;
+}
+
+std::array<ColorTargetState, 2> TransparencyPass::colorTargets() {
+	std::array<ColorTargetState, 2> targets;
+
+	targets[0].format = TextureFormat::RGBA16Float;
+	targets[0].blend = &ACCUMULATION_BLEND;
+	targets[0].writeMask = ColorWriteMask::All;
+
+	targets[1].format = TextureFormat::R8Unorm;
+	targets[1].blend = &REVEALAGE_BLEND;
+	targets[1].writeMask = ColorWriteMask::Red;
+
+	return targets;
+}
+
+std::array<RenderPassColorAttachment, 2> TransparencyPass::colorAttachments() const {
+	std::array<RenderPassColorAttachment, 2> attachments;
+
+	attachments[0] = RenderPassColorAttachment{};
+	attachments[0].view = *m_accumulationTextureView;
+	attachments[0].resolveTarget = nullptr;
+	attachments[0].loadOp = LoadOp::Clear;
+	attachments[0].storeOp = StoreOp::Store;
+	attachments[0].clearValue = Color{ 0.0, 0.0, 0.0, 0.0 };
+
+	// Fully revealed until something is drawn
+	attachments[1] = RenderPassColorAttachment{};
+	attachments[1].view = *m_revealageTextureView;
+	attachments[1].resolveTarget = nullptr;
+	attachments[1].loadOp = LoadOp::Clear;
+	attachments[1].storeOp = StoreOp::Store;
+	attachments[1].clearValue = Color{ 1.0, 0.0, 0.0, 0.0 };
+
+	return attachments;
+}
+
+void TransparencyPass::resolve(
+	CommandEncoder encoder,
+	TextureView sceneColor,
+	uint32_t renderWidth,
+	uint32_t renderHeight,
+	const RenderPassTimestampWrites* timestampWrites
+) {
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Transparency resolve";
+
+	RenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = sceneColor;
+	colorAttachment.resolveTarget = nullptr;
+	colorAttachment.loadOp = LoadOp::Load;
+	colorAttachment.storeOp = StoreOp::Store;
+	colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 0.0 };
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &colorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+	renderPassDesc.timestampWrites = timestampWrites;
+
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	renderPass.setViewport(0.0f, 0.0f, static_cast<float>(renderWidth), static_cast<float>(renderHeight), 0.0f, 1.0f);
+	renderPass.setPipeline(*m_resolvePipeline);
+	renderPass.setBindGroup(0, *m_bindGroup, 0, nullptr);
+	renderPass.draw(3, 1, 0, 0);
+	renderPass.end();
+	renderPass.release();
+}
+
+bool TransparencyPass::initPipeline(TextureFormat sceneColorFormat) {
+	m_shaderModule = ResourceManager::loadShaderModule(RESOURCE_DIR "/shaders/oit-composite.wgsl", m_device);
+	if (!m_shaderModule) {
+		std::cerr << "Could not load transparency resolve shader!" << std::endl;
+		return false;
+	}
+
+	std::vector<BindGroupLayoutEntry> entries(2, Default);
+	// Accumulation
+	entries[0].binding = 0;
+	entries[0].visibility = ShaderStage::Fragment;
+	entries[0].texture.sampleType = TextureSampleType::Float;
+	entries[0].texture.viewDimension = TextureViewDimension::_2D;
+
+	// Revealage
+	entries[1].binding = 1;
+	entries[1].visibility = ShaderStage::Fragment;
+	entries[1].texture.sampleType = TextureSampleType::Float;
+	entries[1].texture.viewDimension = TextureViewDimension::_2D;
+
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.label = "Transparency resolve";
+	bindGroupLayoutDesc.entryCount = (uint32_t)entries.size();
+	bindGroupLayoutDesc.entries = entries.data();
+	m_bindGroupLayout = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&*m_bindGroupLayout;
+	PipelineLayout layout = m_device.createPipelineLayout(layoutDesc);
+
+	RenderPipelineDescriptor pipelineDesc;
+	pipelineDesc.label = "Transparency resolve";
+	pipelineDesc.layout = layout;
+	pipelineDesc.vertex.module = *m_shaderModule;
+	pipelineDesc.vertex.entryPoint = "vs_composite";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+	pipelineDesc.vertex.bufferCount = 0;
+	pipelineDesc.vertex.buffers = nullptr;
+
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	pipelineDesc.primitive.cullMode = CullMode::None;
+
+	// Average color over the opaque scene, with the total coverage
+	BlendState blendState;
+	blendState.color.srcFactor = BlendFactor::SrcAlpha;
+	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+	blendState.color.operation = BlendOperation::Add;
+	blendState.alpha.srcFactor = BlendFactor::Zero;
+	blendState.alpha.dstFactor = BlendFactor::One;
+	blendState.alpha.operation = BlendOperation::Add;
+
+	ColorTargetState colorTarget;
+	colorTarget.format = sceneColorFormat;
+	colorTarget.blend = &blendState;
+	colorTarget.writeMask = ColorWriteMask::All;
+
+	FragmentState fragmentState;
+	fragmentState.module = *m_shaderModule;
+	fragmentState.entryPoint = "fs_composite";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+
+	pipelineDesc.depthStencil = nullptr;
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	m_resolvePipeline = m_device.createRenderPipeline(pipelineDesc);
+	layout.release();
+
+	return m_resolvePipeline;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "gpu-memory.h"
+
+#include <webgpu/webgpu.hpp>
+#include <webgpu/webgpu-raii.hpp>
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Weighted blended order-independent transparency.
+ *
+ * Blended primitives are drawn in any order, testing but not writing depth,
+ * into an accumulation and a revealage target (see transparentOutput() in
+ * shader.wgsl). A full-screen pass then resolves them over the scene color,
+ * so that transparent primitives never need to be sorted.
+ */
+class TransparencyPass {
+public:
+	bool init(wgpu::Device device, wgpu::TextureFormat sceneColorFormat);
+	void terminate();
+
+	// (Re)create the targets, at the size of the scene color target
+	bool resize(uint32_t width, uint32_t height);
+
+	// Color targets of the pipelines of blended primitives, in location order
+	static std::array<wgpu::ColorTargetState, 2> colorTargets();
+
+	// Attachments of the pass drawing blended primitives, which clears them
+	std::array<wgpu::RenderPassColorAttachment, 2> colorAttachments() const;
+
+	// Blend the accumulated surfaces over the scene color, within the
+	// top-left region that the 3D passes render to
+	void resolve(
+		wgpu::CommandEncoder encoder,
+		wgpu::TextureView sceneColor,
+		uint32_t renderWidth,
+		uint32_t renderHeight,
+		const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr
+	);
+
+private:
+	bool initPipeline(wgpu::TextureFormat sceneColorFormat);
+
+private:
+	wgpu::Device m_device = nullptr;
+
+	wgpu::raii::ShaderModule m_shaderModule;
+	wgpu::raii::BindGroupLayout m_bindGroupLayout;
+	wgpu::raii::RenderPipeline m_resolvePipeline;
+
+	wgpu::raii::Texture m_accumulationTexture;
+	wgpu::raii::TextureView m_accumulationTextureView;
+	wgpu::raii::Texture m_revealageTexture;
+	wgpu::raii::TextureView m_revealageTextureView;
+	// Of both targets
+	GpuMemory::Allocation m_textureMemory;
+	wgpu::raii::BindGroup m_bindGroup;
+};
@@ -1,4 +1,5 @@
 #include "ui-manager.h"
+#include "allocation-tracker.h"
 #include "gpu-scene.h"
 #include "resource-manager.h"
 
@@ -10,6 +11,9 @@
 #include <backends/imgui_impl_wgpu.h>
 #include <backends/imgui_impl_glfw.h>
 
+#include <algorithm>
+#include <array>
+
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm/gtx/polar_coordinates.hpp>
 
@@ -22,16 +26,26 @@ namespace ImGui {
     }
 }
 
+bool UiManager::s_hasWindow = false;
+
 /**
  * Public Methods
  */
 
 bool UiManager::init(GLFWwindow* window, wgpu::Device device, wgpu::TextureFormat surfaceFormat, wgpu::TextureFormat depthTextureFormat) {
     IMGUI_CHECKVERSION();
+    // So that the allocations of ImGui count towards the frame
+    ImGui::SetAllocatorFunctions(
+        [](size_t size, void*) { return AllocationTracker::allocate(size); },
+        [](void* pointer, void*) { AllocationTracker::deallocate(pointer); }
+    );
     ImGui::CreateContext();
     ImGui::GetIO();
 
-    ImGui_ImplGlfw_InitForOther(window, true);
+    s_hasWindow = window != nullptr;
+    if (s_hasWindow) {
+        ImGui_ImplGlfw_InitForOther(window, true);
+    }
     ImGui_ImplWGPU_InitInfo initInfo;
 
     initInfo.Device = device;
@@ -43,23 +57,34 @@ bool UiManager::init(GLFWwindow* window, wgpu::Device device, wgpu::TextureForma
     return true;
 }
 
+void UiManager::setDisplaySize(uint32_t width, uint32_t height) {
+    ImGui::GetIO().DisplaySize = ImVec2(static_cast<float>(width), static_cast<float>(height));
+}
+
 void UiManager::update(wgpu::RenderPassEncoder renderPass,
                        Application::GlobalUniforms& globalUniforms,
                        Application::LightingUniforms& lightingUniforms,
-                       bool& lightingUniFormsChanged,
+                       Application::RenderSettings& renderSettings,
+                       const Application::RenderStats& renderStats,
+                       const FramePacer& framePacer,
                        ResourceManager::path& filePath,
                        bool& filePathHasChanged
 ) {
     ImGui_ImplWGPU_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
+    if (s_hasWindow) {
+        ImGui_ImplGlfw_NewFrame();
+    }
     ImGui::NewFrame();
 
     {
-        auto io = ImGui::GetIO();
+        // Not a copy, which would allocate its queues
+        ImGuiIO& io = ImGui::GetIO();
         ImGui::SetWindowPos(ImVec2(io.DisplaySize.x / 2 - ImGui::GetWindowWidth() / 2, 0));
 
         fileMenu(filePath, filePathHasChanged);
-        lightingMenu(globalUniforms, lightingUniforms, lightingUniFormsChanged);
+        lightingMenu(globalUniforms, lightingUniforms);
+        renderingMenu(renderSettings, renderStats, framePacer);
+        performanceWindow(renderStats);
     }
 
     // Draw the UI
@@ -72,7 +97,9 @@ void UiManager::update(wgpu::RenderPassEncoder renderPass,
 
 
 void UiManager::shutdown() {
-    ImGui_ImplGlfw_Shutdown();
+    if (s_hasWindow) {
+        ImGui_ImplGlfw_Shutdown();
+    }
     ImGui_ImplWGPU_Shutdown();
 }
 
@@ -81,19 +108,183 @@ void UiManager::shutdown() {
  */
 
 void UiManager::lightingMenu(Application::GlobalUniforms& globalUniforms,
-                             Application::LightingUniforms& lightingUniforms,
-                             bool& lightingUniFormsChanged
+                             Application::LightingUniforms& lightingUniforms
 )
 {
-    bool changed = false;
+    // Uniforms are uploaded every frame, no need to track changes
     ImGui::Begin("Lighting");
-    changed = ImGui::ColorEdit3("World", glm::value_ptr(globalUniforms.worldColor)) || changed;
-    changed = ImGui::ColorEdit3("Color #0", glm::value_ptr(lightingUniforms.colors[0])) || changed;
-    changed = ImGui::DragDirection("Direction #0", lightingUniforms.directions[0]) || changed;
-    changed = ImGui::ColorEdit3("Color #1", glm::value_ptr(lightingUniforms.colors[1])) || changed;
-    changed = ImGui::DragDirection("Direction #1", lightingUniforms.directions[1]) || changed;
+    ImGui::ColorEdit3("World", glm::value_ptr(globalUniforms.worldColor));
+    ImGui::ColorEdit3("Color #0", glm::value_ptr(lightingUniforms.colors[0]));
+    ImGui::DragDirection("Direction #0", lightingUniforms.directions[0]);
+    ImGui::ColorEdit3("Color #1", glm::value_ptr(lightingUniforms.colors[1]));
+    ImGui::DragDirection("Direction #1", lightingUniforms.directions[1]);
+    ImGui::End();
+}
+
+void UiManager::renderingMenu(Application::RenderSettings& renderSettings,
+                              const Application::RenderStats& renderStats,
+                              const FramePacer& framePacer
+) {
+    ImGui::Begin("Rendering");
+    ImGuiIO& io = ImGui::GetIO();
+    ImGui::Text("%.2f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+    ImGui::Checkbox("Depth pre-pass", &renderSettings.depthPrePass);
+    int qualityTier = static_cast<int>(renderSettings.qualityTier);
+    if (ImGui::Combo("Quality", &qualityTier, "Low\0High\0")) {
+        renderSettings.qualityTier = static_cast<Application::QualityTier>(qualityTier);
+    }
+    ImGui::Text("%u shader variants, %u pipelines", renderStats.shaderVariantCount, renderStats.cachedPipelineCount);
+    if (renderStats.pendingPipelineCount > 0) {
+        ImGui::Text("%u pipelines compiling", renderStats.pendingPipelineCount);
+    }
+    ImGui::Text("%u punctual lights", renderStats.punctualLightCount);
+    ImGui::Checkbox("Static batching", &renderSettings.staticBatching);
+    ImGui::Text("%u primitives in %u static batches", renderStats.batchedPrimitiveCount, renderStats.staticBatchCount);
+    const BufferPool::Stats& uniformPool = renderStats.uniformPool;
+    ImGui::Text("Uniforms: %.1f / %.1f KiB in %u pages",
+                uniformPool.usedBytes / 1024.0f, uniformPool.reservedBytes / 1024.0f, uniformPool.pageCount);
+    ImGui::Text("%u free blocks (largest %.1f KiB), %.1f KiB moved",
+                uniformPool.freeBlockCount, uniformPool.largestFreeBlock / 1024.0f, uniformPool.movedBytes / 1024.0f);
+
+    ImGui::Separator();
+    ImGui::Text("Resolution");
+    if (renderStats.gpuTimingAvailable) {
+        ImGui::Text("GPU %.2f ms", renderStats.gpuFrameTimeMs);
+        ImGui::Checkbox("Dynamic resolution", &renderSettings.dynamicResolution);
+    }
+    else {
+        ImGui::Text("GPU timing unavailable, dynamic resolution disabled");
+    }
+    bool dynamicResolution = renderStats.gpuTimingAvailable && renderSettings.dynamicResolution;
+    if (dynamicResolution) {
+        ImGui::SliderFloat("Target GPU time", &renderSettings.targetFrameTimeMs, 2.0f, 50.0f, "%.1f ms");
+        ImGui::SliderFloat("Minimum scale", &renderSettings.minRenderScale, Application::MIN_RENDER_SCALE, 1.0f, "%.2f");
+        ImGui::Text("Scale %.2f", renderSettings.renderScale);
+    }
+    else {
+        ImGui::SliderFloat("Scale", &renderSettings.renderScale, Application::MIN_RENDER_SCALE, 1.0f, "%.2f");
+    }
+    ImGui::Text("%u x %u -> %u x %u", renderStats.renderWidth, renderStats.renderHeight, renderStats.outputWidth, renderStats.outputHeight);
+    ImGui::SliderFloat("Sharpness", &renderSettings.sharpness, 0.0f, 1.0f, "%.2f");
+
+    ImGui::Separator();
+    ImGui::Text("Shadows");
+    ImGui::Checkbox("Cascaded shadow maps", &renderSettings.shadows);
+    if (renderSettings.shadows) {
+        ImGui::SliderFloat("Shadow distance", &renderSettings.shadowDistance, 1.0f, 100.0f, "%.1f");
+        ImGui::Text("%u cascades re-rendered", renderStats.shadowCascadesRendered);
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Profiling");
+    if (!renderStats.gpuScopes.empty()) {
+        ImGui::Text("GPU passes (avg, min - max)");
+        for (const GpuProfiler::ScopeStats& scope : renderStats.gpuScopes) {
+            ImGui::Text("%-20s %6.2f ms  %.2f - %.2f", scope.name, scope.avgMs, scope.minMs, scope.maxMs);
+        }
+    }
+    // The capture is written when recording stops
+    ImGui::Checkbox("Record CPU trace", &renderSettings.recordCpuTrace);
+
+    ImGui::Separator();
+    ImGui::Text("Frame pacing");
+    if (ImGui::BeginCombo("Present mode", FramePacer::presentModeName(renderSettings.presentMode))) {
+        for (wgpu::PresentMode presentMode : framePacer.supportedPresentModes()) {
+            bool selected = presentMode == renderSettings.presentMode;
+            if (ImGui::Selectable(FramePacer::presentModeName(presentMode), selected)) {
+                renderSettings.presentMode = presentMode;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    ImGui::SliderFloat("Frame rate cap", &renderSettings.maxFrameRate, 0.0f, 360.0f, renderSettings.maxFrameRate > 0.0f ? "%.0f FPS" : "Off");
+    int maxQueuedFrames = static_cast<int>(renderSettings.maxQueuedFrames);
+    if (ImGui::SliderInt("Queued frames", &maxQueuedFrames, 1, static_cast<int>(Application::FRAMES_IN_FLIGHT))) {
+        renderSettings.maxQueuedFrames = static_cast<uint32_t>(maxQueuedFrames);
+    }
+    const FramePacer::Stats& stats = framePacer.stats();
+    ImGui::Text("Present interval %.2f ms (min %.2f, max %.2f)", stats.averageMs, stats.minMs, stats.maxMs);
+    ImGui::Text("Jitter %.3f ms", stats.jitterMs);
+    ImGui::End();
+}
+
+void UiManager::performanceWindow(const Application::RenderStats& renderStats) {
+    using FrameHistory = Application::RenderStats::FrameHistory;
+    ImGui::Begin("Performance");
+    const FrameHistory& history = renderStats.history;
+    if (history.count == 0) {
+        ImGui::End();
+        return;
+    }
+    const int count = static_cast<int>(history.count);
+    // Plots start from the oldest frame once the history is full
+    const int offset = history.count == FrameHistory::LENGTH ? static_cast<int>(history.nextFrame) : 0;
+
+    // Percentiles, on a sorted copy. Its order differs from the history, which
+    // does not matter to the histogram.
+    std::array<float, FrameHistory::LENGTH> sortedFrameMs;
+    std::copy_n(history.frameMs.begin(), count, sortedFrameMs.begin());
+    std::sort(sortedFrameMs.begin(), sortedFrameMs.begin() + count);
+    auto percentile = [&](float fraction) {
+        return sortedFrameMs[static_cast<int>(fraction * (count - 1) + 0.5f)];
+    };
+    const float p50 = percentile(0.50f);
+    const float p95 = percentile(0.95f);
+    const float p99 = percentile(0.99f);
+    const float lastFrameMs = history.frameMs[(history.nextFrame + FrameHistory::LENGTH - 1) % FrameHistory::LENGTH];
+    ImGui::Text("Frame %.2f ms  p50 %.2f  p95 %.2f  p99 %.2f  max %.2f",
+                lastFrameMs, p50, p95, p99, sortedFrameMs[count - 1]);
+
+    // Shared scale, so that the graphs compare. Spikes above it are clipped.
+    const float scaleMs = std::max({ 2.0f * p50, 1.25f * p99, 1.0f });
+    const ImVec2 graphSize(0.0f, 60.0f);
+    ImGui::PlotLines("Frame", history.frameMs.data(), count, offset, nullptr, 0.0f, scaleMs, graphSize);
+
+    constexpr int BIN_COUNT = 40;
+    std::array<float, BIN_COUNT> bins = {};
+    for (int i = 0; i < count; ++i) {
+        int bin = static_cast<int>(sortedFrameMs[i] / scaleMs * BIN_COUNT);
+        ++bins[std::min(bin, BIN_COUNT - 1)];
+    }
+    ImGui::PlotHistogram("Histogram", bins.data(), BIN_COUNT, 0, nullptr, 0.0f, static_cast<float>(count), graphSize);
+    ImGui::Text("0 to %.1f ms, the last bin includes slower frames", scaleMs);
+
+    ImGui::Separator();
+    const float cpuMs = history.cpuMs[(history.nextFrame + FrameHistory::LENGTH - 1) % FrameHistory::LENGTH];
+    if (renderStats.gpuTimingAvailable) {
+        ImGui::Text("CPU %.2f ms, GPU %.2f ms", cpuMs, renderStats.gpuFrameTimeMs);
+    }
+    else {
+        ImGui::Text("CPU %.2f ms, GPU timing unavailable", cpuMs);
+    }
+    ImGui::PlotLines("CPU", history.cpuMs.data(), count, offset, nullptr, 0.0f, scaleMs, graphSize);
+    if (renderStats.gpuTimingAvailable) {
+        ImGui::PlotLines("GPU", history.gpuMs.data(), count, offset, nullptr, 0.0f, scaleMs, graphSize);
+    }
+
+    ImGui::Separator();
+    const GpuScene::DrawStats& draws = renderStats.draws;
+    ImGui::Text("%u draw calls, %.3f M triangles", draws.drawCalls, draws.triangles / 1e6);
+    ImGui::Text("%u pipeline switches, %u bind group switches", draws.pipelineSwitches, draws.bindGroupSwitches);
+    ImGui::Text("Uploads %.1f KiB/frame", renderStats.uploadBytes / 1024.0f);
+    if (AllocationTracker::ENABLED) {
+        ImGui::Text("%llu heap allocations/frame", static_cast<unsigned long long>(renderStats.heapAllocations));
+    }
+
+    ImGui::Separator();
+    const GpuMemory::Stats& memory = renderStats.gpuMemory;
+    constexpr float MIB = 1024.0f * 1024.0f;
+    ImGui::Text("GPU memory %.1f MiB, peak %.1f MiB", memory.totalBytes / MIB, memory.peakTotalBytes / MIB);
+    if (memory.budgetBytes > 0) {
+        ImGui::ProgressBar(static_cast<float>(memory.totalBytes) / memory.budgetBytes, ImVec2(-1.0f, 0.0f));
+        ImGui::Text("Budget %.1f MiB", memory.budgetBytes / MIB);
+    }
+    for (uint32_t categoryIdx = 0; categoryIdx < GpuMemory::CATEGORY_COUNT; ++categoryIdx) {
+        ImGui::Text("%-14s %8.2f MiB, peak %8.2f",
+                    GpuMemory::categoryName(static_cast<GpuMemory::Category>(categoryIdx)),
+                    memory.usedBytes[categoryIdx] / MIB, memory.peakBytes[categoryIdx] / MIB);
+    }
     ImGui::End();
-    lightingUniFormsChanged = changed;
 }
 
 void UiManager::fileMenu(ResourceManager::path& filePath, bool& filePathHasChanged) {
@@ -10,21 +10,35 @@
 
 class UiManager {
 public:
+    // Without a window, the UI is drawn offscreen and receives no input
     static bool init(GLFWwindow* window, wgpu::Device device, wgpu::TextureFormat surfaceFormat, wgpu::TextureFormat depthTextureFrmat);
+
+    // Only needed without a window, which otherwise gives its size
+    static void setDisplaySize(uint32_t width, uint32_t height);
     
     static void update(wgpu::RenderPassEncoder renderPass,
                        Application::GlobalUniforms& globalUniforms,
                        Application::LightingUniforms& lightingUniforms,
-                       bool& lightingUniFormsChanged,
+                       Application::RenderSettings& renderSettings,
+                       const Application::RenderStats& renderStats,
+                       const FramePacer& framePacer,
                        ResourceManager::path& filePath,
                        bool& filePathHasChanged);
     
     static void shutdown();
 
 private:
+    static bool s_hasWindow;
+
     static void fileMenu(ResourceManager::path& filePath, bool& filePathHasChanged);
     
     static void lightingMenu(Application::GlobalUniforms& globalUniforms,
-                  Application::LightingUniforms& lightingUniforms,
-                  bool& lightingUniFormsChanged);
+                  Application::LightingUniforms& lightingUniforms);
+
+    static void renderingMenu(Application::RenderSettings& renderSettings,
+                              const Application::RenderStats& renderStats,
+                              const FramePacer& framePacer);
+
+    // Frame time graphs and histogram, and per-frame counters
+    static void performanceWindow(const Application::RenderStats& renderStats);
 };
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "upscaler.h"
+#include "resource-manager.h"
+
+#include <iostream>
+#include <vector>
+
+using namespace wgpu;
+
+bool Upscaler::init(Device device, TextureFormat surfaceFormat) {
+	m_device = device;
+	m_queue = device.getQueue();
+
+	BufferDescriptor bufferDesc;
+	bufferDesc.label = "Upscale parameters";
+	bufferDesc.size = sizeof(Params);
+	bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+	bufferDesc.mappedAtCreation = false;
+	m_paramsBuffer = m_device.createBuffer(bufferDesc);
+	m_paramsBufferMemory.set(GpuMemory::Category::Uniform, bufferDesc.size);
+	m_params = {};
+	m_queue.writeBuffer(*m_paramsBuffer, 0, &m_params, sizeof(Params));
+	m_uploadedBytes += sizeof(Params);
+
+	return initPipelines(surfaceFormat);
+}
+
+void Upscaler::terminate() {
+	m_presentBindGroup = {};
+	m_upscaleBindGroup = {};
+	m_outputTextureView = {};
+	m_outputTexture = {};
+	m_outputTextureMemory.reset();
+	m_paramsBuffer = {};
+	m_paramsBufferMemory.reset();
+	m_presentPipeline = {};
+	m_upscalePipeline = {};
+	m_presentBindGroupLayout = {};
+	m_upscaleBindGroupLayout = {};
+	m_shaderModule = {};
+	if (m_queue) m_queue.release();
+	m_queue = nullptr;
+	m_device = nullptr;
+}
+
+bool Upscaler::resize(TextureView source, uint32_t outputWidth, uint32_t outputHeight) {
+	m_presentBindGroup = {};
+	m_upscaleBindGroup = {};
+	m_outputTextureView = {};
+	m_outputTexture = {};
+
+	TextureDescriptor textureDesc;
+	textureDesc.label = "Upscaled color";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = TextureFormat::RGBA16Float;
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.size = { outputWidth, outputHeight, 1 };
+	textureDesc.usage = TextureUsage::StorageBinding | TextureUsage::TextureBinding;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	m_outputTexture = m_device.createTexture(textureDesc);
+	m_outputTextureMemory.set(GpuMemory::Category::RenderTarget, GpuMemory::textureByteSize(textureDesc));
+
+	TextureViewDescriptor viewDesc;
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = TextureViewDimension::_2D;
+	viewDesc.format = textureDesc.format;
+	m_outputTextureView = m_outputTexture->createView(viewDesc);
+
+	{
+		std::vector<BindGroupEntry> entries(3, Default);
+		entries[0].binding = 0;
+		entries[0].textureView = source;
+		entries[1].binding = 1;
+		entries[1].textureView = *m_outputTextureView;
+		entries[2].binding = 2;
+		entries[2].buffer = *m_paramsBuffer;
+		entries[2].offset = 0;
+		entries[2].size = sizeof(Params);
+
+		BindGroupDescriptor bindGroupDesc;
+		bindGroupDesc.label = "Upscale";
+		bindGroupDesc.layout = *m_upscaleBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)entries.size();
+		bindGroupDesc.entries = entries.data();
+		m_upscaleBindGroup = m_device.createBindGroup(bindGroupDesc);
+	}
+
+	{
+		std::vector<BindGroupEntry> entries(2, Default);
+		entries[0].binding = 2;
+		entries[0].buffer = *m_paramsBuffer;
+		entries[0].offset = 0;
+		entries[0].size = sizeof(Params);
+		entries[1].binding = 3;
+		entries[1].textureView = *m_outputTextureView;
+
+		BindGroupDescriptor bindGroupDesc;
+		bindGroupDesc.label = "Upscale present";
+		bindGroupDesc.layout = *m_presentBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)entries.size();
+		bindGroupDesc.entries = entries.data();
+		m_presentBindGroup = m_device.createBindGroup(bindGroupDesc);
+	}
+
+	m_params.outputSize[0] = outputWidth;
+	m_params.outputSize[1] = outputHeight;
+	m_queue.writeBuffer(*m_paramsBuffer, 0, &m_params, sizeof(Params));
+	m_uploadedBytes += sizeof(Params);
+
+	return m_upscaleBindGroup && m_presentBindGroup;
+}
+
+void Upscaler::upscale(
+	CommandEncoder encoder,
+	uint32_t renderWidth,
+	uint32_t renderHeight,
+	float sharpness,
+	const ComputePassTimestampWrites* timestampWrites
+) {
+	if (renderWidth != m_params.renderSize[0] || renderHeight != m_params.renderSize[1] || sharpness != m_params.sharpness) {
+		m_params.renderSize[0] = renderWidth;
+		m_params.renderSize[1] = renderHeight;
+		m_params.sharpness = sharpness;
+		m_queue.writeBuffer(*m_paramsBuffer, 0, &m_params, sizeof(Params));
+		m_uploadedBytes += sizeof(Params);
+	}
+
+	ComputePassDescriptor computePassDesc;
+	computePassDesc.label = "Upscale";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(*m_upscalePipeline);
+	computePass.setBindGroup(0, *m_upscaleBindGroup, 0, nullptr);
+	computePass.dispatchWorkgroups(
+		(m_params.outputSize[0] + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+		(m_params.outputSize[1] + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+		1
+	);
+	computePass.end();
+	computePass.release();
+}
+
+void Upscaler::draw(RenderPassEncoder renderPass) {
+	renderPass.setPipeline(*m_presentPipeline);
+	renderPass.setBindGroup(0, *m_presentBindGroup, 0, nullptr);
+	renderPass.draw(3, 1, 0, 0);
+}
+
+bool Upscaler::initPipelines(TextureFormat surfaceFormat) {
+	m_shaderModule = ResourceManager::loadShaderModule(RESOURCE_DIR "/shaders/upscale.wgsl", m_device);
+	if (!m_shaderModule) {
+		std::cerr << "Could not load upscale shader!" << std::endl;
+		return false;
+	}
+
+	// Compute upscale
+	{
+		std::vector<BindGroupLayoutEntry> entries(3, Default);
+		// Scene color
+		entries[0].binding = 0;
+		entries[0].visibility = ShaderStage::Compute;
+		entries[0].texture.sampleType = TextureSampleType::Float;
+		entries[0].texture.viewDimension = TextureViewDimension::_2D;
+
+		// Native resolution output
+		entries[1].binding = 1;
+		entries[1].visibility = ShaderStage::Compute;
+		entries[1].storageTexture.access = StorageTextureAccess::WriteOnly;
+		entries[1].storageTexture.format = TextureFormat::RGBA16Float;
+		entries[1].storageTexture.viewDimension = TextureViewDimension::_2D;
+
+		// Parameters
+		entries[2].binding = 2;
+		entries[2].visibility = ShaderStage::Compute;
+		entries[2].buffer.type = BufferBindingType::Uniform;
+		entries[2].buffer.minBindingSize = sizeof(Params);
+
+		BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+		bindGroupLayoutDesc.label = "Upscale";
+		bindGroupLayoutDesc.entryCount = (uint32_t)entries.size();
+		bindGroupLayoutDesc.entries = entries.data();
+		m_upscaleBindGroupLayout = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+		PipelineLayoutDescriptor layoutDesc{};
+		layoutDesc.bindGroupLayoutCount = 1;
+		layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&*m_upscaleBindGroupLayout;
+		PipelineLayout layout = m_device.createPipelineLayout(layoutDesc);
+
+		ComputePipelineDescriptor pipelineDesc;
+		pipelineDesc.label = "Upscale";
+		pipelineDesc.layout = layout;
+		pipelineDesc.compute.module = *m_shaderModule;
+		pipelineDesc.compute.entryPoint = "cs_upscale";
+		pipelineDesc.compute.constantCount = 0;
+		pipelineDesc.compute.constants = nullptr;
+		m_upscalePipeline = m_device.createComputePipeline(pipelineDesc);
+		layout.release();
+	}
+
+	// Full-screen sharpen into the surface
+	{
+		std::vector<BindGroupLayoutEntry> entries(2, Default);
+		// Parameters
+		entries[0].binding = 2;
+		entries[0].visibility = ShaderStage::Fragment;
+		entries[0].buffer.type = BufferBindingType::Uniform;
+		entries[0].buffer.minBindingSize = sizeof(Params);
+
+		// Upscaled color
+		entries[1].binding = 3;
+		entries[1].visibility = ShaderStage::Fragment;
+		entries[1].texture.sampleType = TextureSampleType::Float;
+		entries[1].texture.viewDimension = TextureViewDimension::_2D;
+
+		BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+		bindGroupLayoutDesc.label = "Upscale present";
+		bindGroupLayoutDesc.entryCount = (uint32_t)entries.size();
+		bindGroupLayoutDesc.entries = entries.data();
+		m_presentBindGroupLayout = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+		PipelineLayoutDescriptor layoutDesc{};
+		layoutDesc.bindGroupLayoutCount = 1;
+		layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&*m_presentBindGroupLayout;
+		PipelineLayout layout = m_device.createPipelineLayout(layoutDesc);
+
+		RenderPipelineDescriptor pipelineDesc;
+		pipelineDesc.label = "Upscale present";
+		pipelineDesc.layout = layout;
+		pipelineDesc.vertex.module = *m_shaderModule;
+		pipelineDesc.vertex.entryPoint = "vs_present";
+		pipelineDesc.vertex.constantCount = 0;
+		pipelineDesc.vertex.constants = nullptr;
+		pipelineDesc.vertex.bufferCount = 0;
+		pipelineDesc.vertex.buffers = nullptr;
+
+		pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+		pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+		pipelineDesc.primitive.frontFace = FrontFace::CCW;
+		pipelineDesc.primitive.cullMode = CullMode::None;
+
+		ColorTargetState colorTarget;
+		colorTarget.format = surfaceFormat;
+		colorTarget.blend = nullptr;
+		colorTarget.writeMask = ColorWriteMask::All;
+
+		FragmentState fragmentState;
+		fragmentState.module = *m_shaderModule;
+		fragmentState.entryPoint = "fs_present";
+		fragmentState.constantCount = 0;
+		fragmentState.constants = nullptr;
+		fragmentState.targetCount = 1;
+		fragmentState.targets = &colorTarget;
+		pipelineDesc.fragment = &fragmentState;
+
+		pipelineDesc.depthStencil = nullptr;
+		pipelineDesc.multisample.count = 1;
+		pipelineDesc.multisample.mask = ~0u;
+		pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+		m_presentPipeline = m_device.createRenderPipeline(pipelineDesc);
+		layout.release();
+	}
+
+	return m_upscalePipeline && m_presentPipeline;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "gpu-memory.h"
+
+#include <webgpu/webgpu.hpp>
+#include <webgpu/webgpu-raii.hpp>
+
+#include <cstdint>
+
+/**
+ * Brings the scene color target, rendered at a fraction of the native
+ * resolution, to the surface.
+ *
+ * A compute pass performs an edge-adaptive upscale into a native resolution
+ * RGBA16Float texture. Surface formats are not storage-capable in core
+ * WebGPU, so the final write happens in a full-screen draw that applies the
+ * sharpening, in the render pass that also draws the UI.
+ */
+class Upscaler {
+public:
+	bool init(wgpu::Device device, wgpu::TextureFormat surfaceFormat);
+	void terminate();
+
+	// (Re)create the native resolution output. 'source' is the scene color
+	// target, of which only the top-left corner is rendered when scaled down.
+	bool resize(wgpu::TextureView source, uint32_t outputWidth, uint32_t outputHeight);
+
+	// Record the upscale from the rendered region of the source
+	void upscale(
+		wgpu::CommandEncoder encoder,
+		uint32_t renderWidth,
+		uint32_t renderHeight,
+		float sharpness,
+		const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr
+	);
+
+	// Draw the upscaled image into a render pass targetting the surface
+	void draw(wgpu::RenderPassEncoder renderPass);
+
+	// Total uploaded parameters so far
+	uint64_t uploadedBytes() const { return m_uploadedBytes; }
+
+private:
+	bool initPipelines(wgpu::TextureFormat surfaceFormat);
+
+private:
+	struct Params {
+		uint32_t renderSize[2];
+		uint32_t outputSize[2];
+		float sharpness;
+		float _pad[3];
+	};
+	static_assert(sizeof(Params) % 16 == 0);
+
+	static constexpr uint32_t WORKGROUP_SIZE = 8;
+
+	wgpu::Device m_device = nullptr;
+	wgpu::Queue m_queue = nullptr;
+
+	wgpu::raii::ShaderModule m_shaderModule;
+	wgpu::raii::BindGroupLayout m_upscaleBindGroupLayout;
+	wgpu::raii::BindGroupLayout m_presentBindGroupLayout;
+	wgpu::raii::ComputePipeline m_upscalePipeline;
+	wgpu::raii::RenderPipeline m_presentPipeline;
+
+	wgpu::raii::Buffer m_paramsBuffer;
+	GpuMemory::Allocation m_paramsBufferMemory;
+	// Last uploaded parameters, the buffer is only written when they change
+	Params m_params = {};
+	uint64_t m_uploadedBytes = 0;
+
+	wgpu::raii::Texture m_outputTexture;
+	GpuMemory::Allocation m_outputTextureMemory;
+	wgpu::raii::TextureView m_outputTextureView;
+	wgpu::raii::BindGroup m_upscaleBindGroup;
+	wgpu::raii::BindGroup m_presentBindGroup;
+};